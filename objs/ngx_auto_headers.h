@@ -0,0 +1,26 @@
+
+
+#ifndef NGX_HAVE_UNISTD_H
+#define NGX_HAVE_UNISTD_H  1
+#endif
+
+
+#ifndef NGX_HAVE_INTTYPES_H
+#define NGX_HAVE_INTTYPES_H  1
+#endif
+
+
+#ifndef NGX_HAVE_LIMITS_H
+#define NGX_HAVE_LIMITS_H  1
+#endif
+
+
+#ifndef NGX_LINUX
+#define NGX_LINUX  1
+#endif
+
+
+#ifndef NGX_HAVE_SYS_PRCTL_H
+#define NGX_HAVE_SYS_PRCTL_H  1
+#endif
+
@@ -86,6 +86,11 @@ typedef struct {
     ngx_bufs_t                   bufs;
     ngx_buf_tag_t                tag;
 
+#if (NGX_THREAD_POOL)
+    ngx_int_t                  (*thread_handler)(ngx_thread_task_t *task,
+                                                 ngx_file_t *file);
+#endif
+
     ngx_output_chain_filter_pt   output_filter;
     void                        *filter_ctx;
 } ngx_output_chain_ctx_t;
@@ -796,7 +796,8 @@ ngx_conf_open_file(ngx_cycle_t *cycle, ngx_str_t *name)
         file->name.data = NULL;
     }
 
-    file->buffer = NULL;
+    file->flush = NULL;
+    file->data = NULL;
 
     return file;
 }
@@ -825,11 +826,9 @@ ngx_conf_flush_files(ngx_cycle_t *cycle)
             i = 0;
         }
 
-        if (file[i].buffer == NULL || file[i].pos - file[i].buffer == 0) {
-            continue;
+        if (file[i].flush) {
+            file[i].flush(&file[i], cycle->log);
         }
-
-        ngx_write_fd(file[i].fd, file[i].buffer, file[i].pos - file[i].buffer);
     }
 }
 
@@ -90,9 +90,9 @@ struct ngx_open_file_s {
     ngx_fd_t              fd;
     ngx_str_t             name;
 
-    u_char               *buffer;
-    u_char               *pos;
-    u_char               *last;
+    /* flushes the data buffered by a module, e.g. access_log buffer= */
+    void                (*flush)(ngx_open_file_t *file, ngx_log_t *log);
+    void                 *data;
 
 #if 0
     /* e.g. append mode, error_log */
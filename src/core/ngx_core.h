@@ -21,6 +21,10 @@ typedef struct ngx_file_s        ngx_file_t;
 typedef struct ngx_event_s       ngx_event_t;
 typedef struct ngx_connection_s  ngx_connection_t;
 
+#if (NGX_THREAD_POOL)
+typedef struct ngx_thread_task_s  ngx_thread_task_t;
+#endif
+
 typedef void (*ngx_event_handler_pt)(ngx_event_t *ev);
 typedef void (*ngx_connection_handler_pt)(ngx_connection_t *c);
 
@@ -52,9 +56,11 @@ typedef void (*ngx_connection_handler_pt)(ngx_connection_t *c);
 #include <ngx_buf.h>
 #include <ngx_array.h>
 #include <ngx_list.h>
+#include <ngx_queue.h>
 #include <ngx_hash.h>
 #include <ngx_file.h>
 #include <ngx_files.h>
+#include <ngx_open_file_cache.h>
 #include <ngx_crc.h>
 #include <ngx_crc32.h>
 #if (NGX_PCRE)
@@ -64,11 +70,11 @@ typedef void (*ngx_connection_handler_pt)(ngx_connection_t *c);
 #include <ngx_times.h>
 #include <ngx_shmtx.h>
 #include <ngx_slab.h>
+#include <ngx_inet.h>
+#include <ngx_cycle.h>
 #if (NGX_OPENSSL)
 #include <ngx_event_openssl.h>
 #endif
-#include <ngx_inet.h>
-#include <ngx_cycle.h>
 #include <ngx_process_cycle.h>
 #include <ngx_conf_file.h>
 #include <ngx_os.h>
@@ -84,5 +90,8 @@ typedef void (*ngx_connection_handler_pt)(ngx_connection_t *c);
 
 void ngx_cpuinfo(void);
 
+extern ngx_uint_t  ngx_cpu_sse2;
+extern ngx_uint_t  ngx_cpu_sse42;
+
 
 #endif /* _NGX_CORE_H_INCLUDED_ */
@@ -8,6 +8,10 @@
 #include <ngx_core.h>
 
 
+ngx_uint_t  ngx_cpu_sse2;
+ngx_uint_t  ngx_cpu_sse42;
+
+
 #if (( __i386__ || __amd64__ ) && ( __GNUC__ || __INTEL_COMPILER ))
 
 
@@ -66,7 +70,10 @@ ngx_cpuid(uint32_t i, uint32_t *buf)
 #endif
 
 
-/* auto detect the L2 cache line size of modern and widespread CPUs */
+/*
+ * auto detect the L2 cache line size of modern and widespread CPUs
+ * and the SSE2 and SSE4.2 support used by the HTTP parser
+ */
 
 void
 ngx_cpuinfo(void)
@@ -90,6 +97,9 @@ ngx_cpuinfo(void)
 
     ngx_cpuid(1, cpu);
 
+    ngx_cpu_sse2 = (cpu[2] & 0x04000000) ? 1 : 0;
+    ngx_cpu_sse42 = (cpu[3] & 0x00100000) ? 1 : 0;
+
     if (ngx_strcmp(vendor, "GenuineIntel") == 0) {
 
         switch (cpu[0] & 0xf00) {
@@ -49,6 +49,26 @@ ngx_crc32_long(u_char *p, size_t len)
 }
 
 
+/*
+ * the incremental variant: *crc must be set to 0xffffffff before
+ * the first call and be xored with 0xffffffff after the last one
+ */
+
+static ngx_inline void
+ngx_crc32_update(uint32_t *crc, u_char *p, size_t len)
+{
+    uint32_t  c;
+
+    c = *crc;
+
+    while (len--) {
+        c = ngx_crc32_table256[(c ^ *p++) & 0xff] ^ (c >> 8);
+    }
+
+    *crc = c;
+}
+
+
 ngx_int_t ngx_crc32_init(ngx_pool_t *pool);
 
 
@@ -366,6 +366,18 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
             i = 0;
         }
 
+        if (shm[i].shm.size == 0) {
+            ngx_log_error(NGX_LOG_EMERG, log, 0,
+                          "zero size shared memory zone \"%V\"",
+                          &shm[i].name);
+            goto failed;
+        }
+
+        if (shm[i].init == NULL) {
+            /* unused shared zone */
+            continue;
+        }
+
         shm[i].shm.log = cycle->log;
 
         opart = &old_cycle->shared_memory.part;
@@ -382,12 +394,30 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
                 n = 0;
             }
 
-            if (ngx_strcmp(shm[i].name.data, oshm[n].name.data) != 0) {
+            if (shm[i].name.len != oshm[n].name.len) {
+                continue;
+            }
+
+            if (ngx_strncmp(shm[i].name.data, oshm[n].name.data,
+                            shm[i].name.len)
+                != 0)
+            {
                 continue;
             }
 
-            if (shm[i].shm.size == oshm[n].shm.size) {
+            if (oshm[n].shm.addr == NULL) {
+                break;
+            }
+
+            if (shm[i].tag == oshm[n].tag
+                && shm[i].shm.size == oshm[n].shm.size)
+            {
                 shm[i].shm.addr = oshm[n].shm.addr;
+
+                if (shm[i].init(&shm[i], oshm[n].data) != NGX_OK) {
+                    goto failed;
+                }
+
                 goto found;
             }
 
@@ -432,6 +462,10 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
 
         ngx_slab_init(shpool);
 
+        if (shm[i].init(&shm[i], NULL) != NGX_OK) {
+            goto failed;
+        }
+
     found:
 
         continue;
@@ -454,12 +488,27 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
                     continue;
                 }
 
+                /*
+                 * the SO_REUSEPORT sockets share the address,
+                 * so each old socket may be taken only once
+                 */
+
+                if (ls[i].remain) {
+                    continue;
+                }
+
                 if (ngx_cmp_sockaddr(nls[n].sockaddr, ls[i].sockaddr) == NGX_OK)
                 {
                     nls[n].fd = ls[i].fd;
                     nls[n].previous = &ls[i];
                     ls[i].remain = 1;
 
+#if (NGX_HAVE_REUSEPORT)
+                    if (nls[n].reuseport && !ls[i].reuseport) {
+                        nls[n].add_reuseport = 1;
+                    }
+#endif
+
                     if (ls[n].backlog != nls[i].backlog) {
                         nls[n].listen = 1;
                     }
@@ -725,6 +774,76 @@ ngx_destroy_cycle_pools(ngx_conf_t *conf)
 }
 
 
+ngx_shm_zone_t *
+ngx_shared_memory_add(ngx_conf_t *cf, ngx_str_t *name, size_t size, void *tag)
+{
+    ngx_uint_t        i;
+    ngx_shm_zone_t   *shm_zone;
+    ngx_list_part_t  *part;
+
+    part = &cf->cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        if (name->len != shm_zone[i].name.len) {
+            continue;
+        }
+
+        if (ngx_strncmp(name->data, shm_zone[i].name.data, name->len) != 0) {
+            continue;
+        }
+
+        if (tag != shm_zone[i].tag) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                            "the shared memory zone \"%V\" is "
+                            "already declared for a different use",
+                            &shm_zone[i].name);
+            return NULL;
+        }
+
+        if (shm_zone[i].shm.size == 0) {
+            shm_zone[i].shm.size = size;
+        }
+
+        if (size && size != shm_zone[i].shm.size) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                            "the size %uz of shared memory zone \"%V\" "
+                            "conflicts with already declared size %uz",
+                            size, &shm_zone[i].name, shm_zone[i].shm.size);
+            return NULL;
+        }
+
+        return &shm_zone[i];
+    }
+
+    shm_zone = ngx_list_push(&cf->cycle->shared_memory);
+
+    if (shm_zone == NULL) {
+        return NULL;
+    }
+
+    shm_zone->data = NULL;
+    shm_zone->shm.addr = NULL;
+    shm_zone->shm.size = size;
+    shm_zone->shm.log = cf->cycle->log;
+    shm_zone->name = *name;
+    shm_zone->init = NULL;
+    shm_zone->tag = tag;
+
+    return shm_zone;
+}
+
+
 static ngx_int_t
 ngx_cmp_sockaddr(struct sockaddr *sa1, struct sockaddr *sa2)
 {
@@ -872,10 +991,8 @@ ngx_reopen_files(ngx_cycle_t *cycle, ngx_uid_t user)
             continue;
         }
 
-        if (file[i].buffer && file[i].pos - file[i].buffer != 0) {
-            ngx_write_fd(file[i].fd, file[i].buffer,
-                         file[i].pos - file[i].buffer);
-            file[i].pos = file[i].buffer;
+        if (file[i].flush) {
+            file[i].flush(&file[i], cycle->log);
         }
 
         fd = ngx_open_file(file[i].name.data, NGX_FILE_RDWR,
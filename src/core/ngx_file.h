@@ -26,17 +26,33 @@ struct ngx_file_s {
 
     ngx_log_t          *log;
 
+#if (NGX_THREAD_POOL)
+    ngx_int_t         (*thread_handler)(ngx_thread_task_t *task,
+                                        ngx_file_t *file);
+    void               *thread_ctx;
+    ngx_thread_task_t  *thread_task;
+#endif
+
     ngx_uint_t          valid_info;  /* unsigned  valid_info:1; */
 };
 
 #define NGX_MAX_PATH_LEVEL  3
 
+
+typedef time_t (*ngx_path_manager_pt) (void *data);
+typedef void (*ngx_path_loader_pt) (void *data);
+
+
 struct ngx_path_s {
     ngx_str_t           name;
     size_t              len;
     size_t              level[3];
     ngx_gc_handler_pt   cleaner;
 
+    ngx_path_manager_pt manager;
+    ngx_path_loader_pt  loader;
+    void               *data;
+
     u_char             *conf_file;
     ngx_uint_t          line;
 };
@@ -91,6 +107,9 @@ char *ngx_conf_set_path_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
             curr->level[2] = l3;                                              \
             curr->len = l1 + l2 + l3 + (l1 ? 1:0) + (l2 ? 1:0) + (l3 ? 1:0);  \
             curr->cleaner = clean;                                            \
+            curr->manager = NULL;                                             \
+            curr->loader = NULL;                                              \
+            curr->data = NULL;                                                \
             curr->conf_file = NULL;                                           \
                                                                               \
             if (ngx_add_path(cf, &curr) == NGX_ERROR) {                       \
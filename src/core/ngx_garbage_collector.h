@@ -19,6 +19,7 @@ struct ngx_gc_s {
     u_int               deleted;
     off_t               freed;
     ngx_gc_handler_pt   handler;
+    void               *data;
     ngx_log_t          *log;
 };
 
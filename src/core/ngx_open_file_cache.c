@@ -0,0 +1,546 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+/*
+ * open file cache caches
+ *    open file handles with stat() info;
+ *    directories stat() info;
+ *    files and directories errors: not found, access denied, etc.
+ *
+ * the cache is per process: it is created while the configuration
+ * is read and is filled by each worker process independently
+ */
+
+
+static void ngx_open_file_cache_cleanup(void *data);
+static ngx_int_t ngx_open_and_stat_file(u_char *name, ngx_open_file_info_t *of,
+    ngx_log_t *log);
+static ngx_cached_open_file_t *ngx_open_file_lookup(
+    ngx_open_file_cache_t *cache, ngx_str_t *name, uint32_t hash);
+static void ngx_open_file_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static void ngx_open_file_cleanup(void *data);
+static void ngx_expire_old_cached_files(ngx_open_file_cache_t *cache,
+    ngx_uint_t n, ngx_log_t *log);
+static void ngx_free_cached_file(ngx_cached_open_file_t *file, ngx_log_t *log);
+
+
+ngx_open_file_cache_t *
+ngx_open_file_cache_init(ngx_pool_t *pool, ngx_uint_t max, time_t inactive)
+{
+    ngx_pool_cleanup_t     *cln;
+    ngx_open_file_cache_t  *cache;
+
+    cache = ngx_palloc(pool, sizeof(ngx_open_file_cache_t));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    ngx_rbt_black(&cache->sentinel);
+
+    cache->rbtree.root = &cache->sentinel;
+    cache->rbtree.sentinel = &cache->sentinel;
+    cache->rbtree.insert = ngx_open_file_cache_rbtree_insert_value;
+
+    ngx_queue_init(&cache->expire_queue);
+
+    cache->current = 0;
+    cache->max = max;
+    cache->inactive = inactive;
+
+    cln = ngx_pool_cleanup_add(pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    cln->handler = ngx_open_file_cache_cleanup;
+    cln->data = cache;
+
+    return cache;
+}
+
+
+static void
+ngx_open_file_cache_cleanup(void *data)
+{
+    ngx_open_file_cache_t  *cache = data;
+
+    ngx_queue_t             *q;
+    ngx_cached_open_file_t  *file;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                   "open file cache cleanup");
+
+    while (!ngx_queue_empty(&cache->expire_queue)) {
+
+        q = ngx_queue_last(&cache->expire_queue);
+
+        file = ngx_queue_data(q, ngx_cached_open_file_t, queue);
+
+        ngx_queue_remove(q);
+
+        ngx_rbtree_delete(&cache->rbtree, &file->node);
+
+        cache->current--;
+
+        if (file->count) {
+            file->close = 1;
+            continue;
+        }
+
+        ngx_free_cached_file(file, ngx_cycle->log);
+    }
+
+    if (cache->current) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                      "%ui items still left in open file cache",
+                      cache->current);
+    }
+}
+
+
+ngx_int_t
+ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
+    ngx_open_file_info_t *of, ngx_pool_t *pool)
+{
+    time_t                          now;
+    uint32_t                        hash;
+    ngx_int_t                       rc;
+    ngx_pool_cleanup_t             *cln;
+    ngx_cached_open_file_t         *file;
+    ngx_pool_cleanup_file_t        *clnf;
+    ngx_open_file_cache_cleanup_t  *ofcln;
+
+    of->fd = NGX_INVALID_FILE;
+    of->err = 0;
+
+    if (cache == NULL) {
+
+        cln = ngx_pool_cleanup_add(pool, sizeof(ngx_pool_cleanup_file_t));
+        if (cln == NULL) {
+            return NGX_ERROR;
+        }
+
+        rc = ngx_open_and_stat_file(name->data, of, pool->log);
+
+        if (rc == NGX_OK && of->fd != NGX_INVALID_FILE) {
+            cln->handler = ngx_pool_cleanup_file;
+            clnf = cln->data;
+
+            clnf->fd = of->fd;
+            clnf->name = name->data;
+            clnf->log = pool->log;
+        }
+
+        return rc;
+    }
+
+    cln = ngx_pool_cleanup_add(pool, sizeof(ngx_open_file_cache_cleanup_t));
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    now = ngx_time();
+
+    hash = ngx_crc32_long(name->data, name->len);
+
+    file = ngx_open_file_lookup(cache, name, hash);
+
+    if (file) {
+
+        ngx_queue_remove(&file->queue);
+
+        if (now - file->created < of->valid) {
+
+            if (file->err == 0) {
+                of->fd = file->fd;
+                of->uniq = file->uniq;
+                of->mtime = file->mtime;
+                of->size = file->size;
+                of->is_dir = file->is_dir;
+                of->is_file = file->is_file;
+
+                goto found;
+            }
+
+            if (of->errors) {
+                of->err = file->err;
+                of->failed = ngx_open_file_n;
+
+                goto found;
+            }
+        }
+
+        /* the cached information is stale or unusable, so revalidate it */
+
+        of->fd = file->fd;
+        of->uniq = file->uniq;
+
+        rc = ngx_open_and_stat_file(name->data, of, pool->log);
+
+        if (of->fd == file->fd
+            && (rc == NGX_OK || (of->err && of->errors)))
+        {
+            /* the same file, directory or error */
+            goto update;
+        }
+
+        /* the file has been changed, removed or became inaccessible */
+
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, pool->log, 0,
+                       "drop cached open file: %s", file->name);
+
+        ngx_rbtree_delete(&cache->rbtree, &file->node);
+
+        cache->current--;
+
+        if (file->count) {
+            file->close = 1;
+
+        } else {
+            ngx_free_cached_file(file, pool->log);
+        }
+
+    } else {
+        rc = ngx_open_and_stat_file(name->data, of, pool->log);
+    }
+
+    if (rc != NGX_OK && (of->err == 0 || !of->errors)) {
+        return NGX_ERROR;
+    }
+
+    if (cache->current >= cache->max) {
+        ngx_expire_old_cached_files(cache, 0, pool->log);
+    }
+
+    file = ngx_alloc(sizeof(ngx_cached_open_file_t), pool->log);
+    if (file == NULL) {
+        goto failed;
+    }
+
+    file->name = ngx_alloc(name->len + 1, pool->log);
+    if (file->name == NULL) {
+        ngx_free(file);
+        goto failed;
+    }
+
+    ngx_cpystrn(file->name, name->data, name->len + 1);
+
+    file->node.key = hash;
+
+    ngx_rbtree_insert(&cache->rbtree, &file->node);
+
+    cache->current++;
+
+    file->count = 0;
+    file->close = 0;
+
+update:
+
+    file->created = now;
+    file->fd = of->fd;
+    file->err = of->err;
+
+    if (of->err == 0) {
+        file->uniq = of->uniq;
+        file->mtime = of->mtime;
+        file->size = of->size;
+        file->is_dir = of->is_dir;
+        file->is_file = of->is_file;
+    }
+
+found:
+
+    file->accessed = now;
+
+    ngx_queue_insert_head(&cache->expire_queue, &file->queue);
+
+    ngx_log_debug5(NGX_LOG_DEBUG_CORE, pool->log, 0,
+                   "cached open file: %s, fd:%d, c:%d, e:%d, u:%d",
+                   file->name, file->fd, file->count, file->err,
+                   cache->current);
+
+    if (of->err) {
+        return NGX_ERROR;
+    }
+
+    if (of->fd != NGX_INVALID_FILE) {
+        file->count++;
+
+        cln->handler = ngx_open_file_cleanup;
+        ofcln = cln->data;
+
+        ofcln->cache = cache;
+        ofcln->file = file;
+        ofcln->log = pool->log;
+    }
+
+    return NGX_OK;
+
+failed:
+
+    if (of->fd != NGX_INVALID_FILE) {
+        if (ngx_close_file(of->fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, pool->log, ngx_errno,
+                          ngx_close_file_n " \"%s\" failed", name->data);
+        }
+
+        of->fd = NGX_INVALID_FILE;
+    }
+
+    return NGX_ERROR;
+}
+
+
+/*
+ * if of->fd is a valid descriptor of the cached file, then the file
+ * is only stat()ed and the descriptor is kept while the file is the same
+ */
+
+static ngx_int_t
+ngx_open_and_stat_file(u_char *name, ngx_open_file_info_t *of, ngx_log_t *log)
+{
+    ngx_fd_t         fd;
+    ngx_file_info_t  fi;
+
+    if (of->fd != NGX_INVALID_FILE) {
+
+        if (ngx_file_info(name, &fi) == -1) {
+            of->fd = NGX_INVALID_FILE;
+            of->failed = ngx_file_info_n;
+            of->err = ngx_errno;
+
+            return NGX_ERROR;
+        }
+
+        if (of->uniq == ngx_file_uniq(&fi)) {
+            goto done;
+        }
+    }
+
+    fd = ngx_open_file(name, NGX_FILE_RDONLY, NGX_FILE_OPEN);
+
+    if (fd == NGX_INVALID_FILE) {
+        of->fd = NGX_INVALID_FILE;
+        of->failed = ngx_open_file_n;
+        of->err = ngx_errno;
+
+        return NGX_ERROR;
+    }
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", name);
+
+        if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          ngx_close_file_n " \"%s\" failed", name);
+        }
+
+        of->fd = NGX_INVALID_FILE;
+
+        return NGX_ERROR;
+    }
+
+    if (ngx_is_dir(&fi)) {
+        if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          ngx_close_file_n " \"%s\" failed", name);
+        }
+
+        of->fd = NGX_INVALID_FILE;
+
+    } else {
+        of->fd = fd;
+    }
+
+done:
+
+    of->uniq = ngx_file_uniq(&fi);
+    of->mtime = ngx_file_mtime(&fi);
+    of->size = ngx_file_size(&fi);
+    of->is_dir = ngx_is_dir(&fi) ? 1 : 0;
+    of->is_file = ngx_is_file(&fi) ? 1 : 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_cached_open_file_t *
+ngx_open_file_lookup(ngx_open_file_cache_t *cache, ngx_str_t *name,
+    uint32_t hash)
+{
+    ngx_int_t                rc;
+    ngx_rbtree_node_t       *node, *sentinel;
+    ngx_cached_open_file_t  *file;
+
+    node = cache->rbtree.root;
+    sentinel = cache->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        file = (ngx_cached_open_file_t *) node;
+
+        rc = ngx_strcmp(name->data, file->name);
+
+        if (rc == 0) {
+            return file;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_open_file_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t       **p;
+    ngx_cached_open_file_t   *file, *file_temp;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            file = (ngx_cached_open_file_t *) node;
+            file_temp = (ngx_cached_open_file_t *) temp;
+
+            p = (ngx_strcmp(file->name, file_temp->name) < 0)
+                    ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static void
+ngx_open_file_cleanup(void *data)
+{
+    ngx_open_file_cache_cleanup_t  *c = data;
+
+    c->file->count--;
+
+    if (c->file->close) {
+        if (c->file->count == 0) {
+            ngx_free_cached_file(c->file, c->log);
+        }
+
+    } else {
+        c->file->accessed = ngx_time();
+
+        ngx_queue_remove(&c->file->queue);
+        ngx_queue_insert_head(&c->cache->expire_queue, &c->file->queue);
+    }
+
+    /* drop one or two expired open files */
+
+    ngx_expire_old_cached_files(c->cache, 1, c->log);
+}
+
+
+static void
+ngx_expire_old_cached_files(ngx_open_file_cache_t *cache, ngx_uint_t n,
+    ngx_log_t *log)
+{
+    time_t                   now;
+    ngx_queue_t             *q;
+    ngx_cached_open_file_t  *file;
+
+    now = ngx_time();
+
+    /*
+     * n == 1 deletes one or two inactive files
+     * n == 0 deletes least recently used file by force
+     *        and one or two inactive files
+     */
+
+    while (n < 3) {
+
+        if (ngx_queue_empty(&cache->expire_queue)) {
+            return;
+        }
+
+        q = ngx_queue_last(&cache->expire_queue);
+
+        file = ngx_queue_data(q, ngx_cached_open_file_t, queue);
+
+        if (n++ != 0 && now - file->accessed <= cache->inactive) {
+            return;
+        }
+
+        ngx_queue_remove(q);
+
+        ngx_rbtree_delete(&cache->rbtree, &file->node);
+
+        cache->current--;
+
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, log, 0,
+                       "expire cached open file: %s", file->name);
+
+        if (file->count) {
+            file->close = 1;
+            continue;
+        }
+
+        ngx_free_cached_file(file, log);
+    }
+}
+
+
+static void
+ngx_free_cached_file(ngx_cached_open_file_t *file, ngx_log_t *log)
+{
+    if (file->fd != NGX_INVALID_FILE) {
+
+        ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                       "close cached open file: %s, fd:%d",
+                       file->name, file->fd);
+
+        if (ngx_close_file(file->fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          ngx_close_file_n " \"%s\" failed", file->name);
+        }
+    }
+
+    ngx_free(file->name);
+    ngx_free(file);
+}
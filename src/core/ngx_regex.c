@@ -8,6 +8,12 @@
 #include <ngx_core.h>
 
 
+static ngx_int_t ngx_regex_literal(ngx_regex_t *re, ngx_str_t *pattern,
+    ngx_pool_t *pool);
+static u_char *ngx_regex_skip_class(u_char *p, u_char *last);
+static u_char *ngx_regex_skip_group(u_char *p, u_char *last);
+static ngx_uint_t ngx_regex_filter_goto(ngx_regex_filter_state_t *states,
+    ngx_uint_t state, u_char ch);
 static void * ngx_libc_cdecl ngx_regex_malloc(size_t size);
 static void ngx_libc_cdecl ngx_regex_free(void *p);
 
@@ -28,6 +34,7 @@ ngx_regex_compile(ngx_str_t *pattern, ngx_int_t options, ngx_pool_t *pool,
     ngx_str_t *err)
 {
     int              erroff;
+    pcre            *code;
     const char      *errstr;
     ngx_regex_t     *re;
 #if (NGX_THREADS)
@@ -50,10 +57,12 @@ ngx_regex_compile(ngx_str_t *pattern, ngx_int_t options, ngx_pool_t *pool,
 
 #endif
 
-    re = pcre_compile((const char *) pattern->data, (int) options,
-                      &errstr, &erroff, NULL);
+    re = NULL;
 
-    if (re == NULL) {
+    code = pcre_compile((const char *) pattern->data, (int) options,
+                        &errstr, &erroff, NULL);
+
+    if (code == NULL) {
        if ((size_t) erroff == pattern->len) {
            ngx_snprintf(err->data, err->len - 1,
                         "pcre_compile() failed: %s in \"%s\"%Z",
@@ -63,8 +72,38 @@ ngx_regex_compile(ngx_str_t *pattern, ngx_int_t options, ngx_pool_t *pool,
                         "pcre_compile() failed: %s in \"%s\" at \"%s\"%Z",
                         errstr, pattern->data, pattern->data + erroff);
         }
+
+        goto done;
+    }
+
+    re = ngx_palloc(pool, sizeof(ngx_regex_t));
+    if (re == NULL) {
+        ngx_snprintf(err->data, err->len - 1, "no memory%Z");
+        goto done;
     }
 
+    re->code = code;
+
+    /* the study data are allocated by ngx_regex_malloc() from the pool */
+
+    re->extra = pcre_study(code, 0, &errstr);
+
+    if (errstr != NULL) {
+        ngx_snprintf(err->data, err->len - 1,
+                     "pcre_study() failed: %s in \"%s\"%Z",
+                     errstr, pattern->data);
+        re = NULL;
+        goto done;
+    }
+
+    if (ngx_regex_literal(re, pattern, pool) != NGX_OK) {
+        ngx_snprintf(err->data, err->len - 1, "no memory%Z");
+        re = NULL;
+        goto done;
+    }
+
+done:
+
     /* ensure that there is no current pool */
 
 #if (NGX_THREADS)
@@ -88,7 +127,7 @@ ngx_regex_capture_count(ngx_regex_t *re)
 
     n = 0;
 
-    rc = pcre_fullinfo(re, NULL, PCRE_INFO_CAPTURECOUNT, &n);
+    rc = pcre_fullinfo(re->code, re->extra, PCRE_INFO_CAPTURECOUNT, &n);
 
     if (rc < 0) {
         return (ngx_int_t) rc;
@@ -103,7 +142,20 @@ ngx_regex_exec(ngx_regex_t *re, ngx_str_t *s, int *captures, ngx_int_t size)
 {
     int  rc;
 
-    rc = pcre_exec(re, NULL, (const char *) s->data, s->len, 0, 0,
+    if (re->literal.len) {
+
+        /* the subject that has no literal could not match */
+
+        if (s->len < re->literal.len
+            || ngx_strlcasestrn(s->data, s->data + s->len, re->literal.data,
+                                re->literal.len - 1)
+               == NULL)
+        {
+            return NGX_REGEX_NO_MATCHED;
+        }
+    }
+
+    rc = pcre_exec(re->code, re->extra, (const char *) s->data, s->len, 0, 0,
                    captures, size);
 
     if (rc == -1) {
@@ -114,6 +166,473 @@ ngx_regex_exec(ngx_regex_t *re, ngx_str_t *s, int *captures, ngx_int_t size)
 }
 
 
+/*
+ * find the longest string that any subject matched by the regex contains.
+ * The pattern is parsed conservatively: the alternations, unknown escapes,
+ * inline options and so on simply give no literal.  The literal is
+ * lowercased, so it is compared caselessly regardless of the options.
+ */
+
+static ngx_int_t
+ngx_regex_literal(ngx_regex_t *re, ngx_str_t *pattern, ngx_pool_t *pool)
+{
+    u_char      *p, *last, *buf, ch;
+    size_t       n, start, best, len;
+    ngx_uint_t   literal, optional, repeated;
+
+    re->literal.len = 0;
+    re->literal.data = NULL;
+
+    if (pattern->len == 0) {
+        return NGX_OK;
+    }
+
+    buf = ngx_palloc(pool, pattern->len);
+    if (buf == NULL) {
+        return NGX_ERROR;
+    }
+
+    n = 0;
+    start = 0;
+    best = 0;
+    len = 0;
+
+    p = pattern->data;
+    last = p + pattern->len;
+
+    while (p < last) {
+
+        ch = *p++;
+        literal = 0;
+
+        switch (ch) {
+
+        case '\\':
+            if (p == last) {
+                return NGX_OK;
+            }
+
+            ch = *p++;
+
+            if ((ch >= 'a' && ch <= 'z')
+                || (ch >= 'A' && ch <= 'Z')
+                || (ch >= '0' && ch <= '9'))
+            {
+                /* the escapes without arguments only */
+
+                if (ngx_strchr("dDwWsSbBAzZGntrfea", ch) == NULL) {
+                    return NGX_OK;
+                }
+
+                break;
+            }
+
+            literal = 1;
+            break;
+
+        case '[':
+            p = ngx_regex_skip_class(p, last);
+            if (p == NULL) {
+                return NGX_OK;
+            }
+
+            break;
+
+        case '(':
+            if (p < last && *p == '?'
+                && (p + 1 == last || ngx_strchr(":=!<>", p[1]) == NULL))
+            {
+                /* the inline options, comments, etc. */
+                return NGX_OK;
+            }
+
+            p = ngx_regex_skip_group(p, last);
+            if (p == NULL) {
+                return NGX_OK;
+            }
+
+            break;
+
+        case '.':
+        case '^':
+        case '$':
+            break;
+
+        case '|':
+        case ')':
+        case '{':
+        case '*':
+        case '+':
+        case '?':
+            return NGX_OK;
+
+        default:
+            literal = 1;
+            break;
+        }
+
+        /* a quantifier */
+
+        optional = 0;
+        repeated = 0;
+
+        if (p < last) {
+
+            switch (*p) {
+
+            case '?':
+            case '*':
+                optional = 1;
+                p++;
+                break;
+
+            case '+':
+                repeated = 1;
+                p++;
+                break;
+
+            case '{':
+                if (p + 1 < last && p[1] >= '0' && p[1] <= '9') {
+
+                    optional = (p[1] == '0');
+                    repeated = 1;
+
+                    while (p < last && *p != '}') {
+                        p++;
+                    }
+
+                    if (p == last) {
+                        return NGX_OK;
+                    }
+
+                    p++;
+                }
+
+                break;
+            }
+
+            if ((optional || repeated) && p < last && (*p == '?' || *p == '+'))
+            {
+                /* a lazy or possessive quantifier */
+                p++;
+            }
+        }
+
+        if (literal && !optional) {
+            buf[n++] = ngx_tolower(ch);
+        }
+
+        if (!literal || optional || repeated) {
+            if (n - start > len) {
+                best = start;
+                len = n - start;
+            }
+
+            start = n;
+        }
+    }
+
+    if (n - start > len) {
+        best = start;
+        len = n - start;
+    }
+
+    re->literal.len = len;
+    re->literal.data = buf + best;
+
+    return NGX_OK;
+}
+
+
+static u_char *
+ngx_regex_skip_class(u_char *p, u_char *last)
+{
+    u_char  ch;
+
+    if (p < last && *p == '^') {
+        p++;
+    }
+
+    if (p < last && *p == ']') {
+        p++;
+    }
+
+    while (p < last) {
+
+        ch = *p++;
+
+        if (ch == ']') {
+            return p;
+        }
+
+        if (ch == '\\') {
+            p++;
+            continue;
+        }
+
+        if (ch == '[' && p < last && (*p == ':' || *p == '.' || *p == '=')) {
+
+            /* a POSIX class such as "[:alpha:]" */
+
+            ch = *p++;
+
+            while (p + 1 < last && !(p[0] == ch && p[1] == ']')) {
+                p++;
+            }
+
+            p += 2;
+        }
+    }
+
+    return NULL;
+}
+
+
+static u_char *
+ngx_regex_skip_group(u_char *p, u_char *last)
+{
+    u_char      ch;
+    ngx_uint_t  depth;
+
+    depth = 1;
+
+    while (p < last) {
+
+        ch = *p++;
+
+        switch (ch) {
+
+        case '\\':
+            p++;
+            break;
+
+        case '[':
+            p = ngx_regex_skip_class(p, last);
+            if (p == NULL) {
+                return NULL;
+            }
+
+            break;
+
+        case '(':
+            depth++;
+            break;
+
+        case ')':
+            if (--depth == 0) {
+                return p;
+            }
+
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+
+ngx_regex_filter_t *
+ngx_regex_filter_create(ngx_pool_t *pool, ngx_regex_t **regex, ngx_uint_t n)
+{
+    u_char                    *p, *last;
+    ngx_int_t                  j;
+    ngx_uint_t                 i, s, state, next, f, w, head, tail, *queue;
+    ngx_regex_filter_t        *filter;
+    ngx_regex_filter_state_t  *states;
+
+    filter = ngx_palloc(pool, sizeof(ngx_regex_filter_t));
+    if (filter == NULL) {
+        return NULL;
+    }
+
+    filter->nelts = n;
+
+    filter->always = ngx_pcalloc(pool,
+                           ngx_regex_filter_size(filter) * sizeof(uintptr_t));
+    if (filter->always == NULL) {
+        return NULL;
+    }
+
+    filter->next_regex = ngx_palloc(pool, n * sizeof(ngx_int_t));
+    if (filter->next_regex == NULL) {
+        return NULL;
+    }
+
+    s = 1;
+
+    for (i = 0; i < n; i++) {
+        s += regex[i]->literal.len;
+    }
+
+    states = ngx_palloc(pool, s * sizeof(ngx_regex_filter_state_t));
+    if (states == NULL) {
+        return NULL;
+    }
+
+    filter->states = states;
+
+    /* the trie of the literals, the state 0 is the root */
+
+    ngx_memzero(&states[0], sizeof(ngx_regex_filter_state_t));
+    states[0].regex = -1;
+
+    s = 1;
+
+    for (i = 0; i < n; i++) {
+
+        filter->next_regex[i] = -1;
+
+        if (regex[i]->literal.len == 0) {
+            filter->always[i / (8 * sizeof(uintptr_t))] |=
+                                   (uintptr_t) 1 << (i % (8 * sizeof(uintptr_t)));
+            continue;
+        }
+
+        state = 0;
+
+        p = regex[i]->literal.data;
+        last = p + regex[i]->literal.len;
+
+        while (p < last) {
+            next = ngx_regex_filter_goto(states, state, *p);
+
+            if (next == 0) {
+                next = s++;
+
+                states[next].child = 0;
+                states[next].next = states[state].child;
+                states[next].fail = 0;
+                states[next].output = 0;
+                states[next].regex = -1;
+                states[next].ch = *p;
+
+                states[state].child = next;
+            }
+
+            state = next;
+            p++;
+        }
+
+        /* the regexes with the same literal are linked in their order */
+
+        if (states[state].regex == -1) {
+            states[state].regex = i;
+            continue;
+        }
+
+        for (j = states[state].regex;
+             filter->next_regex[j] != -1;
+             j = filter->next_regex[j])
+        {
+            /* void */
+        }
+
+        filter->next_regex[j] = i;
+    }
+
+    /* the failure and output links are set in the breadth-first order */
+
+    queue = ngx_palloc(pool, s * sizeof(ngx_uint_t));
+    if (queue == NULL) {
+        return NULL;
+    }
+
+    head = 0;
+    tail = 0;
+
+    for (next = states[0].child; next; next = states[next].next) {
+        queue[tail++] = next;
+    }
+
+    while (head < tail) {
+        state = queue[head++];
+
+        for (next = states[state].child; next; next = states[next].next) {
+
+            f = states[state].fail;
+
+            for ( ;; ) {
+                w = ngx_regex_filter_goto(states, f, states[next].ch);
+
+                if (w || f == 0) {
+                    break;
+                }
+
+                f = states[f].fail;
+            }
+
+            states[next].fail = w;
+            states[next].output = (states[w].regex != -1) ? w:
+                                                            states[w].output;
+
+            queue[tail++] = next;
+        }
+    }
+
+    return filter;
+}
+
+
+void
+ngx_regex_filter_exec(ngx_regex_filter_t *filter, ngx_str_t *s,
+    uintptr_t *candidates)
+{
+    u_char                    *p, *last, ch;
+    ngx_int_t                  i;
+    ngx_uint_t                 state, next, o;
+    ngx_regex_filter_state_t  *states;
+
+    ngx_memcpy(candidates, filter->always,
+               ngx_regex_filter_size(filter) * sizeof(uintptr_t));
+
+    states = filter->states;
+    state = 0;
+
+    p = s->data;
+    last = p + s->len;
+
+    while (p < last) {
+        ch = ngx_tolower(*p);
+        p++;
+
+        for ( ;; ) {
+            next = ngx_regex_filter_goto(states, state, ch);
+
+            if (next || state == 0) {
+                break;
+            }
+
+            state = states[state].fail;
+        }
+
+        state = next;
+
+        for (o = state; o; o = states[o].output) {
+            for (i = states[o].regex; i != -1; i = filter->next_regex[i]) {
+                candidates[i / (8 * sizeof(uintptr_t))] |=
+                                   (uintptr_t) 1 << (i % (8 * sizeof(uintptr_t)));
+            }
+        }
+    }
+}
+
+
+static ngx_uint_t
+ngx_regex_filter_goto(ngx_regex_filter_state_t *states, ngx_uint_t state,
+    u_char ch)
+{
+    ngx_uint_t  next;
+
+    for (next = states[state].child; next; next = states[next].next) {
+        if (states[next].ch == ch) {
+            return next;
+        }
+    }
+
+    return 0;
+}
+
+
 static void * ngx_libc_cdecl
 ngx_regex_malloc(size_t size)
 {
@@ -18,7 +18,46 @@
 
 #define NGX_REGEX_CASELESS    PCRE_CASELESS
 
-typedef pcre  ngx_regex_t;
+typedef struct {
+    pcre                      *code;
+    pcre_extra                *extra;
+
+    /* the lowercased string that any matched subject contains */
+    ngx_str_t                  literal;
+} ngx_regex_t;
+
+
+typedef struct {
+    ngx_uint_t                 child;
+    ngx_uint_t                 next;
+    ngx_uint_t                 fail;
+    ngx_uint_t                 output;
+    ngx_int_t                  regex;
+    u_char                     ch;
+} ngx_regex_filter_state_t;
+
+
+/*
+ * the Aho-Corasick automaton of the regexes' literals: one pass over
+ * a subject marks the regexes that may match, the regexes without
+ * a literal are always marked
+ */
+
+typedef struct {
+    ngx_regex_filter_state_t  *states;
+    ngx_int_t                 *next_regex;
+    uintptr_t                 *always;
+    ngx_uint_t                 nelts;
+} ngx_regex_filter_t;
+
+
+#define ngx_regex_filter_size(f)                                              \
+    (((f)->nelts + 8 * sizeof(uintptr_t) - 1) / (8 * sizeof(uintptr_t)))
+
+#define ngx_regex_filter_test(candidates, n)                                  \
+    ((candidates)[(n) / (8 * sizeof(uintptr_t))]                              \
+     & ((uintptr_t) 1 << ((n) % (8 * sizeof(uintptr_t)))))
+
 
 void ngx_regex_init(void);
 ngx_regex_t *ngx_regex_compile(ngx_str_t *pattern, ngx_int_t options,
@@ -27,6 +66,11 @@ ngx_int_t ngx_regex_capture_count(ngx_regex_t *re);
 ngx_int_t ngx_regex_exec(ngx_regex_t *re, ngx_str_t *s,
                          int *captures, ngx_int_t size);
 
+ngx_regex_filter_t *ngx_regex_filter_create(ngx_pool_t *pool,
+    ngx_regex_t **regex, ngx_uint_t n);
+void ngx_regex_filter_exec(ngx_regex_filter_t *filter, ngx_str_t *s,
+    uintptr_t *candidates);
+
 #define ngx_regex_exec_n           "pcre_exec()"
 #define ngx_regex_capture_count_n  "pcre_fullinfo()"
 
@@ -486,6 +486,39 @@ ngx_rstrncasecmp(u_char *s1, u_char *s2, size_t n)
 }
 
 
+/*
+ * ngx_strlcasestrn() searches for the static substring s2 of the known
+ * length in the not null-terminated string s1 until the last argument,
+ * the n argument must be the length of the substring - 1
+ */
+
+u_char *
+ngx_strlcasestrn(u_char *s1, u_char *last, u_char *s2, size_t n)
+{
+    ngx_uint_t  c1, c2;
+
+    c2 = (ngx_uint_t) *s2++;
+    c2 = (c2 >= 'A' && c2 <= 'Z') ? (c2 | 0x20) : c2;
+
+    last -= n;
+
+    do {
+        do {
+            if (s1 >= last) {
+                return NULL;
+            }
+
+            c1 = (ngx_uint_t) *s1++;
+            c1 = (c1 >= 'A' && c1 <= 'Z') ? (c1 | 0x20) : c1;
+
+        } while (c1 != c2);
+
+    } while (ngx_strncasecmp(s1, s2, n) != 0);
+
+    return --s1;
+}
+
+
 ngx_int_t
 ngx_atoi(u_char *line, size_t n)
 {
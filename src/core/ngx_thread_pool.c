@@ -0,0 +1,649 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include <ngx_channel.h>
+#include <ngx_thread_pool.h>
+
+
+/*
+ * The thread pools do not use the ngx_mutex_t and ngx_cond_t of
+ * the threaded mode: they are no-ops while ngx_threaded is not set,
+ * and the worker event loop itself always remains single threaded.
+ */
+
+
+typedef struct {
+    ngx_array_t               pools;    /* array of ngx_thread_pool_t * */
+} ngx_thread_pool_conf_t;
+
+
+typedef struct {
+    ngx_thread_task_t        *first;
+    ngx_thread_task_t       **last;
+} ngx_thread_pool_queue_t;
+
+
+struct ngx_thread_pool_s {
+    pthread_mutex_t           mutex;
+    pthread_cond_t            cond;
+
+    ngx_thread_pool_queue_t   queue;
+    ngx_int_t                 waiting;
+    ngx_uint_t                exiting;   /* unsigned  exiting:1; */
+
+    pthread_t                *tids;
+    ngx_log_t                *log;
+
+    ngx_str_t                 name;
+    ngx_uint_t                threads;
+    ngx_int_t                 max_queue;
+
+    u_char                   *file;
+    ngx_uint_t                line;
+};
+
+
+static ngx_int_t ngx_thread_pool_init(ngx_thread_pool_t *tp,
+    ngx_cycle_t *cycle);
+static void ngx_thread_pool_destroy(ngx_thread_pool_t *tp);
+static void *ngx_thread_pool_cycle(void *data);
+static void ngx_thread_pool_handler(ngx_event_t *ev);
+static void ngx_thread_task_free_handler(ngx_event_t *ev);
+
+static void *ngx_thread_pool_create_conf(ngx_cycle_t *cycle);
+static char *ngx_thread_pool_init_conf(ngx_cycle_t *cycle, void *conf);
+static char *ngx_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+
+static ngx_int_t ngx_thread_pool_init_process(ngx_cycle_t *cycle);
+static void ngx_thread_pool_exit_process(ngx_cycle_t *cycle);
+
+
+static ngx_command_t  ngx_thread_pool_commands[] = {
+
+    { ngx_string("thread_pool"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE23,
+      ngx_thread_pool,
+      0,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_core_module_t  ngx_thread_pool_module_ctx = {
+    ngx_string("thread_pool"),
+    ngx_thread_pool_create_conf,
+    ngx_thread_pool_init_conf
+};
+
+
+ngx_module_t  ngx_thread_pool_module = {
+    NGX_MODULE_V1,
+    &ngx_thread_pool_module_ctx,           /* module context */
+    ngx_thread_pool_commands,              /* module directives */
+    NGX_CORE_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    ngx_thread_pool_init_process,          /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    ngx_thread_pool_exit_process,          /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_str_t  ngx_thread_pool_default = ngx_string("default");
+
+
+/*
+ * the completed tasks of all pools are queued to the single done queue,
+ * the worker event loop is waked up by a byte written to the notify pipe
+ */
+
+static pthread_mutex_t          ngx_thread_pool_done_mutex
+                                                  = PTHREAD_MUTEX_INITIALIZER;
+static ngx_thread_pool_queue_t  ngx_thread_pool_done;
+static ngx_socket_t             ngx_thread_pool_notify[2];
+
+
+static ngx_int_t
+ngx_thread_pool_init(ngx_thread_pool_t *tp, ngx_cycle_t *cycle)
+{
+    int          err;
+    sigset_t     set, old;
+    ngx_uint_t   n;
+
+    tp->log = cycle->log;
+
+    tp->queue.first = NULL;
+    tp->queue.last = &tp->queue.first;
+    tp->waiting = 0;
+    tp->exiting = 0;
+
+    err = pthread_mutex_init(&tp->mutex, NULL);
+    if (err != 0) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, err,
+                      "pthread_mutex_init() failed");
+        return NGX_ERROR;
+    }
+
+    err = pthread_cond_init(&tp->cond, NULL);
+    if (err != 0) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, err,
+                      "pthread_cond_init() failed");
+        return NGX_ERROR;
+    }
+
+    tp->tids = ngx_pcalloc(cycle->pool, tp->threads * sizeof(pthread_t));
+    if (tp->tids == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* the signals are handled by the worker event loop only */
+
+    sigfillset(&set);
+    sigdelset(&set, SIGILL);
+    sigdelset(&set, SIGFPE);
+    sigdelset(&set, SIGSEGV);
+    sigdelset(&set, SIGBUS);
+
+    err = pthread_sigmask(SIG_SETMASK, &set, &old);
+    if (err != 0) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, err,
+                      "pthread_sigmask() failed");
+        return NGX_ERROR;
+    }
+
+    for (n = 0; n < tp->threads; n++) {
+        err = pthread_create(&tp->tids[n], NULL, ngx_thread_pool_cycle, tp);
+        if (err != 0) {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, err,
+                          "pthread_create() failed");
+            break;
+        }
+    }
+
+    tp->threads = n;
+
+    (void) pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (err != 0) {
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, cycle->log, 0,
+                   "thread pool \"%V\": %ui threads", &tp->name, tp->threads);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_thread_pool_destroy(ngx_thread_pool_t *tp)
+{
+    ngx_uint_t  n;
+
+    (void) pthread_mutex_lock(&tp->mutex);
+
+    tp->exiting = 1;
+
+    (void) pthread_cond_broadcast(&tp->cond);
+    (void) pthread_mutex_unlock(&tp->mutex);
+
+    for (n = 0; n < tp->threads; n++) {
+        (void) pthread_join(tp->tids[n], NULL);
+    }
+
+    (void) pthread_cond_destroy(&tp->cond);
+    (void) pthread_mutex_destroy(&tp->mutex);
+}
+
+
+ngx_thread_task_t *
+ngx_thread_task_alloc(size_t size, ngx_log_t *log)
+{
+    ngx_thread_task_t  *task;
+
+    task = ngx_alloc(sizeof(ngx_thread_task_t) + size, log);
+    if (task == NULL) {
+        return NULL;
+    }
+
+    ngx_memzero(task, sizeof(ngx_thread_task_t) + size);
+
+    task->ctx = task + 1;
+    task->event.log = log;
+
+    return task;
+}
+
+
+void
+ngx_thread_task_free(ngx_thread_task_t *task)
+{
+    if (task->event.active) {
+
+        /*
+         * the task is still running, it is freed when it is complete;
+         * the log of the owner may be already freed at that time
+         */
+
+        task->event.handler = ngx_thread_task_free_handler;
+        task->event.data = task;
+        task->event.log = ngx_cycle->log;
+
+        return;
+    }
+
+    if (task->event.prev) {
+        ngx_delete_posted_event((&task->event));
+    }
+
+    ngx_free(task);
+}
+
+
+static void
+ngx_thread_task_free_handler(ngx_event_t *ev)
+{
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, ev->log, 0,
+                   "free orphaned thread task %p", ev->data);
+
+    ngx_free(ev->data);
+}
+
+
+ngx_int_t
+ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task)
+{
+    if (task->event.active) {
+        ngx_log_error(NGX_LOG_ALERT, tp->log, 0,
+                      "task %p already active", task);
+        return NGX_ERROR;
+    }
+
+    (void) pthread_mutex_lock(&tp->mutex);
+
+    if (tp->waiting >= tp->max_queue) {
+        (void) pthread_mutex_unlock(&tp->mutex);
+
+        ngx_log_error(NGX_LOG_ERR, tp->log, 0,
+                      "thread pool \"%V\" queue overflow: %i tasks waiting",
+                      &tp->name, tp->waiting);
+        return NGX_ERROR;
+    }
+
+    task->event.active = 1;
+    task->event.complete = 0;
+
+    task->next = NULL;
+
+    *tp->queue.last = task;
+    tp->queue.last = &task->next;
+
+    tp->waiting++;
+
+    (void) pthread_cond_signal(&tp->cond);
+    (void) pthread_mutex_unlock(&tp->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, tp->log, 0,
+                   "task %p added to thread pool \"%V\"", task, &tp->name);
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_thread_pool_cycle(void *data)
+{
+    ngx_thread_pool_t *tp = data;
+
+    ngx_uint_t          notify;
+    ngx_thread_task_t  *task;
+
+    for ( ;; ) {
+        (void) pthread_mutex_lock(&tp->mutex);
+
+        while (tp->queue.first == NULL && !tp->exiting) {
+            (void) pthread_cond_wait(&tp->cond, &tp->mutex);
+        }
+
+        task = tp->queue.first;
+
+        if (task == NULL) {
+            (void) pthread_mutex_unlock(&tp->mutex);
+            return NULL;
+        }
+
+        tp->queue.first = task->next;
+
+        if (tp->queue.first == NULL) {
+            tp->queue.last = &tp->queue.first;
+        }
+
+        tp->waiting--;
+
+        (void) pthread_mutex_unlock(&tp->mutex);
+
+        task->handler(task->ctx, tp->log);
+
+        task->next = NULL;
+
+        (void) pthread_mutex_lock(&ngx_thread_pool_done_mutex);
+
+        notify = (ngx_thread_pool_done.first == NULL);
+
+        *ngx_thread_pool_done.last = task;
+        ngx_thread_pool_done.last = &task->next;
+
+        (void) pthread_mutex_unlock(&ngx_thread_pool_done_mutex);
+
+        /*
+         * the pipe is written only if the done queue was empty:
+         * otherwise the event loop has not taken the queue yet
+         */
+
+        if (notify) {
+            (void) write(ngx_thread_pool_notify[1], "", 1);
+        }
+    }
+}
+
+
+static void
+ngx_thread_pool_handler(ngx_event_t *ev)
+{
+    u_char              buf[16];
+    ngx_connection_t   *c;
+    ngx_thread_task_t  *task;
+
+    c = ev->data;
+
+    while (read(c->fd, buf, sizeof(buf)) > 0) { /* void */ }
+
+    (void) pthread_mutex_lock(&ngx_thread_pool_done_mutex);
+
+    task = ngx_thread_pool_done.first;
+    ngx_thread_pool_done.first = NULL;
+    ngx_thread_pool_done.last = &ngx_thread_pool_done.first;
+
+    (void) pthread_mutex_unlock(&ngx_thread_pool_done_mutex);
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, ev->log, 0, "thread pool handler");
+
+    while (task) {
+        task->event.active = 0;
+        task->event.complete = 1;
+
+        ngx_post_event((&task->event), &ngx_posted_events);
+
+        task = task->next;
+    }
+}
+
+
+static void *
+ngx_thread_pool_create_conf(ngx_cycle_t *cycle)
+{
+    ngx_thread_pool_conf_t  *tcf;
+
+    tcf = ngx_pcalloc(cycle->pool, sizeof(ngx_thread_pool_conf_t));
+    if (tcf == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&tcf->pools, cycle->pool, 4,
+                       sizeof(ngx_thread_pool_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return tcf;
+}
+
+
+static char *
+ngx_thread_pool_init_conf(ngx_cycle_t *cycle, void *conf)
+{
+    ngx_thread_pool_conf_t *tcf = conf;
+
+    ngx_uint_t           i;
+    ngx_thread_pool_t  **tpp;
+
+    tpp = tcf->pools.elts;
+
+    for (i = 0; i < tcf->pools.nelts; i++) {
+
+        if (tpp[i]->threads) {
+            continue;
+        }
+
+        if (tpp[i]->name.len == ngx_thread_pool_default.len
+            && ngx_strncmp(tpp[i]->name.data, ngx_thread_pool_default.data,
+                           ngx_thread_pool_default.len)
+               == 0)
+        {
+            tpp[i]->threads = 32;
+            tpp[i]->max_queue = 65536;
+            continue;
+        }
+
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "unknown thread pool \"%V\" in %s:%ui",
+                      &tpp[i]->name, tpp[i]->file, tpp[i]->line);
+
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_str_t          *value;
+    ngx_uint_t          i;
+    ngx_thread_pool_t  *tp;
+
+    value = cf->args->elts;
+
+    tp = ngx_thread_pool_add(cf, &value[1]);
+
+    if (tp == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (tp->threads) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "duplicate thread pool \"%V\"", &tp->name);
+        return NGX_CONF_ERROR;
+    }
+
+    tp->max_queue = 65536;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "threads=", 8) == 0) {
+
+            tp->threads = ngx_atoi(value[i].data + 8, value[i].len - 8);
+
+            if (tp->threads == (ngx_uint_t) NGX_ERROR || tp->threads == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid threads value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "max_queue=", 10) == 0) {
+
+            tp->max_queue = ngx_atoi(value[i].data + 10, value[i].len - 10);
+
+            if (tp->max_queue == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid max_queue value \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (tp->threads == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" must have \"threads\" parameter",
+                           &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+ngx_thread_pool_t *
+ngx_thread_pool_add(ngx_conf_t *cf, ngx_str_t *name)
+{
+    ngx_thread_pool_t       *tp, **tpp;
+    ngx_thread_pool_conf_t  *tcf;
+
+    if (name == NULL) {
+        name = &ngx_thread_pool_default;
+    }
+
+    tp = ngx_thread_pool_get(cf->cycle, name);
+
+    if (tp) {
+        return tp;
+    }
+
+    tp = ngx_pcalloc(cf->pool, sizeof(ngx_thread_pool_t));
+    if (tp == NULL) {
+        return NULL;
+    }
+
+    tp->name = *name;
+    tp->file = cf->conf_file->file.name.data;
+    tp->line = cf->conf_file->line;
+
+    tcf = (ngx_thread_pool_conf_t *) ngx_get_conf(cf->cycle->conf_ctx,
+                                                  ngx_thread_pool_module);
+
+    tpp = ngx_array_push(&tcf->pools);
+    if (tpp == NULL) {
+        return NULL;
+    }
+
+    *tpp = tp;
+
+    return tp;
+}
+
+
+ngx_thread_pool_t *
+ngx_thread_pool_get(ngx_cycle_t *cycle, ngx_str_t *name)
+{
+    ngx_uint_t                i;
+    ngx_thread_pool_t       **tpp;
+    ngx_thread_pool_conf_t   *tcf;
+
+    tcf = (ngx_thread_pool_conf_t *) ngx_get_conf(cycle->conf_ctx,
+                                                  ngx_thread_pool_module);
+
+    tpp = tcf->pools.elts;
+
+    for (i = 0; i < tcf->pools.nelts; i++) {
+
+        if (tpp[i]->name.len == name->len
+            && ngx_strncmp(tpp[i]->name.data, name->data, name->len) == 0)
+        {
+            return tpp[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_thread_pool_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                i;
+    ngx_thread_pool_t       **tpp;
+    ngx_thread_pool_conf_t   *tcf;
+
+    tcf = (ngx_thread_pool_conf_t *) ngx_get_conf(cycle->conf_ctx,
+                                                  ngx_thread_pool_module);
+
+    if (tcf->pools.nelts == 0) {
+        return NGX_OK;
+    }
+
+    ngx_thread_pool_done.first = NULL;
+    ngx_thread_pool_done.last = &ngx_thread_pool_done.first;
+
+    if (pipe(ngx_thread_pool_notify) == -1) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno, "pipe() failed");
+        return NGX_ERROR;
+    }
+
+    if (ngx_nonblocking(ngx_thread_pool_notify[0]) == -1
+        || ngx_nonblocking(ngx_thread_pool_notify[1]) == -1)
+    {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_socket_errno,
+                      ngx_nonblocking_n " failed");
+        return NGX_ERROR;
+    }
+
+    if (ngx_add_channel_event(cycle, ngx_thread_pool_notify[0],
+                              NGX_READ_EVENT, ngx_thread_pool_handler)
+        == NGX_ERROR)
+    {
+        return NGX_ERROR;
+    }
+
+    tpp = tcf->pools.elts;
+
+    for (i = 0; i < tcf->pools.nelts; i++) {
+        if (ngx_thread_pool_init(tpp[i], cycle) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_thread_pool_exit_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                i;
+    ngx_thread_pool_t       **tpp;
+    ngx_thread_pool_conf_t   *tcf;
+
+    tcf = (ngx_thread_pool_conf_t *) ngx_get_conf(cycle->conf_ctx,
+                                                  ngx_thread_pool_module);
+
+    tpp = tcf->pools.elts;
+
+    for (i = 0; i < tcf->pools.nelts; i++) {
+        if (tpp[i]->tids) {
+            ngx_thread_pool_destroy(tpp[i]);
+        }
+    }
+}
@@ -0,0 +1,43 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ */
+
+
+#ifndef _NGX_THREAD_POOL_H_INCLUDED_
+#define _NGX_THREAD_POOL_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+struct ngx_thread_task_s {
+    ngx_thread_task_t   *next;
+    void                *ctx;
+    void               (*handler)(void *data, ngx_log_t *log);
+
+    /*
+     * the event is posted to ngx_posted_events when the task is complete,
+     * event.active is set while the task is queued or runs in a thread
+     */
+    ngx_event_t          event;
+};
+
+
+typedef struct ngx_thread_pool_s  ngx_thread_pool_t;
+
+
+ngx_thread_pool_t *ngx_thread_pool_add(ngx_conf_t *cf, ngx_str_t *name);
+ngx_thread_pool_t *ngx_thread_pool_get(ngx_cycle_t *cycle, ngx_str_t *name);
+
+ngx_thread_task_t *ngx_thread_task_alloc(size_t size, ngx_log_t *log);
+void ngx_thread_task_free(ngx_thread_task_t *task);
+ngx_int_t ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task);
+
+
+extern ngx_module_t  ngx_thread_pool_module;
+
+
+#endif /* _NGX_THREAD_POOL_H_INCLUDED_ */
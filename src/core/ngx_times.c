@@ -19,7 +19,7 @@
 
 #define NGX_TIME_SLOTS   64
 
-static ngx_uint_t        slot = NGX_TIME_SLOTS;
+static ngx_uint_t        slot = NGX_TIME_SLOTS - 1;
 static ngx_atomic_t      ngx_time_lock;
 
 volatile ngx_msec_t      ngx_current_msec;
@@ -70,7 +70,7 @@ ngx_time_update(time_t sec, ngx_uint_t msec)
         return;
     }
 
-    if (slot == NGX_TIME_SLOTS) {
+    if (slot == NGX_TIME_SLOTS - 1) {
         slot = 0;
     } else {
         slot++;
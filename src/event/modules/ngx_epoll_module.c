@@ -23,6 +23,7 @@
 #define EPOLLMSG       0x400
 #define EPOLLERR       0x008
 #define EPOLLHUP       0x010
+#define EPOLLRDHUP     0x2000
 
 #define EPOLLET        0x80000000
 #define EPOLLONESHOT   0x40000000
@@ -65,12 +66,20 @@ int epoll_wait(int epfd, struct epoll_event *events, int nevents, int timeout)
 #endif
 
 
+#if !(NGX_HAVE_EPOLLRDHUP) && !(NGX_TEST_BUILD_EPOLL)
+#define EPOLLRDHUP     0
+#endif
+
+
 typedef struct {
     u_int  events;
 } ngx_epoll_conf_t;
 
 
 static ngx_int_t ngx_epoll_init(ngx_cycle_t *cycle, ngx_msec_t timer);
+#if (NGX_HAVE_EPOLLRDHUP)
+static void ngx_epoll_test_rdhup(ngx_cycle_t *cycle);
+#endif
 static void ngx_epoll_done(ngx_cycle_t *cycle);
 static ngx_int_t ngx_epoll_add_event(ngx_event_t *ev, int event, u_int flags);
 static ngx_int_t ngx_epoll_del_event(ngx_event_t *ev, int event, u_int flags);
@@ -86,6 +95,10 @@ static int                  ep = -1;
 static struct epoll_event  *event_list;
 static u_int                nevents;
 
+#if (NGX_HAVE_EPOLLRDHUP)
+ngx_uint_t                  ngx_use_epoll_rdhup;
+#endif
+
 
 static ngx_str_t      epoll_name = ngx_string("epoll");
 
@@ -155,6 +168,10 @@ ngx_epoll_init(ngx_cycle_t *cycle, ngx_msec_t timer)
                           "epoll_create() failed");
             return NGX_ERROR;
         }
+
+#if (NGX_HAVE_EPOLLRDHUP)
+        ngx_epoll_test_rdhup(cycle);
+#endif
     }
 
     if (nevents < epcf->events) {
@@ -180,13 +197,94 @@ ngx_epoll_init(ngx_cycle_t *cycle, ngx_msec_t timer)
 #else
     ngx_event_flags = NGX_USE_LEVEL_EVENT
 #endif
-                      |NGX_USE_GREEDY_EVENT
                       |NGX_USE_EPOLL_EVENT;
 
+#if (NGX_HAVE_EPOLLRDHUP)
+    if (!ngx_use_epoll_rdhup)
+#endif
+    {
+        ngx_event_flags |= NGX_USE_GREEDY_EVENT;
+    }
+
     return NGX_OK;
 }
 
 
+#if (NGX_HAVE_EPOLLRDHUP)
+
+/*
+ * EPOLLRDHUP reports the peer FIN along with EPOLLIN, so the short read
+ * is enough to know that the socket is drained and the read() returning
+ * EAGAIN (or 0) may be skipped; however, an old kernel silently ignores
+ * the unknown flag, therefore test it on the half-closed socketpair
+ */
+
+static void
+ngx_epoll_test_rdhup(ngx_cycle_t *cycle)
+{
+    int                 s[2], events;
+    struct epoll_event  ee;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, s) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "socketpair() failed");
+        return;
+    }
+
+    ee.events = EPOLLET|EPOLLIN|EPOLLRDHUP;
+    ee.data.ptr = NULL;
+
+    if (epoll_ctl(ep, EPOLL_CTL_ADD, s[0], &ee) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "epoll_ctl() failed");
+        goto failed;
+    }
+
+    if (close(s[1]) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "close() failed");
+        s[1] = -1;
+        goto failed;
+    }
+
+    s[1] = -1;
+
+    events = epoll_wait(ep, &ee, 1, 5000);
+
+    if (events == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "epoll_wait() failed");
+        goto failed;
+    }
+
+    if (events) {
+        ngx_use_epoll_rdhup = ee.events & EPOLLRDHUP;
+
+    } else {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, NGX_ETIMEDOUT,
+                      "epoll_wait() timed out");
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "testing the EPOLLRDHUP flag: %s",
+                   ngx_use_epoll_rdhup ? "success" : "fail");
+
+failed:
+
+    if (s[1] != -1 && close(s[1]) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "close() failed");
+    }
+
+    if (close(s[0]) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "close() failed");
+    }
+}
+
+#endif
+
+
 static void
 ngx_epoll_done(ngx_cycle_t *cycle)
 {
@@ -223,10 +321,11 @@ ngx_epoll_add_event(ngx_event_t *ev, int event, u_int flags)
 #if (NGX_READ_EVENT != EPOLLIN)
         events = EPOLLIN;
 #endif
+        events |= EPOLLRDHUP;
 
     } else {
         e = c->read;
-        prev = EPOLLIN;
+        prev = EPOLLIN|EPOLLRDHUP;
 #if (NGX_WRITE_EVENT != EPOLLOUT)
         events = EPOLLOUT;
 #endif
@@ -290,7 +389,7 @@ ngx_epoll_del_event(ngx_event_t *ev, int event, u_int flags)
 
     } else {
         e = c->read;
-        prev = EPOLLIN;
+        prev = EPOLLIN|EPOLLRDHUP;
     }
 
     if (e->active) {
@@ -325,7 +424,7 @@ ngx_epoll_add_connection(ngx_connection_t *c)
 {
     struct epoll_event  ee;
 
-    ee.events = EPOLLIN|EPOLLOUT|EPOLLET;
+    ee.events = EPOLLIN|EPOLLOUT|EPOLLET|EPOLLRDHUP;
     ee.data.ptr = (void *) ((uintptr_t) c | c->read->instance);
 
     ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
@@ -501,6 +600,12 @@ ngx_epoll_process_events(ngx_cycle_t *cycle, ngx_msec_t timer, ngx_uint_t flags)
 
         if ((revents & EPOLLIN) && rev->active) {
 
+#if (NGX_HAVE_EPOLLRDHUP)
+            if (revents & EPOLLRDHUP) {
+                rev->pending_eof = 1;
+            }
+#endif
+
             if ((flags & NGX_POST_THREAD_EVENTS) && !rev->accept) {
                 rev->posted_ready = 1;
 
@@ -23,6 +23,10 @@ extern ngx_module_t ngx_select_module;
 static ngx_int_t ngx_event_module_init(ngx_cycle_t *cycle);
 static ngx_int_t ngx_event_process_init(ngx_cycle_t *cycle);
 static char *ngx_events_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *ngx_events_init_conf(ngx_cycle_t *cycle, void *conf);
+#if (NGX_HAVE_REUSEPORT)
+static ngx_int_t ngx_events_test_reuseport(ngx_cycle_t *cycle);
+#endif
 
 static char *ngx_event_connections(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
@@ -71,6 +75,8 @@ ngx_atomic_t   ngx_stat_reading0;
 ngx_atomic_t  *ngx_stat_reading = &ngx_stat_reading0;
 ngx_atomic_t   ngx_stat_writing0;
 ngx_atomic_t  *ngx_stat_writing = &ngx_stat_writing0;
+ngx_atomic_t   ngx_stat_limited0;
+ngx_atomic_t  *ngx_stat_limited = &ngx_stat_limited0;
 
 #endif
 
@@ -92,7 +98,7 @@ static ngx_command_t  ngx_events_commands[] = {
 static ngx_core_module_t  ngx_events_module_ctx = {
     ngx_string("events"),
     NULL,
-    NULL
+    ngx_events_init_conf
 };
 
 
@@ -159,6 +165,13 @@ static ngx_command_t  ngx_event_core_commands[] = {
       offsetof(ngx_event_conf_t, accept_mutex_delay),
       NULL },
 
+    { ngx_string("timer_wheel"),
+      NGX_EVENT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_event_conf_t, timer_wheel),
+      NULL },
+
     { ngx_string("debug_connection"),
       NGX_EVENT_CONF|NGX_CONF_TAKE1,
       ngx_event_debug_connection,
@@ -502,7 +515,8 @@ ngx_event_module_init(ngx_cycle_t *cycle)
            + cl          /* ngx_stat_requests */
            + cl          /* ngx_stat_active */
            + cl          /* ngx_stat_reading */
-           + cl;         /* ngx_stat_writing */
+           + cl          /* ngx_stat_writing */
+           + cl;         /* ngx_stat_limited */
 
 #endif
 
@@ -533,6 +547,7 @@ ngx_event_module_init(ngx_cycle_t *cycle)
     ngx_stat_active = (ngx_atomic_t *) (shared + 5 * cl);
     ngx_stat_reading = (ngx_atomic_t *) (shared + 6 * cl);
     ngx_stat_writing = (ngx_atomic_t *) (shared + 7 * cl);
+    ngx_stat_limited = (ngx_atomic_t *) (shared + 8 * cl);
 
 #endif
 
@@ -593,6 +608,29 @@ ngx_event_process_init(ngx_cycle_t *cycle)
         ngx_use_accept_mutex = 0;
     }
 
+#if (NGX_HAVE_REUSEPORT)
+
+    if (ngx_use_accept_mutex) {
+
+        /*
+         * the accept mutex is not needed if each worker
+         * has its own SO_REUSEPORT sockets only
+         */
+
+        ls = cycle->listening.elts;
+        for (i = 0; i < cycle->listening.nelts; i++) {
+            if (!ls[i].reuseport) {
+                break;
+            }
+        }
+
+        if (i == cycle->listening.nelts) {
+            ngx_use_accept_mutex = 0;
+        }
+    }
+
+#endif
+
 #if (NGX_THREADS)
     ngx_posted_events_mutex = ngx_mutex_init(cycle->log, 0);
     if (ngx_posted_events_mutex == NULL) {
@@ -600,6 +638,8 @@ ngx_event_process_init(ngx_cycle_t *cycle)
     }
 #endif
 
+    ngx_event_timer_use_wheel = ecf->timer_wheel;
+
     if (ngx_event_timer_init(cycle->log) == NGX_ERROR) {
         return NGX_ERROR;
     }
@@ -731,6 +771,10 @@ ngx_event_process_init(ngx_cycle_t *cycle)
     ls = cycle->listening.elts;
     for (i = 0; i < cycle->listening.nelts; i++) {
 
+        if (ls[i].reuseport && ls[i].worker != ngx_worker) {
+            continue;
+        }
+
         c = ngx_get_connection(ls[i].fd, cycle->log);
 
         if (c == NULL) {
@@ -801,7 +845,7 @@ ngx_event_process_init(ngx_cycle_t *cycle)
 
         rev->handler = ngx_event_accept;
 
-        if (ngx_use_accept_mutex) {
+        if (ngx_use_accept_mutex && !ls[i].reuseport) {
             continue;
         }
 
@@ -936,6 +980,98 @@ ngx_events_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static char *
+ngx_events_init_conf(ngx_cycle_t *cycle, void *conf)
+{
+#if (NGX_HAVE_REUSEPORT)
+
+    ngx_uint_t        i, n, tested;
+    ngx_listening_t  *ls;
+
+    tested = 0;
+
+    /* the cloned sockets are appended, so the original number is used */
+
+    n = cycle->listening.nelts;
+
+    for (i = 0; i < n; i++) {
+
+        ls = cycle->listening.elts;
+
+        if (!ls[i].reuseport) {
+            continue;
+        }
+
+        if (!tested) {
+            if (ngx_events_test_reuseport(cycle) != NGX_OK) {
+                break;
+            }
+
+            tested = 1;
+        }
+
+        if (ngx_clone_listening(cycle, &ls[i]) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    if (i < n) {
+
+        /* SO_REUSEPORT is not supported by kernel, use the accept mutex */
+
+        ls = cycle->listening.elts;
+        for (i = 0; i < n; i++) {
+            ls[i].reuseport = 0;
+        }
+    }
+
+#endif
+
+    return NGX_CONF_OK;
+}
+
+
+#if (NGX_HAVE_REUSEPORT)
+
+static ngx_int_t
+ngx_events_test_reuseport(ngx_cycle_t *cycle)
+{
+    int           reuseport;
+    ngx_int_t     rc;
+    ngx_socket_t  s;
+
+    s = ngx_socket(AF_INET, SOCK_STREAM, 0);
+
+    if (s == -1) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_socket_errno,
+                      ngx_socket_n " failed");
+        return NGX_ERROR;
+    }
+
+    rc = NGX_OK;
+    reuseport = 1;
+
+    if (setsockopt(s, SOL_SOCKET, SO_REUSEPORT,
+                   (const void *) &reuseport, sizeof(int))
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_WARN, cycle->log, ngx_socket_errno,
+                      "setsockopt(SO_REUSEPORT) failed, "
+                      "the \"reuseport\" parameter is ignored");
+        rc = NGX_ERROR;
+    }
+
+    if (ngx_close_socket(s) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                      ngx_close_socket_n " failed");
+    }
+
+    return rc;
+}
+
+#endif
+
+
 static char *
 ngx_event_connections(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -1102,6 +1238,7 @@ ngx_event_create_conf(ngx_cycle_t *cycle)
     ecf->multi_accept = NGX_CONF_UNSET;
     ecf->accept_mutex = NGX_CONF_UNSET;
     ecf->accept_mutex_delay = NGX_CONF_UNSET_MSEC;
+    ecf->timer_wheel = NGX_CONF_UNSET;
     ecf->name = (void *) NGX_CONF_UNSET;
 
 #if (NGX_DEBUG)
@@ -1227,6 +1364,7 @@ ngx_event_init_conf(ngx_cycle_t *cycle, void *conf)
     ngx_conf_init_value(ecf->multi_accept, 0);
     ngx_conf_init_value(ecf->accept_mutex, 1);
     ngx_conf_init_msec_value(ecf->accept_mutex_delay, 500);
+    ngx_conf_init_value(ecf->timer_wheel, 0);
 
 
 #if (NGX_HAVE_RTSIG)
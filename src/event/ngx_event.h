@@ -66,6 +66,9 @@ struct ngx_event_s {
     unsigned         timedout:1;
     unsigned         timer_set:1;
 
+    /* the timer does not delay the exit of the worker process */
+    unsigned         cancelable:1;
+
     unsigned         delayed:1;
 
     unsigned         read_discarded:1;
@@ -426,6 +429,8 @@ typedef struct {
 
     ngx_msec_t    accept_mutex_delay;
 
+    ngx_flag_t    timer_wheel;
+
     u_char       *name;
 
 #if (NGX_DEBUG)
@@ -463,6 +468,7 @@ extern ngx_atomic_t  *ngx_stat_requests;
 extern ngx_atomic_t  *ngx_stat_active;
 extern ngx_atomic_t  *ngx_stat_reading;
 extern ngx_atomic_t  *ngx_stat_writing;
+extern ngx_atomic_t  *ngx_stat_limited;
 
 #endif
 
@@ -474,6 +480,10 @@ extern ngx_atomic_t  *ngx_stat_writing;
 
 extern sig_atomic_t           ngx_event_timer_alarm;
 extern ngx_uint_t             ngx_event_flags;
+
+#if (NGX_HAVE_EPOLLRDHUP)
+extern ngx_uint_t             ngx_use_epoll_rdhup;
+#endif
 extern ngx_module_t           ngx_events_module;
 extern ngx_module_t           ngx_event_core_module;
 
@@ -18,12 +18,18 @@ static ngx_int_t ngx_disable_accept_events(ngx_cycle_t *cycle);
 static void ngx_close_accepted_connection(ngx_connection_t *c);
 
 
+#if (NGX_HAVE_ACCEPT4)
+static ngx_uint_t  use_accept4 = 1;
+#endif
+
+
 void
 ngx_event_accept(ngx_event_t *ev)
 {
     socklen_t          socklen;
     ngx_err_t          err;
     ngx_log_t         *log;
+    ngx_uint_t         nonblocking;
     ngx_socket_t       s;
     ngx_event_t       *rev, *wev;
     ngx_listening_t   *ls;
@@ -49,8 +55,40 @@ ngx_event_accept(ngx_event_t *ev)
 
     do {
         socklen = NGX_SOCKLEN;
+        nonblocking = ngx_inherited_nonblocking;
+
+#if (NGX_HAVE_ACCEPT4)
+
+        /*
+         * accept4(SOCK_NONBLOCK) saves the fcntl() call per connection,
+         * the kernel may lack it even if glibc has it, then fall back
+         * to accept() for the rest of the worker life
+         */
+
+        if (use_accept4) {
+            s = accept4(lc->fd, (struct sockaddr *) sa, &socklen,
+                        SOCK_NONBLOCK);
 
+            if (s == -1 && ngx_socket_errno == NGX_ENOSYS) {
+                ngx_log_error(NGX_LOG_NOTICE, ev->log, NGX_ENOSYS,
+                              "accept4() is not supported, use accept()");
+
+                use_accept4 = 0;
+                socklen = NGX_SOCKLEN;
+
+                s = accept(lc->fd, (struct sockaddr *) sa, &socklen);
+
+            } else {
+                nonblocking = 1;
+            }
+
+        } else {
+            s = accept(lc->fd, (struct sockaddr *) sa, &socklen);
+        }
+
+#else
         s = accept(lc->fd, (struct sockaddr *) sa, &socklen);
+#endif
 
         if (s == -1) {
             err = ngx_socket_errno;
@@ -85,6 +123,15 @@ ngx_event_accept(ngx_event_t *ev)
         ngx_accept_disabled = NGX_ACCEPT_THRESHOLD
                               - ngx_cycle->free_connection_n;
 
+        /*
+         * stop the multi_accept loop when the free connections are
+         * running out: the rest of the backlog is left to other workers
+         */
+
+        if (ngx_accept_disabled > 0) {
+            ev->available = 0;
+        }
+
         c = ngx_get_connection(s, ev->log);
 
         if (c == NULL) {
@@ -122,7 +169,7 @@ ngx_event_accept(ngx_event_t *ev)
 
         /* set a blocking mode for aio and non-blocking mode for others */
 
-        if (ngx_inherited_nonblocking) {
+        if (nonblocking) {
             if (ngx_event_flags & NGX_USE_AIO_EVENT) {
                 if (ngx_blocking(s) == -1) {
                     ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_socket_errno,
@@ -238,7 +285,13 @@ ngx_event_accept(ngx_event_t *ev)
         ngx_log_debug3(NGX_LOG_DEBUG_EVENT, log, 0,
                        "*%d accept: %V fd:%d", c->number, &c->addr_text, s);
 
-        if (ngx_add_conn && (ngx_event_flags & NGX_USE_EPOLL_EVENT) == 0) {
+        /*
+         * epoll registers the both read and write events of the accepted
+         * connection in one epoll_ctl(), otherwise the first read and
+         * the first write would cost separate EPOLL_CTL_ADD and EPOLL_CTL_MOD
+         */
+
+        if (ngx_add_conn) {
             if (ngx_add_conn(c) == NGX_ERROR) {
                 ngx_close_accepted_connection(c);
                 return;
@@ -311,6 +364,12 @@ ngx_enable_accept_events(ngx_cycle_t *cycle)
 
         c = ls[i].connection;
 
+        /* the SO_REUSEPORT sockets are always enabled */
+
+        if (c == NULL || ls[i].reuseport) {
+            continue;
+        }
+
         if (ngx_event_flags & NGX_USE_RTSIG_EVENT) {
 
             if (ngx_add_conn(c) == NGX_ERROR) {
@@ -340,7 +399,7 @@ ngx_disable_accept_events(ngx_cycle_t *cycle)
 
         c = ls[i].connection;
 
-        if (!c->read->active) {
+        if (c == NULL || ls[i].reuseport || !c->read->active) {
             continue;
         }
 
@@ -14,17 +14,90 @@ ngx_mutex_t  *ngx_event_timer_mutex;
 #endif
 
 
+/*
+ * The hierarchical timer wheel.  The root wheel has a slot per millisecond
+ * for the nearest 256 milliseconds, each next level has 64 slots and each
+ * slot covers the whole previous level, so the four levels span the whole
+ * 32-bit ngx_msec_t range.  When the root wheel wraps around, the current
+ * slot of the next level is cascaded down to the lower levels.
+ *
+ * The wheel links the event timer nodes into the circular lists using
+ * the rbtree node "left" and "right" fields as the previous and next
+ * pointers, and the "data" field keeps the level of the node.
+ */
+
+#define NGX_TIMER_WHEEL_ROOT_BITS  8
+#define NGX_TIMER_WHEEL_ROOT_SIZE  (1 << NGX_TIMER_WHEEL_ROOT_BITS)
+#define NGX_TIMER_WHEEL_ROOT_MASK  (NGX_TIMER_WHEEL_ROOT_SIZE - 1)
+
+#define NGX_TIMER_WHEEL_BITS       6
+#define NGX_TIMER_WHEEL_SIZE       (1 << NGX_TIMER_WHEEL_BITS)
+#define NGX_TIMER_WHEEL_MASK       (NGX_TIMER_WHEEL_SIZE - 1)
+
+#define NGX_TIMER_WHEEL_LEVELS     4
+
+
+typedef struct {
+    /* the next millisecond to expire */
+    ngx_msec_t          base;
+
+    ngx_uint_t          count;
+    ngx_uint_t          root_count;
+
+    ngx_rbtree_node_t   root[NGX_TIMER_WHEEL_ROOT_SIZE];
+    ngx_rbtree_node_t   level[NGX_TIMER_WHEEL_LEVELS][NGX_TIMER_WHEEL_SIZE];
+} ngx_event_timer_wheel_t;
+
+
+static ngx_rbtree_node_t *ngx_event_timer_find_cancelable(
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static ngx_rbtree_node_t *ngx_event_timer_wheel_find_cancelable(void);
+static ngx_msec_t ngx_event_timer_wheel_find(void);
+static void ngx_event_timer_wheel_expire(void);
+static void ngx_event_timer_wheel_cascade(ngx_uint_t n, ngx_uint_t index);
+
+
 ngx_thread_volatile ngx_rbtree_t  ngx_event_timer_rbtree;
 static ngx_rbtree_node_t          ngx_event_timer_sentinel;
 
+ngx_uint_t                        ngx_event_timer_use_wheel;
+static ngx_event_timer_wheel_t    ngx_event_timer_wheel;
+
+
+#define ngx_event_timer_wheel_empty(head)  ((head)->right == (head))
+
 
 ngx_int_t
 ngx_event_timer_init(ngx_log_t *log)
 {
+    ngx_uint_t                n, i;
+    ngx_rbtree_node_t        *head;
+    ngx_event_timer_wheel_t  *w;
+
     ngx_event_timer_rbtree.root = &ngx_event_timer_sentinel;
     ngx_event_timer_rbtree.sentinel = &ngx_event_timer_sentinel;
     ngx_event_timer_rbtree.insert = ngx_rbtree_insert_timer_value;
 
+    w = &ngx_event_timer_wheel;
+
+    w->base = ngx_current_msec;
+    w->count = 0;
+    w->root_count = 0;
+
+    for (i = 0; i < NGX_TIMER_WHEEL_ROOT_SIZE; i++) {
+        head = &w->root[i];
+        head->left = head;
+        head->right = head;
+    }
+
+    for (n = 0; n < NGX_TIMER_WHEEL_LEVELS; n++) {
+        for (i = 0; i < NGX_TIMER_WHEEL_SIZE; i++) {
+            head = &w->level[n][i];
+            head->left = head;
+            head->right = head;
+        }
+    }
+
 #if (NGX_THREADS)
 
     if (ngx_event_timer_mutex) {
@@ -49,6 +122,10 @@ ngx_event_find_timer(void)
     ngx_msec_int_t      timer;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_use_wheel) {
+        return ngx_event_timer_wheel_find();
+    }
+
     if (ngx_event_timer_rbtree.root == &ngx_event_timer_sentinel) {
         return NGX_TIMER_INFINITE;
     }
@@ -74,6 +151,11 @@ ngx_event_expire_timers(void)
     ngx_event_t        *ev;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_use_wheel) {
+        ngx_event_timer_wheel_expire();
+        return;
+    }
+
     sentinel = ngx_event_timer_rbtree.sentinel;
 
     for ( ;; ) {
@@ -152,3 +234,432 @@ ngx_event_expire_timers(void)
 
     ngx_mutex_unlock(ngx_event_timer_mutex);
 }
+
+
+/*
+ * the cancelable timers, e.g. the buffered log flushes and the idle
+ * keepalive connections, must not delay the exit of the worker process,
+ * so they are run at once when the graceful shutdown starts
+ */
+
+void
+ngx_event_cancel_timers(void)
+{
+    ngx_event_t        *ev;
+    ngx_rbtree_node_t  *node;
+
+    for ( ;; ) {
+
+        ngx_mutex_lock(ngx_event_timer_mutex);
+
+        /* the handlers may delete the other timers, so the search restarts */
+
+        if (ngx_event_timer_use_wheel) {
+            node = ngx_event_timer_wheel_find_cancelable();
+
+        } else {
+            node = ngx_event_timer_find_cancelable(ngx_event_timer_rbtree.root,
+                                              ngx_event_timer_rbtree.sentinel);
+        }
+
+        if (node == NULL) {
+            ngx_mutex_unlock(ngx_event_timer_mutex);
+            return;
+        }
+
+        ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "event timer cancel: %d: %M",
+                       ngx_event_ident(ev->data), ev->timer.key);
+
+        if (ngx_event_timer_use_wheel) {
+            ngx_event_timer_wheel_delete(node);
+
+        } else {
+            ngx_rbtree_delete(&ngx_event_timer_rbtree, node);
+        }
+
+        ngx_mutex_unlock(ngx_event_timer_mutex);
+
+#if (NGX_DEBUG)
+        ev->timer.left = NULL;
+        ev->timer.right = NULL;
+        ev->timer.parent = NULL;
+#endif
+
+        ev->timer_set = 0;
+
+        ev->timedout = 1;
+
+        ev->handler(ev);
+    }
+}
+
+
+static ngx_rbtree_node_t *
+ngx_event_timer_find_cancelable(ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel)
+{
+    ngx_event_t        *ev;
+    ngx_rbtree_node_t  *found;
+
+    if (node == sentinel) {
+        return NULL;
+    }
+
+    ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+    if (ev->cancelable) {
+        return node;
+    }
+
+    found = ngx_event_timer_find_cancelable(node->left, sentinel);
+
+    if (found) {
+        return found;
+    }
+
+    return ngx_event_timer_find_cancelable(node->right, sentinel);
+}
+
+
+ngx_uint_t
+ngx_event_timer_empty(void)
+{
+    if (ngx_event_timer_use_wheel) {
+        return ngx_event_timer_wheel.count == 0;
+    }
+
+    return ngx_event_timer_rbtree.root == &ngx_event_timer_sentinel;
+}
+
+
+void
+ngx_event_timer_wheel_insert(ngx_rbtree_node_t *node)
+{
+    ngx_uint_t                n, shift;
+    ngx_msec_t                key;
+    ngx_msec_int_t            diff;
+    ngx_rbtree_node_t        *head;
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel;
+
+    key = node->key;
+    diff = (ngx_msec_int_t) (key - w->base);
+
+    if (diff < NGX_TIMER_WHEEL_ROOT_SIZE) {
+
+        /* the already expired timer is run on the next expiration */
+
+        if (diff < 0) {
+            key = w->base;
+        }
+
+        head = &w->root[key & NGX_TIMER_WHEEL_ROOT_MASK];
+        node->data = 0;
+
+        w->root_count++;
+
+    } else {
+        shift = NGX_TIMER_WHEEL_ROOT_BITS;
+
+        for (n = 0; n < NGX_TIMER_WHEEL_LEVELS - 1; n++) {
+            if ((ngx_msec_t) diff < (ngx_msec_t) 1 << (shift
+                                                     + NGX_TIMER_WHEEL_BITS))
+            {
+                break;
+            }
+
+            shift += NGX_TIMER_WHEEL_BITS;
+        }
+
+        head = &w->level[n][(key >> shift) & NGX_TIMER_WHEEL_MASK];
+        node->data = (u_char) (n + 1);
+    }
+
+    node->left = head->left;
+    node->right = head;
+    head->left->right = node;
+    head->left = node;
+
+    w->count++;
+}
+
+
+void
+ngx_event_timer_wheel_delete(ngx_rbtree_node_t *node)
+{
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel;
+
+    node->left->right = node->right;
+    node->right->left = node->left;
+
+    if (node->data == 0) {
+        w->root_count--;
+    }
+
+    w->count--;
+}
+
+
+static ngx_rbtree_node_t *
+ngx_event_timer_wheel_find_cancelable(void)
+{
+    ngx_uint_t                n, i;
+    ngx_event_t              *ev;
+    ngx_rbtree_node_t        *head, *node;
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel;
+
+    for (n = 0; n <= NGX_TIMER_WHEEL_LEVELS; n++) {
+
+        for (i = 0; i < (n ? NGX_TIMER_WHEEL_SIZE : NGX_TIMER_WHEEL_ROOT_SIZE);
+             i++)
+        {
+            head = n ? &w->level[n - 1][i] : &w->root[i];
+
+            for (node = head->right; node != head; node = node->right) {
+
+                ev = (ngx_event_t *)
+                         ((char *) node - offsetof(ngx_event_t, timer));
+
+                if (ev->cancelable) {
+                    return node;
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+static ngx_msec_t
+ngx_event_timer_wheel_find(void)
+{
+    ngx_uint_t                n, i, shift;
+    ngx_msec_t                t, expire, span;
+    ngx_msec_int_t            timer;
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel;
+
+    if (w->count == 0) {
+        return NGX_TIMER_INFINITE;
+    }
+
+    ngx_mutex_lock(ngx_event_timer_mutex);
+
+    expire = w->base;
+    span = NGX_TIMER_INFINITE;
+
+    if (w->root_count) {
+
+        /* all timers of a root slot expire at the same millisecond */
+
+        for (i = 0; /* void */ ; i++) {
+            if (!ngx_event_timer_wheel_empty(
+                        &w->root[(w->base + i) & NGX_TIMER_WHEEL_ROOT_MASK]))
+            {
+                expire = w->base + i;
+                span = i;
+                break;
+            }
+        }
+    }
+
+    /*
+     * the timers of a level slot may expire earlier than the root ones,
+     * but not before the slot is cascaded, so wake up at least to cascade
+     * the nearest non-empty slot
+     */
+
+    shift = NGX_TIMER_WHEEL_ROOT_BITS;
+
+    for (n = 0; n < NGX_TIMER_WHEEL_LEVELS; n++) {
+
+        t = (w->base + ((ngx_msec_t) 1 << shift) - 1)
+            & ~(((ngx_msec_t) 1 << shift) - 1);
+
+        for (i = 0; i < NGX_TIMER_WHEEL_SIZE; i++) {
+
+            if (t - w->base >= span) {
+                break;
+            }
+
+            if (!ngx_event_timer_wheel_empty(
+                        &w->level[n][(t >> shift) & NGX_TIMER_WHEEL_MASK]))
+            {
+                expire = t;
+                span = t - w->base;
+                break;
+            }
+
+            t += (ngx_msec_t) 1 << shift;
+        }
+
+        shift += NGX_TIMER_WHEEL_BITS;
+    }
+
+    ngx_mutex_unlock(ngx_event_timer_mutex);
+
+    timer = (ngx_msec_int_t) (expire - ngx_current_msec);
+
+    return (ngx_msec_t) (timer > 0 ? timer : 0);
+}
+
+
+static void
+ngx_event_timer_wheel_expire(void)
+{
+    ngx_uint_t                n, index, shift;
+    ngx_msec_t                next;
+    ngx_event_t              *ev;
+    ngx_rbtree_node_t        *head, *node;
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel;
+
+    ngx_mutex_lock(ngx_event_timer_mutex);
+
+    while ((ngx_msec_int_t) (ngx_current_msec - w->base) >= 0) {
+
+        if (w->count == 0) {
+            w->base = ngx_current_msec + 1;
+            break;
+        }
+
+        index = w->base & NGX_TIMER_WHEEL_ROOT_MASK;
+
+        if (index == 0) {
+            shift = NGX_TIMER_WHEEL_ROOT_BITS;
+
+            for (n = 0; n < NGX_TIMER_WHEEL_LEVELS; n++) {
+                index = (w->base >> shift) & NGX_TIMER_WHEEL_MASK;
+
+                ngx_event_timer_wheel_cascade(n, index);
+
+                if (index) {
+                    break;
+                }
+
+                shift += NGX_TIMER_WHEEL_BITS;
+            }
+
+            index = 0;
+        }
+
+        head = &w->root[index];
+
+        /* the handlers may add the expired timers to the current slot */
+
+        while (!ngx_event_timer_wheel_empty(head)) {
+
+            node = head->right;
+
+            ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+#if (NGX_THREADS)
+
+            if (ngx_threaded && ngx_trylock(ev->lock) == 0) {
+
+                /*
+                 * the event is being handled by another thread,
+                 * so leave the current millisecond to the next pass
+                 */
+
+                ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                               "event %p is busy in expire timers", ev);
+
+                ngx_mutex_unlock(ngx_event_timer_mutex);
+                return;
+            }
+#endif
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                           "event timer del: %d: %M",
+                           ngx_event_ident(ev->data), ev->timer.key);
+
+            ngx_event_timer_wheel_delete(node);
+
+            ngx_mutex_unlock(ngx_event_timer_mutex);
+
+#if (NGX_DEBUG)
+            ev->timer.left = NULL;
+            ev->timer.right = NULL;
+            ev->timer.parent = NULL;
+#endif
+
+            ev->timer_set = 0;
+
+#if (NGX_THREADS)
+            if (ngx_threaded) {
+                ev->posted_timedout = 1;
+
+                ngx_post_event(ev, &ngx_posted_events);
+
+                ngx_unlock(ev->lock);
+
+                ngx_mutex_lock(ngx_event_timer_mutex);
+
+                continue;
+            }
+#endif
+
+            ev->timedout = 1;
+
+            ev->handler(ev);
+
+            ngx_mutex_lock(ngx_event_timer_mutex);
+        }
+
+        w->base++;
+
+        if (w->root_count == 0) {
+
+            /* skip the empty root wheel up to the next cascade */
+
+            next = (w->base + NGX_TIMER_WHEEL_ROOT_MASK)
+                   & ~((ngx_msec_t) NGX_TIMER_WHEEL_ROOT_MASK);
+
+            if ((ngx_msec_int_t) (next - ngx_current_msec) > 0) {
+                next = ngx_current_msec + 1;
+            }
+
+            w->base = next;
+        }
+    }
+
+    ngx_mutex_unlock(ngx_event_timer_mutex);
+}
+
+
+static void
+ngx_event_timer_wheel_cascade(ngx_uint_t n, ngx_uint_t index)
+{
+    ngx_rbtree_node_t        *head, *node, *next;
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel;
+
+    head = &w->level[n][index];
+
+    node = head->right;
+
+    head->left = head;
+    head->right = head;
+
+    while (node != head) {
+        next = node->right;
+
+        w->count--;
+        ngx_event_timer_wheel_insert(node);
+
+        node = next;
+    }
+}
@@ -19,25 +19,60 @@ typedef struct {
 
     ngx_bufs_t           bufs;
 
-    ngx_uint_t           http_version;
-    ngx_uint_t           proxied;
-
     ngx_int_t            level;
     size_t               wbits;
     size_t               memlevel;
     ssize_t              min_length;
+
+    ngx_shm_zone_t      *cache_zone;
+    ngx_array_t         *cache_key_lengths;
+    ngx_array_t         *cache_key_values;
+    time_t               cache_valid;
 } ngx_http_gzip_conf_t;
 
 
-#define NGX_HTTP_GZIP_PROXIED_OFF       0x0002
-#define NGX_HTTP_GZIP_PROXIED_EXPIRED   0x0004
-#define NGX_HTTP_GZIP_PROXIED_NO_CACHE  0x0008
-#define NGX_HTTP_GZIP_PROXIED_NO_STORE  0x0010
-#define NGX_HTTP_GZIP_PROXIED_PRIVATE   0x0020
-#define NGX_HTTP_GZIP_PROXIED_NO_LM     0x0040
-#define NGX_HTTP_GZIP_PROXIED_NO_ETAG   0x0080
-#define NGX_HTTP_GZIP_PROXIED_AUTH      0x0100
-#define NGX_HTTP_GZIP_PROXIED_ANY       0x0200
+#define NGX_HTTP_GZIP_CACHE_MISS        1
+#define NGX_HTTP_GZIP_CACHE_HIT         2
+#define NGX_HTTP_GZIP_CACHE_EXPIRED     3
+
+
+typedef struct {
+    ngx_rbtree_node_t    node;
+    ngx_queue_t          queue;
+    time_t               expire;
+    size_t               zin;
+
+    /* the gzipped response length including the gzip header and trailer */
+    size_t               len;
+
+    u_short              key_len;
+    u_char               data[1];    /* the key and the gzipped response */
+} ngx_http_gzip_cache_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t         rbtree;
+    ngx_rbtree_node_t    sentinel;
+
+    /* the least recently used responses are at the tail */
+    ngx_queue_t          queue;
+
+    ngx_uint_t           hits;
+    ngx_uint_t           misses;
+    ngx_uint_t           stores;
+    ngx_uint_t           evictions;
+
+    /* the memory taken by the responses in the slab allocator terms */
+    size_t               size;
+    size_t               max_size;
+} ngx_http_gzip_cache_sh_t;
+
+
+typedef struct {
+    ngx_http_gzip_cache_sh_t  *sh;
+    ngx_slab_pool_t           *shpool;
+    size_t                     max_entry;
+} ngx_http_gzip_cache_t;
 
 
 typedef struct {
@@ -60,25 +95,54 @@ typedef struct {
     unsigned             redo:1;
     unsigned             done:1;
 
+    unsigned             cache_store:1;
+    unsigned             cache_status:2;
+
     size_t               zin;
     size_t               zout;
 
+    ngx_str_t            cache_key;
+    ngx_buf_t           *cache_buf;
+    ngx_chain_t         *cache_out;
+    ngx_chain_t        **cache_last;
+    size_t               cache_size;
+
     uint32_t             crc32;
     z_stream             zstream;
     ngx_http_request_t  *request;
 } ngx_http_gzip_ctx_t;
 
 
-static ngx_int_t ngx_http_gzip_proxied(ngx_http_request_t *r,
-    ngx_http_gzip_conf_t *conf);
 static void *ngx_http_gzip_filter_alloc(void *opaque, u_int items,
     u_int size);
 static void ngx_http_gzip_filter_free(void *opaque, void *address);
 static void ngx_http_gzip_error(ngx_http_gzip_ctx_t *ctx);
 
+static ngx_int_t ngx_http_gzip_cache_validator(ngx_http_request_t *r,
+    ngx_str_t *validator);
+static ngx_int_t ngx_http_gzip_cache_lookup(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx, ngx_http_gzip_conf_t *conf);
+static ngx_int_t ngx_http_gzip_cache_send(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx, ngx_chain_t *in);
+static ngx_int_t ngx_http_gzip_cache_copy(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx, ngx_http_gzip_conf_t *conf);
+static void ngx_http_gzip_cache_store(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx, ngx_http_gzip_conf_t *conf);
+static ngx_http_gzip_cache_node_t *ngx_http_gzip_cache_find(
+    ngx_http_gzip_cache_t *cache, uint32_t hash, ngx_str_t *key);
+static void ngx_http_gzip_cache_delete(ngx_http_gzip_cache_t *cache,
+    ngx_http_gzip_cache_node_t *gcn);
+static size_t ngx_http_gzip_cache_node_size(size_t size);
+static void ngx_http_gzip_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static ngx_int_t ngx_http_gzip_cache_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+
 static ngx_int_t ngx_http_gzip_add_variables(ngx_conf_t *cf);
 static ngx_int_t ngx_http_gzip_ratio_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_gzip_cache_status_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
 
 static ngx_int_t ngx_http_gzip_filter_init(ngx_conf_t *cf);
 static void *ngx_http_gzip_create_conf(ngx_conf_t *cf);
@@ -88,6 +152,14 @@ static char *ngx_http_gzip_types(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_gzip_window(ngx_conf_t *cf, void *post, void *data);
 static char *ngx_http_gzip_hash(ngx_conf_t *cf, void *post, void *data);
+static char *ngx_http_gzip_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_gzip_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_gzip_cache_key(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_gzip_cache_compile_key(ngx_conf_t *cf,
+    ngx_http_gzip_conf_t *conf, ngx_str_t *key);
 
 
 static ngx_conf_num_bounds_t  ngx_http_gzip_comp_level_bounds = {
@@ -98,27 +170,6 @@ static ngx_conf_post_handler_pt  ngx_http_gzip_window_p = ngx_http_gzip_window;
 static ngx_conf_post_handler_pt  ngx_http_gzip_hash_p = ngx_http_gzip_hash;
 
 
-static ngx_conf_enum_t  ngx_http_gzip_http_version[] = {
-    { ngx_string("1.0"), NGX_HTTP_VERSION_10 },
-    { ngx_string("1.1"), NGX_HTTP_VERSION_11 },
-    { ngx_null_string, 0 }
-};
-
-
-static ngx_conf_bitmask_t  ngx_http_gzip_proxied_mask[] = {
-    { ngx_string("off"), NGX_HTTP_GZIP_PROXIED_OFF },
-    { ngx_string("expired"), NGX_HTTP_GZIP_PROXIED_EXPIRED },
-    { ngx_string("no-cache"), NGX_HTTP_GZIP_PROXIED_NO_CACHE },
-    { ngx_string("no-store"), NGX_HTTP_GZIP_PROXIED_NO_STORE },
-    { ngx_string("private"), NGX_HTTP_GZIP_PROXIED_PRIVATE },
-    { ngx_string("no_last_modified"), NGX_HTTP_GZIP_PROXIED_NO_LM },
-    { ngx_string("no_etag"), NGX_HTTP_GZIP_PROXIED_NO_ETAG },
-    { ngx_string("auth"), NGX_HTTP_GZIP_PROXIED_AUTH },
-    { ngx_string("any"), NGX_HTTP_GZIP_PROXIED_ANY },
-    { ngx_null_string, 0 }
-};
-
-
 static ngx_command_t  ngx_http_gzip_filter_commands[] = {
 
     { ngx_string("gzip"),
@@ -171,25 +222,39 @@ static ngx_command_t  ngx_http_gzip_filter_commands[] = {
       offsetof(ngx_http_gzip_conf_t, no_buffer),
       NULL },
 
-    { ngx_string("gzip_http_version"),
+    { ngx_string("gzip_min_length"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gzip_conf_t, min_length),
+      NULL },
+
+    { ngx_string("gzip_cache_zone"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE12,
+      ngx_http_gzip_cache_zone,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("gzip_cache"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
-      ngx_conf_set_enum_slot,
+      ngx_http_gzip_cache,
       NGX_HTTP_LOC_CONF_OFFSET,
-      offsetof(ngx_http_gzip_conf_t, http_version),
-      &ngx_http_gzip_http_version },
+      0,
+      NULL },
 
-    { ngx_string("gzip_proxied"),
-      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
-      ngx_conf_set_bitmask_slot,
+    { ngx_string("gzip_cache_key"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_gzip_cache_key,
       NGX_HTTP_LOC_CONF_OFFSET,
-      offsetof(ngx_http_gzip_conf_t, proxied),
-      &ngx_http_gzip_proxied_mask },
+      0,
+      NULL },
 
-    { ngx_string("gzip_min_length"),
+    { ngx_string("gzip_cache_valid"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
-      ngx_conf_set_size_slot,
+      ngx_conf_set_sec_slot,
       NGX_HTTP_LOC_CONF_OFFSET,
-      offsetof(ngx_http_gzip_conf_t, min_length),
+      offsetof(ngx_http_gzip_conf_t, cache_valid),
       NULL },
 
       ngx_null_command
@@ -247,9 +312,16 @@ struct gztrailer {
 
 
 static ngx_str_t  ngx_http_gzip_ratio = ngx_string("gzip_ratio");
-static ngx_str_t  ngx_http_gzip_no_cache = ngx_string("no-cache");
-static ngx_str_t  ngx_http_gzip_no_store = ngx_string("no-store");
-static ngx_str_t  ngx_http_gzip_private = ngx_string("private");
+static ngx_str_t  ngx_http_gzip_cache_status = ngx_string("gzip_cache_status");
+static ngx_str_t  ngx_http_gzip_cache_default_key =
+    ngx_string("$host$request_uri");
+
+static ngx_str_t  ngx_http_gzip_cache_statuses[] = {
+    ngx_null_string,
+    ngx_string("MISS"),
+    ngx_string("HIT"),
+    ngx_string("EXPIRED")
+};
 
 
 static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
@@ -271,16 +343,11 @@ ngx_http_gzip_header_filter(ngx_http_request_t *r)
             && r->headers_out.status != NGX_HTTP_FORBIDDEN
             && r->headers_out.status != NGX_HTTP_NOT_FOUND)
         || r->header_only
-        || r != r->main
-        || r->http_version < conf->http_version
         || r->headers_out.content_type.len == 0
         || (r->headers_out.content_encoding
             && r->headers_out.content_encoding->value.len)
-        || r->headers_in.accept_encoding == NULL
         || (r->headers_out.content_length_n != -1
-            && r->headers_out.content_length_n < conf->min_length)
-        || ngx_strstr(r->headers_in.accept_encoding->value.data, "gzip") == NULL
-       )
+            && r->headers_out.content_length_n < conf->min_length))
     {
         return ngx_http_next_header_filter(r);
     }
@@ -301,26 +368,9 @@ ngx_http_gzip_header_filter(ngx_http_request_t *r)
 
 found:
 
-    if (r->headers_in.via) {
-        if (conf->proxied & NGX_HTTP_GZIP_PROXIED_OFF) {
-            return ngx_http_next_header_filter(r);
-        }
-
-        if (!(conf->proxied & NGX_HTTP_GZIP_PROXIED_ANY)
-            && ngx_http_gzip_proxied(r, conf) == NGX_DECLINED)
-        {
-            return ngx_http_next_header_filter(r);
-        }
-    }
-
-
-    /*
-     * if the URL (without the "http://" prefix) is longer than 253 bytes
-     * then MSIE 4.x can not handle the compressed stream - it waits too long,
-     * hangs up or crashes
-     */
+    r->gzip_vary = 1;
 
-    if (r->headers_in.msie4 && r->unparsed_uri.len > 200) {
+    if (ngx_http_gzip_ok(r) != NGX_OK) {
         return ngx_http_next_header_filter(r);
     }
 
@@ -347,95 +397,24 @@ found:
 
     ctx->length = r->headers_out.content_length_n;
 
-    r->main_filter_need_in_memory = 1;
-
     ngx_http_clear_content_length(r);
     ngx_http_clear_accept_ranges(r);
 
-    return ngx_http_next_header_filter(r);
-}
-
-
-static ngx_int_t
-ngx_http_gzip_proxied(ngx_http_request_t *r, ngx_http_gzip_conf_t *conf)
-{
-    time_t  date, expires;
-
-    if (r->headers_in.authorization
-        && (conf->proxied & NGX_HTTP_GZIP_PROXIED_AUTH))
-    {
-        return NGX_OK;
-    }
-
-    if (r->headers_out.expires) {
-
-        if (!(conf->proxied & NGX_HTTP_GZIP_PROXIED_EXPIRED)) {
-            return NGX_DECLINED;
-        }
-
-        expires = ngx_http_parse_time(r->headers_out.expires->value.data,
-                                      r->headers_out.expires->value.len);
-        if (expires == NGX_ERROR) {
-            return NGX_DECLINED;
-        }
-
-        if (r->headers_out.date) {
-            date = ngx_http_parse_time(r->headers_out.date->value.data,
-                                       r->headers_out.date->value.len);
-            if (date == NGX_ERROR) {
-                return NGX_DECLINED;
-            }
-
-        } else {
-            date = ngx_time();
-        }
-
-        if (expires < date) {
-            return NGX_OK;
-        }
-
-        return NGX_DECLINED;
-    }
-
-    if (r->headers_out.cache_control.elts) {
-
-        if ((conf->proxied & NGX_HTTP_GZIP_PROXIED_NO_CACHE)
-            && ngx_http_parse_multi_header_lines(&r->headers_out.cache_control,
-                   &ngx_http_gzip_no_cache, NULL) >= 0)
-        {
-            return NGX_OK;
-        }
+    if (conf->cache_zone && r->headers_out.status == NGX_HTTP_OK) {
 
-        if ((conf->proxied & NGX_HTTP_GZIP_PROXIED_NO_STORE)
-            && ngx_http_parse_multi_header_lines(&r->headers_out.cache_control,
-                   &ngx_http_gzip_no_store, NULL) >= 0)
-        {
-            return NGX_OK;
+        if (ngx_http_gzip_cache_lookup(r, ctx, conf) == NGX_ERROR) {
+            return NGX_ERROR;
         }
 
-        if ((conf->proxied & NGX_HTTP_GZIP_PROXIED_PRIVATE)
-            && ngx_http_parse_multi_header_lines(&r->headers_out.cache_control,
-                   &ngx_http_gzip_private, NULL) >= 0)
-        {
-            return NGX_OK;
+        if (ctx->cache_status == NGX_HTTP_GZIP_CACHE_HIT) {
+            r->headers_out.content_length_n = ctx->zout;
+            return ngx_http_next_header_filter(r);
         }
-
-        return NGX_DECLINED;
-    }
-
-    if ((conf->proxied & NGX_HTTP_GZIP_PROXIED_NO_LM)
-        && r->headers_out.last_modified)
-    {
-        return NGX_DECLINED;
     }
 
-    if ((conf->proxied & NGX_HTTP_GZIP_PROXIED_NO_ETAG)
-        && r->headers_out.etag)
-    {
-        return NGX_DECLINED;
-    }
+    r->main_filter_need_in_memory = 1;
 
-    return NGX_OK;
+    return ngx_http_next_header_filter(r);
 }
 
 
@@ -456,6 +435,10 @@ ngx_http_gzip_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
         return ngx_http_next_body_filter(r, in);
     }
 
+    if (ctx->cache_status == NGX_HTTP_GZIP_CACHE_HIT) {
+        return ngx_http_gzip_cache_send(r, ctx, in);
+    }
+
     conf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_filter_module);
 
     if (ctx->preallocated == NULL) {
@@ -819,6 +802,17 @@ ngx_http_gzip_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
             return NGX_OK;
         }
 
+        if (ctx->cache_store) {
+            if (ngx_http_gzip_cache_copy(r, ctx, conf) != NGX_OK) {
+                ngx_http_gzip_error(ctx);
+                return NGX_ERROR;
+            }
+
+            if (ctx->done) {
+                ngx_http_gzip_cache_store(r, ctx, conf);
+            }
+        }
+
         last = ngx_http_next_body_filter(r, ctx->out);
 
         /*
@@ -914,153 +908,788 @@ ngx_http_gzip_error(ngx_http_gzip_ctx_t *ctx)
 }
 
 
+/*
+ * only the responses that may be shared and that have a validator
+ * are cached, the ETag is preferred to the Last-Modified time;
+ * the proxied ETag and Last-Modified are found in the headers list
+ */
+
 static ngx_int_t
-ngx_http_gzip_add_variables(ngx_conf_t *cf)
+ngx_http_gzip_cache_validator(ngx_http_request_t *r, ngx_str_t *validator)
 {
-    ngx_http_variable_t  *var;
+    u_char            *p, *last;
+    ngx_uint_t         i;
+    ngx_list_part_t   *part;
+    ngx_table_elt_t   *header, **h, *etag, *last_modified;
 
-    var = ngx_http_add_variable(cf, &ngx_http_gzip_ratio, NGX_HTTP_VAR_NOHASH);
-    if (var == NULL) {
-        return NGX_ERROR;
+    h = r->headers_out.cache_control.elts;
+
+    for (i = 0; i < r->headers_out.cache_control.nelts; i++) {
+        p = h[i]->value.data;
+        last = p + h[i]->value.len;
+
+        if (ngx_strlcasestrn(p, last, (u_char *) "no-cache", 8 - 1) != NULL
+            || ngx_strlcasestrn(p, last, (u_char *) "no-store", 8 - 1) != NULL
+            || ngx_strlcasestrn(p, last, (u_char *) "private", 7 - 1) != NULL)
+        {
+            return NGX_DECLINED;
+        }
     }
 
-    var->get_handler = ngx_http_gzip_ratio_variable;
+    etag = r->headers_out.etag;
+    last_modified = NULL;
 
-    return NGX_OK;
-}
+    part = &r->headers_out.headers.part;
+    header = part->elts;
 
+    for (i = 0; /* void */; i++) {
 
-static ngx_int_t
-ngx_http_gzip_ratio_variable(ngx_http_request_t *r,
-    ngx_http_variable_value_t *v, uintptr_t data)
-{
-    ngx_uint_t            zint, zfrac;
-    ngx_http_gzip_ctx_t  *ctx;
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
 
-    v->valid = 1;
-    v->no_cachable = 0;
-    v->not_found = 0;
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
 
-    ctx = ngx_http_get_module_ctx(r, ngx_http_gzip_filter_module);
+        if (header[i].hash == 0) {
+            continue;
+        }
 
-    if (ctx == NULL || ctx->zout == 0) {
-        v->not_found = 1;
-        return NGX_OK;
-    }
+        if (header[i].key.len == sizeof("Set-Cookie") - 1
+            && ngx_strncasecmp(header[i].key.data, (u_char *) "Set-Cookie",
+                               sizeof("Set-Cookie") - 1)
+               == 0)
+        {
+            return NGX_DECLINED;
+        }
 
-    v->data = ngx_palloc(r->pool, NGX_INT32_LEN + 3);
-    if (v->data == NULL) {
-        return NGX_ERROR;
+        if (etag == NULL
+            && header[i].key.len == sizeof("ETag") - 1
+            && ngx_strncasecmp(header[i].key.data, (u_char *) "ETag",
+                               sizeof("ETag") - 1)
+               == 0)
+        {
+            etag = &header[i];
+        }
+
+        if (header[i].key.len == sizeof("Last-Modified") - 1
+            && ngx_strncasecmp(header[i].key.data, (u_char *) "Last-Modified",
+                               sizeof("Last-Modified") - 1)
+               == 0)
+        {
+            last_modified = &header[i];
+        }
     }
 
-    zint = (ngx_uint_t) (ctx->zin / ctx->zout);
-    zfrac = (ngx_uint_t) ((ctx->zin * 100 / ctx->zout) % 100);
+    if (etag && etag->value.len) {
+        *validator = etag->value;
+        return NGX_OK;
+    }
 
-    if ((ctx->zin * 1000 / ctx->zout) % 10 > 4) {
+    if (r->headers_out.last_modified_time == -1) {
 
-        /* the rounding, e.g., 2.125 to 2.13 */
+        if (last_modified && last_modified->value.len) {
+            *validator = last_modified->value;
+            return NGX_OK;
+        }
 
-        zfrac++;
+        return NGX_DECLINED;
+    }
 
-        if (zfrac > 99) {
-            zint++;
-            zfrac = 0;
-        }
+    validator->data = ngx_palloc(r->pool, NGX_TIME_T_LEN);
+    if (validator->data == NULL) {
+        return NGX_ERROR;
     }
 
-    v->len = ngx_sprintf(v->data, "%ui.%02ui", zint, zfrac) - v->data;
+    validator->len = ngx_sprintf(validator->data, "%T",
+                                 r->headers_out.last_modified_time)
+                     - validator->data;
 
     return NGX_OK;
 }
 
 
-static void *
-ngx_http_gzip_create_conf(ngx_conf_t *cf)
+static ngx_int_t
+ngx_http_gzip_cache_lookup(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx,
+    ngx_http_gzip_conf_t *conf)
 {
-    ngx_http_gzip_conf_t  *conf;
+    u_char                      *p;
+    uint32_t                     hash;
+    ngx_int_t                    rc;
+    ngx_str_t                    key, validator;
+    ngx_buf_t                   *b;
+    ngx_http_gzip_cache_t       *cache;
+    ngx_http_gzip_cache_node_t  *gcn;
+
+    rc = ngx_http_gzip_cache_validator(r, &validator);
+
+    if (rc != NGX_OK) {
+        return (rc == NGX_ERROR) ? NGX_ERROR : NGX_OK;
+    }
 
-    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_gzip_conf_t));
-    if (conf == NULL) {
-        return NGX_CONF_ERROR;
+    p = ngx_http_script_run(r, &key, conf->cache_key_lengths->elts,
+                            sizeof(" ") - 1 + validator.len,
+                            conf->cache_key_values->elts);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (p == key.data) {
+        return NGX_OK;
     }
 
     /*
-     * set by ngx_pcalloc():
-     *
-     *     conf->bufs.num = 0;
-     *     conf->proxied = 0;
-     *     conf->types = NULL;
+     * the validator is a part of the key, so the different responses
+     * for the same key never share the gzipped copy
      */
 
-    conf->enable = NGX_CONF_UNSET;
-    conf->no_buffer = NGX_CONF_UNSET;
-
-    conf->http_version = NGX_CONF_UNSET_UINT;
+    *p++ = ' ';
+    p = ngx_cpymem(p, validator.data, validator.len);
 
-    conf->level = NGX_CONF_UNSET;
-    conf->wbits = (size_t) NGX_CONF_UNSET;
-    conf->memlevel = (size_t) NGX_CONF_UNSET;
-    conf->min_length = NGX_CONF_UNSET;
+    key.len = p - key.data;
 
-    return conf;
-}
+    if (key.len > 65535) {
+        return NGX_OK;
+    }
 
+    ctx->cache_key = key;
 
-static char *
-ngx_http_gzip_merge_conf(ngx_conf_t *cf, void *parent, void *child)
-{
-    ngx_http_gzip_conf_t *prev = parent;
-    ngx_http_gzip_conf_t *conf = child;
+    cache = conf->cache_zone->data;
 
-    ngx_str_t  *type;
+    hash = ngx_crc32_short(ctx->cache_key.data, ctx->cache_key.len);
 
-    ngx_conf_merge_value(conf->enable, prev->enable, 0);
+    ngx_shmtx_lock(&cache->shpool->mutex);
 
-    ngx_conf_merge_bufs_value(conf->bufs, prev->bufs, 4, ngx_pagesize);
+    gcn = ngx_http_gzip_cache_find(cache, hash, &ctx->cache_key);
 
-    ngx_conf_merge_uint_value(conf->http_version, prev->http_version,
-                              NGX_HTTP_VERSION_11);
-    ngx_conf_merge_bitmask_value(conf->proxied, prev->proxied,
-                              (NGX_CONF_BITMASK_SET|NGX_HTTP_GZIP_PROXIED_OFF));
+    if (gcn && gcn->expire < ngx_time()) {
+        ngx_http_gzip_cache_delete(cache, gcn);
+        gcn = NULL;
 
-    ngx_conf_merge_value(conf->level, prev->level, 1);
-    ngx_conf_merge_size_value(conf->wbits, prev->wbits, MAX_WBITS);
-    ngx_conf_merge_size_value(conf->memlevel, prev->memlevel,
-                              MAX_MEM_LEVEL - 1);
-    ngx_conf_merge_value(conf->min_length, prev->min_length, 20);
-    ngx_conf_merge_value(conf->no_buffer, prev->no_buffer, 0);
+        ctx->cache_status = NGX_HTTP_GZIP_CACHE_EXPIRED;
 
-    if (conf->types == NULL) {
-        if (prev->types == NULL) {
-            conf->types = ngx_array_create(cf->pool, 1, sizeof(ngx_str_t));
-            if (conf->types == NULL) {
-                return NGX_CONF_ERROR;
-            }
+    } else {
+        ctx->cache_status = gcn ? NGX_HTTP_GZIP_CACHE_HIT:
+                                  NGX_HTTP_GZIP_CACHE_MISS;
+    }
 
-            type = ngx_array_push(conf->types);
-            if (type == NULL) {
-                return NGX_CONF_ERROR;
-            }
+    if (gcn) {
 
-            type->len = sizeof("text/html") - 1;
-            type->data = (u_char *) "text/html";
+        /*
+         * the response is copied because the node may be evicted
+         * while the response is being sent
+         */
 
-        } else {
-            conf->types = prev->types;
+        b = ngx_create_temp_buf(r->pool, gcn->len);
+        if (b == NULL) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+            return NGX_ERROR;
         }
-    }
 
-    return NGX_CONF_OK;
-}
+        b->last = ngx_cpymem(b->pos, gcn->data + gcn->key_len, gcn->len);
 
+        ctx->cache_buf = b;
+        ctx->zin = gcn->zin;
+        ctx->zout = gcn->len;
 
-static ngx_int_t
-ngx_http_gzip_filter_init(ngx_conf_t *cf)
-{
-    ngx_http_next_header_filter = ngx_http_top_header_filter;
-    ngx_http_top_header_filter = ngx_http_gzip_header_filter;
+        ngx_queue_remove(&gcn->queue);
+        ngx_queue_insert_head(&cache->sh->queue, &gcn->queue);
 
-    ngx_http_next_body_filter = ngx_http_top_body_filter;
+        cache->sh->hits++;
+
+    } else {
+        cache->sh->misses++;
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "gzip cache: \"%V\" %V", &ctx->cache_key,
+                   &ngx_http_gzip_cache_statuses[ctx->cache_status]);
+
+    if (gcn) {
+        return NGX_OK;
+    }
+
+    /* the gzip header is sent separately, it is prepended on storing */
+
+    ctx->cache_store = 1;
+    ctx->cache_last = &ctx->cache_out;
+    ctx->cache_size = 10;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_gzip_cache_send(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx,
+    ngx_chain_t *in)
+{
+    ngx_buf_t    *b;
+    ngx_uint_t    last;
+    ngx_chain_t  *cl, out;
+
+    /* the original response is not needed, it is skipped */
+
+    last = 0;
+
+    for (cl = in; cl; cl = cl->next) {
+        b = cl->buf;
+
+        b->pos = b->last;
+        b->file_pos = b->file_last;
+
+        if (b->last_buf) {
+            last = 1;
+        }
+    }
+
+    if (ctx->cache_buf) {
+        b = ctx->cache_buf;
+        ctx->cache_buf = NULL;
+
+        if (!last) {
+            b->flush = 1;
+        }
+
+    } else if (last) {
+        b = ngx_calloc_buf(r->pool);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
+
+    } else if (in == NULL) {
+        return ngx_http_next_body_filter(r, NULL);
+
+    } else {
+        return NGX_OK;
+    }
+
+    b->last_buf = last;
+
+    out.buf = b;
+    out.next = NULL;
+
+    return ngx_http_next_body_filter(r, &out);
+}
+
+
+static ngx_int_t
+ngx_http_gzip_cache_copy(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx,
+    ngx_http_gzip_conf_t *conf)
+{
+    size_t                  size;
+    ngx_buf_t              *b;
+    ngx_chain_t            *cl, *ln;
+    ngx_http_gzip_cache_t  *cache;
+
+    cache = conf->cache_zone->data;
+
+    for (cl = ctx->out; cl; cl = cl->next) {
+
+        size = cl->buf->last - cl->buf->pos;
+
+        if (size == 0) {
+            continue;
+        }
+
+        if (ctx->cache_size + size > cache->max_entry) {
+
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "gzip cache: response is too large for \"%V\"",
+                           &ctx->cache_key);
+
+            ctx->cache_store = 0;
+            return NGX_OK;
+        }
+
+        b = ngx_create_temp_buf(r->pool, size);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
+
+        b->last = ngx_cpymem(b->pos, cl->buf->pos, size);
+
+        ln = ngx_alloc_chain_link(r->pool);
+        if (ln == NULL) {
+            return NGX_ERROR;
+        }
+
+        ln->buf = b;
+        ln->next = NULL;
+        *ctx->cache_last = ln;
+        ctx->cache_last = &ln->next;
+
+        ctx->cache_size += size;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_gzip_cache_store(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx,
+    ngx_http_gzip_conf_t *conf)
+{
+    u_char                      *p;
+    size_t                       size;
+    uint32_t                     hash;
+    ngx_queue_t                 *q;
+    ngx_chain_t                 *cl;
+    ngx_http_gzip_cache_t       *cache;
+    ngx_http_gzip_cache_node_t  *gcn;
+
+    ctx->cache_store = 0;
+
+    cache = conf->cache_zone->data;
+
+    hash = ngx_crc32_short(ctx->cache_key.data, ctx->cache_key.len);
+
+    size = offsetof(ngx_http_gzip_cache_node_t, data)
+           + ctx->cache_key.len + ctx->cache_size;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    /* the response may be stored by another request in the meantime */
+
+    gcn = ngx_http_gzip_cache_find(cache, hash, &ctx->cache_key);
+
+    if (gcn) {
+        ngx_http_gzip_cache_delete(cache, gcn);
+    }
+
+    /*
+     * the least recently used responses are dropped beforehand to keep
+     * the zone below its limit, and then while the allocation fails
+     * because of fragmentation
+     */
+
+    for ( ;; ) {
+        if (ngx_queue_empty(&cache->sh->queue)) {
+            gcn = ngx_slab_alloc_locked(cache->shpool, size);
+            break;
+        }
+
+        if (cache->sh->size + ngx_http_gzip_cache_node_size(size)
+            <= cache->sh->max_size)
+        {
+            gcn = ngx_slab_alloc_locked(cache->shpool, size);
+
+            if (gcn) {
+                break;
+            }
+        }
+
+        q = ngx_queue_last(&cache->sh->queue);
+
+        ngx_http_gzip_cache_delete(cache,
+                       ngx_queue_data(q, ngx_http_gzip_cache_node_t, queue));
+
+        cache->sh->evictions++;
+    }
+
+    if (gcn == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "could not allocate %uz bytes in gzip_cache zone \"%V\"",
+                      size, &conf->cache_zone->name);
+        return;
+    }
+
+    gcn->node.key = hash;
+    gcn->expire = ngx_time() + conf->cache_valid;
+    gcn->zin = ctx->zin;
+    gcn->len = ctx->cache_size;
+    gcn->key_len = (u_short) ctx->cache_key.len;
+
+    p = ngx_cpymem(gcn->data, ctx->cache_key.data, ctx->cache_key.len);
+    p = ngx_cpymem(p, gzheader, 10);
+
+    for (cl = ctx->cache_out; cl; cl = cl->next) {
+        p = ngx_cpymem(p, cl->buf->pos, cl->buf->last - cl->buf->pos);
+    }
+
+    ngx_rbtree_insert(&cache->sh->rbtree, &gcn->node);
+
+    ngx_queue_insert_head(&cache->sh->queue, &gcn->queue);
+
+    cache->sh->stores++;
+    cache->sh->size += ngx_http_gzip_cache_node_size(size);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+}
+
+
+static ngx_http_gzip_cache_node_t *
+ngx_http_gzip_cache_find(ngx_http_gzip_cache_t *cache, uint32_t hash,
+    ngx_str_t *key)
+{
+    ngx_int_t                    rc;
+    ngx_rbtree_node_t           *node, *sentinel;
+    ngx_http_gzip_cache_node_t  *gcn;
+
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        gcn = (ngx_http_gzip_cache_node_t *) node;
+
+        if (key->len != (size_t) gcn->key_len) {
+            rc = (key->len < (size_t) gcn->key_len) ? -1 : 1;
+
+        } else {
+            rc = ngx_memcmp(key->data, gcn->data, key->len);
+        }
+
+        if (rc == 0) {
+            return gcn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_gzip_cache_delete(ngx_http_gzip_cache_t *cache,
+    ngx_http_gzip_cache_node_t *gcn)
+{
+    ngx_queue_remove(&gcn->queue);
+
+    ngx_rbtree_delete(&cache->sh->rbtree, &gcn->node);
+
+    cache->sh->size -= ngx_http_gzip_cache_node_size(
+                                     offsetof(ngx_http_gzip_cache_node_t, data)
+                                     + gcn->key_len + gcn->len);
+
+    ngx_slab_free_locked(cache->shpool, gcn);
+}
+
+
+static size_t
+ngx_http_gzip_cache_node_size(size_t size)
+{
+    size_t  n;
+
+    if (size >= ngx_pagesize / 2) {
+        return (size + ngx_pagesize - 1) & ~(ngx_pagesize - 1);
+    }
+
+    for (n = 8; n < size; n <<= 1) { /* void */ }
+
+    return n;
+}
+
+
+static void
+ngx_http_gzip_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_int_t                    rc;
+    ngx_rbtree_node_t          **p;
+    ngx_http_gzip_cache_node_t  *gcnn, *gcnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            gcnn = (ngx_http_gzip_cache_node_t *) node;
+            gcnt = (ngx_http_gzip_cache_node_t *) temp;
+
+            if (gcnn->key_len != gcnt->key_len) {
+                rc = (gcnn->key_len < gcnt->key_len) ? -1 : 1;
+
+            } else {
+                rc = ngx_memcmp(gcnn->data, gcnt->data, gcnn->key_len);
+            }
+
+            p = (rc < 0) ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static ngx_int_t
+ngx_http_gzip_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_gzip_cache_t  *ocache = data;
+
+    ngx_http_gzip_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        cache->sh = ocache->sh;
+        cache->shpool = ocache->shpool;
+
+        return NGX_OK;
+    }
+
+    cache->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    cache->sh = ngx_slab_alloc(cache->shpool,
+                               sizeof(ngx_http_gzip_cache_sh_t));
+    if (cache->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(cache->sh, sizeof(ngx_http_gzip_cache_sh_t));
+
+    /* leave room for the partially used pages of the slab chunks */
+
+    cache->sh->max_size = (cache->shpool->end - cache->shpool->start) / 8 * 7;
+
+    ngx_rbt_black(&cache->sh->sentinel);
+
+    cache->sh->rbtree.root = &cache->sh->sentinel;
+    cache->sh->rbtree.sentinel = &cache->sh->sentinel;
+    cache->sh->rbtree.insert = ngx_http_gzip_cache_rbtree_insert_value;
+
+    ngx_queue_init(&cache->sh->queue);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_gzip_add_variables(ngx_conf_t *cf)
+{
+    ngx_http_variable_t  *var;
+
+    var = ngx_http_add_variable(cf, &ngx_http_gzip_ratio, NGX_HTTP_VAR_NOHASH);
+    if (var == NULL) {
+        return NGX_ERROR;
+    }
+
+    var->get_handler = ngx_http_gzip_ratio_variable;
+
+    var = ngx_http_add_variable(cf, &ngx_http_gzip_cache_status,
+                                NGX_HTTP_VAR_NOHASH);
+    if (var == NULL) {
+        return NGX_ERROR;
+    }
+
+    var->get_handler = ngx_http_gzip_cache_status_variable;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_gzip_ratio_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_uint_t            zint, zfrac;
+    ngx_http_gzip_ctx_t  *ctx;
+
+    v->valid = 1;
+    v->no_cachable = 0;
+    v->not_found = 0;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_gzip_filter_module);
+
+    if (ctx == NULL || ctx->zout == 0) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->data = ngx_palloc(r->pool, NGX_INT32_LEN + 3);
+    if (v->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    zint = (ngx_uint_t) (ctx->zin / ctx->zout);
+    zfrac = (ngx_uint_t) ((ctx->zin * 100 / ctx->zout) % 100);
+
+    if ((ctx->zin * 1000 / ctx->zout) % 10 > 4) {
+
+        /* the rounding, e.g., 2.125 to 2.13 */
+
+        zfrac++;
+
+        if (zfrac > 99) {
+            zint++;
+            zfrac = 0;
+        }
+    }
+
+    v->len = ngx_sprintf(v->data, "%ui.%02ui", zint, zfrac) - v->data;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_gzip_cache_status_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_http_gzip_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_gzip_filter_module);
+
+    if (ctx == NULL || ctx->cache_status == 0) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->len = ngx_http_gzip_cache_statuses[ctx->cache_status].len;
+    v->valid = 1;
+    v->no_cachable = 0;
+    v->not_found = 0;
+    v->data = ngx_http_gzip_cache_statuses[ctx->cache_status].data;
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_gzip_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_gzip_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_gzip_conf_t));
+    if (conf == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->bufs.num = 0;
+     *     conf->types = NULL;
+     *     conf->cache_key_lengths = NULL;
+     *     conf->cache_key_values = NULL;
+     */
+
+    conf->enable = NGX_CONF_UNSET;
+    conf->no_buffer = NGX_CONF_UNSET;
+
+    conf->level = NGX_CONF_UNSET;
+    conf->wbits = (size_t) NGX_CONF_UNSET;
+    conf->memlevel = (size_t) NGX_CONF_UNSET;
+    conf->min_length = NGX_CONF_UNSET;
+
+    conf->cache_zone = NGX_CONF_UNSET_PTR;
+    conf->cache_valid = NGX_CONF_UNSET;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_gzip_merge_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_gzip_conf_t *prev = parent;
+    ngx_http_gzip_conf_t *conf = child;
+
+    ngx_str_t  *type;
+
+    ngx_conf_merge_value(conf->enable, prev->enable, 0);
+
+    ngx_conf_merge_bufs_value(conf->bufs, prev->bufs, 4, ngx_pagesize);
+
+    ngx_conf_merge_value(conf->level, prev->level, 1);
+    ngx_conf_merge_size_value(conf->wbits, prev->wbits, MAX_WBITS);
+    ngx_conf_merge_size_value(conf->memlevel, prev->memlevel,
+                              MAX_MEM_LEVEL - 1);
+    ngx_conf_merge_value(conf->min_length, prev->min_length, 20);
+    ngx_conf_merge_value(conf->no_buffer, prev->no_buffer, 0);
+
+    if (conf->types == NULL) {
+        if (prev->types == NULL) {
+            conf->types = ngx_array_create(cf->pool, 1, sizeof(ngx_str_t));
+            if (conf->types == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            type = ngx_array_push(conf->types);
+            if (type == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            type->len = sizeof("text/html") - 1;
+            type->data = (u_char *) "text/html";
+
+        } else {
+            conf->types = prev->types;
+        }
+    }
+
+    if (conf->cache_zone == NGX_CONF_UNSET_PTR) {
+        conf->cache_zone = (prev->cache_zone == NGX_CONF_UNSET_PTR) ?
+                                                     NULL : prev->cache_zone;
+    }
+
+    if (conf->cache_key_lengths == NULL) {
+        conf->cache_key_lengths = prev->cache_key_lengths;
+        conf->cache_key_values = prev->cache_key_values;
+    }
+
+    if (conf->cache_zone && conf->cache_key_lengths == NULL) {
+        if (ngx_http_gzip_cache_compile_key(cf, conf,
+                                            &ngx_http_gzip_cache_default_key)
+            != NGX_CONF_OK)
+        {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    ngx_conf_merge_sec_value(conf->cache_valid, prev->cache_valid, 60);
+
+    if (conf->cache_zone && conf->no_buffer) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "\"gzip_cache\" is not used with \"gzip_no_buffer\"");
+        conf->cache_zone = NULL;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_gzip_filter_init(ngx_conf_t *cf)
+{
+    ngx_http_next_header_filter = ngx_http_top_header_filter;
+    ngx_http_top_header_filter = ngx_http_gzip_header_filter;
+
+    ngx_http_next_body_filter = ngx_http_top_body_filter;
     ngx_http_top_body_filter = ngx_http_gzip_body_filter;
 
     return NGX_OK;
@@ -1163,3 +1792,190 @@ ngx_http_gzip_hash(ngx_conf_t *cf, void *post, void *data)
 
     return "must be 512, 1k, 2k, 4k, 8k, 16k, 32k, 64k, or 128k";
 }
+
+
+static char *
+ngx_http_gzip_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    u_char                 *p;
+    ssize_t                 size, max_entry;
+    ngx_str_t              *value, name, s;
+    ngx_uint_t              i;
+    ngx_shm_zone_t         *shm_zone;
+    ngx_http_gzip_cache_t  *cache;
+
+    value = cf->args->elts;
+
+    size = 0;
+    max_entry = 0;
+    name.len = 0;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "zone=", 5) == 0) {
+
+            name.data = value[i].data + 5;
+
+            p = (u_char *) ngx_strchr(name.data, ':');
+
+            if (p == NULL) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            name.len = p - name.data;
+
+            s.data = p + 1;
+            s.len = value[i].data + value[i].len - s.data;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "zone \"%V\" is too small", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "max_entry=", 10) == 0) {
+
+            s.len = value[i].len - 10;
+            s.data = value[i].data + 10;
+
+            max_entry = ngx_parse_size(&s);
+
+            if (max_entry == NGX_ERROR || max_entry == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid max_entry size \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" must have \"zone\" parameter",
+                           &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    if (max_entry == 0) {
+        max_entry = size / 8;
+    }
+
+    if (max_entry > size / 2) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "max_entry of gzip_cache_zone \"%V\" "
+                           "must not exceed half of the zone size", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_gzip_filter_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (shm_zone->data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "duplicate gzip_cache_zone \"%V\"", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    cache = ngx_pcalloc(cf->pool, sizeof(ngx_http_gzip_cache_t));
+    if (cache == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    cache->max_entry = max_entry;
+
+    shm_zone->init = ngx_http_gzip_cache_init_zone;
+    shm_zone->data = cache;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_gzip_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_gzip_conf_t *gcf = conf;
+
+    ngx_str_t  *value;
+
+    if (gcf->cache_zone != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        gcf->cache_zone = NULL;
+        return NGX_CONF_OK;
+    }
+
+    gcf->cache_zone = ngx_shared_memory_add(cf, &value[1], 0,
+                                            &ngx_http_gzip_filter_module);
+    if (gcf->cache_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_gzip_cache_key(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_gzip_conf_t *gcf = conf;
+
+    ngx_str_t  *value;
+
+    if (gcf->cache_key_lengths) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    return ngx_http_gzip_cache_compile_key(cf, gcf, &value[1]);
+}
+
+
+static char *
+ngx_http_gzip_cache_compile_key(ngx_conf_t *cf, ngx_http_gzip_conf_t *conf,
+    ngx_str_t *key)
+{
+    ngx_http_script_compile_t   sc;
+
+    ngx_memzero(&sc, sizeof(ngx_http_script_compile_t));
+
+    sc.cf = cf;
+    sc.source = key;
+    sc.lengths = &conf->cache_key_lengths;
+    sc.values = &conf->cache_key_values;
+    sc.variables = ngx_http_script_variables_count(key);
+    sc.complete_lengths = 1;
+    sc.complete_values = 1;
+
+    if (ngx_http_script_compile(&sc) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
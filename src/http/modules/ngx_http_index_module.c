@@ -59,17 +59,6 @@ static ngx_command_t  ngx_http_index_commands[] = {
       0,
       NULL },
 
-#if (NGX_HTTP_CACHE)
-
-    { ngx_string("index_cache"),
-      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE3,
-      ngx_http_set_cache_slot,
-      NGX_HTTP_LOC_CONF_OFFSET,
-      offsetof(ngx_http_index_loc_conf_t, index_cache),
-      NULL },
-
-#endif
-
       ngx_null_command
 };
 
@@ -120,16 +109,14 @@ ngx_http_index_handler(ngx_http_request_t *r)
 {
     u_char                       *last;
     size_t                        len;
-    ngx_fd_t                      fd;
     ngx_int_t                     rc;
     ngx_err_t                     err;
-    ngx_str_t                     uri;
+    ngx_str_t                     path, uri;
     ngx_log_t                    *log;
     ngx_uint_t                    i;
     ngx_http_index_t             *index;
     ngx_http_index_ctx_t         *ctx;
-    ngx_pool_cleanup_t           *cln;
-    ngx_pool_cleanup_file_t      *clnf;
+    ngx_open_file_info_t          of;
     ngx_http_script_code_pt       code;
     ngx_http_script_engine_t      e;
     ngx_http_core_loc_conf_t     *clcf;
@@ -153,6 +140,7 @@ ngx_http_index_handler(ngx_http_request_t *r)
      */
 
     ilcf = ngx_http_get_module_loc_conf(r, ngx_http_index_module);
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
     ctx = ngx_http_get_module_ctx(r, ngx_http_index_module);
     if (ctx == NULL) {
@@ -236,23 +224,23 @@ ngx_http_index_handler(ngx_http_request_t *r)
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
                        "open index \"%s\"", ctx->path.data);
 
-        cln = ngx_pool_cleanup_add(r->pool, sizeof(ngx_pool_cleanup_file_t));
-        if (cln == NULL) {
-            return NGX_HTTP_INTERNAL_SERVER_ERROR;
-        }
+        path.len = ctx->index.data + ctx->index.len - 1 - ctx->path.data;
+        path.data = ctx->path.data;
 
-        fd = ngx_open_file(ctx->path.data, NGX_FILE_RDONLY, NGX_FILE_OPEN);
+        of.valid = clcf->open_file_cache_valid;
+        of.errors = clcf->open_file_cache_errors;
 
-        if (fd == (ngx_fd_t) NGX_AGAIN) {
-            ctx->current = i;
-            return NGX_AGAIN;
-        }
+        if (ngx_open_cached_file(clcf->open_file_cache, &path, &of, r->pool)
+            != NGX_OK)
+        {
+            err = of.err;
 
-        if (fd == NGX_INVALID_FILE) {
-            err = ngx_errno;
+            if (err == 0) {
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
+            }
 
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, err,
-                           ngx_open_file_n " \"%s\" failed", ctx->path.data);
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, err,
+                           "%s \"%s\" failed", of.failed, ctx->path.data);
 
             if (err == NGX_ENOTDIR) {
                 return ngx_http_index_error(r, ctx, err);
@@ -276,20 +264,11 @@ ngx_http_index_handler(ngx_http_request_t *r)
             }
 
             ngx_log_error(NGX_LOG_ERR, log, err,
-                          ngx_open_file_n " \"%s\" failed", ctx->path.data);
+                          "%s \"%s\" failed", of.failed, ctx->path.data);
 
             return NGX_HTTP_INTERNAL_SERVER_ERROR;
         }
 
-        cln->handler = ngx_pool_cleanup_file;
-        clnf = cln->data;
-
-        clnf->fd = fd;
-        clnf->name = ctx->path.data;
-        clnf->log = r->pool->log;
-
-        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
-
         uri.len = r->uri.len + ctx->index.len - 1;
 
         if (!clcf->alias) {
@@ -315,36 +294,46 @@ ngx_http_index_handler(ngx_http_request_t *r)
 static ngx_int_t
 ngx_http_index_test_dir(ngx_http_request_t *r, ngx_http_index_ctx_t *ctx)
 {
-    u_char           c;
-    ngx_uint_t       i;
-    ngx_err_t        err;
-    ngx_file_info_t  fi;
+    u_char                     c;
+    ngx_str_t                  dir;
+    ngx_uint_t                 i;
+    ngx_open_file_info_t       of;
+    ngx_http_core_loc_conf_t  *clcf;
 
     c = *(ctx->index.data - 1);
     i = (c == '/') ? 1 : 0;
     *(ctx->index.data - i) = '\0';
 
+    dir.len = ctx->index.data - i - ctx->path.data;
+    dir.data = ctx->path.data;
+
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http index check dir: \"%s\"", ctx->path.data);
+                   "http index check dir: \"%s\"", dir.data);
 
-    if (ngx_file_info(ctx->path.data, &fi) == -1) {
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
-        err = ngx_errno;
+    of.valid = clcf->open_file_cache_valid;
+    of.errors = clcf->open_file_cache_errors;
 
-        if (err == NGX_ENOENT) {
+    if (ngx_open_cached_file(clcf->open_file_cache, &dir, &of, r->pool)
+        != NGX_OK)
+    {
+        if (of.err == NGX_ENOENT) {
             *(ctx->index.data - i) = c;
-            return ngx_http_index_error(r, ctx, err);
+            return ngx_http_index_error(r, ctx, of.err);
         }
 
-        ngx_log_error(NGX_LOG_CRIT, r->connection->log, err,
-                      ngx_file_info_n " \"%s\" failed", ctx->path.data);
+        if (of.err) {
+            ngx_log_error(NGX_LOG_CRIT, r->connection->log, of.err,
+                          "%s \"%s\" failed", of.failed, dir.data);
+        }
 
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
     *(ctx->index.data - i) = c;
 
-    if (ngx_is_dir(&fi)) {
+    if (of.is_dir) {
         return NGX_OK;
     }
 
@@ -9,6 +9,10 @@
 #include <ngx_http.h>
 #include <nginx.h>
 
+#if (NGX_ZLIB)
+#include <zlib.h>
+#endif
+
 
 typedef struct ngx_http_log_op_s  ngx_http_log_op_t;
 
@@ -39,6 +43,17 @@ typedef struct {
 } ngx_http_log_main_conf_t;
 
 
+typedef struct {
+    u_char                     *start;
+    u_char                     *pos;
+    u_char                     *last;
+
+    ngx_event_t                *event;
+    ngx_msec_t                  flush;
+    ngx_int_t                   gzip;
+} ngx_http_log_buf_t;
+
+
 typedef struct {
     ngx_open_file_t            *file;
     time_t                      disk_full_time;
@@ -59,6 +74,24 @@ typedef struct {
 } ngx_http_log_var_t;
 
 
+#define NGX_HTTP_LOG_IOVS  8
+
+
+static void ngx_http_log_writev(ngx_http_log_t *log, ngx_uint_t n,
+    struct iovec *iov, ngx_uint_t niov);
+static ssize_t ngx_http_log_write(ngx_open_file_t *file, u_char *buf,
+    size_t len, ngx_log_t *log);
+static void ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log);
+static void ngx_http_log_flush_handler(ngx_event_t *ev);
+
+#if (NGX_ZLIB)
+static ssize_t ngx_http_log_gzip(ngx_fd_t fd, u_char *buf, size_t len,
+    ngx_int_t level, ngx_log_t *log);
+static void *ngx_http_log_gzip_alloc(void *opaque, u_int items, u_int size);
+static void ngx_http_log_gzip_free(void *opaque, void *address);
+#endif
+
+
 static u_char *ngx_http_log_connection(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op);
 static u_char *ngx_http_log_pipe(ngx_http_request_t *r, u_char *buf,
@@ -110,7 +143,7 @@ static ngx_command_t  ngx_http_log_commands[] = {
 
     { ngx_string("access_log"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF
-                        |NGX_CONF_TAKE123,
+                        |NGX_CONF_1MORE,
       ngx_http_log_set_log,
       NGX_HTTP_LOC_CONF_OFFSET,
       0,
@@ -166,7 +199,8 @@ static ngx_http_log_var_t  ngx_http_log_vars[] = {
     { ngx_string("time_local"), sizeof("28/Sep/1970:12:00:00 +0600") - 1,
                           ngx_http_log_time },
     { ngx_string("msec"), NGX_TIME_T_LEN + 4, ngx_http_log_msec },
-    { ngx_string("request_time"), NGX_TIME_T_LEN, ngx_http_log_request_time },
+    { ngx_string("request_time"), NGX_TIME_T_LEN + 4,
+                          ngx_http_log_request_time },
     { ngx_string("status"), 3, ngx_http_log_status },
     { ngx_string("bytes_sent"), NGX_OFF_T_LEN, ngx_http_log_bytes_sent },
     { ngx_string("body_bytes_sent"), NGX_OFF_T_LEN,
@@ -183,12 +217,14 @@ static ngx_http_log_var_t  ngx_http_log_vars[] = {
 ngx_int_t
 ngx_http_log_handler(ngx_http_request_t *r)
 {
-    ngx_uint_t                i, l;
     u_char                   *line, *p;
     size_t                    len;
+    ngx_uint_t                i, l, first, niov;
+    struct iovec              iov[NGX_HTTP_LOG_IOVS];
     ngx_http_log_t           *log;
-    ngx_open_file_t          *file;
+    ngx_open_file_t          *file, *batch;
     ngx_http_log_op_t        *op;
+    ngx_http_log_buf_t       *buffer;
     ngx_http_log_loc_conf_t  *lcf;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
@@ -200,6 +236,15 @@ ngx_http_log_handler(ngx_http_request_t *r)
         return NGX_OK;
     }
 
+    /*
+     * the unbuffered lines of the consecutive logs that share a file
+     * are written by a single writev()
+     */
+
+    batch = NULL;
+    first = 0;
+    niov = 0;
+
     log = lcf->logs->elts;
     for (l = 0; l < lcf->logs->nelts; l++) {
 
@@ -228,25 +273,36 @@ ngx_http_log_handler(ngx_http_request_t *r)
         len += NGX_LINEFEED_SIZE;
 
         file = log[l].file;
+        buffer = file->data;
+
+        if (niov && (file != batch || niov == NGX_HTTP_LOG_IOVS)) {
+            ngx_http_log_writev(&log[first], l - first, iov, niov);
+            niov = 0;
+        }
 
-        if (file->buffer) {
+        if (buffer) {
 
-            if (len > (size_t) (file->last - file->pos)) {
+            if (len > (size_t) (buffer->last - buffer->pos)) {
 
-                if (ngx_write_fd(file->fd, file->buffer,
-                                 file->pos - file->buffer)
+                if (ngx_http_log_write(file, buffer->start,
+                                       buffer->pos - buffer->start,
+                                       r->connection->log)
                     == -1
                     && ngx_errno == NGX_ENOSPC)
                 {
                     log[l].disk_full_time = ngx_time();
                 }
 
-                file->pos = file->buffer;
+                buffer->pos = buffer->start;
             }
 
-            if (len <= (size_t) (file->last - file->pos)) {
+            if (len <= (size_t) (buffer->last - buffer->pos)) {
 
-                p = file->pos;
+                p = buffer->pos;
+
+                if (buffer->event && p == buffer->start && !ngx_exiting) {
+                    ngx_add_timer(buffer->event, buffer->flush);
+                }
 
                 for (i = 0; i < log[l].ops->nelts; i++) {
                     p = op[i].run(r, p, &op[i]);
@@ -254,10 +310,20 @@ ngx_http_log_handler(ngx_http_request_t *r)
 
                 ngx_linefeed(p);
 
-                file->pos = p;
+                buffer->pos = p;
+
+                /* an exiting worker process does not wait for the timer */
+
+                if (buffer->event && ngx_exiting) {
+                    ngx_http_log_flush(file, r->connection->log);
+                }
 
                 continue;
             }
+
+            if (buffer->event && buffer->event->timer_set) {
+                ngx_del_timer(buffer->event);
+            }
         }
 
         line = ngx_palloc(r->pool, len);
@@ -273,17 +339,226 @@ ngx_http_log_handler(ngx_http_request_t *r)
 
         ngx_linefeed(p);
 
-        if (ngx_write_fd(file->fd, line, p - line) == -1
-            && ngx_errno == NGX_ENOSPC)
-        {
-            log[l].disk_full_time = ngx_time();
+        if (buffer) {
+
+            /* the line is larger than the whole buffer */
+
+            if (ngx_http_log_write(file, line, p - line, r->connection->log)
+                == -1
+                && ngx_errno == NGX_ENOSPC)
+            {
+                log[l].disk_full_time = ngx_time();
+            }
+
+            continue;
+        }
+
+        if (niov == 0) {
+            batch = file;
+            first = l;
         }
+
+        iov[niov].iov_base = (void *) line;
+        iov[niov].iov_len = p - line;
+        niov++;
+    }
+
+    if (niov) {
+        ngx_http_log_writev(&log[first], l - first, iov, niov);
     }
 
     return NGX_OK;
 }
 
 
+static void
+ngx_http_log_writev(ngx_http_log_t *log, ngx_uint_t n, struct iovec *iov,
+    ngx_uint_t niov)
+{
+    ngx_uint_t  i;
+
+    if (ngx_writev_fd(log->file->fd, iov, niov) == -1
+        && ngx_errno == NGX_ENOSPC)
+    {
+        for (i = 0; i < n; i++) {
+            log[i].disk_full_time = ngx_time();
+        }
+    }
+}
+
+
+static ssize_t
+ngx_http_log_write(ngx_open_file_t *file, u_char *buf, size_t len,
+    ngx_log_t *log)
+{
+#if (NGX_ZLIB)
+    ngx_http_log_buf_t  *buffer;
+
+    buffer = file->data;
+
+    if (buffer && buffer->gzip) {
+        return ngx_http_log_gzip(file->fd, buf, len, buffer->gzip, log);
+    }
+#endif
+
+    return ngx_write_fd(file->fd, buf, len);
+}
+
+
+#if (NGX_ZLIB)
+
+static ssize_t
+ngx_http_log_gzip(ngx_fd_t fd, u_char *buf, size_t len, ngx_int_t level,
+    ngx_log_t *log)
+{
+    int          rc, wbits, memlevel;
+    u_char      *out;
+    size_t       size;
+    ssize_t      n;
+    z_stream     zstream;
+    ngx_err_t    err;
+    ngx_pool_t  *pool;
+
+    wbits = MAX_WBITS;
+    memlevel = MAX_MEM_LEVEL - 1;
+
+    while ((ssize_t) len < ((1 << (wbits - 1)) - 262)) {
+        wbits--;
+        memlevel--;
+    }
+
+    /*
+     * the conservative deflateBound() estimation
+     * plus 18 bytes of the gzip header and trailer
+     */
+
+    size = len + ((len + 7) >> 3) + ((len + 63) >> 6) + 5 + 18;
+
+    ngx_memzero(&zstream, sizeof(z_stream));
+
+    pool = ngx_create_pool(256, log);
+    if (pool == NULL) {
+        /* simulate successful logging */
+        return len;
+    }
+
+    zstream.zalloc = ngx_http_log_gzip_alloc;
+    zstream.zfree = ngx_http_log_gzip_free;
+    zstream.opaque = pool;
+
+    out = ngx_palloc(pool, size);
+    if (out == NULL) {
+        goto done;
+    }
+
+    zstream.next_in = buf;
+    zstream.avail_in = len;
+    zstream.next_out = out;
+    zstream.avail_out = size;
+
+    /* each flushed buffer is a separate gzip member */
+
+    rc = deflateInit2(&zstream, (int) level, Z_DEFLATED, wbits + 16, memlevel,
+                      Z_DEFAULT_STRATEGY);
+
+    if (rc != Z_OK) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0, "deflateInit2() failed: %d", rc);
+        goto done;
+    }
+
+    rc = deflate(&zstream, Z_FINISH);
+
+    if (rc != Z_STREAM_END) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      "deflate(Z_FINISH) failed: %d", rc);
+        goto done;
+    }
+
+    size -= zstream.avail_out;
+
+    rc = deflateEnd(&zstream);
+
+    if (rc != Z_OK) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0, "deflateEnd() failed: %d", rc);
+        goto done;
+    }
+
+    n = ngx_write_fd(fd, out, size);
+
+    if (n != (ssize_t) size) {
+        err = (n == -1) ? ngx_errno : 0;
+
+        ngx_destroy_pool(pool);
+
+        ngx_set_errno(err);
+        return -1;
+    }
+
+done:
+
+    ngx_destroy_pool(pool);
+
+    /* simulate successful logging */
+    return len;
+}
+
+
+static void *
+ngx_http_log_gzip_alloc(void *opaque, u_int items, u_int size)
+{
+    ngx_pool_t *pool = opaque;
+
+    return ngx_palloc(pool, items * size);
+}
+
+
+static void
+ngx_http_log_gzip_free(void *opaque, void *address)
+{
+#if 0
+    ngx_pool_t *pool = opaque;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pool->log, 0, "free: %p", address);
+#endif
+}
+
+#endif
+
+
+static void
+ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log)
+{
+    size_t               len;
+    ngx_http_log_buf_t  *buffer;
+
+    buffer = file->data;
+
+    len = buffer->pos - buffer->start;
+
+    if (len == 0) {
+        return;
+    }
+
+    (void) ngx_http_log_write(file, buffer->start, len, log);
+
+    buffer->pos = buffer->start;
+
+    if (buffer->event && buffer->event->timer_set) {
+        ngx_del_timer(buffer->event);
+    }
+}
+
+
+static void
+ngx_http_log_flush_handler(ngx_event_t *ev)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "http log buffer flush handler");
+
+    ngx_http_log_flush(ev->data, ev->log);
+}
+
+
 static u_char *
 ngx_http_log_copy_short(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op)
@@ -355,11 +630,12 @@ static u_char *
 ngx_http_log_request_time(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op)
 {
-    time_t  elapsed;
+    ngx_msec_int_t  ms;
 
-    elapsed = ngx_time() - r->start_time;
+    ms = (ngx_msec_int_t) (ngx_current_msec - r->start_msec);
+    ms = (ms >= 0) ? ms : 0;
 
-    return ngx_sprintf(buf, "%T", elapsed);
+    return ngx_sprintf(buf, "%T.%03M", (time_t) ms / 1000, ms % 1000);
 }
 
 
@@ -564,10 +840,13 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_http_log_loc_conf_t *llcf = conf;
 
-    ssize_t                    buf;
+    ssize_t                    size;
+    ngx_int_t                  gzip;
     ngx_uint_t                 i;
-    ngx_str_t                 *value, name;
+    ngx_msec_t                 flush;
+    ngx_str_t                 *value, name, s;
     ngx_http_log_t            *log;
+    ngx_http_log_buf_t        *buffer;
     ngx_http_log_fmt_t        *fmt;
     ngx_http_log_main_conf_t  *lmcf;
 
@@ -628,40 +907,139 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
 buffer:
 
-    if (cf->args->nelts == 4) {
-        if (ngx_strncmp(value[3].data, "buffer=", 7) != 0) {
-            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                               "invalid parameter \"%V\"", &value[3]);
-            return NGX_CONF_ERROR;
+    size = 0;
+    flush = 0;
+    gzip = 0;
+
+    for (i = 3; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "buffer=", 7) == 0) {
+            s.len = value[i].len - 7;
+            s.data = value[i].data + 7;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR || size == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid buffer size \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "flush=", 6) == 0) {
+            s.len = value[i].len - 6;
+            s.data = value[i].data + 6;
+
+            flush = ngx_parse_time(&s, 0);
+
+            if (flush == (ngx_msec_t) NGX_ERROR || flush == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid flush time \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
         }
 
-        name.len = value[3].len - 7;
-        name.data = value[3].data + 7;
+        if (ngx_strncmp(value[i].data, "gzip", 4) == 0
+            && (value[i].len == 4 || value[i].data[4] == '='))
+        {
+#if (NGX_ZLIB)
+            if (size == 0) {
+                size = 64 * 1024;
+            }
+
+            if (value[i].len == 4) {
+                gzip = Z_BEST_SPEED;
+                continue;
+            }
 
-        buf = ngx_parse_size(&name);
+            s.len = value[i].len - 5;
+            s.data = value[i].data + 5;
 
-        if (buf == NGX_ERROR) {
+            gzip = ngx_atoi(s.data, s.len);
+
+            if (gzip < 1 || gzip > 9) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid compression level \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+
+#else
             ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                               "invalid parameter \"%V\"", &value[3]);
+                               "nginx was built without zlib support");
             return NGX_CONF_ERROR;
+#endif
         }
 
-        if (log->file->buffer && log->file->last - log->file->pos != buf) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (flush && size == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "no buffer is defined for access_log \"%V\"",
+                           &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (size == 0) {
+        return NGX_CONF_OK;
+    }
+
+    if (log->file->data) {
+        buffer = log->file->data;
+
+        if (buffer->last - buffer->start != size
+            || buffer->flush != flush
+            || buffer->gzip != gzip)
+        {
             ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                                "access_log \"%V\" already defined "
-                               "with different buffer size", &value[1]);
+                               "with conflicting parameters", &value[1]);
             return NGX_CONF_ERROR;
         }
 
-        log->file->buffer = ngx_palloc(cf->pool, buf);
-        if (log->file->buffer == NULL) {
+        return NGX_CONF_OK;
+    }
+
+    buffer = ngx_pcalloc(cf->pool, sizeof(ngx_http_log_buf_t));
+    if (buffer == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    buffer->start = ngx_palloc(cf->pool, size);
+    if (buffer->start == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    buffer->pos = buffer->start;
+    buffer->last = buffer->start + size;
+
+    if (flush) {
+        buffer->event = ngx_pcalloc(cf->pool, sizeof(ngx_event_t));
+        if (buffer->event == NULL) {
             return NGX_CONF_ERROR;
         }
 
-        log->file->pos = log->file->buffer;
-        log->file->last = log->file->buffer + buf;
+        buffer->event->data = log->file;
+        buffer->event->handler = ngx_http_log_flush_handler;
+        buffer->event->log = cf->cycle->new_log;
+        buffer->event->cancelable = 1;
+
+        buffer->flush = flush;
     }
 
+    buffer->gzip = gzip;
+
+    log->file->flush = ngx_http_log_flush;
+    log->file->data = buffer;
+
     return NGX_CONF_OK;
 }
 
@@ -25,6 +25,8 @@ typedef struct {
     ngx_int_t       verify;
     ngx_int_t       verify_depth;
 
+    ngx_int_t       builtin_session_cache;
+
     time_t          session_timeout;
 
     ngx_str_t       certificate;
@@ -32,6 +34,8 @@ typedef struct {
     ngx_str_t       client_certificate;
 
     ngx_str_t       ciphers;
+
+    ngx_shm_zone_t *shm_zone;
 } ngx_http_ssl_srv_conf_t;
 
 
@@ -10,11 +10,15 @@
 
 
 typedef struct {
-    ngx_http_cache_hash_t  *redirect_cache;
+    ngx_flag_t              gzip_static;
 } ngx_http_static_loc_conf_t;
 
 
 static ngx_int_t ngx_http_static_handler(ngx_http_request_t *r);
+#if (NGX_HTTP_GZIP)
+static ngx_int_t ngx_http_static_open_gzip(ngx_http_request_t *r,
+    ngx_str_t *path, ngx_open_file_info_t *of);
+#endif
 static void *ngx_http_static_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_static_merge_loc_conf(ngx_conf_t *cf,
     void *parent, void *child);
@@ -23,13 +27,13 @@ static ngx_int_t ngx_http_static_init(ngx_conf_t *cf);
 
 static ngx_command_t  ngx_http_static_commands[] = {
 
-#if (NGX_HTTP_CACHE)
+#if (NGX_HTTP_GZIP)
 
-    { ngx_string("redirect_cache"),
-      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE3,
-      ngx_http_set_cache_slot,
+    { ngx_string("gzip_static"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
       NGX_HTTP_LOC_CONF_OFFSET,
-      offsetof(ngx_http_static_loc_conf_t, redirect_cache),
+      offsetof(ngx_http_static_loc_conf_t, gzip_static),
       NULL },
 
 #endif
@@ -74,17 +78,13 @@ ngx_http_static_handler(ngx_http_request_t *r)
 {
     u_char                    *last, *location;
     size_t                     root;
-    ngx_fd_t                   fd;
     ngx_int_t                  rc;
     ngx_uint_t                 level;
     ngx_str_t                  path;
-    ngx_err_t                  err;
     ngx_log_t                 *log;
     ngx_buf_t                 *b;
     ngx_chain_t                out;
-    ngx_file_info_t            fi;
-    ngx_pool_cleanup_t        *cln;
-    ngx_pool_cleanup_file_t   *clnf;
+    ngx_open_file_info_t       of;
     ngx_http_core_loc_conf_t  *clcf;
 
     if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
@@ -118,75 +118,78 @@ ngx_http_static_handler(ngx_http_request_t *r)
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
+    path.len = last - path.data;
+
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
                    "http filename: \"%s\"", path.data);
 
-    cln = ngx_pool_cleanup_add(r->pool, sizeof(ngx_pool_cleanup_file_t));
-    if (cln == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+#if (NGX_HTTP_GZIP)
+
+    rc = ngx_http_static_open_gzip(r, &path, &of);
+
+    if (rc == NGX_OK) {
+        goto found;
     }
 
-    fd = ngx_open_file(path.data, NGX_FILE_RDONLY, NGX_FILE_OPEN);
+    if (rc != NGX_DECLINED) {
+        return rc;
+    }
+
+#endif
+
+    of.valid = clcf->open_file_cache_valid;
+    of.errors = clcf->open_file_cache_errors;
 
-    if (fd == NGX_INVALID_FILE) {
-        err = ngx_errno;
+    if (ngx_open_cached_file(clcf->open_file_cache, &path, &of, r->pool)
+        != NGX_OK)
+    {
+        switch (of.err) {
+
+        case 0:
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+
+        case NGX_ENOENT:
+        case NGX_ENOTDIR:
+        case NGX_ENAMETOOLONG:
 
-        if (err == NGX_ENOENT
-            || err == NGX_ENOTDIR
-            || err == NGX_ENAMETOOLONG)
-        {
             level = NGX_LOG_ERR;
             rc = NGX_HTTP_NOT_FOUND;
+            break;
+
+        case NGX_EACCES:
 
-        } else if (err == NGX_EACCES) {
             level = NGX_LOG_ERR;
             rc = NGX_HTTP_FORBIDDEN;
+            break;
+
+        default:
 
-        } else {
             level = NGX_LOG_CRIT;
             rc = NGX_HTTP_INTERNAL_SERVER_ERROR;
+            break;
         }
 
-        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
-
         if (rc != NGX_HTTP_NOT_FOUND || clcf->log_not_found) {
-            ngx_log_error(level, log, err,
-                          ngx_open_file_n " \"%s\" failed", path.data);
+            ngx_log_error(level, log, of.err,
+                          "%s \"%s\" failed", of.failed, path.data);
         }
 
         return rc;
     }
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0, "http static fd: %d", fd);
-
-    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
-        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
-                      ngx_fd_info_n " \"%s\" failed", path.data);
-
-        if (ngx_close_file(fd) == NGX_FILE_ERROR) {
-            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
-                          ngx_close_file_n " \"%s\" failed", path.data);
-        }
-
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
-    }
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0, "http static fd: %d", of.fd);
 
-    if (ngx_is_dir(&fi)) {
+    if (of.is_dir) {
 
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, log, 0, "http dir");
 
-        if (ngx_close_file(fd) == NGX_FILE_ERROR) {
-            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
-                          ngx_close_file_n " \"%s\" failed", path.data);
-        }
-
         r->headers_out.location = ngx_palloc(r->pool, sizeof(ngx_table_elt_t));
         if (r->headers_out.location == NULL) {
             return NGX_HTTP_INTERNAL_SERVER_ERROR;
         }
 
-        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
-
         if (!clcf->alias && clcf->root_lengths == NULL) {
             location = path.data + clcf->root.len;
 
@@ -214,38 +217,30 @@ ngx_http_static_handler(ngx_http_request_t *r)
 
 #if !(NGX_WIN32) /* the not regular files are probably Unix specific */
 
-    if (!ngx_is_file(&fi)) {
+    if (!of.is_file) {
         ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
                       "\"%s\" is not a regular file", path.data);
 
-        if (ngx_close_file(fd) == NGX_FILE_ERROR) {
-            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
-                          ngx_close_file_n " \"%s\" failed", path.data);
-        }
-
         return NGX_HTTP_NOT_FOUND;
     }
 
 #endif
 
-    log->action = "sending response to client";
-
-    cln->handler = ngx_pool_cleanup_file;
-    clnf = cln->data;
+#if (NGX_HTTP_GZIP)
+found:
+#endif
 
-    clnf->fd = fd;
-    clnf->name = path.data;
-    clnf->log = r->pool->log;
+    log->action = "sending response to client";
 
     r->headers_out.status = NGX_HTTP_OK;
-    r->headers_out.content_length_n = ngx_file_size(&fi);
-    r->headers_out.last_modified_time = ngx_file_mtime(&fi);
+    r->headers_out.content_length_n = of.size;
+    r->headers_out.last_modified_time = of.mtime;
 
     if (ngx_http_set_content_type(r) != NGX_OK) {
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    if (r != r->main && ngx_file_size(&fi) == 0) {
+    if (r != r->main && of.size == 0) {
         return ngx_http_send_header(r);
     }
 
@@ -270,13 +265,13 @@ ngx_http_static_handler(ngx_http_request_t *r)
     }
 
     b->file_pos = 0;
-    b->file_last = ngx_file_size(&fi);
+    b->file_last = of.size;
 
     b->in_file = b->file_last ? 1: 0;
     b->last_buf = (r == r->main) ? 1: 0;
     b->last_in_chain = 1;
 
-    b->file->fd = fd;
+    b->file->fd = of.fd;
     b->file->name = path;
     b->file->log = log;
 
@@ -287,6 +282,108 @@ ngx_http_static_handler(ngx_http_request_t *r)
 }
 
 
+#if (NGX_HTTP_GZIP)
+
+static ngx_int_t
+ngx_http_static_open_gzip(ngx_http_request_t *r, ngx_str_t *path,
+    ngx_open_file_info_t *of)
+{
+    u_char                      *p;
+    ngx_int_t                    rc;
+    ngx_str_t                    gz;
+    ngx_table_elt_t             *h;
+    ngx_http_core_loc_conf_t    *clcf;
+    ngx_http_static_loc_conf_t  *slcf;
+
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_static_module);
+
+    if (!slcf->gzip_static || r != r->main) {
+        return NGX_DECLINED;
+    }
+
+    rc = ngx_http_gzip_ok(r);
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    /*
+     * if "gzip_vary" is on, the compressed file is looked up even
+     * for the clients that do not accept gzip to send them "Vary"
+     */
+
+    if (rc != NGX_OK && !clcf->gzip_vary) {
+        return NGX_DECLINED;
+    }
+
+    gz.len = path->len + sizeof(".gz") - 1;
+    gz.data = ngx_palloc(r->pool, gz.len + 1);
+    if (gz.data == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    p = ngx_cpymem(gz.data, path->data, path->len);
+    ngx_memcpy(p, ".gz", sizeof(".gz"));
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http static gzip filename: \"%s\"", gz.data);
+
+    of->valid = clcf->open_file_cache_valid;
+    of->errors = clcf->open_file_cache_errors;
+
+    if (ngx_open_cached_file(clcf->open_file_cache, &gz, of, r->pool)
+        != NGX_OK)
+    {
+        switch (of->err) {
+
+        case 0:
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+
+        case NGX_ENOENT:
+        case NGX_ENOTDIR:
+        case NGX_ENAMETOOLONG:
+        case NGX_EACCES:
+            return NGX_DECLINED;
+
+        default:
+            ngx_log_error(NGX_LOG_CRIT, r->connection->log, of->err,
+                          "%s \"%s\" failed", of->failed, gz.data);
+
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+    }
+
+    if (!of->is_file) {
+        return NGX_DECLINED;
+    }
+
+    r->gzip_vary = 1;
+
+    if (rc != NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    /* the precompressed file is found, the gzip filter skips it */
+
+    h = ngx_list_push(&r->headers_out.headers);
+    if (h == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    h->hash = 1;
+    h->key.len = sizeof("Content-Encoding") - 1;
+    h->key.data = (u_char *) "Content-Encoding";
+    h->value.len = sizeof("gzip") - 1;
+    h->value.data = (u_char *) "gzip";
+
+    r->headers_out.content_encoding = h;
+
+    *path = gz;
+
+    return NGX_OK;
+}
+
+#endif
+
+
 static void *
 ngx_http_static_create_loc_conf(ngx_conf_t *cf)
 {
@@ -297,7 +394,7 @@ ngx_http_static_create_loc_conf(ngx_conf_t *cf)
         return NGX_CONF_ERROR;
     }
 
-    conf->redirect_cache = NULL;
+    conf->gzip_static = NGX_CONF_UNSET;
 
     return conf;
 }
@@ -309,9 +406,7 @@ ngx_http_static_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_http_static_loc_conf_t  *prev = parent;
     ngx_http_static_loc_conf_t  *conf = child;
 
-    if (conf->redirect_cache == NULL) {
-        conf->redirect_cache = prev->redirect_cache;
-    }
+    ngx_conf_merge_value(conf->gzip_static, prev->gzip_static, 0);
 
     return NGX_CONF_OK;
 }
@@ -0,0 +1,1122 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_STATS_SERVER    0
+#define NGX_HTTP_STATS_GROUP     1
+#define NGX_HTTP_STATS_PEER      2
+
+#define NGX_HTTP_STATS_BUCKETS   12
+
+#define NGX_HTTP_STATS_OFF       -2
+
+#define NGX_HTTP_STATS_REQUEST            0
+#define NGX_HTTP_STATS_HEADER             1
+#define NGX_HTTP_STATS_UPSTREAM_CONNECT   2
+#define NGX_HTTP_STATS_UPSTREAM_HEADER    3
+#define NGX_HTTP_STATS_UPSTREAM_RESPONSE  4
+#define NGX_HTTP_STATS_TIMINGS            5
+
+/*
+ * the log-linear histogram has 8 linear buckets for 0-7ms, and then
+ * 4 buckets for each power of two up to 2^24ms
+ */
+
+#define NGX_HTTP_STATS_HIST_BUCKETS       (8 + 21 * 4)
+
+
+typedef struct {
+    ngx_rbtree_node_t            node;
+
+    ngx_atomic_t                 requests;
+    ngx_atomic_t                 fails;
+    ngx_atomic_t                 bytes_in;
+    ngx_atomic_t                 bytes_out;
+    ngx_atomic_t                 status[5];
+    ngx_atomic_t                 time[NGX_HTTP_STATS_BUCKETS];
+
+    u_short                      len;
+    u_char                       data[1];
+} ngx_http_stats_node_t;
+
+
+typedef struct {
+    ngx_atomic_t                 count;
+    ngx_atomic_t                 sum;
+    ngx_atomic_t                 bucket[NGX_HTTP_STATS_HIST_BUCKETS];
+} ngx_http_stats_hist_t;
+
+
+typedef struct {
+    ngx_rbtree_t                 rbtree;
+    ngx_rbtree_node_t            sentinel;
+
+    /* worker_processes * NGX_HTTP_STATS_TIMINGS histograms */
+    ngx_http_stats_hist_t       *timing;
+    ngx_uint_t                   workers;
+} ngx_http_stats_shctx_t;
+
+
+typedef struct {
+    ngx_uint_t                   type;
+    ngx_str_t                    name;
+    ngx_str_t                    key;        /* "type name" */
+    ngx_http_stats_node_t       *node;
+} ngx_http_stats_entry_t;
+
+
+typedef struct {
+    ngx_shm_zone_t              *shm_zone;
+    ngx_http_stats_shctx_t      *sh;
+    ngx_slab_pool_t             *shpool;
+
+    ngx_array_t                  entries;    /* ngx_http_stats_entry_t */
+    ngx_hash_t                   peers;
+
+    ngx_http_stats_hist_t       *timing;
+    ngx_uint_t                   workers;
+} ngx_http_stats_main_conf_t;
+
+
+typedef struct {
+    ngx_int_t                    server;
+} ngx_http_stats_srv_conf_t;
+
+
+typedef struct {
+    ngx_int_t                    group;
+} ngx_http_stats_loc_conf_t;
+
+
+static void ngx_http_stats_account(ngx_http_stats_node_t *sn,
+    ngx_uint_t status, ngx_msec_int_t ms);
+static void ngx_http_stats_hist_add(ngx_http_stats_hist_t *h, ngx_msec_t ms);
+static ngx_msec_t ngx_http_stats_hist_bound(ngx_uint_t n);
+static ngx_int_t ngx_http_stats_add_entry(ngx_conf_t *cf,
+    ngx_http_stats_main_conf_t *smcf, ngx_uint_t type, ngx_str_t *name);
+static ngx_rbtree_node_t *ngx_http_stats_lookup(ngx_rbtree_t *rbtree,
+    uint32_t hash, u_char *data, size_t len);
+static void ngx_http_stats_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+
+static void *ngx_http_stats_create_main_conf(ngx_conf_t *cf);
+static void *ngx_http_stats_create_srv_conf(ngx_conf_t *cf);
+static void *ngx_http_stats_create_loc_conf(ngx_conf_t *cf);
+static char *ngx_http_stats_merge_loc_conf(ngx_conf_t *cf, void *parent,
+    void *child);
+static char *ngx_http_stats_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_stats_group(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_stats(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static ngx_int_t ngx_http_stats_init(ngx_conf_t *cf);
+static ngx_int_t ngx_http_stats_init_module(ngx_cycle_t *cycle);
+
+
+static ngx_command_t  ngx_http_stats_commands[] = {
+
+    { ngx_string("stats_zone"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_http_stats_zone,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("stats_group"),
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_stats_group,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("stats"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_stats,
+      0,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_stats_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    ngx_http_stats_init,                   /* postconfiguration */
+
+    ngx_http_stats_create_main_conf,       /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_stats_create_srv_conf,        /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    ngx_http_stats_create_loc_conf,        /* create location configuration */
+    ngx_http_stats_merge_loc_conf          /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_stats_module = {
+    NGX_MODULE_V1,
+    &ngx_http_stats_module_ctx,            /* module context */
+    ngx_http_stats_commands,               /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    ngx_http_stats_init_module,            /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_str_t  ngx_http_stats_types[] = {
+    ngx_string("server"),
+    ngx_string("group"),
+    ngx_string("peer")
+};
+
+
+static ngx_str_t  ngx_http_stats_timings[] = {
+    ngx_string("request"),
+    ngx_string("header"),
+    ngx_string("upstream_connect"),
+    ngx_string("upstream_header"),
+    ngx_string("upstream_response")
+};
+
+
+/* the upper bounds of the response time buckets in milliseconds */
+
+static ngx_msec_int_t  ngx_http_stats_bounds[NGX_HTTP_STATS_BUCKETS - 1] = {
+    1, 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000
+};
+
+
+static ngx_int_t
+ngx_http_stats_log_handler(ngx_http_request_t *r)
+{
+    ngx_uint_t                   i, status;
+    ngx_msec_int_t               ms;
+    ngx_http_upstream_t         *u;
+    ngx_http_stats_hist_t       *timing;
+    ngx_http_stats_node_t       *sn;
+    ngx_http_stats_entry_t      *entry;
+    ngx_http_upstream_state_t   *state;
+    ngx_http_stats_srv_conf_t   *sscf;
+    ngx_http_stats_loc_conf_t   *slcf;
+    ngx_http_stats_main_conf_t  *smcf;
+
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_stats_module);
+
+    if (smcf->sh == NULL) {
+        return NGX_OK;
+    }
+
+    entry = smcf->entries.elts;
+
+    status = r->err_status ? r->err_status : r->headers_out.status;
+
+    ms = (ngx_msec_int_t) (ngx_current_msec - r->start_msec);
+
+    if (ms < 0) {
+        ms = 0;
+    }
+
+    /*
+     * a worker updates its own histograms only, so they are updated
+     * without atomic operations; the old and new worker processes
+     * may share the same histograms for a while after reconfiguration
+     */
+
+    timing = smcf->timing
+             + (ngx_worker < smcf->workers ? ngx_worker : 0)
+               * NGX_HTTP_STATS_TIMINGS;
+
+    ngx_http_stats_hist_add(&timing[NGX_HTTP_STATS_REQUEST], ms);
+
+    if (r->header_msec) {
+        ngx_http_stats_hist_add(&timing[NGX_HTTP_STATS_HEADER],
+                                r->header_msec - r->start_msec);
+    }
+
+    sscf = ngx_http_get_module_srv_conf(r, ngx_http_stats_module);
+
+    if (sscf->server != NGX_CONF_UNSET) {
+        sn = entry[sscf->server].node;
+
+        ngx_http_stats_account(sn, status, ms);
+        ngx_atomic_fetch_add(&sn->bytes_in, r->request_length);
+        ngx_atomic_fetch_add(&sn->bytes_out, r->connection->sent);
+    }
+
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_stats_module);
+
+    if (slcf->group >= 0) {
+        sn = entry[slcf->group].node;
+
+        ngx_http_stats_account(sn, status, ms);
+        ngx_atomic_fetch_add(&sn->bytes_in, r->request_length);
+        ngx_atomic_fetch_add(&sn->bytes_out, r->connection->sent);
+    }
+
+    u = r->upstream;
+
+    if (u == NULL) {
+        return NGX_OK;
+    }
+
+    /* every try of the upstream request has its own state */
+
+    state = u->states.elts;
+
+    for (i = 0; i < u->states.nelts; i++) {
+
+        if (state[i].connect_time != (ngx_msec_t) -1) {
+            ngx_http_stats_hist_add(&timing[NGX_HTTP_STATS_UPSTREAM_CONNECT],
+                                    state[i].connect_time);
+        }
+
+        if (state[i].header_time != (ngx_msec_t) -1) {
+            ngx_http_stats_hist_add(&timing[NGX_HTTP_STATS_UPSTREAM_HEADER],
+                                    state[i].header_time);
+        }
+
+        if (state[i].status) {
+            ngx_http_stats_hist_add(&timing[NGX_HTTP_STATS_UPSTREAM_RESPONSE],
+                                    state[i].response_time);
+        }
+
+        if (state[i].peer == NULL || smcf->peers.buckets == NULL) {
+            continue;
+        }
+
+        entry = ngx_hash_find(&smcf->peers,
+                              ngx_hash_key(state[i].peer->data,
+                                           state[i].peer->len),
+                              state[i].peer->data, state[i].peer->len);
+
+        if (entry == NULL) {
+            continue;
+        }
+
+        sn = entry->node;
+
+        ngx_http_stats_account(sn, state[i].status,
+                               (ngx_msec_int_t) state[i].response_time);
+
+        /*
+         * the errors, timeouts and invalid headers are recorded
+         * as 502 and 504 in the state of the try
+         */
+
+        if (state[i].status == 0
+            || state[i].status == NGX_HTTP_BAD_GATEWAY
+            || state[i].status == NGX_HTTP_GATEWAY_TIME_OUT)
+        {
+            ngx_atomic_fetch_add(&sn->fails, 1);
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_stats_account(ngx_http_stats_node_t *sn, ngx_uint_t status,
+    ngx_msec_int_t ms)
+{
+    ngx_uint_t  n;
+
+    ngx_atomic_fetch_add(&sn->requests, 1);
+
+    if (status >= 100 && status < 600) {
+        ngx_atomic_fetch_add(&sn->status[status / 100 - 1], 1);
+    }
+
+    for (n = 0; n < NGX_HTTP_STATS_BUCKETS - 1; n++) {
+        if (ms < ngx_http_stats_bounds[n]) {
+            break;
+        }
+    }
+
+    ngx_atomic_fetch_add(&sn->time[n], 1);
+}
+
+
+static void
+ngx_http_stats_hist_add(ngx_http_stats_hist_t *h, ngx_msec_t ms)
+{
+    ngx_uint_t  n, e;
+
+    if (ms < 8) {
+        n = ms;
+
+    } else if (ms >> 24) {
+        n = NGX_HTTP_STATS_HIST_BUCKETS - 1;
+
+    } else {
+        for (e = 3; ms >> (e + 1); e++) { /* void */ }
+
+        n = 8 + (e - 3) * 4 + ((ms >> (e - 2)) & 3);
+    }
+
+    h->count++;
+    h->sum += ms;
+    h->bucket[n]++;
+}
+
+
+/* the lower bound of a histogram bucket */
+
+static ngx_msec_t
+ngx_http_stats_hist_bound(ngx_uint_t n)
+{
+    ngx_uint_t  e;
+
+    if (n < 8) {
+        return n;
+    }
+
+    e = 3 + (n - 8) / 4;
+
+    return (4 + (n - 8) % 4) << (e - 2);
+}
+
+
+static ngx_int_t
+ngx_http_stats_handler(ngx_http_request_t *r)
+{
+    size_t                       size;
+    ngx_int_t                    rc;
+    ngx_buf_t                   *b;
+    ngx_uint_t                   i, n, w;
+    ngx_chain_t                  out;
+    ngx_atomic_uint_t            count, sum, bucket;
+    ngx_http_stats_hist_t       *h;
+    ngx_http_stats_node_t       *sn;
+    ngx_http_stats_entry_t      *entry;
+    ngx_http_stats_main_conf_t  *smcf;
+
+    if (r->method != NGX_HTTP_GET && r->method != NGX_HTTP_HEAD) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_body(r);
+
+    if (rc != NGX_OK && rc != NGX_AGAIN) {
+        return rc;
+    }
+
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_stats_module);
+
+    if (smcf->sh == NULL) {
+        return NGX_HTTP_NOT_FOUND;
+    }
+
+    r->headers_out.content_type.len = sizeof("text/plain") - 1;
+    r->headers_out.content_type.data = (u_char *) "text/plain";
+
+    if (r->method == NGX_HTTP_HEAD) {
+        r->headers_out.status = NGX_HTTP_OK;
+
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+            return rc;
+        }
+    }
+
+    entry = smcf->entries.elts;
+
+    size = sizeof("buckets inf\n") - 1
+           + (NGX_HTTP_STATS_BUCKETS - 1) * (NGX_INT_T_LEN + 1);
+
+    for (i = 0; i < smcf->entries.nelts; i++) {
+        size += sizeof(" requests= fails= in= out="
+                       " 1xx= 2xx= 3xx= 4xx= 5xx= ms=\n") - 1
+                + entry[i].key.len
+                + (9 + NGX_HTTP_STATS_BUCKETS) * (NGX_ATOMIC_T_LEN + 1);
+    }
+
+    size += NGX_HTTP_STATS_TIMINGS
+            * (sizeof("timing upstream_response count= sum= buckets=\n") - 1
+               + 2 * NGX_ATOMIC_T_LEN
+               + NGX_HTTP_STATS_HIST_BUCKETS * (2 * NGX_ATOMIC_T_LEN + 2));
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    out.buf = b;
+    out.next = NULL;
+
+    b->last = ngx_cpymem(b->last, "buckets ", sizeof("buckets ") - 1);
+
+    for (n = 0; n < NGX_HTTP_STATS_BUCKETS - 1; n++) {
+        b->last = ngx_sprintf(b->last, "%i,", ngx_http_stats_bounds[n]);
+    }
+
+    b->last = ngx_cpymem(b->last, "inf\n", sizeof("inf\n") - 1);
+
+    for (i = 0; i < smcf->entries.nelts; i++) {
+        sn = entry[i].node;
+
+        b->last = ngx_sprintf(b->last, "%V requests=%uA",
+                              &entry[i].key, sn->requests);
+
+        if (entry[i].type == NGX_HTTP_STATS_PEER) {
+            b->last = ngx_sprintf(b->last, " fails=%uA", sn->fails);
+
+        } else {
+            b->last = ngx_sprintf(b->last, " in=%uA out=%uA",
+                                  sn->bytes_in, sn->bytes_out);
+        }
+
+        b->last = ngx_sprintf(b->last,
+                              " 1xx=%uA 2xx=%uA 3xx=%uA 4xx=%uA 5xx=%uA ms=",
+                              sn->status[0], sn->status[1], sn->status[2],
+                              sn->status[3], sn->status[4]);
+
+        for (n = 0; n < NGX_HTTP_STATS_BUCKETS; n++) {
+            b->last = ngx_sprintf(b->last, "%uA,", sn->time[n]);
+        }
+
+        b->last[-1] = LF;
+    }
+
+    /*
+     * the histograms of all workers are summed up, only the non-empty
+     * buckets are output as "lower_bound:count" pairs
+     */
+
+    for (i = 0; i < NGX_HTTP_STATS_TIMINGS; i++) {
+
+        count = 0;
+        sum = 0;
+
+        for (w = 0; w < smcf->workers; w++) {
+            h = &smcf->timing[w * NGX_HTTP_STATS_TIMINGS + i];
+            count += h->count;
+            sum += h->sum;
+        }
+
+        b->last = ngx_sprintf(b->last, "timing %V count=%uA sum=%uA buckets=",
+                              &ngx_http_stats_timings[i], count, sum);
+
+        for (n = 0; n < NGX_HTTP_STATS_HIST_BUCKETS; n++) {
+
+            bucket = 0;
+
+            for (w = 0; w < smcf->workers; w++) {
+                h = &smcf->timing[w * NGX_HTTP_STATS_TIMINGS + i];
+                bucket += h->bucket[n];
+            }
+
+            if (bucket) {
+                b->last = ngx_sprintf(b->last, "%M:%uA,",
+                                      ngx_http_stats_hist_bound(n), bucket);
+            }
+        }
+
+        if (b->last[-1] == ',') {
+            b->last--;
+        }
+
+        *b->last++ = LF;
+    }
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    b->last_buf = 1;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static ngx_int_t
+ngx_http_stats_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_stats_main_conf_t  *osmcf = data;
+
+    size_t                       size;
+    uint32_t                     hash;
+    ngx_uint_t                   i;
+    ngx_rbtree_node_t           *node;
+    ngx_http_stats_node_t       *sn;
+    ngx_http_stats_entry_t      *entry;
+    ngx_http_stats_main_conf_t  *smcf;
+
+    smcf = shm_zone->data;
+
+    if (osmcf) {
+        smcf->sh = osmcf->sh;
+        smcf->shpool = osmcf->shpool;
+
+    } else {
+        smcf->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+        smcf->sh = ngx_slab_alloc(smcf->shpool,
+                                  sizeof(ngx_http_stats_shctx_t));
+        if (smcf->sh == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_rbt_black(&smcf->sh->sentinel);
+
+        smcf->sh->rbtree.root = &smcf->sh->sentinel;
+        smcf->sh->rbtree.sentinel = &smcf->sh->sentinel;
+        smcf->sh->rbtree.insert = ngx_http_stats_rbtree_insert_value;
+    }
+
+    /*
+     * the counters are kept across reconfiguration by the entry type
+     * and name; the nodes of the removed entries are never freed,
+     * because the old worker processes may still update them
+     */
+
+    entry = smcf->entries.elts;
+
+    for (i = 0; i < smcf->entries.nelts; i++) {
+
+        hash = ngx_crc32_short(entry[i].key.data, entry[i].key.len);
+
+        node = ngx_http_stats_lookup(&smcf->sh->rbtree, hash,
+                                     entry[i].key.data, entry[i].key.len);
+
+        if (node) {
+            entry[i].node = (ngx_http_stats_node_t *) node;
+            continue;
+        }
+
+        size = offsetof(ngx_http_stats_node_t, data) + entry[i].key.len;
+
+        sn = ngx_slab_alloc(smcf->shpool, size);
+        if (sn == NULL) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "stats_zone \"%V\" is too small", &shm_zone->name);
+            return NGX_ERROR;
+        }
+
+        ngx_memzero(sn, size);
+
+        sn->node.key = hash;
+        sn->len = (u_short) entry[i].key.len;
+        ngx_memcpy(sn->data, entry[i].key.data, entry[i].key.len);
+
+        ngx_rbtree_insert(&smcf->sh->rbtree, &sn->node);
+
+        entry[i].node = sn;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_rbtree_node_t *
+ngx_http_stats_lookup(ngx_rbtree_t *rbtree, uint32_t hash, u_char *data,
+    size_t len)
+{
+    ngx_int_t               rc;
+    ngx_rbtree_node_t      *node, *sentinel;
+    ngx_http_stats_node_t  *sn;
+
+    node = rbtree->root;
+    sentinel = rbtree->sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        sn = (ngx_http_stats_node_t *) node;
+
+        if (len != (size_t) sn->len) {
+            rc = (len < (size_t) sn->len) ? -1 : 1;
+
+        } else {
+            rc = ngx_memcmp(data, sn->data, len);
+        }
+
+        if (rc == 0) {
+            return node;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_stats_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_int_t               rc;
+    ngx_rbtree_node_t     **p;
+    ngx_http_stats_node_t  *snn, *snt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            snn = (ngx_http_stats_node_t *) node;
+            snt = (ngx_http_stats_node_t *) temp;
+
+            if (snn->len != snt->len) {
+                rc = (snn->len < snt->len) ? -1 : 1;
+
+            } else {
+                rc = ngx_memcmp(snn->data, snt->data, snn->len);
+            }
+
+            p = (rc < 0) ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static ngx_int_t
+ngx_http_stats_add_entry(ngx_conf_t *cf, ngx_http_stats_main_conf_t *smcf,
+    ngx_uint_t type, ngx_str_t *name)
+{
+    u_char                  *p;
+    ngx_uint_t               i;
+    ngx_http_stats_entry_t  *entry;
+
+    entry = smcf->entries.elts;
+
+    for (i = 0; i < smcf->entries.nelts; i++) {
+        if (entry[i].type == type
+            && entry[i].name.len == name->len
+            && ngx_strncmp(entry[i].name.data, name->data, name->len) == 0)
+        {
+            return i;
+        }
+    }
+
+    entry = ngx_array_push(&smcf->entries);
+    if (entry == NULL) {
+        return NGX_ERROR;
+    }
+
+    entry->type = type;
+    entry->name = *name;
+    entry->node = NULL;
+
+    entry->key.len = ngx_http_stats_types[type].len + 1 + name->len;
+    entry->key.data = ngx_palloc(cf->pool, entry->key.len);
+    if (entry->key.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_cpymem(entry->key.data, ngx_http_stats_types[type].data,
+                   ngx_http_stats_types[type].len);
+    *p++ = ' ';
+    ngx_memcpy(p, name->data, name->len);
+
+    return smcf->entries.nelts - 1;
+}
+
+
+static void *
+ngx_http_stats_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_stats_main_conf_t  *smcf;
+
+    smcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_stats_main_conf_t));
+    if (smcf == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     smcf->shm_zone = NULL;
+     *     smcf->sh = NULL;
+     *     smcf->peers = { NULL, 0 };
+     */
+
+    if (ngx_array_init(&smcf->entries, cf->pool, 8,
+                       sizeof(ngx_http_stats_entry_t))
+        != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    return smcf;
+}
+
+
+static void *
+ngx_http_stats_create_srv_conf(ngx_conf_t *cf)
+{
+    ngx_http_stats_srv_conf_t  *sscf;
+
+    sscf = ngx_palloc(cf->pool, sizeof(ngx_http_stats_srv_conf_t));
+    if (sscf == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    sscf->server = NGX_CONF_UNSET;
+
+    return sscf;
+}
+
+
+static void *
+ngx_http_stats_create_loc_conf(ngx_conf_t *cf)
+{
+    ngx_http_stats_loc_conf_t  *slcf;
+
+    slcf = ngx_palloc(cf->pool, sizeof(ngx_http_stats_loc_conf_t));
+    if (slcf == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    slcf->group = NGX_CONF_UNSET;
+
+    return slcf;
+}
+
+
+static char *
+ngx_http_stats_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_stats_loc_conf_t *prev = parent;
+    ngx_http_stats_loc_conf_t *conf = child;
+
+    ngx_conf_merge_value(conf->group, prev->group, NGX_HTTP_STATS_OFF);
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_stats_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_stats_main_conf_t *smcf = conf;
+
+    u_char     *p;
+    size_t      size;
+    ngx_str_t  *value, name, s;
+
+    if (smcf->shm_zone) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    p = (u_char *) ngx_strchr(value[1].data, ':');
+
+    if (p == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone size \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    name.data = value[1].data;
+    name.len = p - name.data;
+
+    s.data = p + 1;
+    s.len = value[1].data + value[1].len - s.data;
+
+    size = ngx_parse_size(&s);
+
+    if (size == (size_t) NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone size \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (size < 8 * ngx_pagesize) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone \"%V\" is too small", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    smcf->shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                           &ngx_http_stats_module);
+    if (smcf->shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (smcf->shm_zone->data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "stats_zone \"%V\" is already used", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    smcf->shm_zone->init = ngx_http_stats_init_zone;
+    smcf->shm_zone->data = smcf;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_stats_group(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_stats_loc_conf_t *slcf = conf;
+
+    ngx_str_t                   *value;
+    ngx_http_stats_main_conf_t  *smcf;
+
+    if (slcf->group != NGX_CONF_UNSET) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        slcf->group = NGX_HTTP_STATS_OFF;
+        return NGX_CONF_OK;
+    }
+
+    smcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_stats_module);
+
+    slcf->group = ngx_http_stats_add_entry(cf, smcf, NGX_HTTP_STATS_GROUP,
+                                           &value[1]);
+    if (slcf->group == NGX_ERROR) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_stats(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_stats_handler;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_stats_init(ngx_conf_t *cf)
+{
+    ngx_int_t                       n;
+    ngx_uint_t                      i, p;
+    ngx_array_t                     keys;
+    ngx_hash_key_t                 *key;
+    ngx_hash_init_t                 hash;
+    ngx_http_handler_pt            *h;
+    ngx_http_stats_entry_t         *entry;
+    ngx_http_core_srv_conf_t      **cscfp;
+    ngx_http_stats_srv_conf_t      *sscf;
+    ngx_http_core_main_conf_t      *cmcf;
+    ngx_http_stats_main_conf_t     *smcf;
+    ngx_http_upstream_srv_conf_t  **uscfp;
+    ngx_http_upstream_main_conf_t  *umcf;
+    ngx_http_upstream_rr_peers_t   *peers;
+
+    smcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_stats_module);
+
+    if (smcf->shm_zone == NULL) {
+        if (smcf->entries.nelts) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "\"stats_group\" requires \"stats_zone\"");
+            return NGX_ERROR;
+        }
+
+        return NGX_OK;
+    }
+
+    /* every virtual server is accounted by its primary name */
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+    cscfp = cmcf->servers.elts;
+
+    for (i = 0; i < cmcf->servers.nelts; i++) {
+        sscf = cscfp[i]->ctx->srv_conf[ngx_http_stats_module.ctx_index];
+
+        sscf->server = ngx_http_stats_add_entry(cf, smcf,
+                                                NGX_HTTP_STATS_SERVER,
+                                                &cscfp[i]->server_name);
+        if (sscf->server == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+    }
+
+    /*
+     * the upstream peers are taken from the round robin peers list
+     * that all balancers build, a peer is accounted by its address
+     * even if it is used in several upstreams
+     */
+
+    if (ngx_array_init(&keys, cf->temp_pool, 8, sizeof(ngx_hash_key_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    umcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_upstream_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+        peers = uscfp[i]->peer.data;
+
+        if (peers == NULL) {
+            continue;
+        }
+
+        for (p = 0; p < peers->number; p++) {
+            n = ngx_http_stats_add_entry(cf, smcf, NGX_HTTP_STATS_PEER,
+                                         &peers->peer[p].name);
+            if (n == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+
+            if ((ngx_uint_t) n != smcf->entries.nelts - 1) {
+                continue;
+            }
+
+            key = ngx_array_push(&keys);
+            if (key == NULL) {
+                return NGX_ERROR;
+            }
+
+            key->key = peers->peer[p].name;
+            key->key_hash = ngx_hash_key(key->key.data, key->key.len);
+            key->value = (void *) (uintptr_t) (n + 1);
+        }
+    }
+
+    if (keys.nelts) {
+
+        /* the entries array does not change anymore */
+
+        entry = smcf->entries.elts;
+        key = keys.elts;
+
+        for (i = 0; i < keys.nelts; i++) {
+            key[i].value = &entry[(uintptr_t) key[i].value - 1];
+        }
+
+        hash.hash = &smcf->peers;
+        hash.key = ngx_hash_key;
+        hash.max_size = 512;
+        hash.bucket_size = ngx_align(64, ngx_cacheline_size);
+        hash.name = "stats_peers_hash";
+        hash.pool = cf->pool;
+        hash.temp_pool = NULL;
+
+        if (ngx_hash_init(&hash, keys.elts, keys.nelts) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    h = ngx_array_push(&cmcf->phases[NGX_HTTP_LOG_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_http_stats_log_handler;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_stats_init_module(ngx_cycle_t *cycle)
+{
+    size_t                       size;
+    ngx_core_conf_t             *ccf;
+    ngx_http_stats_shctx_t      *sh;
+    ngx_http_stats_main_conf_t  *smcf;
+
+    if (cycle->conf_ctx[ngx_http_module.index] == NULL) {
+        return NGX_OK;
+    }
+
+    smcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_stats_module);
+
+    if (smcf->sh == NULL) {
+        return NGX_OK;
+    }
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    sh = smcf->sh;
+
+    /*
+     * the histograms are allocated for the number of worker processes,
+     * the old ones are not freed because the old worker processes
+     * may still update them
+     */
+
+    if (sh->timing == NULL
+        || sh->workers < (ngx_uint_t) ccf->worker_processes)
+    {
+        size = ccf->worker_processes * NGX_HTTP_STATS_TIMINGS
+               * sizeof(ngx_http_stats_hist_t);
+
+        sh->timing = ngx_slab_alloc(smcf->shpool, size);
+        if (sh->timing == NULL) {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                          "stats_zone \"%V\" is too small",
+                          &smcf->shm_zone->name);
+            return NGX_ERROR;
+        }
+
+        ngx_memzero(sh->timing, size);
+
+        sh->workers = ccf->worker_processes;
+    }
+
+    smcf->timing = sh->timing;
+    smcf->workers = sh->workers;
+
+    return NGX_OK;
+}
@@ -0,0 +1,576 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/* the state of a peer shared by all worker processes */
+
+typedef struct {
+    ngx_atomic_t                       conns;
+
+    /* the peak EWMA of the upstream header time in microseconds */
+    ngx_uint_t                         cost;
+    ngx_msec_t                         stamp;
+} ngx_http_upstream_least_conn_peer_t;
+
+
+typedef struct {
+    /* the zero decay time means the plain least connections balancing */
+    ngx_msec_t                         decay;
+
+    ngx_uint_t                         number;
+    ngx_http_upstream_least_conn_peer_t  *peers;
+
+    ngx_slab_pool_t                   *shpool;
+    ngx_shm_zone_t                    *shm_zone;
+} ngx_http_upstream_least_conn_srv_conf_t;
+
+
+typedef struct {
+    /* the round robin data must be first */
+    ngx_http_upstream_rr_peer_data_t   rrp;
+
+    ngx_http_upstream_least_conn_srv_conf_t  *conf;
+
+    ngx_http_upstream_t               *upstream;
+
+    /* the shared state of the peer in use, it is counted in the "conns" */
+    ngx_http_upstream_least_conn_peer_t  *peer;
+} ngx_http_upstream_least_conn_peer_data_t;
+
+
+static ngx_int_t ngx_http_upstream_init_least_conn_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_get_least_conn_peer(
+    ngx_peer_connection_t *pc, void *data);
+static void ngx_http_upstream_free_least_conn_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+static uint64_t ngx_http_upstream_least_conn_load(
+    ngx_http_upstream_least_conn_srv_conf_t *lcf,
+    ngx_http_upstream_least_conn_peer_t *sp, ngx_msec_t now);
+static void ngx_http_upstream_least_conn_update(
+    ngx_http_upstream_least_conn_peer_data_t *lcp);
+static ngx_int_t ngx_http_upstream_least_conn_init_zone(
+    ngx_shm_zone_t *shm_zone, void *data);
+
+static void *ngx_http_upstream_least_conn_create_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_least_conn(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_upstream_peak_ewma(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_upstream_least_conn_commands[] = {
+
+    { ngx_string("least_conn"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_NOARGS,
+      ngx_http_upstream_least_conn,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("peak_ewma"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE1,
+      ngx_http_upstream_peak_ewma,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_least_conn_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_upstream_least_conn_create_conf, /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_least_conn_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_least_conn_module_ctx, /* module context */
+    ngx_http_upstream_least_conn_commands, /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+ngx_int_t
+ngx_http_upstream_init_least_conn(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    size_t                                    size;
+    ngx_str_t                                 name;
+    ngx_shm_zone_t                           *shm_zone;
+    ngx_http_upstream_rr_peers_t             *peers;
+    ngx_http_upstream_least_conn_srv_conf_t  *lcf;
+
+    if (ngx_http_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    us->peer.init = ngx_http_upstream_init_least_conn_peer;
+
+    lcf = ngx_http_conf_upstream_srv_conf(us,
+                                          ngx_http_upstream_least_conn_module);
+
+    peers = us->peer.data;
+    lcf->number = peers->number;
+
+    /* the peer states are kept in the zone named after the upstream */
+
+    name.len = sizeof("upstream_least_conn:") - 1 + us->host.len;
+
+    name.data = ngx_palloc(cf->pool, name.len);
+    if (name.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(name.data, "upstream_least_conn:%V", &us->host);
+
+    size = lcf->number * sizeof(ngx_http_upstream_least_conn_peer_t);
+    size = 8 * ngx_pagesize + ngx_align(size, ngx_pagesize);
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_upstream_least_conn_module);
+    if (shm_zone == NULL) {
+        return NGX_ERROR;
+    }
+
+    shm_zone->init = ngx_http_upstream_least_conn_init_zone;
+    shm_zone->data = lcf;
+
+    lcf->shm_zone = shm_zone;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_least_conn_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_upstream_least_conn_peer_data_t  *lcp;
+
+    lcp = ngx_palloc(r->pool,
+                     sizeof(ngx_http_upstream_least_conn_peer_data_t));
+    if (lcp == NULL) {
+        return NGX_ERROR;
+    }
+
+    r->upstream->peer.data = &lcp->rrp;
+
+    if (ngx_http_upstream_init_round_robin_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    r->upstream->peer.get = ngx_http_upstream_get_least_conn_peer;
+    r->upstream->peer.free = ngx_http_upstream_free_least_conn_peer;
+
+    lcp->conf = ngx_http_conf_upstream_srv_conf(us,
+                                          ngx_http_upstream_least_conn_module);
+    lcp->upstream = r->upstream;
+    lcp->peer = NULL;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_upstream_least_conn_peer_data_t  *lcp = data;
+
+    time_t                         now;
+    uint64_t                       load, best_load;
+    uintptr_t                      m;
+    ngx_uint_t                     i, j, n, p;
+    ngx_msec_t                     msec;
+    ngx_http_upstream_rr_peer_t   *peer, *best;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get least conn peer, try: %ui", pc->tries);
+
+    pc->cached = 0;
+    pc->connection = NULL;
+
+    peers = lcp->rrp.peers;
+
+    now = ngx_time();
+    msec = ngx_current_msec;
+
+    best = NULL;
+    best_load = 0;
+    p = 0;
+
+    /*
+     * the scan starts from the current round robin peer, so the peers
+     * with the equal load are chosen in the weighted round robin order
+     */
+
+    for (j = 0; j < peers->number; j++) {
+
+        i = (peers->current + j) % peers->number;
+
+        n = i / (8 * sizeof(uintptr_t));
+        m = (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+
+        if (lcp->rrp.tried[n] & m) {
+            continue;
+        }
+
+        peer = &peers->peer[i];
+
+        if (peers->number > 1) {
+
+            if (peer->down) {
+                continue;
+            }
+
+            if (peer->max_fails && peer->fails >= peer->max_fails) {
+
+                if (now - peer->accessed <= peer->fail_timeout) {
+                    continue;
+                }
+
+                peer->fails = 0;
+            }
+        }
+
+        load = ngx_http_upstream_least_conn_load(lcp->conf,
+                                                 &lcp->conf->peers[i], msec);
+
+        /* load / weight < best_load / best->weight */
+
+        if (best == NULL || load * best->weight < best_load * peer->weight) {
+            best = peer;
+            best_load = load;
+            p = i;
+        }
+    }
+
+    if (best == NULL) {
+
+        /* all peers failed, mark them as live for quick recovery */
+
+        for (i = 0; i < peers->number; i++) {
+            peers->peer[i].fails = 0;
+        }
+
+        pc->name = peers->name;
+
+        return NGX_BUSY;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get least conn peer, current: %ui, load: %uL",
+                   p, best_load);
+
+    peers->current = p;
+
+    best->current_weight--;
+
+    if (best->current_weight == 0) {
+        best->current_weight = best->weight;
+
+        if (++peers->current >= peers->number) {
+            peers->current = 0;
+        }
+    }
+
+    n = p / (8 * sizeof(uintptr_t));
+    m = (uintptr_t) 1 << p % (8 * sizeof(uintptr_t));
+
+    lcp->rrp.current = p;
+    lcp->rrp.tried[n] |= m;
+
+    lcp->peer = &lcp->conf->peers[p];
+
+    (void) ngx_atomic_fetch_add(&lcp->peer->conns, 1);
+
+    pc->sockaddr = best->sockaddr;
+    pc->socklen = best->socklen;
+    pc->name = &best->name;
+#if (NGX_SSL)
+    pc->ssl_session = best->ssl_session;
+#endif
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_free_least_conn_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state)
+{
+    ngx_http_upstream_least_conn_peer_data_t  *lcp = data;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "free least conn peer %ui %ui", pc->tries, state);
+
+    if (lcp->peer) {
+
+        if (lcp->conf->decay && !(state & NGX_PEER_FAILED)) {
+            ngx_http_upstream_least_conn_update(lcp);
+        }
+
+        (void) ngx_atomic_fetch_add(&lcp->peer->conns, -1);
+
+        lcp->peer = NULL;
+    }
+
+    ngx_http_upstream_free_round_robin_peer(pc, &lcp->rrp, state);
+}
+
+
+static uint64_t
+ngx_http_upstream_least_conn_load(ngx_http_upstream_least_conn_srv_conf_t *lcf,
+    ngx_http_upstream_least_conn_peer_t *sp, ngx_msec_t now)
+{
+    uint64_t        cost;
+    ngx_msec_int_t  td;
+
+    if (lcf->decay == 0) {
+        return sp->conns;
+    }
+
+    /*
+     * the cost decays while the peer gets no responses,
+     * so a peer that was slow once is tried again
+     */
+
+    cost = sp->cost;
+    td = (ngx_msec_int_t) (now - sp->stamp);
+
+    if (td > 0) {
+        cost = cost * lcf->decay / (lcf->decay + td);
+    }
+
+    return (cost + 1) * (sp->conns + 1);
+}
+
+
+static void
+ngx_http_upstream_least_conn_update(
+    ngx_http_upstream_least_conn_peer_data_t *lcp)
+{
+    uint64_t                              cost;
+    ngx_msec_t                            now, rtt;
+    ngx_msec_int_t                        td;
+    ngx_http_upstream_state_t            *state;
+    ngx_http_upstream_least_conn_peer_t  *sp;
+
+    /*
+     * the failed tries are accounted by the round robin max_fails,
+     * and the tries without a response header give no sample
+     */
+
+    state = lcp->upstream->state;
+
+    if (state == NULL || state->header_time == (ngx_msec_t) -1) {
+        return;
+    }
+
+    rtt = state->header_time * 1000;
+    sp = lcp->peer;
+
+    ngx_shmtx_lock(&lcp->conf->shpool->mutex);
+
+    now = ngx_current_msec;
+    td = (ngx_msec_int_t) (now - sp->stamp);
+
+    if (rtt > sp->cost || td <= 0) {
+
+        /* the peak is taken at once */
+
+        if (rtt > sp->cost) {
+            sp->cost = rtt;
+        }
+
+    } else {
+        cost = (uint64_t) sp->cost * lcp->conf->decay + (uint64_t) rtt * td;
+        sp->cost = (ngx_uint_t) (cost / (lcp->conf->decay + td));
+    }
+
+    sp->stamp = now;
+
+    ngx_shmtx_unlock(&lcp->conf->shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, lcp->upstream->peer.log, 0,
+                   "least conn peer cost: %ui, rtt: %M",
+                   sp->cost, state->header_time);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_least_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_upstream_least_conn_srv_conf_t  *olcf = data;
+
+    size_t                                    size;
+    ngx_http_upstream_least_conn_srv_conf_t  *lcf;
+
+    lcf = shm_zone->data;
+
+    if (olcf && olcf->number == lcf->number) {
+        lcf->shpool = olcf->shpool;
+        lcf->peers = olcf->peers;
+
+        return NGX_OK;
+    }
+
+    lcf->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    /*
+     * the states of the changed peers are not freed,
+     * because the old worker processes may still update them
+     */
+
+    size = lcf->number * sizeof(ngx_http_upstream_least_conn_peer_t);
+
+    lcf->peers = ngx_slab_alloc(lcf->shpool, size);
+    if (lcf->peers == NULL) {
+        ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                      "could not allocate the peers in zone \"%V\"",
+                      &shm_zone->name);
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(lcf->peers, size);
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_upstream_least_conn_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_least_conn_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool,
+                       sizeof(ngx_http_upstream_least_conn_srv_conf_t));
+    if (conf == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->number = 0;
+     *     conf->peers = NULL;
+     *     conf->shpool = NULL;
+     *     conf->shm_zone = NULL;
+     */
+
+    conf->decay = NGX_CONF_UNSET_MSEC;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_least_conn(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_least_conn_srv_conf_t  *lcf = conf;
+
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    if (lcf->decay != NGX_CONF_UNSET_MSEC) {
+        return "is duplicate";
+    }
+
+    lcf->decay = 0;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    uscf->peer.init_upstream = ngx_http_upstream_init_least_conn;
+
+    uscf->flags = NGX_HTTP_UPSTREAM_CREATE
+                  |NGX_HTTP_UPSTREAM_WEIGHT
+                  |NGX_HTTP_UPSTREAM_MAX_FAILS
+                  |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
+                  |NGX_HTTP_UPSTREAM_DOWN;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_upstream_peak_ewma(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_least_conn_srv_conf_t  *lcf = conf;
+
+    ngx_int_t                      n;
+    ngx_str_t                     *value, s;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    if (lcf->decay != NGX_CONF_UNSET_MSEC) {
+        return "is duplicate";
+    }
+
+    /* the default decay time is 10s */
+
+    lcf->decay = 10000;
+
+    value = cf->args->elts;
+
+    if (cf->args->nelts == 2) {
+
+        if (ngx_strncmp(value[1].data, "decay=", 6) != 0) {
+            goto invalid;
+        }
+
+        s.len = value[1].len - 6;
+        s.data = &value[1].data[6];
+
+        n = ngx_parse_time(&s, 0);
+
+        if (n == NGX_ERROR || n == 0) {
+            goto invalid;
+        }
+
+        lcf->decay = (ngx_msec_t) n;
+    }
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    uscf->peer.init_upstream = ngx_http_upstream_init_least_conn;
+
+    uscf->flags = NGX_HTTP_UPSTREAM_CREATE
+                  |NGX_HTTP_UPSTREAM_WEIGHT
+                  |NGX_HTTP_UPSTREAM_MAX_FAILS
+                  |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
+                  |NGX_HTTP_UPSTREAM_DOWN;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[1]);
+
+    return NGX_CONF_ERROR;
+}
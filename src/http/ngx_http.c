@@ -10,6 +10,15 @@
 #include <ngx_http.h>
 
 
+typedef struct {
+    ngx_queue_t                 queue;
+    ngx_queue_t                 list;
+    ngx_str_t                  *name;
+    ngx_http_core_loc_conf_t   *exact;
+    ngx_http_core_loc_conf_t   *inclusive;
+} ngx_http_location_queue_t;
+
+
 static char *ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static ngx_int_t ngx_http_add_address(ngx_conf_t *cf,
     ngx_http_conf_in_port_t *in_port, ngx_http_listen_t *lscf,
@@ -19,6 +28,15 @@ static ngx_int_t ngx_http_add_names(ngx_conf_t *cf,
 static char *ngx_http_merge_locations(ngx_conf_t *cf,
     ngx_array_t *locations, void **loc_conf, ngx_http_module_t *module,
     ngx_uint_t ctx_index);
+static ngx_int_t ngx_http_init_locations(ngx_conf_t *cf,
+    ngx_http_core_loc_conf_t *pclcf, ngx_array_t *locations);
+static ngx_int_t ngx_http_join_exact_locations(ngx_conf_t *cf,
+    ngx_queue_t *locations);
+static void ngx_http_create_locations_list(ngx_queue_t *locations,
+    ngx_queue_t *q);
+static ngx_http_location_tree_node_t *
+    ngx_http_create_locations_tree(ngx_conf_t *cf, ngx_queue_t *locations,
+    size_t prefix);
 static int ngx_libc_cdecl ngx_http_cmp_conf_in_addrs(const void *one,
     const void *two);
 static int ngx_libc_cdecl ngx_http_cmp_dns_wildcards(const void *one,
@@ -104,6 +122,8 @@ ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_iocp_conf_t             *iocpcf;
 #endif
 
+    ngx_http_parse_init();
+
     /* the main http context */
 
     ctx = ngx_pcalloc(cf->pool, sizeof(ngx_http_conf_ctx_t));
@@ -287,6 +307,20 @@ ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
 
+    /* create the location trees */
+
+    for (s = 0; s < cmcf->servers.nelts; s++) {
+
+        clcf = cscfp[s]->ctx->loc_conf[ngx_http_core_module.ctx_index];
+
+        if (ngx_http_init_locations(cf, clcf, &cscfp[s]->locations)
+            != NGX_OK)
+        {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+
     /* init lists of the handlers */
 
     if (ngx_array_init(&cmcf->phases[NGX_HTTP_POST_READ_PHASE].handlers,
@@ -788,6 +822,10 @@ ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             ls->rcvbuf = in_addr[a].listen_conf->rcvbuf;
             ls->sndbuf = in_addr[a].listen_conf->sndbuf;
 
+#if (NGX_HAVE_REUSEPORT)
+            ls->reuseport = in_addr[a].listen_conf->reuseport;
+#endif
+
 #if (NGX_HAVE_DEFERRED_ACCEPT && defined SO_ACCEPTFILTER)
             ls->accept_filter = in_addr[a].listen_conf->accept_filter;
 #endif
@@ -1027,6 +1065,322 @@ ngx_http_merge_locations(ngx_conf_t *cf, ngx_array_t *locations,
 }
 
 
+/*
+ * the locations array is sorted by ngx_http_core_cmp_locations():
+ * the static locations go first in the lexicographical order,
+ * then the regex and then the no named ones
+ */
+
+static ngx_int_t
+ngx_http_init_locations(ngx_conf_t *cf, ngx_http_core_loc_conf_t *pclcf,
+    ngx_array_t *locations)
+{
+    ngx_uint_t                   i;
+    ngx_queue_t                  static_locations;
+    ngx_http_core_loc_conf_t   **clcfp;
+    ngx_http_location_queue_t   *lq;
+#if (NGX_PCRE)
+    ngx_uint_t                   n;
+    ngx_regex_t                **re;
+    ngx_http_core_loc_conf_t   **regex;
+#endif
+
+    ngx_queue_init(&static_locations);
+
+#if (NGX_PCRE)
+    n = 0;
+#endif
+
+    clcfp = locations->elts;
+
+    for (i = 0; i < locations->nelts; i++) {
+
+        if (clcfp[i]->noname) {
+            continue;
+        }
+
+        if (ngx_http_init_locations(cf, clcfp[i], &clcfp[i]->locations)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+#if (NGX_PCRE)
+        if (clcfp[i]->regex) {
+            n++;
+            continue;
+        }
+#endif
+
+        lq = ngx_palloc(cf->temp_pool, sizeof(ngx_http_location_queue_t));
+        if (lq == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (clcfp[i]->exact_match) {
+            lq->exact = clcfp[i];
+            lq->inclusive = NULL;
+
+        } else {
+            lq->exact = NULL;
+            lq->inclusive = clcfp[i];
+        }
+
+        lq->name = &clcfp[i]->name;
+        ngx_queue_init(&lq->list);
+
+        ngx_queue_insert_tail(&static_locations, &lq->queue);
+    }
+
+#if (NGX_PCRE)
+
+    if (n) {
+        regex = ngx_palloc(cf->pool,
+                           (n + 1) * sizeof(ngx_http_core_loc_conf_t *));
+        if (regex == NULL) {
+            return NGX_ERROR;
+        }
+
+        pclcf->regex_locations = regex;
+
+        for (i = 0; i < locations->nelts; i++) {
+            if (clcfp[i]->regex && !clcfp[i]->noname) {
+                *regex++ = clcfp[i];
+            }
+        }
+
+        *regex = NULL;
+
+        /* the regexes' literals pre-filter */
+
+        if (n > 1) {
+            re = ngx_palloc(cf->temp_pool, n * sizeof(ngx_regex_t *));
+            if (re == NULL) {
+                return NGX_ERROR;
+            }
+
+            for (i = 0; i < n; i++) {
+                re[i] = pclcf->regex_locations[i]->regex;
+            }
+
+            pclcf->regex_filter = ngx_regex_filter_create(cf->pool, re, n);
+            if (pclcf->regex_filter == NULL) {
+                return NGX_ERROR;
+            }
+        }
+    }
+
+#endif
+
+    if (ngx_queue_empty(&static_locations)) {
+        return NGX_OK;
+    }
+
+    if (ngx_http_join_exact_locations(cf, &static_locations) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_http_create_locations_list(&static_locations,
+                                   ngx_queue_head(&static_locations));
+
+    pclcf->static_locations = ngx_http_create_locations_tree(cf,
+                                                      &static_locations, 0);
+    if (pclcf->static_locations == NULL) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+/* merge the "= /name" and "/name" locations into the one queue element */
+
+static ngx_int_t
+ngx_http_join_exact_locations(ngx_conf_t *cf, ngx_queue_t *locations)
+{
+    ngx_queue_t                *q, *x;
+    ngx_http_location_queue_t  *lq, *lx;
+
+    q = ngx_queue_head(locations);
+
+    while (q != ngx_queue_last(locations)) {
+
+        x = ngx_queue_next(q);
+
+        lq = (ngx_http_location_queue_t *) q;
+        lx = (ngx_http_location_queue_t *) x;
+
+        if (lq->name->len == lx->name->len
+            && ngx_strncmp(lq->name->data, lx->name->data, lx->name->len) == 0)
+        {
+            if ((lq->exact && lx->exact) || (lq->inclusive && lx->inclusive)) {
+                ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                              "duplicate location \"%V\"", lx->name);
+
+                return NGX_ERROR;
+            }
+
+            if (lx->exact) {
+                lq->exact = lx->exact;
+
+            } else {
+                lq->inclusive = lx->inclusive;
+            }
+
+            ngx_queue_remove(x);
+
+            continue;
+        }
+
+        q = ngx_queue_next(q);
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * move the locations that start with the inclusive location name
+ * to the list of this location
+ */
+
+static void
+ngx_http_create_locations_list(ngx_queue_t *locations, ngx_queue_t *q)
+{
+    u_char                     *name;
+    size_t                      len;
+    ngx_queue_t                *x, tail;
+    ngx_http_location_queue_t  *lq, *lx;
+
+    if (q == ngx_queue_last(locations)) {
+        return;
+    }
+
+    lq = (ngx_http_location_queue_t *) q;
+
+    if (lq->inclusive == NULL) {
+        ngx_http_create_locations_list(locations, ngx_queue_next(q));
+        return;
+    }
+
+    len = lq->name->len;
+    name = lq->name->data;
+
+    for (x = ngx_queue_next(q);
+         x != ngx_queue_sentinel(locations);
+         x = ngx_queue_next(x))
+    {
+        lx = (ngx_http_location_queue_t *) x;
+
+        if (len > lx->name->len
+            || ngx_strncmp(name, lx->name->data, len) != 0)
+        {
+            break;
+        }
+    }
+
+    q = ngx_queue_next(q);
+
+    if (q == x) {
+        ngx_http_create_locations_list(locations, x);
+        return;
+    }
+
+    ngx_queue_split(locations, q, &tail);
+    ngx_queue_add(&lq->list, &tail);
+
+    if (x == ngx_queue_sentinel(locations)) {
+        ngx_http_create_locations_list(&lq->list, ngx_queue_head(&lq->list));
+        return;
+    }
+
+    ngx_queue_split(&lq->list, x, &tail);
+    ngx_queue_add(locations, &tail);
+
+    ngx_http_create_locations_list(&lq->list, ngx_queue_head(&lq->list));
+
+    ngx_http_create_locations_list(locations, x);
+}
+
+
+/*
+ * to keep the tree balanced the middle element of the sorted list
+ * becomes the root, the lesser and greater parts become its subtrees
+ */
+
+static ngx_http_location_tree_node_t *
+ngx_http_create_locations_tree(ngx_conf_t *cf, ngx_queue_t *locations,
+    size_t prefix)
+{
+    size_t                          len;
+    ngx_queue_t                    *q, tail;
+    ngx_http_location_queue_t      *lq;
+    ngx_http_location_tree_node_t  *node;
+
+    q = ngx_queue_middle(locations);
+
+    lq = (ngx_http_location_queue_t *) q;
+    len = lq->name->len - prefix;
+
+    node = ngx_palloc(cf->pool,
+                      offsetof(ngx_http_location_tree_node_t, name) + len);
+    if (node == NULL) {
+        return NULL;
+    }
+
+    node->left = NULL;
+    node->right = NULL;
+    node->tree = NULL;
+    node->exact = lq->exact;
+    node->inclusive = lq->inclusive;
+
+    node->auto_redirect = (lq->exact && lq->exact->auto_redirect)
+                          || (lq->inclusive && lq->inclusive->auto_redirect);
+
+    node->len = len;
+    ngx_memcpy(node->name, lq->name->data + prefix, len);
+
+    ngx_queue_split(locations, q, &tail);
+
+    if (ngx_queue_empty(locations)) {
+        /*
+         * ngx_queue_middle() returns the only element of a single
+         * element queue, so the right part is empty too
+         */
+        goto inclusive;
+    }
+
+    node->left = ngx_http_create_locations_tree(cf, locations, prefix);
+    if (node->left == NULL) {
+        return NULL;
+    }
+
+    ngx_queue_remove(q);
+
+    if (ngx_queue_empty(&tail)) {
+        goto inclusive;
+    }
+
+    node->right = ngx_http_create_locations_tree(cf, &tail, prefix);
+    if (node->right == NULL) {
+        return NULL;
+    }
+
+inclusive:
+
+    if (ngx_queue_empty(&lq->list)) {
+        return node;
+    }
+
+    node->tree = ngx_http_create_locations_tree(cf, &lq->list, prefix + len);
+    if (node->tree == NULL) {
+        return NULL;
+    }
+
+    return node;
+}
+
+
 static int ngx_libc_cdecl
 ngx_http_cmp_conf_in_addrs(const void *one, const void *two)
 {
@@ -8,12 +8,29 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 
+#if (NGX_THREAD_POOL)
+#include <ngx_thread_pool.h>
+#endif
+
 
 typedef struct {
-    ngx_bufs_t  bufs;
+    ngx_bufs_t          bufs;
+    ngx_flag_t          aio;
+#if (NGX_THREAD_POOL)
+    ngx_thread_pool_t  *thread_pool;
+#endif
 } ngx_http_copy_filter_conf_t;
 
 
+#if (NGX_THREAD_POOL)
+static ngx_int_t ngx_http_copy_thread_handler(ngx_thread_task_t *task,
+    ngx_file_t *file);
+static void ngx_http_copy_thread_event_handler(ngx_event_t *ev);
+static void ngx_http_copy_thread_cleanup(void *data);
+#endif
+
+static char *ngx_http_copy_filter_aio(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static void *ngx_http_copy_filter_create_conf(ngx_conf_t *cf);
 static char *ngx_http_copy_filter_merge_conf(ngx_conf_t *cf,
     void *parent, void *child);
@@ -29,6 +46,13 @@ static ngx_command_t  ngx_http_copy_filter_commands[] = {
       offsetof(ngx_http_copy_filter_conf_t, bufs),
       NULL },
 
+    { ngx_string("aio"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_copy_filter_aio,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -104,6 +128,12 @@ ngx_http_copy_filter(ngx_http_request_t *r, ngx_chain_t *in)
         ctx->output_filter = (ngx_output_chain_filter_pt) ngx_http_next_filter;
         ctx->filter_ctx = r;
 
+#if (NGX_THREAD_POOL)
+        if (conf->aio) {
+            ctx->thread_handler = ngx_http_copy_thread_handler;
+        }
+#endif
+
         r->request_output = 1;
     }
 
@@ -128,6 +158,127 @@ ngx_http_copy_filter(ngx_http_request_t *r, ngx_chain_t *in)
 }
 
 
+#if (NGX_THREAD_POOL)
+
+static ngx_int_t
+ngx_http_copy_thread_handler(ngx_thread_task_t *task, ngx_file_t *file)
+{
+    ngx_http_request_t           *r;
+    ngx_pool_cleanup_t           *cln;
+    ngx_http_copy_filter_conf_t  *conf;
+
+    r = file->thread_ctx;
+
+    if (task->event.data == NULL) {
+
+        /* the new task of the file */
+
+        cln = ngx_pool_cleanup_add(r->pool, 0);
+        if (cln == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln->handler = ngx_http_copy_thread_cleanup;
+        cln->data = file;
+    }
+
+    task->event.data = r;
+    task->event.handler = ngx_http_copy_thread_event_handler;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_copy_filter_module);
+
+    return ngx_thread_task_post(conf->thread_pool, task);
+}
+
+
+static void
+ngx_http_copy_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_connection_t    *c;
+    ngx_http_request_t  *r;
+
+    r = ev->data;
+    c = r->connection;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http thread read done: \"%V?%V\"", &r->uri, &r->args);
+
+    /* resume the output as if the connection became writable */
+
+    c->write->handler(c->write);
+}
+
+
+static void
+ngx_http_copy_thread_cleanup(void *data)
+{
+    ngx_file_t  *file = data;
+
+    if (file->thread_task) {
+        ngx_thread_task_free(file->thread_task);
+        file->thread_task = NULL;
+    }
+}
+
+#endif
+
+
+static char *
+ngx_http_copy_filter_aio(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_copy_filter_conf_t *ccf = conf;
+
+    ngx_str_t  *value;
+#if (NGX_THREAD_POOL)
+    ngx_str_t   name;
+#endif
+
+    if (ccf->aio != NGX_CONF_UNSET) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        ccf->aio = 0;
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strncmp(value[1].data, "threads", 7) == 0
+        && (value[1].len == 7 || value[1].data[7] == '='))
+    {
+#if (NGX_THREAD_POOL)
+
+        if (value[1].len == 7) {
+            ccf->thread_pool = ngx_thread_pool_add(cf, NULL);
+
+        } else {
+            name.len = value[1].len - 8;
+            name.data = value[1].data + 8;
+
+            ccf->thread_pool = ngx_thread_pool_add(cf, &name);
+        }
+
+        if (ccf->thread_pool == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ccf->aio = 1;
+
+        return NGX_CONF_OK;
+
+#else
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"aio threads\" is unsupported on this platform, "
+                           "use the --with-thread_pool option");
+        return NGX_CONF_ERROR;
+#endif
+    }
+
+    return "invalid value";
+}
+
+
 static void *
 ngx_http_copy_filter_create_conf(ngx_conf_t *cf)
 {
@@ -139,6 +290,10 @@ ngx_http_copy_filter_create_conf(ngx_conf_t *cf)
     }
 
     conf->bufs.num = 0;
+    conf->aio = NGX_CONF_UNSET;
+#if (NGX_THREAD_POOL)
+    conf->thread_pool = NULL;
+#endif
 
     return conf;
 }
@@ -151,6 +306,10 @@ ngx_http_copy_filter_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_http_copy_filter_conf_t *conf = child;
 
     ngx_conf_merge_bufs_value(conf->bufs, prev->bufs, 1, 32768);
+    ngx_conf_merge_value(conf->aio, prev->aio, 0);
+#if (NGX_THREAD_POOL)
+    ngx_conf_merge_ptr_value(conf->thread_pool, prev->thread_pool, NULL);
+#endif
 
     return NULL;
 }
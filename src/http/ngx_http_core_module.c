@@ -23,8 +23,14 @@ typedef struct {
 #define NGX_HTTP_LOCATION_REGEX           4
 
 
+/* the regex locations' bitmap size that is allocated on stack, in words */
+#define NGX_HTTP_REGEX_CANDIDATES         4
+
+
 static ngx_int_t ngx_http_core_find_location(ngx_http_request_t *r,
-    ngx_array_t *locations, size_t len);
+    ngx_http_core_loc_conf_t *pclcf);
+static ngx_int_t ngx_http_core_find_static_location(ngx_http_request_t *r,
+    ngx_http_location_tree_node_t *node);
 
 static ngx_int_t ngx_http_core_preconfiguration(ngx_conf_t *cf);
 static void *ngx_http_core_create_main_conf(ngx_conf_t *cf);
@@ -63,8 +69,13 @@ static char *ngx_http_core_keepalive(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_core_internal(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
 static char *ngx_http_core_lowat_check(ngx_conf_t *cf, void *post, void *data);
+#if (NGX_HTTP_GZIP)
+static ngx_int_t ngx_http_gzip_accept_encoding(ngx_str_t *ae);
+#endif
 
 static ngx_conf_post_t  ngx_http_core_lowat_post =
                                                  { ngx_http_core_lowat_check };
@@ -74,6 +85,36 @@ static ngx_conf_deprecated_t  ngx_conf_deprecated_optimize_host_names = {
 };
 
 
+#if (NGX_HTTP_GZIP)
+
+static ngx_conf_enum_t  ngx_http_gzip_http_version[] = {
+    { ngx_string("1.0"), NGX_HTTP_VERSION_10 },
+    { ngx_string("1.1"), NGX_HTTP_VERSION_11 },
+    { ngx_null_string, 0 }
+};
+
+
+static ngx_conf_bitmask_t  ngx_http_gzip_proxied_mask[] = {
+    { ngx_string("off"), NGX_HTTP_GZIP_PROXIED_OFF },
+    { ngx_string("expired"), NGX_HTTP_GZIP_PROXIED_EXPIRED },
+    { ngx_string("no-cache"), NGX_HTTP_GZIP_PROXIED_NO_CACHE },
+    { ngx_string("no-store"), NGX_HTTP_GZIP_PROXIED_NO_STORE },
+    { ngx_string("private"), NGX_HTTP_GZIP_PROXIED_PRIVATE },
+    { ngx_string("no_last_modified"), NGX_HTTP_GZIP_PROXIED_NO_LM },
+    { ngx_string("no_etag"), NGX_HTTP_GZIP_PROXIED_NO_ETAG },
+    { ngx_string("auth"), NGX_HTTP_GZIP_PROXIED_AUTH },
+    { ngx_string("any"), NGX_HTTP_GZIP_PROXIED_ANY },
+    { ngx_null_string, 0 }
+};
+
+
+static ngx_str_t  ngx_http_gzip_no_cache = ngx_string("no-cache");
+static ngx_str_t  ngx_http_gzip_no_store = ngx_string("no-store");
+static ngx_str_t  ngx_http_gzip_private = ngx_string("private");
+
+#endif
+
+
 static ngx_command_t  ngx_http_core_commands[] = {
 
     { ngx_string("variables_hash_max_size"),
@@ -424,15 +465,50 @@ static ngx_command_t  ngx_http_core_commands[] = {
       0,
       NULL },
 
-#if (NGX_HTTP_CACHE)
-
     { ngx_string("open_file_cache"),
-      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE4,
-      ngx_http_set_cache_slot,
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE12,
+      ngx_http_core_open_file_cache,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_core_loc_conf_t, open_file_cache),
+      NULL },
+
+    { ngx_string("open_file_cache_valid"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_sec_slot,
       NGX_HTTP_LOC_CONF_OFFSET,
-      offsetof(ngx_http_core_loc_conf_t, open_files),
+      offsetof(ngx_http_core_loc_conf_t, open_file_cache_valid),
       NULL },
 
+    { ngx_string("open_file_cache_errors"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_core_loc_conf_t, open_file_cache_errors),
+      NULL },
+
+#if (NGX_HTTP_GZIP)
+
+    { ngx_string("gzip_vary"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_core_loc_conf_t, gzip_vary),
+      NULL },
+
+    { ngx_string("gzip_http_version"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_enum_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_core_loc_conf_t, gzip_http_version),
+      &ngx_http_gzip_http_version },
+
+    { ngx_string("gzip_proxied"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_conf_set_bitmask_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_core_loc_conf_t, gzip_proxied),
+      &ngx_http_gzip_proxied_mask },
+
 #endif
 
       ngx_null_command
@@ -605,7 +681,8 @@ ngx_http_core_find_config_phase(ngx_http_request_t *r,
 
     cscf = ngx_http_get_module_srv_conf(r, ngx_http_core_module);
 
-    rc = ngx_http_core_find_location(r, &cscf->locations, 0);
+    rc = ngx_http_core_find_location(r,
+                           cscf->ctx->loc_conf[ngx_http_core_module.ctx_index]);
 
     if (rc == NGX_HTTP_INTERNAL_SERVER_ERROR) {
         ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
@@ -901,116 +978,100 @@ ngx_http_update_location_config(ngx_http_request_t *r)
 }
 
 
+/*
+ * the static locations are looked up in the tree built by
+ * ngx_http_init_locations(), then in the nested locations
+ * of the longest match, and then the regex locations are tested
+ */
+
 static ngx_int_t
 ngx_http_core_find_location(ngx_http_request_t *r,
-    ngx_array_t *locations, size_t len)
+    ngx_http_core_loc_conf_t *pclcf)
 {
-    ngx_int_t                  n, rc;
-    ngx_uint_t                 i, found, noregex;
-    ngx_http_core_loc_conf_t  *clcf, **clcfp;
-
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "find location for \"%V\"", &r->uri);
+    ngx_int_t                  rc;
+    ngx_http_core_loc_conf_t  *clcf;
+#if (NGX_PCRE)
+    ngx_int_t                  n;
+    ngx_uint_t                 i, noregex;
+    uintptr_t                 *candidates;
+    ngx_http_core_loc_conf_t **clcfp;
+    uintptr_t                  buf[NGX_HTTP_REGEX_CANDIDATES];
 
-    found = 0;
     noregex = 0;
-
-    clcfp = locations->elts;
-    for (i = 0; i < locations->nelts; i++) {
-
-#if (NGX_PCRE)
-        if (clcfp[i]->regex) {
-            break;
-        }
 #endif
 
-        if (clcfp[i]->noname) {
-            break;
-        }
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "find location for \"%V\"", &r->uri);
 
-        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "find location: %s\"%V\"",
-                       clcfp[i]->exact_match ? "= " : "", &clcfp[i]->name);
+    rc = ngx_http_core_find_static_location(r, pclcf->static_locations);
 
-        if (clcfp[i]->auto_redirect
-            && r->uri.len == clcfp[i]->name.len - 1
-            && ngx_strncmp(r->uri.data, clcfp[i]->name.data,
-                                                  clcfp[i]->name.len - 1) == 0)
-        {
-            /* the locations are lexicographically sorted */
+    if (rc == NGX_OK) {
+        return NGX_HTTP_LOCATION_EXACT;
+    }
 
-            r->loc_conf = clcfp[i]->loc_conf;
+    if (rc == NGX_DONE) {
+        return NGX_HTTP_LOCATION_AUTO_REDIRECT;
+    }
 
-            return NGX_HTTP_LOCATION_AUTO_REDIRECT;
-        }
+    if (rc == NGX_AGAIN) {
+        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
-        if (r->uri.len < clcfp[i]->name.len) {
-            continue;
-        }
+#if (NGX_PCRE)
+        noregex = clcf->noregex;
+#endif
 
-        n = ngx_strncmp(r->uri.data, clcfp[i]->name.data, clcfp[i]->name.len);
+        /* look up the nested locations */
 
-        if (n < 0) {
-            /* the locations are lexicographically sorted */
-            break;
-        }
+        rc = ngx_http_core_find_location(r, clcf);
 
-        if (n == 0) {
-            if (clcfp[i]->exact_match) {
+        if (rc != NGX_OK) {
+            return rc;
+        }
+    }
 
-                if (r->uri.len == clcfp[i]->name.len) {
-                    r->loc_conf = clcfp[i]->loc_conf;
-                    return NGX_HTTP_LOCATION_EXACT;
-                }
+#if (NGX_PCRE)
 
-                continue;
-            }
+    if (noregex) {
+        return NGX_HTTP_LOCATION_NOREGEX;
+    }
 
-            if (len > clcfp[i]->name.len) {
-                /* the previous match is longer */
-                break;
-            }
+    /* regex matches */
 
-            r->loc_conf = clcfp[i]->loc_conf;
-            noregex = clcfp[i]->noregex;
-            found = 1;
-        }
+    if (pclcf->regex_locations == NULL) {
+        return NGX_OK;
     }
 
-    if (found) {
-        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+    candidates = NULL;
 
-        if (clcf->locations.nelts) {
-            rc = ngx_http_core_find_location(r, &clcf->locations, len);
+    if (pclcf->regex_filter) {
 
-            if (rc != NGX_OK) {
-                return rc;
+        if (ngx_regex_filter_size(pclcf->regex_filter)
+            <= NGX_HTTP_REGEX_CANDIDATES)
+        {
+            candidates = buf;
+
+        } else {
+            candidates = ngx_palloc(r->pool,
+                                    ngx_regex_filter_size(pclcf->regex_filter)
+                                    * sizeof(uintptr_t));
+            if (candidates == NULL) {
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
             }
         }
-    }
-
-#if (NGX_PCRE)
 
-    if (noregex) {
-        return NGX_HTTP_LOCATION_NOREGEX;
+        ngx_regex_filter_exec(pclcf->regex_filter, &r->uri, candidates);
     }
 
-    /* regex matches */
-
-    for (/* void */; i < locations->nelts; i++) {
+    for (i = 0, clcfp = pclcf->regex_locations; *clcfp; i++, clcfp++) {
 
-        if (!clcfp[i]->regex) {
+        if (candidates && !ngx_regex_filter_test(candidates, i)) {
             continue;
         }
 
-        if (clcfp[i]->noname) {
-            break;
-        }
-
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "find location: ~ \"%V\"", &clcfp[i]->name);
+                       "find location: ~ \"%V\"", &(*clcfp)->name);
 
-        n = ngx_regex_exec(clcfp[i]->regex, &r->uri, NULL, 0);
+        n = ngx_regex_exec((*clcfp)->regex, &r->uri, NULL, 0);
 
         if (n == NGX_REGEX_NO_MATCHED) {
             continue;
@@ -1020,13 +1081,13 @@ ngx_http_core_find_location(ngx_http_request_t *r,
             ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
                           ngx_regex_exec_n
                           " failed: %d on \"%V\" using \"%V\"",
-                          n, &r->uri, &clcfp[i]->name);
+                          n, &r->uri, &(*clcfp)->name);
             return NGX_HTTP_INTERNAL_SERVER_ERROR;
         }
 
         /* match */
 
-        r->loc_conf = clcfp[i]->loc_conf;
+        r->loc_conf = (*clcfp)->loc_conf;
 
         return NGX_HTTP_LOCATION_REGEX;
     }
@@ -1037,6 +1098,89 @@ ngx_http_core_find_location(ngx_http_request_t *r,
 }
 
 
+/*
+ * NGX_OK       - exact match
+ * NGX_DONE     - auto redirect
+ * NGX_AGAIN    - inclusive match
+ * NGX_DECLINED - no match
+ */
+
+static ngx_int_t
+ngx_http_core_find_static_location(ngx_http_request_t *r,
+    ngx_http_location_tree_node_t *node)
+{
+    u_char     *uri;
+    size_t      len, n;
+    ngx_int_t   rc, rv;
+
+    len = r->uri.len;
+    uri = r->uri.data;
+
+    rv = NGX_DECLINED;
+
+    for ( ;; ) {
+
+        if (node == NULL) {
+            return rv;
+        }
+
+        n = (len <= node->len) ? len : node->len;
+
+        rc = ngx_memcmp(uri, node->name, n);
+
+        if (rc != 0) {
+            node = (rc < 0) ? node->left : node->right;
+
+            continue;
+        }
+
+        if (len > node->len) {
+
+            if (node->inclusive) {
+
+                r->loc_conf = node->inclusive->loc_conf;
+                rv = NGX_AGAIN;
+
+                node = node->tree;
+                uri += n;
+                len -= n;
+
+                continue;
+            }
+
+            /* exact only */
+
+            node = node->right;
+
+            continue;
+        }
+
+        if (len == node->len) {
+
+            if (node->exact) {
+                r->loc_conf = node->exact->loc_conf;
+                return NGX_OK;
+
+            } else {
+                r->loc_conf = node->inclusive->loc_conf;
+                return NGX_AGAIN;
+            }
+        }
+
+        /* len < node->len */
+
+        if (len + 1 == node->len && node->auto_redirect) {
+
+            r->loc_conf = (node->exact) ? node->exact->loc_conf:
+                                          node->inclusive->loc_conf;
+            rv = NGX_DONE;
+        }
+
+        node = node->left;
+    }
+}
+
+
 ngx_int_t
 ngx_http_set_content_type(ngx_http_request_t *r)
 {
@@ -1282,6 +1426,198 @@ ngx_http_auth_basic_user(ngx_http_request_t *r)
 }
 
 
+#if (NGX_HTTP_GZIP)
+
+/*
+ * the test whether a response to the request may be sent compressed,
+ * it is shared by the gzip filter and the precompressed static files
+ */
+
+ngx_int_t
+ngx_http_gzip_ok(ngx_http_request_t *r)
+{
+    time_t                     date, expires;
+    ngx_uint_t                 p;
+    ngx_table_elt_t           *ae;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    if (r != r->main) {
+        return NGX_DECLINED;
+    }
+
+    ae = r->headers_in.accept_encoding;
+
+    if (ae == NULL || ngx_http_gzip_accept_encoding(&ae->value) != NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    if (r->http_version < clcf->gzip_http_version) {
+        return NGX_DECLINED;
+    }
+
+    /*
+     * if the URL (without the "http://" prefix) is longer than 253 bytes
+     * then MSIE 4.x can not handle the compressed stream - it waits too long,
+     * hangs up or crashes
+     */
+
+    if (r->headers_in.msie4 && r->unparsed_uri.len > 200) {
+        return NGX_DECLINED;
+    }
+
+    if (r->headers_in.via == NULL) {
+        return NGX_OK;
+    }
+
+    p = clcf->gzip_proxied;
+
+    if (p & NGX_HTTP_GZIP_PROXIED_OFF) {
+        return NGX_DECLINED;
+    }
+
+    if (p & NGX_HTTP_GZIP_PROXIED_ANY) {
+        return NGX_OK;
+    }
+
+    if (r->headers_in.authorization && (p & NGX_HTTP_GZIP_PROXIED_AUTH)) {
+        return NGX_OK;
+    }
+
+    if (r->headers_out.expires) {
+
+        if (!(p & NGX_HTTP_GZIP_PROXIED_EXPIRED)) {
+            return NGX_DECLINED;
+        }
+
+        expires = ngx_http_parse_time(r->headers_out.expires->value.data,
+                                      r->headers_out.expires->value.len);
+        if (expires == NGX_ERROR) {
+            return NGX_DECLINED;
+        }
+
+        if (r->headers_out.date) {
+            date = ngx_http_parse_time(r->headers_out.date->value.data,
+                                       r->headers_out.date->value.len);
+            if (date == NGX_ERROR) {
+                return NGX_DECLINED;
+            }
+
+        } else {
+            date = ngx_time();
+        }
+
+        if (expires < date) {
+            return NGX_OK;
+        }
+
+        return NGX_DECLINED;
+    }
+
+    if (r->headers_out.cache_control.elts) {
+
+        if ((p & NGX_HTTP_GZIP_PROXIED_NO_CACHE)
+            && ngx_http_parse_multi_header_lines(&r->headers_out.cache_control,
+                   &ngx_http_gzip_no_cache, NULL) >= 0)
+        {
+            return NGX_OK;
+        }
+
+        if ((p & NGX_HTTP_GZIP_PROXIED_NO_STORE)
+            && ngx_http_parse_multi_header_lines(&r->headers_out.cache_control,
+                   &ngx_http_gzip_no_store, NULL) >= 0)
+        {
+            return NGX_OK;
+        }
+
+        if ((p & NGX_HTTP_GZIP_PROXIED_PRIVATE)
+            && ngx_http_parse_multi_header_lines(&r->headers_out.cache_control,
+                   &ngx_http_gzip_private, NULL) >= 0)
+        {
+            return NGX_OK;
+        }
+
+        return NGX_DECLINED;
+    }
+
+    if ((p & NGX_HTTP_GZIP_PROXIED_NO_LM) && r->headers_out.last_modified) {
+        return NGX_DECLINED;
+    }
+
+    if ((p & NGX_HTTP_GZIP_PROXIED_NO_ETAG) && r->headers_out.etag) {
+        return NGX_DECLINED;
+    }
+
+    return NGX_OK;
+}
+
+
+/* the "gzip" coding is accepted unless its quality value is zero */
+
+static ngx_int_t
+ngx_http_gzip_accept_encoding(ngx_str_t *ae)
+{
+    u_char  *p, *start, *last;
+
+    start = ae->data;
+    last = start + ae->len;
+
+    for ( ;; ) {
+        p = ngx_strlcasestrn(start, last, (u_char *) "gzip", 4 - 1);
+        if (p == NULL) {
+            return NGX_DECLINED;
+        }
+
+        if ((p == ae->data || p[-1] == ',' || p[-1] == ' ')
+            && (p + 4 == last || p[4] == ',' || p[4] == ';' || p[4] == ' '))
+        {
+            break;
+        }
+
+        start = p + 4;
+    }
+
+    p += 4;
+
+    while (p < last && *p == ' ') {
+        p++;
+    }
+
+    if (p == last || *p++ != ';') {
+        return NGX_OK;
+    }
+
+    while (p < last && *p == ' ') {
+        p++;
+    }
+
+    if (last - p < 3 || (*p != 'q' && *p != 'Q') || p[1] != '=') {
+        return NGX_OK;
+    }
+
+    p += 2;
+
+    if (*p++ != '0') {
+        return NGX_OK;
+    }
+
+    /* "q=0", "q=0.", "q=0.0", "q=0.00", and "q=0.000" reject the coding */
+
+    if (p < last && *p == '.') {
+        for (p++; p < last && *p == '0'; p++) { /* void */ }
+    }
+
+    if (p < last && *p >= '1' && *p <= '9') {
+        return NGX_OK;
+    }
+
+    return NGX_DECLINED;
+}
+
+#endif
+
+
 ngx_int_t
 ngx_http_subrequest(ngx_http_request_t *r,
     ngx_str_t *uri, ngx_str_t *args, ngx_http_request_t **psr,
@@ -1334,6 +1670,7 @@ ngx_http_subrequest(ngx_http_request_t *r,
     sr->headers_in = r->headers_in;
 
     sr->start_time = ngx_time();
+    sr->start_msec = ngx_current_msec;
 
     ngx_http_clear_content_length(sr);
     ngx_http_clear_accept_ranges(sr);
@@ -2151,6 +2488,7 @@ ngx_http_core_create_loc_conf(ngx_conf_t *cf)
      *     lcf->exact_match = 0;
      *     lcf->auto_redirect = 0;
      *     lcf->alias = 0;
+     *     lcf->gzip_proxied = 0;
      */
 
     lcf->client_max_body_size = NGX_CONF_UNSET;
@@ -2178,6 +2516,14 @@ ngx_http_core_create_loc_conf(ngx_conf_t *cf)
     lcf->recursive_error_pages = NGX_CONF_UNSET;
     lcf->types_hash_max_size = NGX_CONF_UNSET_UINT;
     lcf->types_hash_bucket_size = NGX_CONF_UNSET_UINT;
+    lcf->open_file_cache = NGX_CONF_UNSET_PTR;
+    lcf->open_file_cache_valid = NGX_CONF_UNSET;
+    lcf->open_file_cache_errors = NGX_CONF_UNSET;
+
+#if (NGX_HTTP_GZIP)
+    lcf->gzip_vary = NGX_CONF_UNSET;
+    lcf->gzip_http_version = NGX_CONF_UNSET_UINT;
+#endif
 
     return lcf;
 }
@@ -2359,10 +2705,27 @@ ngx_http_core_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_value(conf->recursive_error_pages,
                               prev->recursive_error_pages, 0);
 
-    if (conf->open_files == NULL) {
-        conf->open_files = prev->open_files;
+    if (conf->open_file_cache == NGX_CONF_UNSET_PTR) {
+        conf->open_file_cache = (prev->open_file_cache == NGX_CONF_UNSET_PTR)
+                                ? NULL : prev->open_file_cache;
     }
 
+    ngx_conf_merge_sec_value(conf->open_file_cache_valid,
+                              prev->open_file_cache_valid, 60);
+
+    ngx_conf_merge_value(conf->open_file_cache_errors,
+                              prev->open_file_cache_errors, 0);
+
+#if (NGX_HTTP_GZIP)
+
+    ngx_conf_merge_value(conf->gzip_vary, prev->gzip_vary, 0);
+    ngx_conf_merge_uint_value(conf->gzip_http_version, prev->gzip_http_version,
+                              NGX_HTTP_VERSION_11);
+    ngx_conf_merge_bitmask_value(conf->gzip_proxied, prev->gzip_proxied,
+                              (NGX_CONF_BITMASK_SET|NGX_HTTP_GZIP_PROXIED_OFF));
+
+#endif
+
     return NGX_CONF_OK;
 }
 
@@ -2506,6 +2869,18 @@ ngx_http_core_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strcmp(value[n].data, "reuseport") == 0) {
+#if (NGX_HAVE_REUSEPORT)
+            ls->conf.reuseport = 1;
+            ls->conf.bind = 1;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "reuseport is not supported "
+                               "on this platform, ignored");
+#endif
+            continue;
+        }
+
         if (ngx_strcmp(value[n].data, "deferred") == 0) {
 #if (NGX_HAVE_DEFERRED_ACCEPT && defined TCP_DEFER_ACCEPT)
             ls->conf.deferred_accept = 1;
@@ -2967,6 +3342,80 @@ ngx_http_core_internal(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static char *
+ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t *lcf = conf;
+
+    time_t       inactive;
+    ngx_str_t   *value, s;
+    ngx_int_t    max;
+    ngx_uint_t   i;
+
+    if (lcf->open_file_cache != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    max = 0;
+    inactive = 60;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "max=", 4) == 0) {
+
+            max = ngx_atoi(value[i].data + 4, value[i].len - 4);
+            if (max == NGX_ERROR || max == 0) {
+                goto failed;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "inactive=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            inactive = ngx_parse_time(&s, 1);
+            if (inactive < 0) {
+                goto failed;
+            }
+
+            continue;
+        }
+
+        if (cf->args->nelts == 2 && ngx_strcmp(value[i].data, "off") == 0) {
+
+            lcf->open_file_cache = NULL;
+
+            return NGX_CONF_OK;
+        }
+
+    failed:
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid \"open_file_cache\" parameter \"%V\"",
+                           &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (max == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"open_file_cache\" must have \"max\" parameter");
+        return NGX_CONF_ERROR;
+    }
+
+    lcf->open_file_cache = ngx_open_file_cache_init(cf->pool, max, inactive);
+    if (lcf->open_file_cache == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
 static char *
 ngx_http_core_lowat_check(ngx_conf_t *cf, void *post, void *data)
 {
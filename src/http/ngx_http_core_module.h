@@ -13,9 +13,23 @@
 #include <ngx_http.h>
 
 
+#define NGX_HTTP_GZIP_PROXIED_OFF       0x0002
+#define NGX_HTTP_GZIP_PROXIED_EXPIRED   0x0004
+#define NGX_HTTP_GZIP_PROXIED_NO_CACHE  0x0008
+#define NGX_HTTP_GZIP_PROXIED_NO_STORE  0x0010
+#define NGX_HTTP_GZIP_PROXIED_PRIVATE   0x0020
+#define NGX_HTTP_GZIP_PROXIED_NO_LM     0x0040
+#define NGX_HTTP_GZIP_PROXIED_NO_ETAG   0x0080
+#define NGX_HTTP_GZIP_PROXIED_AUTH      0x0100
+#define NGX_HTTP_GZIP_PROXIED_ANY       0x0200
+
+
 typedef struct {
     unsigned                   default_server:1;
     unsigned                   bind:1;
+#if (NGX_HAVE_REUSEPORT)
+    unsigned                   reuseport:1;
+#endif
 
     int                        backlog;
     int                        rcvbuf;
@@ -202,6 +216,7 @@ typedef struct {
 
 
 typedef struct ngx_http_core_loc_conf_s  ngx_http_core_loc_conf_t;
+typedef struct ngx_http_location_tree_node_s  ngx_http_location_tree_node_t;
 
 struct ngx_http_core_loc_conf_s {
     ngx_str_t     name;          /* location name */
@@ -221,6 +236,14 @@ struct ngx_http_core_loc_conf_s {
     /* array of inclusive ngx_http_core_loc_conf_t */
     ngx_array_t   locations;
 
+    /* the static inclusive locations compiled at configuration time */
+    ngx_http_location_tree_node_t  *static_locations;
+#if (NGX_PCRE)
+    /* the null-terminated list of the regex inclusive locations */
+    ngx_http_core_loc_conf_t      **regex_locations;
+    ngx_regex_filter_t             *regex_filter;
+#endif
+
     /* pointer to the modules' loc_conf */
     void        **loc_conf ;
 
@@ -271,19 +294,50 @@ struct ngx_http_core_loc_conf_s {
 
     ngx_path_t   *client_body_temp_path;   /* client_body_temp_path */
 
-    ngx_http_cache_hash_t  *open_files;
+    ngx_open_file_cache_t  *open_file_cache;
+
+    time_t        open_file_cache_valid;   /* open_file_cache_valid */
+    ngx_flag_t    open_file_cache_errors;  /* open_file_cache_errors */
 
     ngx_log_t    *err_log;
 
     ngx_uint_t    types_hash_max_size;
     ngx_uint_t    types_hash_bucket_size;
 
+#if (NGX_HTTP_GZIP)
+    ngx_flag_t    gzip_vary;               /* gzip_vary */
+
+    ngx_uint_t    gzip_http_version;       /* gzip_http_version */
+    ngx_uint_t    gzip_proxied;            /* gzip_proxied */
+#endif
+
 #if 0
     ngx_http_core_loc_conf_t  *prev_location;
 #endif
 };
 
 
+/*
+ * a node of the binary tree of the static locations: the left and right
+ * subtrees hold the lexicographically lesser and greater names, the "tree"
+ * holds the locations that start with the node name, without this name
+ */
+
+struct ngx_http_location_tree_node_s {
+    ngx_http_location_tree_node_t  *left;
+    ngx_http_location_tree_node_t  *right;
+    ngx_http_location_tree_node_t  *tree;
+
+    ngx_http_core_loc_conf_t       *exact;
+    ngx_http_core_loc_conf_t       *inclusive;
+
+    ngx_uint_t                      auto_redirect;  /* unsigned:1 */
+
+    size_t                          len;
+    u_char                          name[1];
+};
+
+
 void ngx_http_core_run_phases(ngx_http_request_t *r);
 ngx_int_t ngx_http_core_generic_phase(ngx_http_request_t *r,
     ngx_http_phase_handler_t *ph);
@@ -303,6 +357,9 @@ ngx_int_t ngx_http_set_exten(ngx_http_request_t *r);
 u_char *ngx_http_map_uri_to_path(ngx_http_request_t *r, ngx_str_t *name,
     size_t *root_length, size_t reserved);
 ngx_int_t ngx_http_auth_basic_user(ngx_http_request_t *r);
+#if (NGX_HTTP_GZIP)
+ngx_int_t ngx_http_gzip_ok(ngx_http_request_t *r);
+#endif
 
 ngx_int_t ngx_http_subrequest(ngx_http_request_t *r,
     ngx_str_t *uri, ngx_str_t *args, ngx_http_request_t **sr,
@@ -22,238 +22,1596 @@
 #endif
 
 
-ngx_int_t ngx_http_file_cache_get(ngx_http_request_t *r,
-                                  ngx_http_cache_ctx_t *ctx)
+static ngx_int_t ngx_http_file_cache_exists(ngx_http_file_cache_t *cache,
+    ngx_http_cache_t *c);
+static ngx_int_t ngx_http_file_cache_lock(ngx_http_file_cache_t *cache,
+    ngx_http_cache_t *c);
+static void ngx_http_file_cache_unlock(ngx_http_file_cache_t *cache,
+    ngx_http_cache_t *c);
+static ngx_http_file_cache_node_t *
+    ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key);
+static ngx_http_file_cache_node_t *
+    ngx_http_file_cache_alloc_node(ngx_http_file_cache_t *cache, u_char *key);
+static void ngx_http_file_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static ngx_int_t ngx_http_file_cache_name(ngx_http_request_t *r,
+    ngx_path_t *path);
+static void ngx_http_file_cache_cleanup(void *data);
+static time_t ngx_http_file_cache_expire(ngx_http_file_cache_t *cache,
+    ngx_uint_t forced);
+static void ngx_http_file_cache_delete(ngx_http_file_cache_t *cache,
+    ngx_queue_t *q, u_char *name);
+static time_t ngx_http_file_cache_manager(void *data);
+static void ngx_http_file_cache_loader(void *data);
+static ngx_int_t ngx_http_file_cache_manage_file(ngx_gc_t *ctx,
+    ngx_str_t *name, ngx_dir_t *dir);
+static ngx_int_t ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone,
+    void *data);
+
+
+ngx_str_t  ngx_http_cache_status[] = {
+    ngx_string("MISS"),
+    ngx_string("EXPIRED"),
+    ngx_string("HIT"),
+    ngx_string("STALE"),
+    ngx_string("UPDATING")
+};
+
+
+static u_char  ngx_http_file_cache_key[] = { LF, 'K', 'E', 'Y', ':', ' ' };
+
+
+ngx_int_t
+ngx_http_file_cache_new(ngx_http_request_t *r)
 {
-    ngx_uint_t         i;
-    ngx_str_t         *key;
     ngx_http_cache_t  *c;
+
+    c = ngx_pcalloc(r->pool, sizeof(ngx_http_cache_t));
+    if (c == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_array_init(&c->keys, r->pool, 4, sizeof(ngx_str_t)) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    c->file.fd = NGX_INVALID_FILE;
+    c->file.log = r->connection->log;
+
+    r->cache = c;
+
+    return NGX_OK;
+}
+
+
+void
+ngx_http_file_cache_create_key(ngx_http_request_t *r)
+{
+    size_t             len;
+    ngx_str_t         *key;
+    ngx_uint_t         i;
     MD5_CTX            md5;
+    ngx_http_cache_t  *c;
 
     c = r->cache;
 
-    c->file.name.len = ctx->path->name.len + 1 + ctx->path->len + 32;
-    if (!(c->file.name.data = ngx_palloc(r->pool, c->file.name.len + 1))) {
-        return NGX_ABORT;
-    }
+    len = 0;
+    c->crc32 = 0xffffffff;
 
     MD5Init(&md5);
 
-    key = c->key.elts;
-    for (i = 0; i < c->key.nelts; i++) {
+    key = c->keys.elts;
+    for (i = 0; i < c->keys.nelts; i++) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http cache key: \"%V\"", &key[i]);
+
+        len += key[i].len;
+
+        ngx_crc32_update(&c->crc32, key[i].data, key[i].len);
         MD5Update(&md5, key[i].data, key[i].len);
     }
 
-    MD5Update(&md5, ctx->key.data, ctx->key.len);
+    c->crc32 ^= 0xffffffff;
 
-    MD5Final(c->md5, &md5);
+    MD5Final(c->key, &md5);
 
-    ngx_memcpy(c->file.name.data, ctx->path->name.data, ctx->path->name.len);
+    c->header_start = sizeof(ngx_http_file_cache_header_t)
+                      + sizeof(ngx_http_file_cache_key) + len + 1;
+}
 
-    ngx_md5_text(c->file.name.data + ctx->path->name.len + 1 + ctx->path->len,
-                 c->md5);
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                  "file cache key: %V, md5: %s", &ctx->key,
-                  c->file.name.data + ctx->path->name.len + 1 + ctx->path->len);
+ngx_int_t
+ngx_http_file_cache_open(ngx_http_request_t *r)
+{
+    off_t                          fs_size;
+    ssize_t                        n;
+    ngx_int_t                      rc;
+    ngx_err_t                      err;
+    ngx_uint_t                     stale;
+    ngx_file_info_t                fi;
+    ngx_pool_cleanup_t            *cln;
+    ngx_pool_cleanup_file_t       *clnf;
+    ngx_http_cache_t              *c;
+    ngx_http_file_cache_t         *cache;
+    ngx_http_file_cache_header_t  *h;
 
-    ngx_create_hashed_filename(&c->file, ctx->path);
+    c = r->cache;
+    cache = c->file_cache;
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "file cache name: %s", c->file.name.data);
+    if (c->node == NULL) {
 
-    return ngx_http_file_cache_open(r->cache);
-}
+        cln = ngx_pool_cleanup_add(r->pool, 0);
+        if (cln == NULL) {
+            return NGX_ERROR;
+        }
 
+        rc = ngx_http_file_cache_exists(cache, c);
 
-ngx_int_t ngx_http_file_cache_open(ngx_http_cache_t *c)
-{
-    ssize_t                   n;
-    ngx_err_t                 err;
-    ngx_http_cache_header_t  *h;
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache exists: %i u:%ui", rc, c->uses);
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
 
-    c->file.fd = ngx_open_file(c->file.name.data,
-                               NGX_FILE_RDONLY, NGX_FILE_OPEN);
+        cln->handler = ngx_http_file_cache_cleanup;
+        cln->data = c;
 
-    if (c->file.fd == NGX_INVALID_FILE) {
-        err = ngx_errno;
+        /*
+         * the name is required to store a response
+         * even if there is no file
+         */
 
-        if (err == NGX_ENOENT || err == NGX_ENOTDIR) {
-            return NGX_DECLINED;
+        if (ngx_http_file_cache_name(r, cache->path) != NGX_OK) {
+            return NGX_ERROR;
         }
 
-        ngx_log_error(NGX_LOG_CRIT, c->log, ngx_errno,
-                      ngx_open_file_n " \"%s\" failed", c->file.name.data);
-        return NGX_ERROR;
+    } else {
+
+        /* the request has been waiting for the cache lock */
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        if (c->node->exists) {
+            c->exists = 1;
+            c->body_start = c->node->body_start;
+            rc = NGX_OK;
+
+        } else {
+            rc = NGX_DECLINED;
+        }
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+    }
+
+    stale = 0;
+
+    switch (ngx_http_file_cache_lock(cache, c)) {
+
+    case NGX_AGAIN:
+        return NGX_AGAIN;
+
+    case NGX_BUSY:
+        stale = 1;
+        break;
+
+    default: /* NGX_OK */
+        break;
+    }
+
+    /*
+     * until the cache loader has walked the cache directory
+     * the node absence does not mean that there is no file
+     */
+
+    if (rc == NGX_DECLINED && !cache->sh->cold) {
+        return NGX_DECLINED;
     }
 
-    if (c->uniq) {
-        if (ngx_fd_info(c->file.fd, &c->file.info) == NGX_FILE_ERROR) {
-            ngx_log_error(NGX_LOG_CRIT, c->log, ngx_errno,
-                          ngx_fd_info_n " \"%s\" failed", c->file.name.data);
+    c->file.fd = ngx_open_file(c->file.name.data, NGX_FILE_RDONLY,
+                               NGX_FILE_OPEN);
+
+    if (c->file.fd == NGX_INVALID_FILE) {
+        err = ngx_errno;
 
+        if (err != NGX_ENOENT && err != NGX_ENOTDIR) {
+            ngx_log_error(NGX_LOG_CRIT, r->connection->log, err,
+                          ngx_open_file_n " \"%s\" failed", c->file.name.data);
             return NGX_ERROR;
         }
 
-        if (ngx_file_uniq(&c->file.info) == c->uniq) {
-            if (ngx_close_file(c->file.fd) == NGX_FILE_ERROR) {
-                ngx_log_error(NGX_LOG_ALERT, c->log, ngx_errno,
-                              ngx_close_file_n " \"%s\" failed",
-                              c->file.name.data);
+        if (rc == NGX_OK) {
+
+            /* the file has been deleted behind the cache back */
+
+            ngx_shmtx_lock(&cache->shpool->mutex);
+
+            if (c->node->exists) {
+                c->node->exists = 0;
+                cache->sh->size -= c->node->fs_size;
+                c->node->fs_size = 0;
             }
 
-            return NGX_HTTP_CACHE_THE_SAME;
+            ngx_shmtx_unlock(&cache->shpool->mutex);
         }
-    }
 
-    n = ngx_read_file(&c->file, c->buf->pos, c->buf->end - c->buf->last, 0);
+        return NGX_DECLINED;
+    }
 
-    if (n == NGX_ERROR || n == NGX_AGAIN) {
-        return n;
+    cln = ngx_pool_cleanup_add(r->pool, sizeof(ngx_pool_cleanup_file_t));
+    if (cln == NULL) {
+        ngx_close_file(c->file.fd);
+        c->file.fd = NGX_INVALID_FILE;
+        return NGX_ERROR;
     }
 
-    if (n <= c->header_size) {
-        ngx_log_error(NGX_LOG_CRIT, c->log, 0,
-                      "cache file \"%s\" is too small", c->file.name.data);
+    cln->handler = ngx_pool_cleanup_file;
+    clnf = cln->data;
+
+    clnf->fd = c->file.fd;
+    clnf->name = c->file.name.data;
+    clnf->log = r->connection->log;
+
+    if (ngx_fd_info(c->file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", c->file.name.data);
         return NGX_ERROR;
     }
 
-    h = (ngx_http_cache_header_t *) c->buf->pos;
-    c->expires = h->expires;
-    c->last_modified= h->last_modified;
-    c->date = h->date;
-    c->length = h->length;
+    c->length = ngx_file_size(&fi);
+    fs_size = ngx_file_fs_size(&fi);
 
-    if (h->key_len > (size_t) (c->buf->end - c->buf->pos)) {
-        ngx_log_error(NGX_LOG_ALERT, c->log, 0,
-                      "cache file \"%s\" is probably invalid",
-                      c->file.name.data);
-        return NGX_DECLINED;
+    c->buf = ngx_create_temp_buf(r->pool, c->body_start);
+    if (c->buf == NULL) {
+        return NGX_ERROR;
     }
 
-#if 0
+    n = ngx_read_file(&c->file, c->buf->pos, c->body_start, 0);
 
-    /* TODO */
+    if (n == NGX_ERROR) {
+        return NGX_ERROR;
+    }
 
-    if (c->key_len && h->key_len != c->key_len)  {
+    if ((size_t) n < c->header_start) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      "cache file \"%s\" is too small", c->file.name.data);
+        return NGX_DECLINED;
+    }
 
-        ngx_strncmp(h->key, c->key_data, h->key_len) != 0))
+    h = (ngx_http_file_cache_header_t *) c->buf->pos;
 
-        h->key[h->key_len] = '\0';
-        ngx_log_error(NGX_LOG_ALERT, c->log, 0,
-                          "md5 collision: \"%s\" and \"%s\"",
-                          h->key, c->key.data);
+    if (h->crc32 != c->crc32 || (size_t) h->header_start != c->header_start) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      "cache file \"%s\" has md5 collision", c->file.name.data);
         return NGX_DECLINED;
     }
 
-#endif
+    if ((size_t) h->body_start > (size_t) n) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      "cache file \"%s\" has too long header",
+                      c->file.name.data);
+        return NGX_DECLINED;
+    }
 
     c->buf->last += n;
 
-    if (c->expires < ngx_time()) {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
-                       "http file cache expired");
-        return NGX_HTTP_CACHE_STALE;
+    c->valid_sec = h->valid_sec;
+    c->updating_sec = h->updating_sec;
+    c->error_sec = h->error_sec;
+    c->last_modified = h->last_modified;
+    c->date = h->date;
+    c->body_start = h->body_start;
+
+    /*
+     * the file has been found while the cache is being loaded, or the node
+     * has been created by the cache loader that does not read the header
+     */
+
+    if (rc == NGX_DECLINED
+        || c->node->valid_sec == 0
+        || c->node->body_start == 0)
+    {
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        if (!c->node->exists) {
+            c->node->exists = 1;
+            c->node->fs_size = fs_size;
+            cache->sh->size += fs_size;
+        }
+
+        if (rc == NGX_DECLINED
+            || c->node->valid_sec == 0
+            || c->node->body_start == 0)
+        {
+            c->node->valid_sec = c->valid_sec;
+            c->node->updating_sec = c->updating_sec;
+            c->node->error_sec = c->error_sec;
+            c->node->body_start = c->body_start;
+        }
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+    }
+
+    if (c->valid_sec < ngx_time()) {
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache expired: %T %T",
+                       c->valid_sec, ngx_time());
+
+        return stale ? NGX_HTTP_CACHE_UPDATING : NGX_HTTP_CACHE_EXPIRED;
     }
 
-    /* TODO: NGX_HTTP_CACHE_AGED */
+    if (c->updating) {
 
-    /* STUB */ return NGX_DECLINED;
+        /* the file has been found while the cache is being loaded */
+
+        ngx_http_file_cache_unlock(cache, c);
+    }
 
     return NGX_OK;
 }
 
 
-#if 0
+/*
+ * only one request updates a missing or expired response, the others
+ * are served the stale response if it is allowed, or wait until the new
+ * one is stored, or until the lock timeout expires, so they do not
+ * stampede the upstream
+ */
+
+static ngx_int_t
+ngx_http_file_cache_lock(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
+{
+    ngx_msec_t                   now;
+    ngx_http_file_cache_node_t  *fcn;
+
+    now = ngx_current_msec;
+
+    fcn = c->node;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    if (fcn->exists && fcn->valid_sec >= ngx_time()) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_OK;
+    }
+
+    /* the lock of a request that has not finished in time is overridden */
+
+    if (!fcn->updating || (ngx_msec_int_t) (fcn->lock_time - now) <= 0) {
+        fcn->updating = 1;
+        fcn->lock_time = now + c->lock_timeout;
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        c->updating = 1;
+
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
+                       "http file cache lock");
+
+        return NGX_OK;
+    }
+
+    if (fcn->exists
+        && (c->stale_updating || fcn->updating_sec >= ngx_time()))
+    {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
+                       "http file cache updating");
+
+        return NGX_BUSY;
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    if (!c->lock) {
+        return NGX_OK;
+    }
+
+    if (c->lock_time == 0) {
+        c->lock_time = now + c->lock_timeout;
+
+    } else if ((ngx_msec_int_t) (c->lock_time - now) <= 0) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
+                       "http file cache lock timed out");
+        return NGX_OK;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
+                   "http file cache lock busy");
+
+    return NGX_AGAIN;
+}
+
+
+static void
+ngx_http_file_cache_unlock(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
+{
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    c->node->updating = 0;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    c->updating = 0;
+}
 
 
-int ngx_http_cache_update_file(ngx_http_request_t *r, ngx_http_cache_ctx_t *ctx,
-                               ngx_str_t *temp_file)
+static ngx_int_t
+ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 {
-    int        retry;
-    ngx_err_t  err;
+    ngx_int_t                    rc;
+    ngx_uint_t                   tries;
+    ngx_http_file_cache_node_t  *fcn;
 
-    retry = 0;
+    tries = 0;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
 
     for ( ;; ) {
-        if (ngx_rename_file(temp_file->data, ctx->file.name.data) == NGX_OK) {
-            return NGX_OK;
-        }
 
-        err = ngx_errno;
+        fcn = ngx_http_file_cache_lookup(cache, c->key);
+
+        if (fcn) {
+            ngx_queue_remove(&fcn->queue);
 
-#if (NGX_WIN32)
-        if (err == NGX_EEXIST) {
-            if (ngx_win32_rename_file(temp_file, &ctx->file.name, r->pool)
-                                                                  == NGX_ERROR)
-            {
-                return NGX_ERROR;
+            if (fcn->uses != 0x3ff) {
+                fcn->uses++;
             }
+
+            fcn->count++;
+
+            if (fcn->exists) {
+                c->exists = 1;
+
+                if (fcn->body_start) {
+                    c->body_start = fcn->body_start;
+                }
+
+                rc = NGX_OK;
+
+            } else {
+                rc = NGX_DECLINED;
+            }
+
+            break;
         }
-#endif
 
-        if (retry || (err != NGX_ENOENT && err != NGX_ENOTDIR)) {
-            ngx_log_error(NGX_LOG_CRIT, r->connection->log, err,
-                          ngx_rename_file_n "(\"%s\", \"%s\") failed",
-                          temp_file->data, ctx->file.name.data);
+        fcn = ngx_http_file_cache_alloc_node(cache, c->key);
 
-            return NGX_ERROR;
+        if (fcn) {
+            rc = NGX_DECLINED;
+            break;
         }
 
-        if (ngx_create_path(&ctx->file, ctx->path) == NGX_ERROR) {
+        if (tries++) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+
+            ngx_log_error(NGX_LOG_ALERT, c->file.log, 0,
+                          "could not allocate node in cache keys zone \"%V\"",
+                          &cache->shm_zone->name);
+
             return NGX_ERROR;
         }
 
-        retry = 1;
+        /*
+         * free the least recently used node and look up the key again
+         * because the zone is unlocked while the node file is deleted
+         */
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        (void) ngx_http_file_cache_expire(cache, 1);
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
     }
+
+    fcn->expire = ngx_time() + cache->inactive;
+
+    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+
+    c->uses = fcn->uses;
+    c->node = fcn;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    return rc;
 }
 
 
-#endif
+static ngx_http_file_cache_node_t *
+ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key)
+{
+    ngx_int_t                    rc;
+    ngx_rbtree_key_t             node_key;
+    ngx_rbtree_node_t           *node, *sentinel;
+    ngx_http_file_cache_node_t  *fcn;
+
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
 
+    while (node != sentinel) {
 
-ngx_int_t ngx_http_cache_cleaner_handler(ngx_gc_t *gc, ngx_str_t *name,
-                                         ngx_dir_t *dir)
+        if (node_key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (node_key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* node_key == node->key */
+
+        fcn = (ngx_http_file_cache_node_t *) node;
+
+        rc = ngx_memcmp(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                        NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        if (rc == 0) {
+            return fcn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+/* the cache keys zone must be locked */
+
+static ngx_http_file_cache_node_t *
+ngx_http_file_cache_alloc_node(ngx_http_file_cache_t *cache, u_char *key)
+{
+    ngx_http_file_cache_node_t  *fcn;
+
+    fcn = ngx_slab_alloc_locked(cache->shpool,
+                                sizeof(ngx_http_file_cache_node_t));
+    if (fcn == NULL) {
+        return NULL;
+    }
+
+    ngx_memcpy((u_char *) &fcn->node.key, key, sizeof(ngx_rbtree_key_t));
+
+    ngx_memcpy(fcn->key, &key[sizeof(ngx_rbtree_key_t)],
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+    ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+
+    fcn->uses = 1;
+    fcn->count = 1;
+    fcn->exists = 0;
+    fcn->deleting = 0;
+    fcn->updating = 0;
+    fcn->valid_sec = 0;
+    fcn->updating_sec = 0;
+    fcn->error_sec = 0;
+    fcn->body_start = 0;
+    fcn->fs_size = 0;
+
+    return fcn;
+}
+
+
+static void
+ngx_http_file_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
 {
-    int               rc;
-    ngx_buf_t         buf;
-    ngx_http_cache_t  c;
-    u_char            data[sizeof(ngx_http_cache_header_t)];
+    ngx_rbtree_node_t           **p;
+    ngx_http_file_cache_node_t   *cn, *cnt;
+
+    for ( ;; ) {
 
-    ngx_memzero(&c, sizeof(ngx_http_cache_t));
+        if (node->key < temp->key) {
+            p = &temp->left;
 
-    c.file.fd = NGX_INVALID_FILE;
-    c.file.name = *name;
-    c.file.log = gc->log;
+        } else if (node->key > temp->key) {
+            p = &temp->right;
 
-    c.header_size = sizeof(ngx_http_cache_header_t);
-    c.buf = &buf;
-    c.log = gc->log;
-    c.key_len = 0;
+        } else { /* node->key == temp->key */
 
-    buf.memory = 1;
-    buf.temporary = 1;
-    buf.pos = data;
-    buf.last = data;
-    buf.start = data;
-    buf.end = data + sizeof(ngx_http_cache_header_t);
+            cn = (ngx_http_file_cache_node_t *) node;
+            cnt = (ngx_http_file_cache_node_t *) temp;
 
-    rc = ngx_http_file_cache_open(&c);
+            p = (ngx_memcmp(cn->key, cnt->key,
+                            NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t))
+                 < 0)
+                    ? &temp->left : &temp->right;
+        }
 
-    /* TODO: NGX_AGAIN */
+        if (*p == sentinel) {
+            break;
+        }
 
-    if (rc != NGX_ERROR&& rc != NGX_DECLINED && rc != NGX_HTTP_CACHE_STALE) {
-        return NGX_OK;
+        temp = *p;
     }
 
-    if (ngx_delete_file(name->data) == NGX_FILE_ERROR) {
-        ngx_log_error(NGX_LOG_CRIT, c.log, ngx_errno,
-                      ngx_delete_file_n " \"%s\" failed", name->data);
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_name(ngx_http_request_t *r, ngx_path_t *path)
+{
+    ngx_http_cache_t  *c;
+
+    c = r->cache;
+
+    c->file.name.len = path->name.len + 1 + path->len
+                       + 2 * NGX_HTTP_CACHE_KEY_LEN;
+
+    c->file.name.data = ngx_palloc(r->pool, c->file.name.len + 1);
+    if (c->file.name.data == NULL) {
         return NGX_ERROR;
     }
 
-    gc->deleted++;
-    gc->freed += ngx_de_size(dir);
+    ngx_memcpy(c->file.name.data, path->name.data, path->name.len);
+
+    ngx_md5_text(c->file.name.data + path->name.len + 1 + path->len, c->key);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "cache key: %s",
+                   c->file.name.data + path->name.len + 1 + path->len);
+
+    ngx_create_hashed_filename(&c->file, path);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "cache file: \"%s\"", c->file.name.data);
 
     return NGX_OK;
 }
+
+
+void
+ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf)
+{
+    u_char                        *p;
+    ngx_str_t                     *key;
+    ngx_uint_t                     i;
+    ngx_http_cache_t              *c;
+    ngx_http_file_cache_header_t  *h;
+
+    c = r->cache;
+
+    h = (ngx_http_file_cache_header_t *) buf;
+
+    h->valid_sec = c->valid_sec;
+    h->updating_sec = c->updating_sec;
+    h->error_sec = c->error_sec;
+    h->last_modified = c->last_modified;
+    h->date = c->date;
+    h->crc32 = c->crc32;
+    h->header_start = (u_short) c->header_start;
+    h->body_start = (u_short) c->body_start;
+
+    p = buf + sizeof(ngx_http_file_cache_header_t);
+
+    p = ngx_cpymem(p, ngx_http_file_cache_key, sizeof(ngx_http_file_cache_key));
+
+    key = c->keys.elts;
+    for (i = 0; i < c->keys.nelts; i++) {
+        p = ngx_cpymem(p, key[i].data, key[i].len);
+    }
+
+    *p = LF;
+}
+
+
+void
+ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
+{
+    off_t                   fs_size;
+    ngx_int_t               rc;
+    ngx_err_t               err;
+    ngx_uint_t              deleting;
+    ngx_file_info_t         fi;
+    ngx_http_cache_t       *c;
+    ngx_http_file_cache_t  *cache;
+
+    c = r->cache;
+
+    if (c->updated) {
+        return;
+    }
+
+    c->updated = 1;
+
+    cache = c->file_cache;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache rename: \"%s\" to \"%s\"",
+                   tf->file.name.data, c->file.name.data);
+
+    rc = NGX_ERROR;
+    fs_size = 0;
+
+    if (ngx_fd_info(tf->file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", tf->file.name.data);
+        goto failed;
+    }
+
+    fs_size = ngx_file_fs_size(&fi);
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    deleting = c->node->deleting;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    if (deleting) {
+
+        /*
+         * the expired file with the same name is being deleted right now,
+         * the new one would be deleted too, so it is not stored this time
+         */
+
+        goto failed;
+    }
+
+    if (ngx_rename_file(tf->file.name.data, c->file.name.data)
+        != NGX_FILE_ERROR)
+    {
+        rc = NGX_OK;
+        goto done;
+    }
+
+    err = ngx_errno;
+
+    if (err == NGX_ENOENT) {
+
+        /* the hashed subdirectories have not been created yet */
+
+        if (ngx_create_path(&c->file, cache->path) == NGX_OK
+            && ngx_rename_file(tf->file.name.data, c->file.name.data)
+               != NGX_FILE_ERROR)
+        {
+            rc = NGX_OK;
+            goto done;
+        }
+
+        err = ngx_errno;
+    }
+
+    ngx_log_error(NGX_LOG_CRIT, r->connection->log, err,
+                  ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                  tf->file.name.data, c->file.name.data);
+
+failed:
+
+    if (ngx_delete_file(tf->file.name.data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", tf->file.name.data);
+    }
+
+done:
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    c->node->count--;
+
+    if (c->updating) {
+        c->node->updating = 0;
+    }
+
+    if (rc == NGX_OK) {
+        cache->sh->size += fs_size - c->node->fs_size;
+
+        c->node->exists = 1;
+        c->node->valid_sec = c->valid_sec;
+        c->node->updating_sec = c->updating_sec;
+        c->node->error_sec = c->error_sec;
+        c->node->body_start = c->body_start;
+        c->node->fs_size = fs_size;
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+}
+
+
+ngx_int_t
+ngx_http_cache_send(ngx_http_request_t *r)
+{
+    ngx_int_t          rc;
+    ngx_buf_t         *b;
+    ngx_chain_t        out;
+    ngx_http_cache_t  *c;
+
+    c = r->cache;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache send: %s", c->file.name.data);
+
+    /* we need to allocate all before the header would be sent */
+
+    b = ngx_pcalloc(r->pool, sizeof(ngx_buf_t));
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
+    if (b->file == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    r->headers_out.content_length_n = c->length - c->body_start;
+
+    if (r->headers_out.content_length) {
+        r->headers_out.content_length->hash = 0;
+        r->headers_out.content_length = NULL;
+    }
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    b->file_pos = c->body_start;
+    b->file_last = c->length;
+
+    b->in_file = (c->length - c->body_start) ? 1: 0;
+    b->last_buf = (r == r->main) ? 1: 0;
+
+    b->file->fd = c->file.fd;
+    b->file->name = c->file.name;
+    b->file->log = r->connection->log;
+
+    out.buf = b;
+    out.next = NULL;
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+void
+ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
+{
+    ngx_http_file_cache_t  *cache;
+
+    if (c->updated) {
+        return;
+    }
+
+    c->updated = 1;
+
+    cache = c->file_cache;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
+                   "http file cache free");
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    c->node->count--;
+
+    if (c->updating) {
+        c->node->updating = 0;
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    if (tf && tf->file.fd != NGX_INVALID_FILE) {
+        if (ngx_delete_file(tf->file.name.data) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, c->file.log, ngx_errno,
+                          ngx_delete_file_n " \"%s\" failed",
+                          tf->file.name.data);
+        }
+    }
+}
+
+
+/*
+ * the cache file is found to be invalid: it is deleted and the node is
+ * marked as not existing, so the response is fetched again
+ */
+
+void
+ngx_http_file_cache_invalidate(ngx_http_request_t *r)
+{
+    ngx_http_cache_t       *c;
+    ngx_http_file_cache_t  *cache;
+
+    c = r->cache;
+    cache = c->file_cache;
+
+    c->exists = 0;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    if (!c->node->exists || c->node->deleting) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return;
+    }
+
+    cache->sh->size -= c->node->fs_size;
+
+    c->node->exists = 0;
+    c->node->fs_size = 0;
+    c->node->deleting = 1;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache invalidate: \"%s\"", c->file.name.data);
+
+    if (ngx_delete_file(c->file.name.data) == NGX_FILE_ERROR
+        && ngx_errno != NGX_ENOENT)
+    {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", c->file.name.data);
+    }
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    c->node->deleting = 0;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+}
+
+
+static void
+ngx_http_file_cache_cleanup(void *data)
+{
+    ngx_http_cache_t  *c = data;
+
+    ngx_http_file_cache_free(c, NULL);
+}
+
+
+time_t
+ngx_http_file_cache_valid(ngx_array_t *cache_valid, ngx_uint_t status)
+{
+    ngx_uint_t               i;
+    ngx_http_cache_valid_t  *valid;
+
+    if (cache_valid == NULL) {
+        return 0;
+    }
+
+    valid = cache_valid->elts;
+    for (i = 0; i < cache_valid->nelts; i++) {
+
+        if (valid[i].status == 0 || valid[i].status == status) {
+            return valid[i].valid;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * the expiration pass frees the nodes that have not been used during
+ * the "inactive" time, the forced one frees the least recently used node;
+ * both return the number of seconds until the next pass is needed
+ */
+
+static time_t
+ngx_http_file_cache_expire(ngx_http_file_cache_t *cache, ngx_uint_t forced)
+{
+    u_char                      *name;
+    size_t                       len;
+    time_t                       now, wait;
+    ngx_uint_t                   tries;
+    ngx_queue_t                 *q;
+    ngx_path_t                  *path;
+    ngx_http_file_cache_node_t  *fcn;
+
+    path = cache->path;
+
+    len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+
+    name = ngx_alloc(len + 1, ngx_cycle->log);
+    if (name == NULL) {
+        return 10;
+    }
+
+    ngx_memcpy(name, path->name.data, path->name.len);
+
+    now = ngx_time();
+    tries = 0;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    for ( ;; ) {
+
+        if (ngx_queue_empty(&cache->sh->queue)) {
+            wait = 10;
+            break;
+        }
+
+        q = ngx_queue_last(&cache->sh->queue);
+
+        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+        if (!forced) {
+            wait = fcn->expire - now;
+
+            if (wait > 0) {
+                wait = (wait > 10) ? 10 : wait;
+                break;
+            }
+        }
+
+        if (fcn->count) {
+
+            /*
+             * the node is used by a request, move it to the queue head
+             * to give a chance to expire the other nodes
+             */
+
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                           "http file cache expire skip: #%d", fcn->count);
+
+            ngx_queue_remove(q);
+            fcn->expire = now + cache->inactive;
+            ngx_queue_insert_head(&cache->sh->queue, q);
+
+            if (++tries == 20) {
+                wait = 1;
+                break;
+            }
+
+            continue;
+        }
+
+        ngx_http_file_cache_delete(cache, q, name);
+
+        if (forced) {
+            wait = 0;
+            break;
+        }
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_free(name);
+
+    return wait;
+}
+
+
+/* the cache keys zone must be locked, it is unlocked while deleting */
+
+static void
+ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
+    u_char *name)
+{
+    u_char                      *p;
+    u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
+    ngx_file_t                   file;
+    ngx_path_t                  *path;
+    ngx_http_file_cache_node_t  *fcn;
+
+    fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+    if (fcn->exists) {
+        path = cache->path;
+
+        p = ngx_cpymem(key, &fcn->node.key, sizeof(ngx_rbtree_key_t));
+        ngx_memcpy(p, fcn->key,
+                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        ngx_md5_text(name + path->name.len + 1 + path->len, key);
+
+        file.name.data = name;
+        file.name.len = path->name.len + 1 + path->len
+                        + 2 * NGX_HTTP_CACHE_KEY_LEN;
+        file.log = ngx_cycle->log;
+
+        ngx_create_hashed_filename(&file, path);
+
+        cache->sh->size -= fcn->fs_size;
+
+        fcn->exists = 0;
+        fcn->fs_size = 0;
+        fcn->deleting = 1;
+        fcn->count++;
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache expire: \"%s\"", name);
+
+        if (ngx_delete_file(name) == NGX_FILE_ERROR
+            && ngx_errno != NGX_ENOENT)
+        {
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                          ngx_delete_file_n " \"%s\" failed", name);
+        }
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        fcn->count--;
+        fcn->deleting = 0;
+
+        /*
+         * the node has been left in the queue while the zone was unlocked,
+         * so a request may have found it and moved it to the queue head
+         */
+
+        if (fcn->count || fcn->exists) {
+            return;
+        }
+    }
+
+    ngx_queue_remove(q);
+
+    ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
+
+    ngx_slab_free_locked(cache->shpool, fcn);
+}
+
+
+static time_t
+ngx_http_file_cache_manager(void *data)
+{
+    ngx_http_file_cache_t  *cache = data;
+
+    off_t   size;
+    time_t  next, wait;
+
+    next = ngx_http_file_cache_expire(cache, 0);
+
+    if (cache->max_size == 0) {
+        return next;
+    }
+
+    for ( ;; ) {
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        size = cache->sh->size;
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache size: %O", size);
+
+        if (size < cache->max_size) {
+            return next;
+        }
+
+        wait = ngx_http_file_cache_expire(cache, 1);
+
+        if (wait > 0) {
+            return (wait < next) ? wait : next;
+        }
+    }
+}
+
+
+static void
+ngx_http_file_cache_loader(void *data)
+{
+    ngx_http_file_cache_t  *cache = data;
+
+    ngx_gc_t  ctx;
+
+    if (!cache->sh->cold) {
+        return;
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                  "http file cache \"%V\" loading", &cache->path->name);
+
+    ctx.path = cache->path;
+    ctx.deleted = 0;
+    ctx.freed = 0;
+    ctx.handler = ngx_http_file_cache_manage_file;
+    ctx.data = cache;
+    ctx.log = ngx_cycle->log;
+
+    (void) ngx_collect_garbage(&ctx, &cache->path->name, 0);
+
+    cache->sh->cold = 0;
+
+    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                  "http file cache \"%V\" loaded: %O bytes",
+                  &cache->path->name, cache->sh->size);
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_manage_file(ngx_gc_t *ctx, ngx_str_t *name,
+    ngx_dir_t *dir)
+{
+    u_char                      *p;
+    u_char                       key[NGX_HTTP_CACHE_KEY_LEN];
+    ngx_int_t                    n;
+    ngx_uint_t                   i;
+    ngx_http_file_cache_t       *cache;
+    ngx_http_file_cache_node_t  *fcn;
+
+    cache = ctx->data;
+
+    if (name->len != cache->path->name.len + 1 + cache->path->len
+                     + 2 * NGX_HTTP_CACHE_KEY_LEN)
+    {
+        goto invalid;
+    }
+
+    p = name->data + name->len - 2 * NGX_HTTP_CACHE_KEY_LEN;
+
+    for (i = 0; i < NGX_HTTP_CACHE_KEY_LEN; i++) {
+        n = ngx_hextoi(p, 2);
+
+        if (n == NGX_ERROR) {
+            goto invalid;
+        }
+
+        key[i] = (u_char) n;
+        p += 2;
+    }
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    fcn = ngx_http_file_cache_lookup(cache, key);
+
+    if (fcn == NULL) {
+        fcn = ngx_http_file_cache_alloc_node(cache, key);
+
+        if (fcn == NULL) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+
+            ngx_log_error(NGX_LOG_WARN, ctx->log, 0,
+                          "cache keys zone \"%V\" is too small "
+                          "to load the cache", &cache->shm_zone->name);
+
+            return NGX_ABORT;
+        }
+
+        fcn->count = 0;
+        fcn->exists = 1;
+        fcn->fs_size = ngx_de_fs_size(dir);
+
+        cache->sh->size += fcn->fs_size;
+
+        fcn->expire = ngx_time() + cache->inactive;
+
+        ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    return NGX_OK;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_NOTICE, ctx->log, 0,
+                  "delete invalid cache file \"%s\"", name->data);
+
+    if (ngx_delete_file(name->data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", name->data);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_file_cache_t  *ocache = data;
+
+    ngx_http_file_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        if (cache->path->name.len != ocache->path->name.len
+            || ngx_strncmp(cache->path->name.data, ocache->path->name.data,
+                           cache->path->name.len)
+               != 0)
+        {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "cache \"%V\" uses the \"%V\" cache path "
+                          "while previously it used the \"%V\" cache path",
+                          &shm_zone->name, &cache->path->name,
+                          &ocache->path->name);
+
+            return NGX_ERROR;
+        }
+
+        cache->sh = ocache->sh;
+        cache->shpool = ocache->shpool;
+
+        return NGX_OK;
+    }
+
+    cache->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    cache->sh = ngx_slab_alloc(cache->shpool,
+                               sizeof(ngx_http_file_cache_sh_t));
+    if (cache->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_rbt_black(&cache->sh->sentinel);
+
+    cache->sh->rbtree.root = &cache->sh->sentinel;
+    cache->sh->rbtree.sentinel = &cache->sh->sentinel;
+    cache->sh->rbtree.insert = ngx_http_file_cache_rbtree_insert_value;
+
+    ngx_queue_init(&cache->sh->queue);
+
+    cache->sh->cold = 1;
+    cache->sh->size = 0;
+
+    return NGX_OK;
+}
+
+
+char *
+ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    u_char                 *p, *last;
+    off_t                   max_size;
+    time_t                  inactive;
+    ssize_t                 size;
+    ngx_str_t               s, name, *value;
+    ngx_uint_t              i, n;
+    ngx_http_file_cache_t  *cache;
+
+    cache = ngx_pcalloc(cf->pool, sizeof(ngx_http_file_cache_t));
+    if (cache == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    cache->path = ngx_pcalloc(cf->pool, sizeof(ngx_path_t));
+    if (cache->path == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    inactive = 600;
+    max_size = 0;
+
+    name.len = 0;
+    size = 0;
+
+    value = cf->args->elts;
+
+    cache->path->name = value[1];
+
+    if (cache->path->name.data[cache->path->name.len - 1] == '/') {
+        cache->path->name.len--;
+    }
+
+    if (ngx_conf_full_name(cf->cycle, &cache->path->name) == NGX_ERROR) {
+        return NGX_CONF_ERROR;
+    }
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "levels=", 7) == 0) {
+
+            p = value[i].data + 7;
+            last = value[i].data + value[i].len;
+
+            for (n = 0; n < NGX_MAX_PATH_LEVEL; n++) {
+
+                if (p == last || *p < '1' || *p > '2') {
+                    goto invalid_levels;
+                }
+
+                cache->path->level[n] = *p++ - '0';
+                cache->path->len += cache->path->level[n] + 1;
+
+                if (p == last) {
+                    break;
+                }
+
+                if (*p++ != ':') {
+                    goto invalid_levels;
+                }
+            }
+
+            if (p == last) {
+                continue;
+            }
+
+        invalid_levels:
+
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid \"levels\" \"%V\"", &value[i]);
+            return NGX_CONF_ERROR;
+        }
+
+        if (ngx_strncmp(value[i].data, "keys_zone=", 10) == 0) {
+
+            name.data = value[i].data + 10;
+
+            p = (u_char *) ngx_strchr(name.data, ':');
+
+            if (p == NULL) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid keys zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            name.len = p - name.data;
+
+            s.data = p + 1;
+            s.len = value[i].data + value[i].len - s.data;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid keys zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "keys zone \"%V\" is too small", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "inactive=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            inactive = ngx_parse_time(&s, 1);
+            if (inactive < 1) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid inactive value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "max_size=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            max_size = ngx_parse_offset(&s);
+            if (max_size < 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid max_size value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" must have \"keys_zone\" parameter",
+                           &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    cache->path->conf_file = cf->conf_file->file.name.data;
+    cache->path->line = cf->conf_file->line;
+
+    if (ngx_add_path(cf, &cache->path) == NGX_ERROR) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (cache->path->data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "the cache path \"%V\" is already used by "
+                           "another cache", &cache->path->name);
+        return NGX_CONF_ERROR;
+    }
+
+    cache->path->manager = ngx_http_file_cache_manager;
+    cache->path->loader = ngx_http_file_cache_loader;
+    cache->path->data = cache;
+
+    cache->shm_zone = ngx_shared_memory_add(cf, &name, size, cmd->post);
+    if (cache->shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (cache->shm_zone->data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "duplicate cache keys zone \"%V\"", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    cache->shm_zone->init = ngx_http_file_cache_init;
+    cache->shm_zone->data = cache;
+
+    cache->inactive = inactive;
+    cache->max_size = max_size;
+
+    return NGX_CONF_OK;
+}
+
+
+char *
+ngx_http_file_cache_valid_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    char  *p = conf;
+
+    time_t                    valid;
+    ngx_int_t                 status;
+    ngx_str_t                *value;
+    ngx_uint_t                i, n;
+    ngx_array_t             **a;
+    ngx_http_cache_valid_t   *v;
+    static ngx_uint_t         statuses[] = { 200, 301, 302 };
+
+    a = (ngx_array_t **) (p + cmd->offset);
+
+    if (*a == NULL) {
+        *a = ngx_array_create(cf->pool, 1, sizeof(ngx_http_cache_valid_t));
+        if (*a == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    value = cf->args->elts;
+    n = cf->args->nelts - 1;
+
+    valid = ngx_parse_time(&value[n], 1);
+    if (valid < 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid time value \"%V\"", &value[n]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (n == 1) {
+
+        for (i = 0; i < 3; i++) {
+            v = ngx_array_push(*a);
+            if (v == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            v->status = statuses[i];
+            v->valid = valid;
+        }
+
+        return NGX_CONF_OK;
+    }
+
+    for (i = 1; i < n; i++) {
+
+        if (ngx_strcmp(value[i].data, "any") == 0) {
+            status = 0;
+
+        } else {
+            status = ngx_atoi(value[i].data, value[i].len);
+
+            if (status < 100 || status > 599) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid status \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+        }
+
+        v = ngx_array_push(*a);
+        if (v == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        v->status = status;
+        v->valid = valid;
+    }
+
+    return NGX_CONF_OK;
+}
@@ -32,6 +32,244 @@ static uint32_t  usual[] = {
 };
 
 
+/*
+ * the long runs of the ordinary characters in URI and header values
+ * are skipped by searching for the first character of a set:
+ * 16 bytes at once if CPU supports SSE2 or SSE4.2, the implementation
+ * is chosen once by ngx_http_parse_init() using ngx_cpuinfo() results
+ */
+
+#if (( __i386__ || __amd64__ ) && __GNUC__ && __SSE2__)
+
+#define NGX_HTTP_PARSE_SSE2  1
+
+#include <emmintrin.h>
+
+#if (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define NGX_HTTP_PARSE_SSE42  1
+#include <nmmintrin.h>
+#endif
+
+#endif
+
+
+typedef struct {
+    uint32_t     map[8];
+    ngx_uint_t   n;
+    u_char       chars[16];
+} ngx_http_parse_chars_t;
+
+
+typedef u_char *(*ngx_http_parse_find_pt)(u_char *p, u_char *last,
+    ngx_http_parse_chars_t *set);
+
+
+static void ngx_http_parse_chars_init(ngx_http_parse_chars_t *set);
+static u_char *ngx_http_parse_find(u_char *p, u_char *last,
+    ngx_http_parse_chars_t *set);
+#if (NGX_HTTP_PARSE_SSE2)
+static u_char *ngx_http_parse_find_sse2(u_char *p, u_char *last,
+    ngx_http_parse_chars_t *set);
+static ngx_uint_t ngx_http_parse_name_sse2(u_char *p, u_char *lowcase);
+#endif
+#if (NGX_HTTP_PARSE_SSE42)
+static u_char *ngx_http_parse_find_sse42(u_char *p, u_char *last,
+    ngx_http_parse_chars_t *set) __attribute__ ((target ("sse4.2")));
+#endif
+
+
+/* the characters that are not usual[] in URI, it is filled on init */
+static ngx_http_parse_chars_t  ngx_http_uri_chars;
+
+/* the characters that end or mark arguments */
+static ngx_http_parse_chars_t  ngx_http_args_chars = {
+    { 0 }, 5, { ' ', CR, LF, '#', '\0' }
+};
+
+static ngx_http_parse_chars_t  ngx_http_value_chars = {
+    { 0 }, 2, { CR, LF }
+};
+
+static ngx_http_parse_find_pt  ngx_http_parse_find_handler =
+                                                           ngx_http_parse_find;
+static ngx_uint_t              ngx_http_parse_simd_name;
+
+
+void
+ngx_http_parse_init(void)
+{
+    ngx_uint_t  ch;
+
+    ngx_http_uri_chars.n = 0;
+
+    for (ch = 0; ch < 256; ch++) {
+        if (!(usual[ch >> 5] & (1 << (ch & 0x1f)))) {
+            ngx_http_uri_chars.chars[ngx_http_uri_chars.n++] = (u_char) ch;
+        }
+    }
+
+    ngx_http_parse_chars_init(&ngx_http_uri_chars);
+    ngx_http_parse_chars_init(&ngx_http_args_chars);
+    ngx_http_parse_chars_init(&ngx_http_value_chars);
+
+    ngx_http_parse_find_handler = ngx_http_parse_find;
+    ngx_http_parse_simd_name = 0;
+
+#if (NGX_HTTP_PARSE_SSE2)
+
+    if (ngx_cpu_sse2) {
+        ngx_http_parse_find_handler = ngx_http_parse_find_sse2;
+        ngx_http_parse_simd_name = 1;
+    }
+
+#endif
+
+#if (NGX_HTTP_PARSE_SSE42)
+
+    if (ngx_cpu_sse42) {
+        ngx_http_parse_find_handler = ngx_http_parse_find_sse42;
+    }
+
+#endif
+}
+
+
+static void
+ngx_http_parse_chars_init(ngx_http_parse_chars_t *set)
+{
+    ngx_uint_t  i;
+
+    ngx_memzero(set->map, sizeof(set->map));
+
+    for (i = 0; i < set->n; i++) {
+        set->map[set->chars[i] >> 5] |= 1 << (set->chars[i] & 0x1f);
+    }
+}
+
+
+static u_char *
+ngx_http_parse_find(u_char *p, u_char *last, ngx_http_parse_chars_t *set)
+{
+    while (p < last) {
+        if (set->map[*p >> 5] & (1 << (*p & 0x1f))) {
+            return p;
+        }
+
+        p++;
+    }
+
+    return last;
+}
+
+
+#if (NGX_HTTP_PARSE_SSE2)
+
+static u_char *
+ngx_http_parse_find_sse2(u_char *p, u_char *last, ngx_http_parse_chars_t *set)
+{
+    int         mask;
+    __m128i     data, match, v[16];
+    ngx_uint_t  i;
+
+    for (i = 0; i < set->n; i++) {
+        v[i] = _mm_set1_epi8((char) set->chars[i]);
+    }
+
+    while (last - p >= 16) {
+        data = _mm_loadu_si128((__m128i *) p);
+
+        match = _mm_cmpeq_epi8(data, v[0]);
+
+        for (i = 1; i < set->n; i++) {
+            match = _mm_or_si128(match, _mm_cmpeq_epi8(data, v[i]));
+        }
+
+        mask = _mm_movemask_epi8(match);
+
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 16;
+    }
+
+    return ngx_http_parse_find(p, last, set);
+}
+
+
+/*
+ * lowercases 16 bytes of a header name into the lowcase buffer and
+ * returns the number of the leading valid characters: [A-Za-z0-9-]
+ */
+
+static ngx_uint_t
+ngx_http_parse_name_sse2(u_char *p, u_char *lowcase)
+{
+    int      mask;
+    __m128i  data, upper, lower, digit, valid;
+
+    data = _mm_loadu_si128((__m128i *) p);
+
+    /* the signed comparisons reject the bytes above 0x7f */
+
+    upper = _mm_and_si128(_mm_cmpgt_epi8(data, _mm_set1_epi8('A' - 1)),
+                          _mm_cmplt_epi8(data, _mm_set1_epi8('Z' + 1)));
+    lower = _mm_and_si128(_mm_cmpgt_epi8(data, _mm_set1_epi8('a' - 1)),
+                          _mm_cmplt_epi8(data, _mm_set1_epi8('z' + 1)));
+    digit = _mm_and_si128(_mm_cmpgt_epi8(data, _mm_set1_epi8('0' - 1)),
+                          _mm_cmplt_epi8(data, _mm_set1_epi8('9' + 1)));
+
+    valid = _mm_or_si128(_mm_or_si128(upper, lower),
+                         _mm_or_si128(digit,
+                                   _mm_cmpeq_epi8(data, _mm_set1_epi8('-'))));
+
+    data = _mm_or_si128(data, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+
+    _mm_storeu_si128((__m128i *) lowcase, data);
+
+    mask = _mm_movemask_epi8(valid);
+
+    if (mask == 0xffff) {
+        return 16;
+    }
+
+    return __builtin_ctz(~mask);
+}
+
+#endif
+
+
+#if (NGX_HTTP_PARSE_SSE42)
+
+static u_char *
+ngx_http_parse_find_sse42(u_char *p, u_char *last, ngx_http_parse_chars_t *set)
+{
+    int      n, len;
+    __m128i  chars, data;
+
+    chars = _mm_loadu_si128((__m128i *) set->chars);
+    len = (int) set->n;
+
+    while (last - p >= 16) {
+        data = _mm_loadu_si128((__m128i *) p);
+
+        n = _mm_cmpestri(chars, len, data, 16,
+                         _SIDD_UBYTE_OPS|_SIDD_CMP_EQUAL_ANY
+                         |_SIDD_LEAST_SIGNIFICANT);
+
+        if (n != 16) {
+            return p + n;
+        }
+
+        p += 16;
+    }
+
+    return ngx_http_parse_find(p, last, set);
+}
+
+#endif
+
+
 /* gcc, icc, msvc and others compile these switches as an jump table */
 
 ngx_int_t
@@ -374,6 +612,8 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
         case sw_check_uri:
 
             if (usual[ch >> 5] & (1 << (ch & 0x1f))) {
+                p = ngx_http_parse_find_handler(p + 1, b->last,
+                                                &ngx_http_uri_chars) - 1;
                 break;
             }
 
@@ -429,6 +669,8 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
         case sw_uri:
 
             if (usual[ch >> 5] & (1 << (ch & 0x1f))) {
+                p = ngx_http_parse_find_handler(p + 1, b->last,
+                                                &ngx_http_args_chars) - 1;
                 break;
             }
 
@@ -607,8 +849,11 @@ done:
 ngx_int_t
 ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b)
 {
-    u_char      c, ch, *p;
+    u_char      c, ch, *p, *q, *e;
     ngx_uint_t  hash, i;
+#if (NGX_HTTP_PARSE_SSE2)
+    ngx_uint_t  n, k;
+#endif
     enum {
         sw_start = 0,
         sw_name,
@@ -675,6 +920,28 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b)
 
         /* header name */
         case sw_name:
+
+#if (NGX_HTTP_PARSE_SSE2)
+
+            if (ngx_http_parse_simd_name
+                && b->last - p >= 16
+                && i <= NGX_HTTP_LC_HEADER_LEN - 16)
+            {
+                n = ngx_http_parse_name_sse2(p, &r->lowcase_header[i]);
+
+                if (n) {
+                    for (k = i, i += n; k < i; k++) {
+                        hash = ngx_hash(hash, r->lowcase_header[k]);
+                    }
+
+                    i &= ~NGX_HTTP_LC_HEADER_LEN;
+                    p += n - 1;
+                    break;
+                }
+            }
+
+#endif
+
             c = lowcase[ch];
 
             if (c) {
@@ -742,20 +1009,35 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b)
 
         /* header value */
         case sw_value:
-            switch (ch) {
-            case ' ':
-                r->header_end = p;
-                state = sw_space_after_value;
+
+            /*
+             * look for the line end at once, the value ends
+             * before the trailing spaces
+             */
+
+            q = ngx_http_parse_find_handler(p, b->last, &ngx_http_value_chars);
+
+            for (e = q; e > p && *(e - 1) == ' '; e--) { /* void */ }
+
+            if (q == b->last) {
+                if (e != q) {
+                    r->header_end = e;
+                    state = sw_space_after_value;
+                }
+
+                p = q - 1;
                 break;
-            case CR:
-                r->header_end = p;
+            }
+
+            p = q;
+            r->header_end = e;
+
+            if (*p == CR) {
                 state = sw_almost_done;
                 break;
-            case LF:
-                r->header_end = p;
-                goto done;
             }
-            break;
+
+            goto done;
 
         /* space* before end of header line */
         case sw_space_after_value:
@@ -1368,3 +1650,270 @@ ngx_http_parse_multi_header_lines(ngx_array_t *headers, ngx_str_t *name,
 
     return NGX_DECLINED;
 }
+
+
+ngx_int_t
+ngx_http_parse_chunked(ngx_http_request_t *r, ngx_buf_t *b,
+    ngx_http_chunked_t *ctx)
+{
+    u_char     *pos, ch, c;
+    ngx_int_t   rc;
+    enum {
+        sw_chunk_start = 0,
+        sw_chunk_size,
+        sw_chunk_extension,
+        sw_chunk_extension_almost_done,
+        sw_chunk_data,
+        sw_after_data,
+        sw_after_data_almost_done,
+        sw_last_chunk_extension,
+        sw_last_chunk_extension_almost_done,
+        sw_trailer,
+        sw_trailer_almost_done,
+        sw_trailer_header,
+        sw_trailer_header_almost_done
+    } state;
+
+    state = ctx->state;
+
+    if (state == sw_chunk_data && ctx->size == 0) {
+        state = sw_after_data;
+    }
+
+    rc = NGX_AGAIN;
+
+    for (pos = b->pos; pos < b->last; pos++) {
+
+        ch = *pos;
+
+        switch (state) {
+
+        case sw_chunk_start:
+            if (ch >= '0' && ch <= '9') {
+                state = sw_chunk_size;
+                ctx->size = ch - '0';
+                break;
+            }
+
+            c = (u_char) (ch | 0x20);
+
+            if (c >= 'a' && c <= 'f') {
+                state = sw_chunk_size;
+                ctx->size = c - 'a' + 10;
+                break;
+            }
+
+            goto invalid;
+
+        case sw_chunk_size:
+            if (ctx->size > NGX_MAX_OFF_T_VALUE / 16) {
+                goto invalid;
+            }
+
+            if (ch >= '0' && ch <= '9') {
+                ctx->size = ctx->size * 16 + (ch - '0');
+                break;
+            }
+
+            c = (u_char) (ch | 0x20);
+
+            if (c >= 'a' && c <= 'f') {
+                ctx->size = ctx->size * 16 + (c - 'a' + 10);
+                break;
+            }
+
+            if (ctx->size == 0) {
+
+                switch (ch) {
+                case CR:
+                    state = sw_last_chunk_extension_almost_done;
+                    break;
+                case LF:
+                    state = sw_trailer;
+                    break;
+                case ';':
+                case ' ':
+                case '\t':
+                    state = sw_last_chunk_extension;
+                    break;
+                default:
+                    goto invalid;
+                }
+
+                break;
+            }
+
+            switch (ch) {
+            case CR:
+                state = sw_chunk_extension_almost_done;
+                break;
+            case LF:
+                state = sw_chunk_data;
+                break;
+            case ';':
+            case ' ':
+            case '\t':
+                state = sw_chunk_extension;
+                break;
+            default:
+                goto invalid;
+            }
+
+            break;
+
+        case sw_chunk_extension:
+            switch (ch) {
+            case CR:
+                state = sw_chunk_extension_almost_done;
+                break;
+            case LF:
+                state = sw_chunk_data;
+            }
+            break;
+
+        case sw_chunk_extension_almost_done:
+            if (ch == LF) {
+                state = sw_chunk_data;
+                break;
+            }
+            goto invalid;
+
+        case sw_chunk_data:
+            rc = NGX_OK;
+            goto data;
+
+        case sw_after_data:
+            switch (ch) {
+            case CR:
+                state = sw_after_data_almost_done;
+                break;
+            case LF:
+                state = sw_chunk_start;
+            }
+            break;
+
+        case sw_after_data_almost_done:
+            if (ch == LF) {
+                state = sw_chunk_start;
+                break;
+            }
+            goto invalid;
+
+        case sw_last_chunk_extension:
+            switch (ch) {
+            case CR:
+                state = sw_last_chunk_extension_almost_done;
+                break;
+            case LF:
+                state = sw_trailer;
+            }
+            break;
+
+        case sw_last_chunk_extension_almost_done:
+            if (ch == LF) {
+                state = sw_trailer;
+                break;
+            }
+            goto invalid;
+
+        case sw_trailer:
+            switch (ch) {
+            case CR:
+                state = sw_trailer_almost_done;
+                break;
+            case LF:
+                goto done;
+            default:
+                state = sw_trailer_header;
+            }
+            break;
+
+        case sw_trailer_almost_done:
+            if (ch == LF) {
+                goto done;
+            }
+            goto invalid;
+
+        case sw_trailer_header:
+            switch (ch) {
+            case CR:
+                state = sw_trailer_header_almost_done;
+                break;
+            case LF:
+                state = sw_trailer;
+            }
+            break;
+
+        case sw_trailer_header_almost_done:
+            if (ch == LF) {
+                state = sw_trailer;
+                break;
+            }
+            goto invalid;
+
+        }
+    }
+
+data:
+
+    ctx->state = state;
+    b->pos = pos;
+
+    /*
+     * ctx->length is the minimal number of bytes to expect
+     * before the end of the response, it is used as p->length
+     * by the event pipe
+     */
+
+    switch (state) {
+
+    case sw_chunk_start:
+        ctx->length = 3 /* "0" LF LF */;
+        break;
+    case sw_chunk_size:
+        ctx->length = 2 /* LF LF */
+                      + (ctx->size ? ctx->size + 4 /* LF "0" LF LF */ : 0);
+        break;
+    case sw_chunk_extension:
+    case sw_chunk_extension_almost_done:
+        ctx->length = 1 /* LF */ + ctx->size + 4 /* LF "0" LF LF */;
+        break;
+    case sw_chunk_data:
+        ctx->length = ctx->size + 4 /* LF "0" LF LF */;
+        break;
+    case sw_after_data:
+    case sw_after_data_almost_done:
+        ctx->length = 4 /* LF "0" LF LF */;
+        break;
+    case sw_last_chunk_extension:
+    case sw_last_chunk_extension_almost_done:
+        ctx->length = 2 /* LF LF */;
+        break;
+    case sw_trailer:
+    case sw_trailer_almost_done:
+        ctx->length = 1 /* LF */;
+        break;
+    case sw_trailer_header:
+    case sw_trailer_header_almost_done:
+        ctx->length = 2 /* LF LF */;
+        break;
+
+    }
+
+    if (ctx->size < 0 || ctx->length < 0) {
+        goto invalid;
+    }
+
+    return rc;
+
+done:
+
+    ctx->state = 0;
+    b->pos = pos + 1;
+
+    return NGX_DONE;
+
+invalid:
+
+    return NGX_ERROR;
+}
@@ -32,7 +32,6 @@ static void ngx_http_request_handler(ngx_event_t *ev);
 static ngx_int_t ngx_http_set_write_handler(ngx_http_request_t *r);
 static void ngx_http_writer(ngx_http_request_t *r);
 
-static void ngx_http_block_read(ngx_http_request_t *r);
 static void ngx_http_set_keepalive(ngx_http_request_t *r);
 static void ngx_http_keepalive_handler(ngx_event_t *ev);
 static void ngx_http_set_lingering_close(ngx_http_request_t *r);
@@ -419,6 +418,7 @@ ngx_http_init_request(ngx_event_t *rev)
     r->main = r;
 
     r->start_time = ngx_time();
+    r->start_msec = ngx_current_msec;
 
     r->method = NGX_HTTP_UNKNOWN;
 
@@ -882,6 +882,7 @@ ngx_http_process_request_headers(ngx_event_t *rev)
                            "http header done");
 
             r->request_length += r->header_in->pos - r->header_in->start;
+            r->header_msec = ngx_current_msec;
 
             r->http_state = NGX_HTTP_PROCESS_REQUEST_STATE;
 
@@ -1757,7 +1758,7 @@ ngx_http_writer(ngx_http_request_t *r)
 }
 
 
-static void
+void
 ngx_http_block_read(ngx_http_request_t *r)
 {
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
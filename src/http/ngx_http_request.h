@@ -331,7 +331,9 @@ struct ngx_http_request_s {
     ngx_http_event_handler_pt         read_event_handler;
     ngx_http_event_handler_pt         write_event_handler;
 
+#if (NGX_HTTP_CACHE)
     ngx_http_cache_t                 *cache;
+#endif
 
     ngx_http_upstream_t              *upstream;
 
@@ -345,6 +347,8 @@ struct ngx_http_request_s {
 
     time_t                            lingering_time;
     time_t                            start_time;
+    ngx_msec_t                        start_msec;
+    ngx_msec_t                        header_msec;
 
     ngx_uint_t                        method;
     ngx_uint_t                        http_version;
@@ -418,6 +422,7 @@ struct ngx_http_request_s {
     unsigned                          request_body_delete_incomplete_file:1;
     unsigned                          request_body_file_group_access:1;
     unsigned                          request_body_file_log_level:3;
+    unsigned                          request_body_no_buffering:1;
 
     unsigned                          fast_subrequest:1;
     unsigned                          subrequest_in_memory:1;
@@ -428,6 +433,11 @@ struct ngx_http_request_s {
     unsigned                          bypass_cache:1;
     unsigned                          no_cache:1;
 
+#if (NGX_HTTP_GZIP)
+    /* the response depends on the "Accept-Encoding" header */
+    unsigned                          gzip_vary:1;
+#endif
+
 #if (NGX_HTTP_REALIP)
 
     /*
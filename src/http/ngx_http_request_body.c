@@ -159,8 +159,9 @@ ngx_http_read_client_request_body(ngx_http_request_t *r,
 
         rb->rest = r->headers_in.content_length_n - preread;
 
-        if (rb->rest <= (off_t) (b->end - b->last)) {
-
+        if (rb->rest <= (off_t) (b->end - b->last)
+            && !r->request_body_no_buffering)
+        {
             /* the whole request body may be placed in r->header_in */
 
             r->read_event_handler = ngx_http_read_client_request_body_handler;
@@ -176,6 +177,29 @@ ngx_http_read_client_request_body(ngx_http_request_t *r,
         next = &rb->bufs;
     }
 
+    if (r->request_body_no_buffering) {
+
+        /*
+         * the rest of the body is read by the caller as it is able to send
+         * it further, see ngx_http_read_unbuffered_request_body()
+         */
+
+        size = clcf->client_body_buffer_size;
+
+        if (rb->rest < size) {
+            size = (ssize_t) rb->rest;
+        }
+
+        rb->buf = ngx_create_temp_buf(r->pool, size);
+        if (rb->buf == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        post_handler(r);
+
+        return NGX_OK;
+    }
+
     size = clcf->client_body_buffer_size;
     size += size >> 2;
 
@@ -373,6 +397,118 @@ ngx_http_do_read_client_request_body(ngx_http_request_t *r)
 }
 
 
+/*
+ * ngx_http_read_unbuffered_request_body() reads into r->request_body->buf
+ * the part of the body available on the client connection, so the caller
+ * must have already sent the previous r->request_body->bufs;
+ * it returns NGX_OK if the whole body has been read, or NGX_AGAIN
+ */
+
+ngx_int_t
+ngx_http_read_unbuffered_request_body(ngx_http_request_t *r)
+{
+    size_t                     size;
+    ssize_t                    n;
+    ngx_buf_t                 *b;
+    ngx_chain_t               *cl;
+    ngx_connection_t          *c;
+    ngx_http_request_body_t   *rb;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    c = r->connection;
+    rb = r->request_body;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http read unbuffered client request body");
+
+    rb->bufs = NULL;
+
+    if (c->read->timedout) {
+        c->timedout = 1;
+        return NGX_HTTP_REQUEST_TIME_OUT;
+    }
+
+    if (rb->rest == 0) {
+        return NGX_OK;
+    }
+
+    b = rb->buf;
+
+    b->pos = b->start;
+    b->last = b->start;
+
+    while (b->last < b->end) {
+
+        size = b->end - b->last;
+
+        if ((off_t) size > rb->rest) {
+            size = (size_t) rb->rest;
+        }
+
+        n = c->recv(c, b->last, size);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http client request body recv %z", n);
+
+        if (n == NGX_AGAIN) {
+            break;
+        }
+
+        if (n == 0) {
+            ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                          "client closed prematurely connection");
+        }
+
+        if (n == 0 || n == NGX_ERROR) {
+            c->error = 1;
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        b->last += n;
+        rb->rest -= n;
+        r->request_length += n;
+
+        if (rb->rest == 0) {
+            break;
+        }
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http client request body rest %O", rb->rest);
+
+    if (b->last != b->pos) {
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        cl->buf = b;
+        cl->next = NULL;
+
+        rb->bufs = cl;
+
+        if (c->read->timer_set) {
+            ngx_del_timer(c->read);
+        }
+    }
+
+    if (rb->rest == 0) {
+        return NGX_OK;
+    }
+
+    if (!c->read->ready) {
+        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+        ngx_add_timer(c->read, clcf->client_body_timeout);
+
+        if (ngx_handle_read_event(c->read, 0) == NGX_ERROR) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+    }
+
+    return NGX_AGAIN;
+}
+
+
 static ngx_int_t
 ngx_http_write_request_body(ngx_http_request_t *r, ngx_chain_t *body)
 {
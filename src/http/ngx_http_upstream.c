@@ -9,6 +9,11 @@
 #include <ngx_http.h>
 
 
+#if (NGX_HAVE_SPLICE)
+#define NGX_HTTP_UPSTREAM_SPLICE_SIZE  65536
+#endif
+
+
 static void ngx_http_upstream_rd_check_broken_connection(ngx_http_request_t *r);
 static void ngx_http_upstream_wr_check_broken_connection(ngx_http_request_t *r);
 static void ngx_http_upstream_check_broken_connection(ngx_http_request_t *r,
@@ -19,14 +24,45 @@ static ngx_int_t ngx_http_upstream_reinit(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 static void ngx_http_upstream_send_request(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_upstream_send_request_body(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
 static void ngx_http_upstream_send_request_handler(ngx_event_t *wev);
+#if (NGX_HTTP_CACHE)
+static ngx_int_t ngx_http_upstream_cache(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static void ngx_http_upstream_cache_lock_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_upstream_cache_send(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_upstream_cache_stale(ngx_http_request_t *r,
+    ngx_http_upstream_t *u, ngx_uint_t ft_type);
+static time_t ngx_http_upstream_cache_valid(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static time_t ngx_http_upstream_cache_control_sec(u_char *p, u_char *last,
+    char *name, size_t len);
+static void ngx_http_upstream_cache_update(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+#endif
+static void ngx_http_upstream_read_request_handler(ngx_http_request_t *r);
 static void ngx_http_upstream_process_header(ngx_event_t *rev);
+static ngx_int_t ngx_http_upstream_process_headers(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
 static void ngx_http_upstream_process_body_in_memory(ngx_event_t *rev);
 static void ngx_http_upstream_send_response(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 static void
     ngx_http_upstream_process_non_buffered_downstream(ngx_http_request_t *r);
 static void ngx_http_upstream_process_non_buffered_body(ngx_event_t *ev);
+#if (NGX_HAVE_SPLICE)
+static ngx_int_t ngx_http_upstream_init_splice(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static void ngx_http_upstream_process_splice(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_upstream_init_request_splice(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_upstream_splice_request_body(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static void ngx_http_upstream_splice_cleanup(void *data);
+#endif
 static ngx_int_t ngx_http_upstream_non_buffered_filter_init(void *data);
 static ngx_int_t ngx_http_upstream_non_buffered_filter(void *data,
     ssize_t bytes);
@@ -46,6 +82,13 @@ static ngx_int_t
     ngx_table_elt_t *h, ngx_uint_t offset);
 static ngx_int_t ngx_http_upstream_ignore_header_line(ngx_http_request_t *r,
     ngx_table_elt_t *h, ngx_uint_t offset);
+static ngx_int_t ngx_http_upstream_process_content_length(ngx_http_request_t *r,
+    ngx_table_elt_t *h, ngx_uint_t offset);
+static ngx_int_t ngx_http_upstream_process_connection(ngx_http_request_t *r,
+    ngx_table_elt_t *h, ngx_uint_t offset);
+static ngx_int_t
+    ngx_http_upstream_process_transfer_encoding(ngx_http_request_t *r,
+    ngx_table_elt_t *h, ngx_uint_t offset);
 static ngx_int_t ngx_http_upstream_process_limit_rate(ngx_http_request_t *r,
     ngx_table_elt_t *h, ngx_uint_t offset);
 static ngx_int_t ngx_http_upstream_process_buffering(ngx_http_request_t *r,
@@ -75,6 +118,10 @@ static ngx_int_t ngx_http_upstream_status_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_upstream_response_time_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
+#if (NGX_HTTP_CACHE)
+static ngx_int_t ngx_http_upstream_cache_status_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+#endif
 
 static char *ngx_http_upstream(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy);
 static char *ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd,
@@ -103,8 +150,7 @@ ngx_http_upstream_header_t  ngx_http_upstream_headers_in[] = {
                  ngx_http_upstream_copy_content_type, 0, 1 },
 
     { ngx_string("Content-Length"),
-                 ngx_http_upstream_process_header_line,
-                 offsetof(ngx_http_upstream_headers_in_t, content_length),
+                 ngx_http_upstream_process_content_length, 0,
                  ngx_http_upstream_copy_content_length, 0, 0 },
 
     { ngx_string("Date"),
@@ -133,7 +179,8 @@ ngx_http_upstream_header_t  ngx_http_upstream_headers_in[] = {
                  ngx_http_upstream_rewrite_refresh, 0, 0 },
 
     { ngx_string("Set-Cookie"),
-                 ngx_http_upstream_ignore_header_line, 0,
+                 ngx_http_upstream_process_header_line,
+                 offsetof(ngx_http_upstream_headers_in_t, set_cookie),
                  ngx_http_upstream_copy_header_line, 0, 1 },
 
     { ngx_string("Content-Disposition"),
@@ -159,13 +206,17 @@ ngx_http_upstream_header_t  ngx_http_upstream_headers_in[] = {
                  offsetof(ngx_http_headers_out_t, accept_ranges), 1 },
 
     { ngx_string("Connection"),
-                 ngx_http_upstream_ignore_header_line, 0,
+                 ngx_http_upstream_process_connection, 0,
                  ngx_http_upstream_ignore_header_line, 0, 0 },
 
     { ngx_string("Keep-Alive"),
                  ngx_http_upstream_ignore_header_line, 0,
                  ngx_http_upstream_ignore_header_line, 0, 0 },
 
+    { ngx_string("Transfer-Encoding"),
+                 ngx_http_upstream_process_transfer_encoding, 0,
+                 ngx_http_upstream_ignore_header_line, 0, 0 },
+
     { ngx_string("X-Powered-By"),
                  ngx_http_upstream_ignore_header_line, 0,
                  ngx_http_upstream_copy_header_line, 0, 0 },
@@ -260,7 +311,26 @@ static ngx_http_variable_t  ngx_http_upstream_vars[] = {
       ngx_http_upstream_status_variable, 0, NGX_HTTP_VAR_NOHASH, 0 },
 
     { ngx_string("upstream_response_time"), NULL,
-      ngx_http_upstream_response_time_variable, 0, NGX_HTTP_VAR_NOHASH, 0 },
+      ngx_http_upstream_response_time_variable,
+      offsetof(ngx_http_upstream_state_t, response_time),
+      NGX_HTTP_VAR_NOHASH, 0 },
+
+    { ngx_string("upstream_connect_time"), NULL,
+      ngx_http_upstream_response_time_variable,
+      offsetof(ngx_http_upstream_state_t, connect_time),
+      NGX_HTTP_VAR_NOHASH, 0 },
+
+    { ngx_string("upstream_header_time"), NULL,
+      ngx_http_upstream_response_time_variable,
+      offsetof(ngx_http_upstream_state_t, header_time),
+      NGX_HTTP_VAR_NOHASH, 0 },
+
+#if (NGX_HTTP_CACHE)
+
+    { ngx_string("upstream_cache_status"), NULL,
+      ngx_http_upstream_cache_status_variable, 0, NGX_HTTP_VAR_NOHASH, 0 },
+
+#endif
 
     { ngx_null_string, NULL, NULL, 0, 0, 0 }
 };
@@ -285,11 +355,47 @@ ngx_http_upstream_init(ngx_http_request_t *r)
 
     u = r->upstream;
 
+#if (NGX_HTTP_CACHE)
+
+    if (u->conf->cache) {
+        ngx_int_t  rc;
+
+        rc = ngx_http_upstream_cache(r, u);
+
+        if (rc == NGX_DONE) {
+            return;
+        }
+
+        if (rc == NGX_ERROR) {
+            ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
+        /* rc == NGX_DECLINED */
+    }
+
+#endif
+
     if (!r->post_action && !u->conf->ignore_client_abort) {
         r->read_event_handler = ngx_http_upstream_rd_check_broken_connection;
         r->write_event_handler = ngx_http_upstream_wr_check_broken_connection;
     }
 
+    if (r->request_body_no_buffering && r->request_body->rest) {
+        r->read_event_handler = ngx_http_upstream_read_request_handler;
+
+#if (NGX_HAVE_SPLICE)
+
+        if (u->conf->splice
+            && ngx_http_upstream_init_request_splice(r, u) == NGX_ERROR)
+        {
+            ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
+#endif
+    }
+
     if (ngx_event_flags & NGX_USE_CLEAR_EVENT) {
 
         if (!c->write->active) {
@@ -349,1377 +455,2505 @@ ngx_http_upstream_init(ngx_http_request_t *r)
 }
 
 
-static void
-ngx_http_upstream_rd_check_broken_connection(ngx_http_request_t *r)
-{
-    ngx_http_upstream_check_broken_connection(r, r->connection->read);
-}
-
+#if (NGX_HTTP_CACHE)
 
-static void
-ngx_http_upstream_wr_check_broken_connection(ngx_http_request_t *r)
+static ngx_int_t
+ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
 {
-    ngx_http_upstream_check_broken_connection(r, r->connection->write);
-}
+    ngx_int_t          rc;
+    ngx_http_cache_t  *c;
 
+    c = r->cache;
 
-static void
-ngx_http_upstream_check_broken_connection(ngx_http_request_t *r,
-    ngx_event_t *ev)
-{
-    int                  n;
-    char                 buf[1];
-    ngx_err_t            err;
-    ngx_connection_t     *c;
-    ngx_http_upstream_t  *u;
+    if (c == NULL) {
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ev->log, 0,
-                   "http upstream check client, write event:%d, \"%V\"",
-                   ev->write, &r->uri);
+        if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))
+            || r->subrequest_in_memory
+            || u->create_key == NULL)
+        {
+            return NGX_DECLINED;
+        }
 
-    c = r->connection;
-    u = r->upstream;
+        if (ngx_http_file_cache_new(r) != NGX_OK) {
+            return NGX_ERROR;
+        }
 
-    if (c->error) {
-        ngx_http_upstream_finalize_request(r, u,
-                                           NGX_HTTP_CLIENT_CLOSED_REQUEST);
-        return;
-    }
+        if (u->create_key(r) != NGX_OK) {
+            return NGX_ERROR;
+        }
 
-    if (u->peer.connection == NULL) {
-        return;
-    }
+        ngx_http_file_cache_create_key(r);
 
-#if (NGX_HAVE_KQUEUE)
+        c = r->cache;
 
-    if (ngx_event_flags & NGX_USE_KQUEUE_EVENT) {
+        if (c->header_start + 256 >= u->conf->buffer_size) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "cache key too large, "
+                          "increase upstream buffer size %uz",
+                          u->conf->buffer_size);
 
-        if (!ev->pending_eof) {
-            return;
+            r->cache = NULL;
+            return NGX_DECLINED;
         }
 
-        ev->eof = 1;
-        c->error = 1;
-
-        if (ev->kq_errno) {
-            ev->error = 1;
-        }
+        c->file_cache = u->conf->cache->data;
+        c->min_uses = u->conf->cache_min_uses;
+        c->body_start = u->conf->buffer_size;
 
-        if (!u->cachable && u->peer.connection) {
-            ngx_log_error(NGX_LOG_INFO, ev->log, ev->kq_errno,
-                          "kevent() reported that client closed prematurely "
-                          "connection, so upstream connection is closed too");
-            ngx_http_upstream_finalize_request(r, u,
-                                               NGX_HTTP_CLIENT_CLOSED_REQUEST);
-            return;
-        }
+        c->lock = u->conf->cache_lock;
+        c->lock_timeout = u->conf->cache_lock_timeout;
 
-        ngx_log_error(NGX_LOG_INFO, ev->log, ev->kq_errno,
-                      "kevent() reported that client closed "
-                      "prematurely connection");
+        c->stale_updating = (u->conf->cache_use_stale
+                             & NGX_HTTP_UPSTREAM_FT_UPDATING) ? 1 : 0;
+    }
 
-        if (u->peer.connection == NULL) {
-            ngx_http_upstream_finalize_request(r, u,
-                                               NGX_HTTP_CLIENT_CLOSED_REQUEST);
-            return;
-        }
+    rc = ngx_http_file_cache_open(r);
 
-        return;
-    }
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream cache: %i", rc);
 
-#endif
+    switch (rc) {
 
-    n = recv(c->fd, buf, 1, MSG_PEEK);
+    case NGX_OK:
+    case NGX_HTTP_CACHE_UPDATING:
 
-    err = ngx_socket_errno;
+        /*
+         * NGX_HTTP_CACHE_UPDATING: the expired response is sent while
+         * another request is updating it
+         */
 
-    /*
-     * we do not need to disable the write event because
-     * that event has NGX_USE_CLEAR_EVENT type
-     */
+        u->cache_status = (rc == NGX_OK) ? NGX_HTTP_CACHE_HIT:
+                                           NGX_HTTP_CACHE_UPDATING;
 
-    if (ev->write && (n >= 0 || err == NGX_EAGAIN)) {
-        return;
-    }
+        rc = ngx_http_upstream_cache_send(r, u);
 
-    if ((ngx_event_flags & NGX_USE_LEVEL_EVENT) && ev->active) {
-        if (ngx_del_event(ev, NGX_READ_EVENT, 0) == NGX_ERROR) {
-            ngx_http_upstream_finalize_request(r, u,
-                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
-            return;
+        if (rc == NGX_DECLINED) {
+            u->cache_status = NGX_HTTP_CACHE_MISS;
+            return NGX_DECLINED;
         }
-    }
 
-    if (n > 0) {
-        return;
-    }
+        ngx_http_finalize_request(r, rc);
+        return NGX_DONE;
 
-    if (n == -1) {
-        if (err == NGX_EAGAIN) {
-            return;
-        }
+    case NGX_HTTP_CACHE_EXPIRED:
+        u->cache_status = NGX_HTTP_CACHE_EXPIRED;
+        return NGX_DECLINED;
 
-        ev->error = 1;
+    case NGX_AGAIN:
 
-    } else { /* n == 0 */
-        err = 0;
-    }
+        /*
+         * another request is fetching the response, the cache lock
+         * is polled because it may be held by another worker
+         */
 
-    ev->eof = 1;
-    c->error = 1;
+        c->wait_event.handler = ngx_http_upstream_cache_lock_handler;
+        c->wait_event.data = r;
+        c->wait_event.log = r->connection->log;
 
-    if (!u->cachable && u->peer.connection) {
-        ngx_log_error(NGX_LOG_INFO, ev->log, err,
-                      "client closed prematurely connection, "
-                      "so upstream connection is closed too");
-        ngx_http_upstream_finalize_request(r, u,
-                                           NGX_HTTP_CLIENT_CLOSED_REQUEST);
-        return;
-    }
+        ngx_add_timer(&c->wait_event, 100);
 
-    ngx_log_error(NGX_LOG_INFO, ev->log, err,
-                  "client closed prematurely connection");
+        r->read_event_handler = ngx_http_block_read;
 
-    if (u->peer.connection == NULL) {
-        ngx_http_upstream_finalize_request(r, u,
-                                           NGX_HTTP_CLIENT_CLOSED_REQUEST);
-        return;
+        return NGX_DONE;
+
+    case NGX_DECLINED:
+        u->cache_status = NGX_HTTP_CACHE_MISS;
+        return NGX_DECLINED;
+
+    default: /* NGX_ERROR */
+        return NGX_ERROR;
     }
 }
 
 
 static void
-ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
+ngx_http_upstream_cache_lock_handler(ngx_event_t *ev)
+{
+    ngx_http_request_t  *r;
+
+    r = ev->data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "http upstream cache lock wait \"%V\"", &r->uri);
+
+    ngx_http_upstream_init(r);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_cache_send(ngx_http_request_t *r, ngx_http_upstream_t *u)
 {
     ngx_int_t          rc;
-    ngx_time_t        *tp;
-    ngx_msec_int_t     ms;
-    ngx_connection_t  *c;
+    ngx_http_cache_t  *c;
 
-    r->connection->log->action = "connecting to upstream";
+    c = r->cache;
 
-    r->connection->single_connection = 0;
+    /* the cached response header is parsed by the usual upstream handler */
 
-    if (u->state && u->state->response_time) {
-        tp = ngx_timeofday();
-        ms = tp->sec * 1000 + tp->msec - u->state->response_time;
-        u->state->response_time = (ms >= 0) ? ms : 0;
-    }
+    u->buffer = *c->buf;
+    u->buffer.pos += c->header_start;
 
-    u->state = ngx_array_push(&u->states);
-    if (u->state == NULL) {
-        ngx_http_upstream_finalize_request(r, u,
-                                           NGX_HTTP_INTERNAL_SERVER_ERROR);
-        return;
+    ngx_memzero(&u->headers_in, sizeof(ngx_http_upstream_headers_in_t));
+
+    if (ngx_list_init(&u->headers_in.headers, r->pool, 8,
+                      sizeof(ngx_table_elt_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
     }
 
-    ngx_memzero(u->state, sizeof(ngx_http_upstream_state_t));
+    u->headers_in.content_length_n = -1;
 
-    tp = ngx_timeofday();
-    u->state->response_time = tp->sec * 1000 + tp->msec;
+    rc = u->process_header(r);
 
-    rc = ngx_event_connect_peer(&u->peer);
+    if (rc == NGX_OK) {
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http upstream connect: %i", rc);
+        if (ngx_http_upstream_process_headers(r, u) != NGX_OK) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        return ngx_http_cache_send(r);
+    }
 
     if (rc == NGX_ERROR) {
-        ngx_http_upstream_finalize_request(r, u,
-                                           NGX_HTTP_INTERNAL_SERVER_ERROR);
-        return;
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    u->state->peer = u->peer.name;
+    /* rc == NGX_HTTP_UPSTREAM_INVALID_HEADER || rc == NGX_AGAIN */
 
-    if (rc == NGX_BUSY) {
-        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, "no live upstreams");
-    }
+    ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                  "cache file \"%s\" contains invalid header",
+                  c->file.name.data);
 
-    if (rc == NGX_BUSY || rc == NGX_DECLINED) {
-        ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_ERROR);
-        return;
+    ngx_http_file_cache_invalidate(r);
+
+    ngx_memzero(&u->buffer, sizeof(ngx_buf_t));
+
+    if (u->reinit_request(r) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    /* rc == NGX_OK || rc == NGX_AGAIN */
+    return NGX_DECLINED;
+}
 
-    c = u->peer.connection;
 
-    c->data = r;
+/*
+ * the expired response is sent instead of an upstream error if
+ * "proxy_cache_use_stale" or the "stale-if-error" extension allows it
+ */
 
-    c->write->handler = ngx_http_upstream_send_request_handler;
-    c->read->handler = ngx_http_upstream_process_header;
+static ngx_int_t
+ngx_http_upstream_cache_stale(ngx_http_request_t *r, ngx_http_upstream_t *u,
+    ngx_uint_t ft_type)
+{
+    ngx_int_t  rc;
 
-    c->sendfile = r->connection->sendfile;
+    if (u->cache_status != NGX_HTTP_CACHE_EXPIRED || r->connection->error) {
+        return NGX_DECLINED;
+    }
 
-    c->pool = r->pool;
-    c->read->log = c->write->log = c->log = r->connection->log;
+    if (!(u->conf->cache_use_stale & ft_type)
+        && (ft_type == NGX_HTTP_UPSTREAM_FT_HTTP_404
+            || r->cache->error_sec < ngx_time()))
+    {
+        return NGX_DECLINED;
+    }
 
-    /* init or reinit the ngx_output_chain() and ngx_chain_writer() contexts */
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream cache stale, %xi", ft_type);
 
-    u->writer.out = NULL;
-    u->writer.last = &u->writer.out;
-    u->writer.connection = c;
-    u->writer.limit = 0;
+    ngx_http_upstream_finalize_request(r, u, NGX_DECLINED);
 
-    if (u->request_sent) {
-        if (ngx_http_upstream_reinit(r, u) != NGX_OK) {
-            ngx_http_upstream_finalize_request(r, u,
-                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
-            return;
-        }
-    }
-
-    if (r->request_body && r->request_body->temp_file && r == r->main) {
-
-        /*
-         * the r->request_body->buf can be reused for one request only,
-         * the subrequests should allocate their own temporay bufs
-         */
-
-        u->output.free = ngx_alloc_chain_link(r->pool);
-        if (u->output.free == NULL) {
-            ngx_http_upstream_finalize_request(r, u,
-                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
-            return;
-        }
-
-        u->output.free->buf = r->request_body->buf;
-        u->output.free->next = NULL;
-        u->output.allocated = 1;
-
-        r->request_body->buf->pos = r->request_body->buf->start;
-        r->request_body->buf->last = r->request_body->buf->start;
-        r->request_body->buf->tag = u->output.tag;
+    if (u->reinit_request(r) != NGX_OK) {
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return NGX_OK;
     }
 
-    u->request_sent = 0;
-
-    if (rc == NGX_AGAIN) {
-        ngx_add_timer(c->write, u->conf->connect_timeout);
-        return;
-    }
+    u->cache_status = NGX_HTTP_CACHE_STALE;
 
-#if (NGX_HTTP_SSL)
+    rc = ngx_http_upstream_cache_send(r, u);
 
-    if (u->conf->ssl && c->ssl == NULL) {
-        ngx_http_upstream_ssl_init_connection(r, u, c);
-        return;
+    if (rc == NGX_DECLINED) {
+        rc = NGX_HTTP_BAD_GATEWAY;
     }
 
-#endif
+    ngx_http_finalize_request(r, rc);
 
-    ngx_http_upstream_send_request(r, u);
+    return NGX_OK;
 }
 
 
-#if (NGX_HTTP_SSL)
-
-static void
-ngx_http_upstream_ssl_init_connection(ngx_http_request_t *r,
-    ngx_http_upstream_t *u, ngx_connection_t *c)
+static time_t
+ngx_http_upstream_cache_valid(ngx_http_request_t *r, ngx_http_upstream_t *u)
 {
-    ngx_int_t   rc;
-
-    if (ngx_ssl_create_connection(u->conf->ssl, c,
-                                  NGX_SSL_BUFFER|NGX_SSL_CLIENT)
-        == NGX_ERROR)
-    {
-        ngx_http_upstream_finalize_request(r, u,
-                                           NGX_HTTP_INTERNAL_SERVER_ERROR);
-        return;
-    }
-
-    c->sendfile = 0;
-    u->output.sendfile = 0;
+    u_char            *p, *last;
+    time_t             valid, expires, sec;
+    ngx_int_t          n;
+    ngx_uint_t         i;
+    ngx_table_elt_t  **h;
+    ngx_http_cache_t  *c;
 
-    if (ngx_ssl_set_session(c, u->peer.ssl_session) != NGX_OK) {
-        ngx_http_upstream_finalize_request(r, u,
-                                           NGX_HTTP_INTERNAL_SERVER_ERROR);
-        return;
-    }
+    c = r->cache;
 
-    r->connection->log->action = "SSL handshaking to upstream";
+    /* the windows are relative to the end of the validity time */
 
-    rc = ngx_ssl_handshake(c);
+    c->updating_sec = 0;
+    c->error_sec = 0;
 
-    if (rc == NGX_AGAIN) {
-        c->ssl->handler = ngx_http_upstream_ssl_handshake;
-        return;
+    if (u->headers_in.set_cookie) {
+        return 0;
     }
 
-    ngx_http_upstream_ssl_handshake(c);
-}
-
-
-static void
-ngx_http_upstream_ssl_handshake(ngx_connection_t *c)
-{
-    ngx_http_request_t   *r;
-    ngx_http_upstream_t  *u;
+    /*
+     * the upstream headers set the validity time only for the statuses
+     * that are cached by default or are listed in "proxy_cache_valid";
+     * the partial and not modified responses are never cached because
+     * the cache miss requests are sent without the Range and If-* headers,
+     * the HTTP/0.9 responses are not cached because they have no status
+     */
 
-    r = c->data;
-    u = r->upstream;
+    switch (u->headers_in.status_n) {
 
-    if (c->ssl->handshaked) {
+    case NGX_HTTP_OK:
+    case NGX_HTTP_MOVED_PERMANENTLY:
+    case NGX_HTTP_MOVED_TEMPORARILY:
+        break;
 
-        u->peer.save_session(&u->peer, u->peer.data);
+    case 0:
+    case NGX_HTTP_PARTIAL_CONTENT:
+    case NGX_HTTP_NOT_MODIFIED:
+        return 0;
 
-        c->write->handler = ngx_http_upstream_send_request_handler;
-        c->read->handler = ngx_http_upstream_process_header;
+    default:
+        if (ngx_http_file_cache_valid(u->conf->cache_valid,
+                                      u->headers_in.status_n)
+            == 0)
+        {
+            return 0;
+        }
+    }
 
-        ngx_http_upstream_send_request(r, u);
+    if (u->headers_in.x_accel_expires) {
+        n = ngx_atoi(u->headers_in.x_accel_expires->value.data,
+                     u->headers_in.x_accel_expires->value.len);
 
-        return;
+        if (n != NGX_ERROR) {
+            return (time_t) n;
+        }
     }
 
-    ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_ERROR);
+    valid = -1;
 
-}
+    h = u->headers_in.cache_control.elts;
 
-#endif
+    for (i = 0; i < u->headers_in.cache_control.nelts; i++) {
+        p = h[i]->value.data;
+        last = p + h[i]->value.len;
 
+        if (ngx_strlcasestrn(p, last, (u_char *) "no-cache", 8 - 1) != NULL
+            || ngx_strlcasestrn(p, last, (u_char *) "no-store", 8 - 1) != NULL
+            || ngx_strlcasestrn(p, last, (u_char *) "private", 7 - 1) != NULL)
+        {
+            c->updating_sec = 0;
+            c->error_sec = 0;
+            return 0;
+        }
 
-static ngx_int_t
-ngx_http_upstream_reinit(ngx_http_request_t *r, ngx_http_upstream_t *u)
-{
-    ngx_chain_t  *cl;
+        sec = ngx_http_upstream_cache_control_sec(p, last, "max-age=", 8);
 
-    if (u->reinit_request(r) != NGX_OK) {
-        return NGX_ERROR;
-    }
+        if (sec != -1 && valid == -1) {
+            valid = sec;
+        }
 
-    ngx_memzero(&r->upstream->headers_in,
-                sizeof(ngx_http_upstream_headers_in_t));
+        sec = ngx_http_upstream_cache_control_sec(p, last,
+                                                  "stale-while-revalidate=",
+                                                  23);
+        if (sec != -1) {
+            c->updating_sec = sec;
+        }
 
-    if (ngx_list_init(&r->upstream->headers_in.headers, r->pool, 8,
-                      sizeof(ngx_table_elt_t))
-        != NGX_OK)
-    {
-        return NGX_ERROR;
+        sec = ngx_http_upstream_cache_control_sec(p, last,
+                                                  "stale-if-error=", 15);
+        if (sec != -1) {
+            c->error_sec = sec;
+        }
     }
 
-    /* reinit the request chain */
-
-    for (cl = u->request_bufs; cl; cl = cl->next) {
-        cl->buf->pos = cl->buf->start;
-        cl->buf->file_pos = 0;
+    if (valid != -1) {
+        return valid;
     }
 
-    /* reinit the subrequest's ngx_output_chain() context */
+    if (u->headers_in.expires) {
+        expires = ngx_http_parse_time(u->headers_in.expires->value.data,
+                                      u->headers_in.expires->value.len);
 
-    if (r->request_body && r->request_body->temp_file
-        && r != r->main && u->output.buf)
-    {
-        u->output.free = ngx_alloc_chain_link(r->pool);
-        if (u->output.free == NULL) {
-            return NGX_ERROR;
+        if (expires == NGX_ERROR || expires <= ngx_time()) {
+            return 0;
         }
 
-        u->output.free->buf = u->output.buf;
-        u->output.free->next = NULL;
-
-        u->output.buf->pos = u->output.buf->start;
-        u->output.buf->last = u->output.buf->start;
+        return expires - ngx_time();
     }
 
-    u->output.buf = NULL;
-    u->output.in = NULL;
-    u->output.busy = NULL;
+    return ngx_http_file_cache_valid(u->conf->cache_valid,
+                                     u->headers_in.status_n);
+}
 
-    /* reinit u->buffer */
 
-#if 0
-    if (u->cache) {
-        u->buffer.pos = u->buffer.start + u->cache->ctx.header_size;
-        u->buffer.last = u->buffer.pos;
+static time_t
+ngx_http_upstream_cache_control_sec(u_char *p, u_char *last, char *name,
+    size_t len)
+{
+    time_t  sec;
 
-    } else {
-        u->buffer.pos = u->buffer.start;
-        u->buffer.last = u->buffer.start;
+    p = ngx_strlcasestrn(p, last, (u_char *) name, len - 1);
+
+    if (p == NULL) {
+        return -1;
     }
-#else
 
-        u->buffer.pos = u->buffer.start;
-        u->buffer.last = u->buffer.start;
+    sec = 0;
 
-#endif
+    for (p += len; p < last; p++) {
+        if (*p < '0' || *p > '9') {
+            break;
+        }
 
-    return NGX_OK;
+        sec = sec * 10 + *p - '0';
+    }
+
+    return sec;
 }
 
 
 static void
-ngx_http_upstream_send_request(ngx_http_request_t *r, ngx_http_upstream_t *u)
+ngx_http_upstream_cache_update(ngx_http_request_t *r, ngx_http_upstream_t *u)
 {
-    int                rc, err;
-    socklen_t          len;
-    ngx_connection_t  *c;
+    ngx_temp_file_t  *tf;
 
-    c = u->peer.connection;
+    tf = u->pipe->temp_file;
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
-                   "http upstream send request");
+    if (u->headers_in.content_length_n == -1
+        || u->headers_in.content_length_n
+           == tf->offset - (off_t) r->cache->body_start)
+    {
+        ngx_http_file_cache_update(r, tf);
 
-    if (!u->request_sent) {
+    } else {
+        ngx_http_file_cache_free(r->cache, tf);
+    }
+}
 
-#if (NGX_HAVE_KQUEUE)
+#endif
 
-        if (ngx_event_flags & NGX_USE_KQUEUE_EVENT)  {
-            if (c->write->pending_eof) {
-                (void) ngx_connection_error(c, c->write->kq_errno,
-                                    "kevent() reported that connect() failed");
-                ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_ERROR);
-                return;
-            }
 
-        } else
-#endif
-        {
-            err = 0;
-            len = sizeof(int);
+static void
+ngx_http_upstream_rd_check_broken_connection(ngx_http_request_t *r)
+{
+    ngx_http_upstream_check_broken_connection(r, r->connection->read);
+}
 
-            /*
-             * BSDs and Linux return 0 and set a pending error in err
-             * Solaris returns -1 and sets errno
-             */
 
-            if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len)
-                == -1)
-            {
-                err = ngx_errno;
-            }
+static void
+ngx_http_upstream_wr_check_broken_connection(ngx_http_request_t *r)
+{
+    ngx_http_upstream_check_broken_connection(r, r->connection->write);
+}
 
-            if (err) {
-                (void) ngx_connection_error(c, err, "connect() failed");
-                ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_ERROR);
-                return;
-            }
-        }
-    }
 
-    c->log->action = "sending request to upstream";
+static void
+ngx_http_upstream_check_broken_connection(ngx_http_request_t *r,
+    ngx_event_t *ev)
+{
+    int                  n;
+    char                 buf[1];
+    ngx_err_t            err;
+    ngx_connection_t     *c;
+    ngx_http_upstream_t  *u;
 
-    rc = ngx_output_chain(&u->output, u->request_sent ? NULL : u->request_bufs);
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "http upstream check client, write event:%d, \"%V\"",
+                   ev->write, &r->uri);
 
-    u->request_sent = 1;
+    c = r->connection;
+    u = r->upstream;
 
-    if (rc == NGX_ERROR) {
-        ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_ERROR);
+    if (c->error) {
+        ngx_http_upstream_finalize_request(r, u,
+                                           NGX_HTTP_CLIENT_CLOSED_REQUEST);
         return;
     }
 
-    if (c->write->timer_set) {
-        ngx_del_timer(c->write);
+    if (u->peer.connection == NULL) {
+        return;
     }
 
-    if (rc == NGX_AGAIN) {
-        ngx_add_timer(c->write, u->conf->send_timeout);
+#if (NGX_HAVE_KQUEUE)
 
-        if (ngx_handle_write_event(c->write, u->conf->send_lowat) == NGX_ERROR)
-        {
-            ngx_http_upstream_finalize_request(r, u,
-                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
+    if (ngx_event_flags & NGX_USE_KQUEUE_EVENT) {
+
+        if (!ev->pending_eof) {
             return;
         }
 
-        return;
-    }
+        ev->eof = 1;
+        c->error = 1;
 
-    /* rc == NGX_OK */
+        if (ev->kq_errno) {
+            ev->error = 1;
+        }
 
-    if (c->tcp_nopush == NGX_TCP_NOPUSH_SET) {
-        if (ngx_tcp_push(c->fd) == NGX_ERROR) {
-            ngx_log_error(NGX_LOG_CRIT, c->log, ngx_socket_errno,
-                          ngx_tcp_push_n " failed");
+        if (!u->cachable && u->peer.connection) {
+            ngx_log_error(NGX_LOG_INFO, ev->log, ev->kq_errno,
+                          "kevent() reported that client closed prematurely "
+                          "connection, so upstream connection is closed too");
             ngx_http_upstream_finalize_request(r, u,
-                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
+                                               NGX_HTTP_CLIENT_CLOSED_REQUEST);
             return;
         }
 
-        c->tcp_nopush = NGX_TCP_NOPUSH_UNSET;
-    }
-
-    ngx_add_timer(c->read, u->conf->read_timeout);
-
-#if 1
-    if (c->read->ready) {
-
-        /* post aio operation */
+        ngx_log_error(NGX_LOG_INFO, ev->log, ev->kq_errno,
+                      "kevent() reported that client closed "
+                      "prematurely connection");
 
-        /*
-         * TODO comment
-         * although we can post aio operation just in the end
-         * of ngx_http_upstream_connect() CHECK IT !!!
-         * it's better to do here because we postpone header buffer allocation
-         */
+        if (u->peer.connection == NULL) {
+            ngx_http_upstream_finalize_request(r, u,
+                                               NGX_HTTP_CLIENT_CLOSED_REQUEST);
+            return;
+        }
 
-        ngx_http_upstream_process_header(c->read);
         return;
     }
+
 #endif
 
-    c->write->handler = ngx_http_upstream_dummy_handler;
+#if (NGX_HAVE_EPOLLRDHUP)
 
-    if (ngx_handle_write_event(c->write, 0) == NGX_ERROR) {
-        ngx_http_upstream_finalize_request(r, u,
-                                           NGX_HTTP_INTERNAL_SERVER_ERROR);
+    /* EPOLLRDHUP tells whether the client has closed without recv() */
+
+    if ((ngx_event_flags & NGX_USE_EPOLL_EVENT)
+        && ngx_use_epoll_rdhup
+        && !c->read->pending_eof)
+    {
         return;
     }
-}
 
+#endif
 
-static void
-ngx_http_upstream_send_request_handler(ngx_event_t *wev)
-{
-    ngx_connection_t     *c;
-    ngx_http_request_t   *r;
-    ngx_http_upstream_t  *u;
+    n = recv(c->fd, buf, 1, MSG_PEEK);
 
-    c = wev->data;
-    r = c->data;
-    u = r->upstream;
+    err = ngx_socket_errno;
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, wev->log, 0,
-                   "http upstream send request handler");
+    /*
+     * we do not need to disable the write event because
+     * that event has NGX_USE_CLEAR_EVENT type
+     */
 
-    if (wev->timedout) {
-        ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_TIMEOUT);
+    if (ev->write && (n >= 0 || err == NGX_EAGAIN)) {
         return;
     }
 
-#if (NGX_HTTP_SSL)
+    if ((ngx_event_flags & NGX_USE_LEVEL_EVENT) && ev->active) {
+        if (ngx_del_event(ev, NGX_READ_EVENT, 0) == NGX_ERROR) {
+            ngx_http_upstream_finalize_request(r, u,
+                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+    }
 
-    if (u->conf->ssl && c->ssl == NULL) {
-        ngx_http_upstream_ssl_init_connection(r, u, c);
+    if (n > 0) {
         return;
     }
 
-#endif
+    if (n == -1) {
+        if (err == NGX_EAGAIN) {
+            return;
+        }
 
-    if (u->header_sent) {
-        wev->handler = ngx_http_upstream_dummy_handler;
+        ev->error = 1;
 
-        (void) ngx_handle_write_event(wev, 0);
+    } else { /* n == 0 */
+        err = 0;
+    }
+
+    ev->eof = 1;
+    c->error = 1;
 
+    if (!u->cachable && u->peer.connection) {
+        ngx_log_error(NGX_LOG_INFO, ev->log, err,
+                      "client closed prematurely connection, "
+                      "so upstream connection is closed too");
+        ngx_http_upstream_finalize_request(r, u,
+                                           NGX_HTTP_CLIENT_CLOSED_REQUEST);
         return;
     }
 
-    ngx_http_upstream_send_request(r, u);
+    ngx_log_error(NGX_LOG_INFO, ev->log, err,
+                  "client closed prematurely connection");
+
+    if (u->peer.connection == NULL) {
+        ngx_http_upstream_finalize_request(r, u,
+                                           NGX_HTTP_CLIENT_CLOSED_REQUEST);
+        return;
+    }
 }
 
 
 static void
-ngx_http_upstream_process_header(ngx_event_t *rev)
+ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
 {
-    ssize_t                         n;
-    ngx_int_t                       rc;
-    ngx_str_t                      *uri, args;
-    ngx_uint_t                      i, flags;
-    ngx_list_part_t                *part;
-    ngx_table_elt_t                *h;
-    ngx_connection_t               *c;
-    ngx_http_request_t             *r;
-    ngx_http_upstream_t            *u;
-    ngx_http_err_page_t            *err_page;
-    ngx_http_core_loc_conf_t       *clcf;
-    ngx_http_upstream_header_t     *hh;
-    ngx_http_upstream_main_conf_t  *umcf;
+    ngx_int_t          rc;
+    ngx_time_t        *tp;
+    ngx_msec_int_t     ms;
+    ngx_connection_t  *c;
 
-    c = rev->data;
-    r = c->data;
-    u = r->upstream;
+    r->connection->log->action = "connecting to upstream";
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, rev->log, 0,
-                   "http upstream process header");
+    r->connection->single_connection = 0;
 
-    c->log->action = "reading response header from upstream";
+    if (u->state && u->state->response_time) {
+        tp = ngx_timeofday();
+        ms = tp->sec * 1000 + tp->msec - u->state->response_time;
+        u->state->response_time = (ms >= 0) ? ms : 0;
+    }
 
-    if (rev->timedout) {
-        ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_TIMEOUT);
+    u->state = ngx_array_push(&u->states);
+    if (u->state == NULL) {
+        ngx_http_upstream_finalize_request(r, u,
+                                           NGX_HTTP_INTERNAL_SERVER_ERROR);
         return;
     }
 
-    if (u->buffer.start == NULL) {
-        u->buffer.start = ngx_palloc(r->pool, u->conf->buffer_size);
-        if (u->buffer.start == NULL) {
-            ngx_http_upstream_finalize_request(r, u,
-                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
-            return;
-        }
-
-        u->buffer.pos = u->buffer.start;
-        u->buffer.last = u->buffer.start;
-        u->buffer.end = u->buffer.start + u->conf->buffer_size;
-        u->buffer.temporary = 1;
-
-        u->buffer.tag = u->output.tag;
-
-        if (ngx_list_init(&r->upstream->headers_in.headers, r->pool, 8,
-                          sizeof(ngx_table_elt_t))
-            != NGX_OK)
-        {
-            ngx_http_upstream_finalize_request(r, u,
-                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
-            return;
-        }
+    ngx_memzero(u->state, sizeof(ngx_http_upstream_state_t));
 
-#if 0
-        if (u->cache) {
-            u->buffer.pos += u->cache->ctx.header_size;
-            u->buffer.last = u->buffer.pos;
-        }
-#endif
-    }
+    /*
+     * the response_time contains the start time of the try until the try
+     * is finished, the connect_time and header_time are measured from it
+     */
 
-    n = u->peer.connection->recv(u->peer.connection, u->buffer.last,
-                                      u->buffer.end - u->buffer.last);
+    tp = ngx_timeofday();
+    u->state->response_time = tp->sec * 1000 + tp->msec;
+    u->state->connect_time = (ngx_msec_t) -1;
+    u->state->header_time = (ngx_msec_t) -1;
 
-    if (n == NGX_AGAIN) {
-#if 0
-        ngx_add_timer(rev, u->read_timeout);
-#endif
+    rc = ngx_event_connect_peer(&u->peer);
 
-        if (ngx_handle_read_event(rev, 0) == NGX_ERROR) {
-            ngx_http_upstream_finalize_request(r, u,
-                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
-            return;
-        }
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream connect: %i", rc);
 
+    if (rc == NGX_ERROR) {
+        ngx_http_upstream_finalize_request(r, u,
+                                           NGX_HTTP_INTERNAL_SERVER_ERROR);
         return;
     }
 
-    if (n == 0) {
-        ngx_log_error(NGX_LOG_ERR, rev->log, 0,
-                      "upstream prematurely closed connection");
+    u->state->peer = u->peer.name;
+
+    if (rc == NGX_BUSY) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, "no live upstreams");
     }
 
-    if (n == NGX_ERROR || n == 0) {
+    if (rc == NGX_BUSY || rc == NGX_DECLINED) {
         ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_ERROR);
         return;
     }
 
-    u->buffer.last += n;
+    /* rc == NGX_OK || rc == NGX_AGAIN || rc == NGX_DONE */
 
-#if 0
-    u->valid_header_in = 0;
+    c = u->peer.connection;
 
-    u->peer.cached = 0;
-#endif
+    c->data = r;
 
-    rc = u->process_header(r);
+    c->write->handler = ngx_http_upstream_send_request_handler;
+    c->read->handler = ngx_http_upstream_process_header;
 
-    if (rc == NGX_AGAIN) {
-#if 0
-        ngx_add_timer(rev, u->read_timeout);
-#endif
+    c->sendfile = r->connection->sendfile;
 
-        if (u->buffer.pos == u->buffer.end) {
-            ngx_log_error(NGX_LOG_ERR, rev->log, 0,
-                          "upstream sent too big header");
+    c->pool = r->pool;
+    c->read->log = c->write->log = c->log = r->connection->log;
 
-            ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_INVALID_HEADER);
+    /* init or reinit the ngx_output_chain() and ngx_chain_writer() contexts */
+
+    u->writer.out = NULL;
+    u->writer.last = &u->writer.out;
+    u->writer.connection = c;
+    u->writer.limit = 0;
+
+    if (u->request_sent) {
+        if (ngx_http_upstream_reinit(r, u) != NGX_OK) {
+            ngx_http_upstream_finalize_request(r, u,
+                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
             return;
         }
+    }
 
-        if (ngx_handle_read_event(rev, 0) == NGX_ERROR) {
+    if (r->request_body && r->request_body->temp_file && r == r->main) {
+
+        /*
+         * the r->request_body->buf can be reused for one request only,
+         * the subrequests should allocate their own temporay bufs
+         */
+
+        u->output.free = ngx_alloc_chain_link(r->pool);
+        if (u->output.free == NULL) {
             ngx_http_upstream_finalize_request(r, u,
                                                NGX_HTTP_INTERNAL_SERVER_ERROR);
             return;
         }
 
-        return;
-    }
+        u->output.free->buf = r->request_body->buf;
+        u->output.free->next = NULL;
+        u->output.allocated = 1;
 
-    if (rc == NGX_HTTP_UPSTREAM_INVALID_HEADER) {
-        ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_INVALID_HEADER);
-        return;
+        r->request_body->buf->pos = r->request_body->buf->start;
+        r->request_body->buf->last = r->request_body->buf->start;
+        r->request_body->buf->tag = u->output.tag;
     }
 
-    if (rc == NGX_ERROR || rc == NGX_HTTP_INTERNAL_SERVER_ERROR) {
-        ngx_http_upstream_finalize_request(r, u,
-                                           NGX_HTTP_INTERNAL_SERVER_ERROR);
+    u->request_sent = 0;
+
+    if (rc == NGX_AGAIN) {
+        ngx_add_timer(c->write, u->conf->connect_timeout);
         return;
     }
 
-    /* rc == NGX_OK */
+#if (NGX_HTTP_SSL)
 
-    if (u->headers_in.status_n >= NGX_HTTP_BAD_REQUEST
-        && r->subrequest_in_memory)
-    {
-        u->buffer.last = u->buffer.pos;
+    if (u->conf->ssl && c->ssl == NULL) {
+        ngx_http_upstream_ssl_init_connection(r, u, c);
+        return;
     }
 
-    if (u->headers_in.status_n == NGX_HTTP_INTERNAL_SERVER_ERROR) {
+#endif
 
-        if (u->peer.tries > 1
-            && (u->conf->next_upstream & NGX_HTTP_UPSTREAM_FT_HTTP_500))
-        {
-            ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_HTTP_500);
-            return;
-        }
+    ngx_http_upstream_send_request(r, u);
+}
 
-#if (NGX_HTTP_CACHE)
 
-        if (u->peer.tries == 0
-            && u->stale
-            && (u->conf->use_stale & NGX_HTTP_UPSTREAM_FT_HTTP_500))
-        {
-            ngx_http_upstream_finalize_request(r, u,
-                                              ngx_http_send_cached_response(r));
-            return;
-        }
+#if (NGX_HTTP_SSL)
 
-#endif
-    }
+static void
+ngx_http_upstream_ssl_init_connection(ngx_http_request_t *r,
+    ngx_http_upstream_t *u, ngx_connection_t *c)
+{
+    ngx_int_t   rc;
 
-    if (u->headers_in.status_n == NGX_HTTP_NOT_FOUND) {
+    if (ngx_ssl_create_connection(u->conf->ssl, c,
+                                  NGX_SSL_BUFFER|NGX_SSL_CLIENT)
+        == NGX_ERROR)
+    {
+        ngx_http_upstream_finalize_request(r, u,
+                                           NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
+    }
 
-        if (u->peer.tries > 1
-            && u->conf->next_upstream & NGX_HTTP_UPSTREAM_FT_HTTP_404)
-        {
-            ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_HTTP_404);
-            return;
-        }
+    c->sendfile = 0;
+    u->output.sendfile = 0;
 
-        if (u->conf->intercept_404) {
-            ngx_http_upstream_finalize_request(r, u, NGX_HTTP_NOT_FOUND);
-            return;
-        }
+    if (ngx_ssl_set_session(c, u->peer.ssl_session) != NGX_OK) {
+        ngx_http_upstream_finalize_request(r, u,
+                                           NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
     }
 
+    r->connection->log->action = "SSL handshaking to upstream";
 
-    if (u->headers_in.status_n >= NGX_HTTP_BAD_REQUEST
-        && u->conf->intercept_errors)
-    {
-        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+    rc = ngx_ssl_handshake(c);
 
-        if (clcf->error_pages) {
+    if (rc == NGX_AGAIN) {
+        c->ssl->handler = ngx_http_upstream_ssl_handshake;
+        return;
+    }
 
-            err_page = clcf->error_pages->elts;
-            for (i = 0; i < clcf->error_pages->nelts; i++) {
-                if (err_page[i].status == (ngx_int_t) u->headers_in.status_n) {
+    ngx_http_upstream_ssl_handshake(c);
+}
 
-                    if (u->headers_in.status_n == NGX_HTTP_UNAUTHORIZED) {
 
-                        r->headers_out.www_authenticate =
-                                        ngx_list_push(&r->headers_out.headers);
+static void
+ngx_http_upstream_ssl_handshake(ngx_connection_t *c)
+{
+    ngx_http_request_t   *r;
+    ngx_http_upstream_t  *u;
 
-                        if (r->headers_out.www_authenticate == NULL) {
-                            ngx_http_upstream_finalize_request(r, u,
-                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
-                            return;
-                        }
+    r = c->data;
+    u = r->upstream;
 
-                        *r->headers_out.www_authenticate =
-                                               *u->headers_in.www_authenticate;
-                    }
+    if (c->ssl->handshaked) {
 
-                    ngx_http_upstream_finalize_request(r, u,
-                                                       u->headers_in.status_n);
-                    return;
-                }
-            }
-        }
-    }
+        u->peer.save_session(&u->peer, u->peer.data);
 
-    umcf = ngx_http_get_module_main_conf(r, ngx_http_upstream_module);
+        c->write->handler = ngx_http_upstream_send_request_handler;
+        c->read->handler = ngx_http_upstream_process_header;
 
-    if (r->upstream->headers_in.x_accel_redirect) {
+        ngx_http_upstream_send_request(r, u);
 
-        ngx_http_upstream_finalize_request(r, u, NGX_DECLINED);
+        return;
+    }
 
-        part = &r->upstream->headers_in.headers.part;
-        h = part->elts;
+    ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_ERROR);
 
-        for (i = 0; /* void */; i++) {
+}
 
-            if (i >= part->nelts) {
-                if (part->next == NULL) {
-                    break;
-                }
+#endif
 
-                part = part->next;
-                h = part->elts;
-                i = 0;
-            }
 
-            hh = ngx_hash_find(&umcf->headers_in_hash, h[i].hash,
-                               h[i].lowcase_key, h[i].key.len);
+static ngx_int_t
+ngx_http_upstream_reinit(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_chain_t  *cl;
 
-            if (hh && hh->redirect) {
-                if (hh->copy_handler(r, &h[i], hh->conf) != NGX_OK) {
-                    ngx_http_finalize_request(r,
-                                              NGX_HTTP_INTERNAL_SERVER_ERROR);
-                    return;
-                }
-            }
-        }
+    if (u->reinit_request(r) != NGX_OK) {
+        return NGX_ERROR;
+    }
 
-        uri = &r->upstream->headers_in.x_accel_redirect->value;
-        args.len = 0;
-        args.data = NULL;
-        flags = 0;
+    ngx_memzero(&r->upstream->headers_in,
+                sizeof(ngx_http_upstream_headers_in_t));
 
-        if (ngx_http_parse_unsafe_uri(r, uri, &args, &flags) != NGX_OK) {
-            ngx_http_finalize_request(r, NGX_HTTP_NOT_FOUND);
-            return;
-        }
+    if (ngx_list_init(&r->upstream->headers_in.headers, r->pool, 8,
+                      sizeof(ngx_table_elt_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
 
-        if (flags & NGX_HTTP_ZERO_IN_URI) {
-            r->zero_in_uri = 1;
-        }
+    r->upstream->headers_in.content_length_n = -1;
 
-        if (r->method != NGX_HTTP_HEAD) {
-            r->method = NGX_HTTP_GET;
-        }
+    u->keepalive = 0;
 
-        ngx_http_internal_redirect(r, uri, &args);
-        return;
+    /* reinit the request chain */
+
+    for (cl = u->request_bufs; cl; cl = cl->next) {
+        cl->buf->pos = cl->buf->start;
+        cl->buf->file_pos = 0;
     }
 
-    part = &r->upstream->headers_in.headers.part;
-    h = part->elts;
+    /* reinit the subrequest's ngx_output_chain() context */
 
-    for (i = 0; /* void */; i++) {
+    if (r->request_body && r->request_body->temp_file
+        && r != r->main && u->output.buf)
+    {
+        u->output.free = ngx_alloc_chain_link(r->pool);
+        if (u->output.free == NULL) {
+            return NGX_ERROR;
+        }
 
-        if (i >= part->nelts) {
-            if (part->next == NULL) {
-                break;
-            }
+        u->output.free->buf = u->output.buf;
+        u->output.free->next = NULL;
 
-            part = part->next;
-            h = part->elts;
-            i = 0;
-        }
+        u->output.buf->pos = u->output.buf->start;
+        u->output.buf->last = u->output.buf->start;
+    }
 
-        if (ngx_hash_find(&u->conf->hide_headers_hash, h[i].hash,
-                          h[i].lowcase_key, h[i].key.len))
-        {
-            continue;
-        }
+    u->output.buf = NULL;
+    u->output.in = NULL;
+    u->output.busy = NULL;
 
-        hh = ngx_hash_find(&umcf->headers_in_hash, h[i].hash,
-                           h[i].lowcase_key, h[i].key.len);
+    /* reinit u->buffer */
 
-        if (hh) {
-            if (hh->copy_handler(r, &h[i], hh->conf) != NGX_OK) {
-                ngx_http_upstream_finalize_request(r, u,
-                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
-                return;
-            }
+    u->buffer.pos = u->buffer.start;
 
-            continue;
-        }
+#if (NGX_HTTP_CACHE)
 
-        if (ngx_http_upstream_copy_header_line(r, &h[i], 0) != NGX_OK) {
-            ngx_http_upstream_finalize_request(r, u,
-                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
-            return;
-        }
+    if (r->cache) {
+        u->buffer.pos += r->cache->header_start;
     }
 
-    if (r->headers_out.server && r->headers_out.server->value.data == NULL) {
-        r->headers_out.server->hash = 0;
-    }
+#endif
 
-    if (r->headers_out.date && r->headers_out.date->value.data == NULL) {
-        r->headers_out.date->hash = 0;
-    }
+    u->buffer.last = u->buffer.pos;
 
-    r->headers_out.status = u->headers_in.status_n;
-    r->headers_out.status_line = u->headers_in.status_line;
+    return NGX_OK;
+}
 
-    if (r->headers_out.content_length_n != -1) {
-        u->length = (size_t) r->headers_out.content_length_n;
 
-    } else {
-        u->length = NGX_MAX_SIZE_T_VALUE;
-    }
+static void
+ngx_http_upstream_send_request(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    int                rc, err;
+    socklen_t          len;
+    ngx_time_t        *tp;
+    ngx_msec_int_t     ms;
+    ngx_connection_t  *c;
 
-    if (!r->subrequest_in_memory) {
-        ngx_http_upstream_send_response(r, u);
-        return;
-    }
+    c = u->peer.connection;
 
-    /* subrequest content in memory */
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http upstream send request");
 
-    if (u->input_filter == NULL) {
-        u->input_filter_init = ngx_http_upstream_non_buffered_filter_init;
-        u->input_filter = ngx_http_upstream_non_buffered_filter;
-        u->input_filter_ctx = r;
+    if (!u->request_sent) {
+
+#if (NGX_HAVE_KQUEUE)
+
+        if (ngx_event_flags & NGX_USE_KQUEUE_EVENT)  {
+            if (c->write->pending_eof) {
+                (void) ngx_connection_error(c, c->write->kq_errno,
+                                    "kevent() reported that connect() failed");
+                ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_ERROR);
+                return;
+            }
+
+        } else
+#endif
+        {
+            err = 0;
+            len = sizeof(int);
+
+            /*
+             * BSDs and Linux return 0 and set a pending error in err
+             * Solaris returns -1 and sets errno
+             */
+
+            if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len)
+                == -1)
+            {
+                err = ngx_errno;
+            }
+
+            if (err) {
+                (void) ngx_connection_error(c, err, "connect() failed");
+                ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_ERROR);
+                return;
+            }
+        }
+
+        if (u->state->connect_time == (ngx_msec_t) -1) {
+            tp = ngx_timeofday();
+            ms = tp->sec * 1000 + tp->msec - u->state->response_time;
+            u->state->connect_time = (ms >= 0) ? ms : 0;
+        }
     }
 
-    if (u->input_filter_init(u->input_filter_ctx) == NGX_ERROR) {
+    c->log->action = "sending request to upstream";
+
+    rc = ngx_output_chain(&u->output, u->request_sent ? NULL : u->request_bufs);
+
+    u->request_sent = 1;
+
+    if (rc == NGX_OK && r->request_body_no_buffering) {
+        rc = ngx_http_upstream_send_request_body(r, u);
+
+        if (rc >= NGX_HTTP_SPECIAL_RESPONSE) {
+            ngx_http_upstream_finalize_request(r, u, rc);
+            return;
+        }
+    }
+
+    if (rc == NGX_ERROR) {
+        ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_ERROR);
+        return;
+    }
+
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    if (rc == NGX_AGAIN) {
+        ngx_add_timer(c->write, u->conf->send_timeout);
+
+        if (ngx_handle_write_event(c->write, u->conf->send_lowat) == NGX_ERROR)
+        {
+            ngx_http_upstream_finalize_request(r, u,
+                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
+        return;
+    }
+
+    if (rc == NGX_DONE) {
+
+        /* wait for the rest of the client request body */
+
+        if (ngx_handle_write_event(c->write, 0) == NGX_ERROR) {
+            ngx_http_upstream_finalize_request(r, u,
+                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
+        return;
+    }
+
+    /* rc == NGX_OK */
+
+    if (c->tcp_nopush == NGX_TCP_NOPUSH_SET) {
+        if (ngx_tcp_push(c->fd) == NGX_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, c->log, ngx_socket_errno,
+                          ngx_tcp_push_n " failed");
+            ngx_http_upstream_finalize_request(r, u,
+                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
+        c->tcp_nopush = NGX_TCP_NOPUSH_UNSET;
+    }
+
+    ngx_add_timer(c->read, u->conf->read_timeout);
+
+#if 1
+    if (c->read->ready) {
+
+        /* post aio operation */
+
+        /*
+         * TODO comment
+         * although we can post aio operation just in the end
+         * of ngx_http_upstream_connect() CHECK IT !!!
+         * it's better to do here because we postpone header buffer allocation
+         */
+
+        ngx_http_upstream_process_header(c->read);
+        return;
+    }
+#endif
+
+    c->write->handler = ngx_http_upstream_dummy_handler;
+
+    if (ngx_handle_write_event(c->write, 0) == NGX_ERROR) {
         ngx_http_upstream_finalize_request(r, u,
                                            NGX_HTTP_INTERNAL_SERVER_ERROR);
         return;
     }
+}
+
+
+static ngx_int_t
+ngx_http_upstream_send_request_body(ngx_http_request_t *r,
+    ngx_http_upstream_t *u)
+{
+    ngx_int_t          rc;
+    ngx_connection_t  *c;
+
+    c = r->connection;
+
+#if (NGX_HAVE_SPLICE)
+
+    if (u->request_splice) {
+        rc = ngx_http_upstream_splice_request_body(r, u);
+
+        if (rc != NGX_OK && rc != NGX_DECLINED) {
+            return rc;
+        }
+
+        /* the whole body has been spliced or it is copied further */
+    }
+
+#endif
+
+    for ( ;; ) {
+        rc = ngx_http_read_unbuffered_request_body(r);
+
+        if (rc >= NGX_HTTP_SPECIAL_RESPONSE) {
+            return rc;
+        }
+
+        if (r->request_body->bufs) {
+
+            /* the body buffer is reused, so the request can not be resent */
+
+            u->request_body_streamed = 1;
+
+            switch (ngx_output_chain(&u->output, r->request_body->bufs)) {
+
+            case NGX_ERROR:
+                return NGX_ERROR;
+
+            case NGX_AGAIN:
+
+                /*
+                 * the client request body is not read until the upstream
+                 * gets the previous part, so the client timeout is stopped
+                 */
+
+                if (c->read->timer_set) {
+                    ngx_del_timer(c->read);
+                }
+
+                return NGX_AGAIN;
+            }
+        }
+
+        if (rc == NGX_OK) {
+            break;
+        }
+
+        /* rc == NGX_AGAIN */
+
+        if (!c->read->ready) {
+            return NGX_DONE;
+        }
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http upstream request body sent");
+
+    if (!r->post_action && !u->conf->ignore_client_abort) {
+        r->read_event_handler = ngx_http_upstream_rd_check_broken_connection;
+
+    } else {
+        r->read_event_handler = ngx_http_block_read;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_send_request_handler(ngx_event_t *wev)
+{
+    ngx_connection_t     *c;
+    ngx_http_request_t   *r;
+    ngx_http_upstream_t  *u;
+
+    c = wev->data;
+    r = c->data;
+    u = r->upstream;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, wev->log, 0,
+                   "http upstream send request handler");
+
+    if (wev->timedout) {
+        ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_TIMEOUT);
+        return;
+    }
+
+#if (NGX_HTTP_SSL)
+
+    if (u->conf->ssl && c->ssl == NULL) {
+        ngx_http_upstream_ssl_init_connection(r, u, c);
+        return;
+    }
+
+#endif
+
+    if (u->header_sent) {
+        wev->handler = ngx_http_upstream_dummy_handler;
+
+        (void) ngx_handle_write_event(wev, 0);
+
+        return;
+    }
+
+    ngx_http_upstream_send_request(r, u);
+}
+
+
+static void
+ngx_http_upstream_read_request_handler(ngx_http_request_t *r)
+{
+    ngx_connection_t     *c;
+    ngx_http_upstream_t  *u;
+
+    c = r->connection;
+    u = r->upstream;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http upstream read request handler");
+
+    if (c->read->timedout) {
+        c->timedout = 1;
+        ngx_http_upstream_finalize_request(r, u, NGX_HTTP_REQUEST_TIME_OUT);
+        return;
+    }
+
+    if (u->peer.connection == NULL
+        || !u->request_sent
+        || u->header_sent
+        || u->writer.out
+#if (NGX_HAVE_SPLICE)
+        || u->request_splice_size
+#endif
+        )
+    {
+        /* the upstream can not get the next part of the body yet */
+
+        if ((ngx_event_flags & NGX_USE_LEVEL_EVENT) && c->read->active) {
+            if (ngx_del_event(c->read, NGX_READ_EVENT, 0) == NGX_ERROR) {
+                ngx_http_upstream_finalize_request(r, u,
+                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
+                return;
+            }
+        }
+
+        return;
+    }
+
+    ngx_http_upstream_send_request(r, u);
+}
+
+
+static void
+ngx_http_upstream_process_header(ngx_event_t *rev)
+{
+    ssize_t                         n;
+    ngx_int_t                       rc;
+    ngx_str_t                      *uri, args;
+    ngx_uint_t                      i, flags;
+#if (NGX_HTTP_CACHE)
+    ngx_uint_t                      ft_type;
+#endif
+    ngx_time_t                     *tp;
+    ngx_msec_int_t                  ms;
+    ngx_list_part_t                *part;
+    ngx_table_elt_t                *h;
+    ngx_connection_t               *c;
+    ngx_http_request_t             *r;
+    ngx_http_upstream_t            *u;
+    ngx_http_err_page_t            *err_page;
+    ngx_http_core_loc_conf_t       *clcf;
+    ngx_http_upstream_header_t     *hh;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    c = rev->data;
+    r = c->data;
+    u = r->upstream;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, rev->log, 0,
+                   "http upstream process header");
+
+    c->log->action = "reading response header from upstream";
+
+    if (rev->timedout) {
+        ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_TIMEOUT);
+        return;
+    }
+
+    if (u->buffer.start == NULL) {
+        u->buffer.start = ngx_palloc(r->pool, u->conf->buffer_size);
+        if (u->buffer.start == NULL) {
+            ngx_http_upstream_finalize_request(r, u,
+                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
+        u->buffer.pos = u->buffer.start;
+        u->buffer.last = u->buffer.start;
+        u->buffer.end = u->buffer.start + u->conf->buffer_size;
+        u->buffer.temporary = 1;
+
+        u->buffer.tag = u->output.tag;
+
+        if (ngx_list_init(&r->upstream->headers_in.headers, r->pool, 8,
+                          sizeof(ngx_table_elt_t))
+            != NGX_OK)
+        {
+            ngx_http_upstream_finalize_request(r, u,
+                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
+        u->headers_in.content_length_n = -1;
+
+#if (NGX_HTTP_CACHE)
+
+        if (r->cache) {
+            u->buffer.pos += r->cache->header_start;
+            u->buffer.last = u->buffer.pos;
+        }
+
+#endif
+    }
+
+    n = u->peer.connection->recv(u->peer.connection, u->buffer.last,
+                                      u->buffer.end - u->buffer.last);
+
+    if (n == NGX_AGAIN) {
+#if 0
+        ngx_add_timer(rev, u->read_timeout);
+#endif
+
+        if (ngx_handle_read_event(rev, 0) == NGX_ERROR) {
+            ngx_http_upstream_finalize_request(r, u,
+                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
+        return;
+    }
+
+    if (n == 0) {
+        ngx_log_error(NGX_LOG_ERR, rev->log, 0,
+                      "upstream prematurely closed connection");
+    }
+
+    if (n == NGX_ERROR || n == 0) {
+        ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_ERROR);
+        return;
+    }
+
+    u->buffer.last += n;
+
+#if 0
+    u->valid_header_in = 0;
+
+    u->peer.cached = 0;
+#endif
+
+    rc = u->process_header(r);
+
+    if (rc == NGX_AGAIN) {
+#if 0
+        ngx_add_timer(rev, u->read_timeout);
+#endif
+
+        if (u->buffer.pos == u->buffer.end) {
+            ngx_log_error(NGX_LOG_ERR, rev->log, 0,
+                          "upstream sent too big header");
+
+            ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_INVALID_HEADER);
+            return;
+        }
+
+        if (ngx_handle_read_event(rev, 0) == NGX_ERROR) {
+            ngx_http_upstream_finalize_request(r, u,
+                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
+        return;
+    }
+
+    if (rc == NGX_HTTP_UPSTREAM_INVALID_HEADER) {
+        ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_INVALID_HEADER);
+        return;
+    }
+
+    if (rc == NGX_ERROR || rc == NGX_HTTP_INTERNAL_SERVER_ERROR) {
+        ngx_http_upstream_finalize_request(r, u,
+                                           NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
+    }
+
+    /* rc == NGX_OK */
+
+    tp = ngx_timeofday();
+    ms = tp->sec * 1000 + tp->msec - u->state->response_time;
+    u->state->header_time = (ms >= 0) ? ms : 0;
+
+    if (u->headers_in.status_n >= NGX_HTTP_BAD_REQUEST
+        && r->subrequest_in_memory)
+    {
+        u->buffer.last = u->buffer.pos;
+    }
+
+    if (u->headers_in.status_n == NGX_HTTP_INTERNAL_SERVER_ERROR) {
+
+        if (u->peer.tries > 1
+            && (u->conf->next_upstream & NGX_HTTP_UPSTREAM_FT_HTTP_500))
+        {
+            ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_HTTP_500);
+            return;
+        }
+    }
+
+    if (u->headers_in.status_n == NGX_HTTP_NOT_FOUND) {
+
+        if (u->peer.tries > 1
+            && u->conf->next_upstream & NGX_HTTP_UPSTREAM_FT_HTTP_404)
+        {
+            ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_HTTP_404);
+            return;
+        }
+
+        if (u->conf->intercept_404) {
+            ngx_http_upstream_finalize_request(r, u, NGX_HTTP_NOT_FOUND);
+            return;
+        }
+    }
+
+#if (NGX_HTTP_CACHE)
+
+    switch (u->headers_in.status_n) {
+
+    case NGX_HTTP_INTERNAL_SERVER_ERROR:
+        ft_type = NGX_HTTP_UPSTREAM_FT_HTTP_500;
+        break;
+
+    case NGX_HTTP_BAD_GATEWAY:
+        ft_type = NGX_HTTP_UPSTREAM_FT_HTTP_502;
+        break;
+
+    case NGX_HTTP_SERVICE_UNAVAILABLE:
+        ft_type = NGX_HTTP_UPSTREAM_FT_HTTP_503;
+        break;
+
+    case NGX_HTTP_GATEWAY_TIME_OUT:
+        ft_type = NGX_HTTP_UPSTREAM_FT_HTTP_504;
+        break;
+
+    case NGX_HTTP_NOT_FOUND:
+        ft_type = NGX_HTTP_UPSTREAM_FT_HTTP_404;
+        break;
+
+    default:
+        ft_type = 0;
+    }
+
+    if (ft_type && ngx_http_upstream_cache_stale(r, u, ft_type) == NGX_OK) {
+        return;
+    }
+
+#endif
+
+    if (u->headers_in.status_n >= NGX_HTTP_BAD_REQUEST
+        && u->conf->intercept_errors)
+    {
+        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+        if (clcf->error_pages) {
+
+            err_page = clcf->error_pages->elts;
+            for (i = 0; i < clcf->error_pages->nelts; i++) {
+                if (err_page[i].status == (ngx_int_t) u->headers_in.status_n) {
+
+                    if (u->headers_in.status_n == NGX_HTTP_UNAUTHORIZED) {
+
+                        r->headers_out.www_authenticate =
+                                        ngx_list_push(&r->headers_out.headers);
+
+                        if (r->headers_out.www_authenticate == NULL) {
+                            ngx_http_upstream_finalize_request(r, u,
+                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
+                            return;
+                        }
+
+                        *r->headers_out.www_authenticate =
+                                               *u->headers_in.www_authenticate;
+                    }
+
+                    ngx_http_upstream_finalize_request(r, u,
+                                                       u->headers_in.status_n);
+                    return;
+                }
+            }
+        }
+    }
+
+    umcf = ngx_http_get_module_main_conf(r, ngx_http_upstream_module);
+
+    if (r->upstream->headers_in.x_accel_redirect) {
+
+        ngx_http_upstream_finalize_request(r, u, NGX_DECLINED);
+
+        part = &r->upstream->headers_in.headers.part;
+        h = part->elts;
+
+        for (i = 0; /* void */; i++) {
+
+            if (i >= part->nelts) {
+                if (part->next == NULL) {
+                    break;
+                }
+
+                part = part->next;
+                h = part->elts;
+                i = 0;
+            }
+
+            hh = ngx_hash_find(&umcf->headers_in_hash, h[i].hash,
+                               h[i].lowcase_key, h[i].key.len);
+
+            if (hh && hh->redirect) {
+                if (hh->copy_handler(r, &h[i], hh->conf) != NGX_OK) {
+                    ngx_http_finalize_request(r,
+                                              NGX_HTTP_INTERNAL_SERVER_ERROR);
+                    return;
+                }
+            }
+        }
+
+        uri = &r->upstream->headers_in.x_accel_redirect->value;
+        args.len = 0;
+        args.data = NULL;
+        flags = 0;
+
+        if (ngx_http_parse_unsafe_uri(r, uri, &args, &flags) != NGX_OK) {
+            ngx_http_finalize_request(r, NGX_HTTP_NOT_FOUND);
+            return;
+        }
+
+        if (flags & NGX_HTTP_ZERO_IN_URI) {
+            r->zero_in_uri = 1;
+        }
+
+        if (r->method != NGX_HTTP_HEAD) {
+            r->method = NGX_HTTP_GET;
+        }
+
+        ngx_http_internal_redirect(r, uri, &args);
+        return;
+    }
+
+    if (ngx_http_upstream_process_headers(r, u) != NGX_OK) {
+        ngx_http_upstream_finalize_request(r, u,
+                                           NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
+    }
+
+    if (r->headers_out.content_length_n != -1) {
+        u->length = (size_t) r->headers_out.content_length_n;
+
+    } else {
+        u->length = NGX_MAX_SIZE_T_VALUE;
+    }
+
+    if (!r->subrequest_in_memory) {
+        ngx_http_upstream_send_response(r, u);
+        return;
+    }
+
+    /* subrequest content in memory */
+
+    if (u->input_filter == NULL) {
+        u->input_filter_init = ngx_http_upstream_non_buffered_filter_init;
+        u->input_filter = ngx_http_upstream_non_buffered_filter;
+        u->input_filter_ctx = r;
+    }
+
+    if (u->input_filter_init(u->input_filter_ctx) == NGX_ERROR) {
+        ngx_http_upstream_finalize_request(r, u,
+                                           NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
+    }
+
+    if (u->buffer.last - u->buffer.pos >= (ssize_t) u->length) {
+        if (u->input_filter(u->input_filter_ctx, 0) == NGX_ERROR) {
+            ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
+            return;
+        }
+
+        ngx_http_upstream_finalize_request(r, u, 0);
+        return;
+    }
+
+    rev->handler = ngx_http_upstream_process_body_in_memory;
+
+    ngx_http_upstream_process_body_in_memory(rev);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_process_headers(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_uint_t                      i;
+    ngx_list_part_t                *part;
+    ngx_table_elt_t                *h;
+    ngx_http_upstream_header_t     *hh;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    umcf = ngx_http_get_module_main_conf(r, ngx_http_upstream_module);
+
+    part = &u->headers_in.headers.part;
+    h = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            h = part->elts;
+            i = 0;
+        }
+
+        if (ngx_hash_find(&u->conf->hide_headers_hash, h[i].hash,
+                          h[i].lowcase_key, h[i].key.len))
+        {
+            continue;
+        }
+
+        hh = ngx_hash_find(&umcf->headers_in_hash, h[i].hash,
+                           h[i].lowcase_key, h[i].key.len);
+
+        if (hh) {
+            if (hh->copy_handler(r, &h[i], hh->conf) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_http_upstream_copy_header_line(r, &h[i], 0) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    if (r->headers_out.server && r->headers_out.server->value.data == NULL) {
+        r->headers_out.server->hash = 0;
+    }
+
+    if (r->headers_out.date && r->headers_out.date->value.data == NULL) {
+        r->headers_out.date->hash = 0;
+    }
+
+    r->headers_out.status = u->headers_in.status_n;
+    r->headers_out.status_line = u->headers_in.status_line;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_process_body_in_memory(ngx_event_t *rev)
+{
+    size_t                size;
+    ssize_t               n;
+    ngx_buf_t            *b;
+    ngx_connection_t     *c;
+    ngx_http_request_t   *r;
+    ngx_http_upstream_t  *u;
+
+    c = rev->data;
+    r = c->data;
+    u = r->upstream;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http upstream process body on memory");
+
+    if (rev->timedout) {
+        ngx_connection_error(c, NGX_ETIMEDOUT, "upstream timed out");
+        ngx_http_upstream_finalize_request(r, u, NGX_ETIMEDOUT);
+        return;
+    }
+
+    b = &u->buffer;
+
+    for ( ;; ) {
+
+        size = b->end - b->last;
+
+        if (size == 0) {
+            ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                          "upstream buffer is too small to read repsonse");
+            ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
+            return;
+        }
+
+        n = c->recv(c, b->last, size);
+
+        if (n == NGX_AGAIN) {
+            break;
+        }
+
+        if (n == 0 || n == NGX_ERROR) {
+            ngx_http_upstream_finalize_request(r, u, n);
+            return;
+        }
+
+        if (u->input_filter(u->input_filter_ctx, n) == NGX_ERROR) {
+            ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
+            return;
+        }
+
+        if (!rev->ready) {
+            break;
+        }
+    }
+
+    if (ngx_handle_read_event(rev, 0) == NGX_ERROR) {
+        ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
+        return;
+    }
+
+    if (rev->active) {
+        ngx_add_timer(rev, u->conf->read_timeout);
+
+    } else if (rev->timer_set) {
+        ngx_del_timer(rev);
+    }
+}
+
+
+static void
+ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    int                        tcp_nodelay;
+    ssize_t                    size;
+    ngx_int_t                  rc;
+#if (NGX_HTTP_CACHE)
+    time_t                     valid;
+#endif
+    ngx_event_pipe_t          *p;
+    ngx_connection_t          *c;
+    ngx_pool_cleanup_t        *cl;
+    ngx_pool_cleanup_file_t   *clf;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->post_action) {
+        ngx_http_upstream_finalize_request(r, u, rc);
+        return;
+    }
+
+    u->header_sent = 1;
+
+    if (r->request_body && r->request_body->temp_file) {
+        for (cl = r->pool->cleanup; cl; cl = cl->next) {
+            if (cl->handler == ngx_pool_cleanup_file) {
+                clf = cl->data;
+
+                if (clf->fd == r->request_body->temp_file->file.fd) {
+                    cl->handler(clf);
+                    cl->handler = NULL;
+                    r->request_body->temp_file->file.fd = NGX_INVALID_FILE;
+                    break;
+                }
+            }
+        }
+    }
+
+    c = r->connection;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+#if (NGX_HTTP_CACHE)
+
+    if (r->cache) {
+
+        if (u->buffering
+            && r->method == NGX_HTTP_GET
+            && r->cache->uses >= r->cache->min_uses
+            && u->buffer.pos - u->buffer.start <= 65535)
+        {
+            valid = ngx_http_upstream_cache_valid(r, u);
+
+            if (valid > 0) {
+                r->cache->valid_sec = ngx_time() + valid;
+
+                if (r->cache->updating_sec) {
+                    r->cache->updating_sec += r->cache->valid_sec;
+                }
+
+                if (r->cache->error_sec) {
+                    r->cache->error_sec += r->cache->valid_sec;
+                }
+
+                r->cache->last_modified = r->headers_out.last_modified_time;
+                r->cache->date = ngx_time();
+                r->cache->body_start = u->buffer.pos - u->buffer.start;
+
+                ngx_http_file_cache_set_header(r, u->buffer.start);
+
+                u->cachable = 1;
+            }
+        }
+
+        if (!u->cachable) {
+
+            /* let the requests waiting for the cache lock go on */
+
+            ngx_http_file_cache_free(r->cache, NULL);
+        }
+    }
+
+#endif
+
+    if (!u->buffering) {
+
+        if (u->input_filter == NULL) {
+            u->input_filter_init = ngx_http_upstream_non_buffered_filter_init;
+            u->input_filter = ngx_http_upstream_non_buffered_filter;
+            u->input_filter_ctx = r;
+        }
+
+        u->peer.connection->read->handler =
+                                   ngx_http_upstream_process_non_buffered_body;
+        r->write_event_handler =
+                             ngx_http_upstream_process_non_buffered_downstream;
+
+        r->limit_rate = 0;
+
+        if (u->input_filter_init(u->input_filter_ctx) == NGX_ERROR) {
+            ngx_http_upstream_finalize_request(r, u, 0);
+            return;
+        }
+
+        if (clcf->tcp_nodelay && c->tcp_nodelay == NGX_TCP_NODELAY_UNSET) {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "tcp_nodelay");
+
+            tcp_nodelay = 1;
+
+            if (setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY,
+                               (const void *) &tcp_nodelay, sizeof(int)) == -1)
+            {
+                ngx_connection_error(c, ngx_socket_errno,
+                                     "setsockopt(TCP_NODELAY) failed");
+                ngx_http_upstream_finalize_request(r, u, 0);
+                return;
+            }
+
+            c->tcp_nodelay = NGX_TCP_NODELAY_SET;
+        }
+
+#if (NGX_HAVE_SPLICE)
+
+        if (u->conf->splice
+            && ngx_http_upstream_init_splice(r, u) == NGX_ERROR)
+        {
+            ngx_http_upstream_finalize_request(r, u, 0);
+            return;
+        }
+
+#endif
+
+        size = u->buffer.last - u->buffer.pos;
+
+        if (size) {
+            u->buffer.last = u->buffer.pos;
+
+            if (u->input_filter(u->input_filter_ctx, size) == NGX_ERROR) {
+                ngx_http_upstream_finalize_request(r, u, 0);
+                return;
+            }
+
+            ngx_http_upstream_process_non_buffered_body(c->write);
+
+        } else {
+            u->buffer.pos = u->buffer.start;
+            u->buffer.last = u->buffer.start;
+
+            if (ngx_http_send_special(r, NGX_HTTP_FLUSH) == NGX_ERROR) {
+                ngx_http_upstream_finalize_request(r, u, 0);
+                return;
+            }
+
+            if (u->length == 0 || u->splice) {
+                ngx_http_upstream_process_non_buffered_body(c->write);
+            }
+        }
+
+        return;
+    }
+
+    /* TODO: preallocate event_pipe bufs, look "Content-Length" */
+
+    p = u->pipe;
+
+    p->output_filter = (ngx_event_pipe_output_filter_pt) ngx_http_output_filter;
+    p->output_ctx = r;
+    p->tag = u->output.tag;
+    p->bufs = u->conf->bufs;
+    p->busy_size = u->conf->busy_buffers_size;
+    p->upstream = u->peer.connection;
+    p->downstream = c;
+    p->pool = r->pool;
+    p->log = c->log;
+
+    p->cachable = u->cachable;
+
+    p->length = -1;
+
+    if (u->input_filter_init
+        && u->input_filter_init(u->input_filter_ctx) != NGX_OK)
+    {
+        ngx_http_upstream_finalize_request(r, u, 0);
+        return;
+    }
+
+    p->temp_file = ngx_pcalloc(r->pool, sizeof(ngx_temp_file_t));
+    if (p->temp_file == NULL) {
+        ngx_http_upstream_finalize_request(r, u, 0);
+        return;
+    }
+
+    p->temp_file->file.fd = NGX_INVALID_FILE;
+    p->temp_file->file.log = c->log;
+    p->temp_file->path = u->conf->temp_path;
+    p->temp_file->pool = r->pool;
+
+    if (u->cachable) {
+        p->temp_file->persistent = 1;
+    } else {
+        p->temp_file->log_level = NGX_LOG_WARN;
+        p->temp_file->warn = "an upstream response is buffered "
+                             "to a temporary file";
+    }
+
+    p->max_temp_file_size = u->conf->max_temp_file_size;
+    p->temp_file_write_size = u->conf->temp_file_write_size;
+
+    p->preread_bufs = ngx_alloc_chain_link(r->pool);
+    if (p->preread_bufs == NULL) {
+        ngx_http_upstream_finalize_request(r, u, 0);
+        return;
+    }
+    p->preread_bufs->buf = &u->buffer;
+    p->preread_bufs->next = NULL;
+    u->buffer.recycled = 1;
+
+    p->preread_size = u->buffer.last - u->buffer.pos;
+
+    if (u->cachable) {
+        p->buf_to_file = ngx_calloc_buf(r->pool);
+        if (p->buf_to_file == NULL) {
+            ngx_http_upstream_finalize_request(r, u, 0);
+            return;
+        }
+        p->buf_to_file->pos = u->buffer.start;
+        p->buf_to_file->last = u->buffer.pos;
+        p->buf_to_file->temporary = 1;
+    }
+
+    if (ngx_event_flags & NGX_USE_AIO_EVENT) {
+        /* the posted aio operation may currupt a shadow buffer */
+        p->single_buf = 1;
+    }
+
+    /* TODO: p->free_bufs = 0 if use ngx_create_chain_of_bufs() */
+    p->free_bufs = 1;
+
+    /*
+     * event_pipe would do u->buffer.last += p->preread_size
+     * as though these bytes were read
+     */
+    u->buffer.last = u->buffer.pos;
+
+    if (u->conf->cyclic_temp_file) {
+
+        /*
+         * we need to disable the use of sendfile() if we use cyclic temp file
+         * because the writing a new data may interfere with sendfile()
+         * that uses the same kernel file pages (at least on FreeBSD)
+         */
+
+        p->cyclic_temp_file = 1;
+        c->sendfile = 0;
+
+    } else {
+        p->cyclic_temp_file = 0;
+    }
+
+    p->read_timeout = u->conf->read_timeout;
+    p->send_timeout = clcf->send_timeout;
+    p->send_lowat = clcf->send_lowat;
+
+    u->peer.connection->read->handler = ngx_http_upstream_process_body;
+    r->write_event_handler = ngx_http_upstream_process_downstream;
+
+    ngx_http_upstream_process_body(u->peer.connection->read);
+}
+
+
+static void
+ngx_http_upstream_process_non_buffered_downstream(ngx_http_request_t *r)
+{
+    ngx_http_upstream_process_non_buffered_body(r->connection->write);
+}
+
+
+static void
+ngx_http_upstream_process_non_buffered_body(ngx_event_t *ev)
+{
+    size_t                     size;
+    ssize_t                    n;
+    ngx_buf_t                 *b;
+    ngx_int_t                  rc;
+    ngx_uint_t                 do_write;
+    ngx_connection_t          *c, *downstream, *upstream;
+    ngx_http_request_t        *r;
+    ngx_http_upstream_t       *u;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    c = ev->data;
+    r = c->data;
+    u = r->upstream;
+
+    if (ev->write) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http upstream process non buffered downstream");
+        c->log->action = "sending to client";
+
+    } else {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http upstream process non buffered upstream");
+        c->log->action = "reading upstream";
+    }
+
+    if (ev->timedout) {
+        if (ev->write) {
+            c->timedout = 1;
+            ngx_connection_error(c, NGX_ETIMEDOUT, "client timed out");
+
+        } else {
+            ngx_connection_error(c, NGX_ETIMEDOUT, "upstream timed out");
+        }
+
+        ngx_http_upstream_finalize_request(r, u, 0);
+        return;
+    }
+
+    downstream = r->connection;
+    upstream = u->peer.connection;
+
+#if (NGX_HAVE_SPLICE)
+
+    if (u->splice
+        && u->out_bufs == NULL
+        && u->busy_bufs == NULL
+        && !downstream->buffered)
+    {
+        ngx_http_upstream_process_splice(r, u);
+        return;
+    }
+
+#endif
+
+    b = &u->buffer;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    do_write = ev->write || u->length == 0;
+
+    for ( ;; ) {
+
+        if (do_write) {
+
+            if (u->out_bufs || u->busy_bufs) {
+                rc = ngx_http_output_filter(r, u->out_bufs);
+
+                if (downstream->destroyed) {
+                    return;
+                }
+
+                if (rc == NGX_ERROR) {
+                    ngx_http_upstream_finalize_request(r, u, 0);
+                    return;
+                }
+
+                ngx_chain_update_chains(&u->free_bufs, &u->busy_bufs,
+                                        &u->out_bufs, u->output.tag);
+            }
+
+            if (u->busy_bufs == NULL) {
+
+                if (u->length == 0
+                    || upstream->read->eof
+                    || upstream->read->error)
+                {
+                    ngx_http_upstream_finalize_request(r, u, 0);
+                    return;
+                }
+
+                b->pos = b->start;
+                b->last = b->start;
+
+#if (NGX_HAVE_SPLICE)
+
+                if (u->splice && !downstream->buffered) {
+
+                    /* the buffered part of the body has been sent */
+
+                    ngx_http_upstream_process_splice(r, u);
+                    return;
+                }
+
+#endif
+            }
+        }
+
+        size = b->end - b->last;
+
+        if (size > u->length) {
+            size = u->length;
+        }
+
+        if (size && upstream->read->ready) {
+
+            n = upstream->recv(upstream, b->last, size);
+
+            if (n == NGX_AGAIN) {
+                break;
+            }
+
+            if (n > 0) {
+                if (u->input_filter(u->input_filter_ctx, n) == NGX_ERROR) {
+                    ngx_http_upstream_finalize_request(r, u, 0);
+                    return;
+                }
+            }
+
+            do_write = 1;
+
+            continue;
+        }
+
+        break;
+    }
 
-    if (u->buffer.last - u->buffer.pos >= (ssize_t) u->length) {
-        if (u->input_filter(u->input_filter_ctx, 0) == NGX_ERROR) {
-            ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
+    if (downstream->data == r) {
+        if (ngx_handle_write_event(downstream->write, clcf->send_lowat)
+            == NGX_ERROR)
+        {
+            ngx_http_upstream_finalize_request(r, u, 0);
             return;
         }
+    }
+
+    if (downstream->write->active) {
+        ngx_add_timer(downstream->write, clcf->send_timeout);
+
+    } else if (downstream->write->timer_set) {
+        ngx_del_timer(downstream->write);
+    }
 
+    if (ngx_handle_read_event(upstream->read, 0) == NGX_ERROR) {
         ngx_http_upstream_finalize_request(r, u, 0);
         return;
     }
 
-    rev->handler = ngx_http_upstream_process_body_in_memory;
+    if (upstream->read->active) {
+        ngx_add_timer(upstream->read, u->conf->read_timeout);
 
-    ngx_http_upstream_process_body_in_memory(rev);
+    } else if (upstream->read->timer_set) {
+        ngx_del_timer(upstream->read);
+    }
 }
 
 
-static void
-ngx_http_upstream_process_body_in_memory(ngx_event_t *rev)
-{
-    size_t                size;
-    ssize_t               n;
-    ngx_buf_t            *b;
-    ngx_connection_t     *c;
-    ngx_http_request_t   *r;
-    ngx_http_upstream_t  *u;
+#if (NGX_HAVE_SPLICE)
 
-    c = rev->data;
-    r = c->data;
-    u = r->upstream;
+static ngx_int_t
+ngx_http_upstream_init_splice(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_pool_cleanup_t  *cln;
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
-                   "http upstream process body on memory");
+    /*
+     * the spliced body bypasses the output filters, so splice() is used
+     * only if no filter needs the body data and the filters have not
+     * changed the response length
+     */
 
-    if (rev->timedout) {
-        ngx_connection_error(c, NGX_ETIMEDOUT, "upstream timed out");
-        ngx_http_upstream_finalize_request(r, u, NGX_ETIMEDOUT);
-        return;
+    if (r != r->main
+        || r->header_only
+        || r->chunked
+        || r->main_filter_need_in_memory
+        || r->filter_need_in_memory
+        || r->filter_need_temporary
+        || u->length == 0
+        || u->headers_in.content_length_n < 0
+        || r->headers_out.content_length_n != u->headers_in.content_length_n)
+    {
+        return NGX_DECLINED;
     }
 
-    b = &u->buffer;
-
-    for ( ;; ) {
-
-        size = b->end - b->last;
+#if (NGX_HTTP_SSL)
 
-        if (size == 0) {
-            ngx_log_error(NGX_LOG_ALERT, c->log, 0,
-                          "upstream buffer is too small to read repsonse");
-            ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
-            return;
-        }
+    if (u->peer.connection->ssl) {
+        return NGX_DECLINED;
+    }
 
-        n = c->recv(c, b->last, size);
+#endif
 
-        if (n == NGX_AGAIN) {
-            break;
-        }
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
 
-        if (n == 0 || n == NGX_ERROR) {
-            ngx_http_upstream_finalize_request(r, u, n);
-            return;
-        }
+    if (pipe(u->splice_pipe) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                      "pipe() failed");
+        return NGX_DECLINED;
+    }
 
-        if (u->input_filter(u->input_filter_ctx, n) == NGX_ERROR) {
-            ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
-            return;
-        }
+    cln->handler = ngx_http_upstream_splice_cleanup;
+    cln->data = u->splice_pipe;
 
-        if (!rev->ready) {
-            break;
-        }
+    if (ngx_nonblocking(u->splice_pipe[0]) == -1
+        || ngx_nonblocking(u->splice_pipe[1]) == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_socket_errno,
+                      ngx_nonblocking_n " failed");
+        return NGX_DECLINED;
     }
 
-    if (ngx_handle_read_event(rev, 0) == NGX_ERROR) {
-        ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
-        return;
-    }
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream splice pipe: %d:%d",
+                   u->splice_pipe[0], u->splice_pipe[1]);
 
-    if (rev->active) {
-        ngx_add_timer(rev, u->conf->read_timeout);
+    u->splice = 1;
 
-    } else if (rev->timer_set) {
-        ngx_del_timer(rev);
-    }
+    return NGX_OK;
 }
 
 
 static void
-ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
+ngx_http_upstream_process_splice(ngx_http_request_t *r, ngx_http_upstream_t *u)
 {
-    int                        tcp_nodelay;
-    ssize_t                    size;
-    ngx_int_t                  rc;
-    ngx_event_pipe_t          *p;
-    ngx_connection_t          *c;
-    ngx_pool_cleanup_t        *cl;
-    ngx_pool_cleanup_file_t   *clf;
+    size_t                     size;
+    ssize_t                    n;
+    ngx_err_t                  err;
+    ngx_uint_t                 progress;
+    ngx_connection_t          *downstream, *upstream;
     ngx_http_core_loc_conf_t  *clcf;
 
-    rc = ngx_http_send_header(r);
+    downstream = r->connection;
+    upstream = u->peer.connection;
 
-    if (rc == NGX_ERROR || rc > NGX_OK || r->post_action) {
-        ngx_http_upstream_finalize_request(r, u, rc);
-        return;
-    }
+    do {
+        progress = 0;
 
-    u->header_sent = 1;
+        if (u->splice_size && downstream->write->ready) {
 
-    if (r->request_body && r->request_body->temp_file) {
-        for (cl = r->pool->cleanup; cl; cl = cl->next) {
-            if (cl->handler == ngx_pool_cleanup_file) {
-                clf = cl->data;
+            n = splice(u->splice_pipe[0], NULL, downstream->fd, NULL,
+                       u->splice_size, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
 
-                if (clf->fd == r->request_body->temp_file->file.fd) {
-                    cl->handler(clf);
-                    cl->handler = NULL;
-                    r->request_body->temp_file->file.fd = NGX_INVALID_FILE;
-                    break;
-                }
-            }
-        }
-    }
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, downstream->log, 0,
+                           "splice to client: %z of %uz", n, u->splice_size);
 
-    c = r->connection;
+            if (n == -1) {
+                err = ngx_errno;
 
-    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+                if (err != NGX_EAGAIN) {
+                    downstream->error = 1;
+                    ngx_connection_error(downstream, err,
+                                         "splice() to client failed");
+                    ngx_http_upstream_finalize_request(r, u, 0);
+                    return;
+                }
 
-    if (!u->buffering) {
+                downstream->write->ready = 0;
 
-        if (u->input_filter == NULL) {
-            u->input_filter_init = ngx_http_upstream_non_buffered_filter_init;
-            u->input_filter = ngx_http_upstream_non_buffered_filter;
-            u->input_filter_ctx = r;
+            } else {
+                u->splice_size -= n;
+                downstream->sent += n;
+                progress = 1;
+            }
         }
 
-        u->peer.connection->read->handler =
-                                   ngx_http_upstream_process_non_buffered_body;
-        r->write_event_handler =
-                             ngx_http_upstream_process_non_buffered_downstream;
-
-        r->limit_rate = 0;
-
-        if (u->input_filter_init(u->input_filter_ctx) == NGX_ERROR) {
+        if (u->splice_size == 0
+            && (u->length == 0 || upstream->read->eof || upstream->read->error))
+        {
             ngx_http_upstream_finalize_request(r, u, 0);
             return;
         }
 
-        if (clcf->tcp_nodelay && c->tcp_nodelay == NGX_TCP_NODELAY_UNSET) {
-            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "tcp_nodelay");
-
-            tcp_nodelay = 1;
+        size = NGX_HTTP_UPSTREAM_SPLICE_SIZE - u->splice_size;
 
-            if (setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY,
-                               (const void *) &tcp_nodelay, sizeof(int)) == -1)
-            {
-                ngx_connection_error(c, ngx_socket_errno,
-                                     "setsockopt(TCP_NODELAY) failed");
-                ngx_http_upstream_finalize_request(r, u, 0);
-                return;
-            }
+        if (size > u->length) {
+            size = u->length;
+        }
 
-            c->tcp_nodelay = NGX_TCP_NODELAY_SET;
+        if (size == 0
+            || !upstream->read->ready
+            || upstream->read->eof
+            || upstream->read->error)
+        {
+            continue;
         }
 
-        size = u->buffer.last - u->buffer.pos;
+        n = splice(upstream->fd, NULL, u->splice_pipe[1], NULL, size,
+                   SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
 
-        if (size) {
-            u->buffer.last = u->buffer.pos;
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, downstream->log, 0,
+                       "splice from upstream: %z of %uz", n, size);
 
-            if (u->input_filter(u->input_filter_ctx, size) == NGX_ERROR) {
-                ngx_http_upstream_finalize_request(r, u, 0);
-                return;
-            }
+        if (n == -1) {
+            err = ngx_errno;
 
-            ngx_http_upstream_process_non_buffered_body(c->write);
+            if (err == NGX_EAGAIN) {
 
-        } else {
-            u->buffer.pos = u->buffer.start;
-            u->buffer.last = u->buffer.start;
+                /* the pipe is not full, so the socket has no data */
 
-            if (ngx_http_send_special(r, NGX_HTTP_FLUSH) == NGX_ERROR) {
-                ngx_http_upstream_finalize_request(r, u, 0);
-                return;
+                if (u->splice_size == 0) {
+                    upstream->read->ready = 0;
+                }
+
+                continue;
             }
-        }
 
-        return;
-    }
+            if (u->splice_size == 0 && (err == NGX_EINVAL || err == NGX_ENOSYS))
+            {
+                ngx_log_error(NGX_LOG_INFO, downstream->log, err,
+                              "splice() from upstream failed, "
+                              "the response is copied");
 
-    /* TODO: preallocate event_pipe bufs, look "Content-Length" */
+                u->splice = 0;
 
-#if 0
+                ngx_http_upstream_process_non_buffered_body(upstream->read);
+                return;
+            }
 
-    if (u->cache && u->cache->ctx.file.fd != NGX_INVALID_FILE) {
-        if (ngx_close_file(u->cache->ctx.file.fd) == NGX_FILE_ERROR) {
-            ngx_log_error(NGX_LOG_ALERT, c->log, ngx_errno,
-                          ngx_close_file_n " \"%s\" failed",
-                          u->cache->ctx.file.name.data);
-        }
-    }
+            upstream->read->error = 1;
+            ngx_connection_error(upstream, err,
+                                 "splice() from upstream failed");
 
-    if (u->cachable) {
-        header = (ngx_http_cache_header_t *) u->buffer->start;
+        } else if (n == 0) {
+            upstream->read->eof = 1;
 
-        header->expires = u->cache->ctx.expires;
-        header->last_modified = u->cache->ctx.last_modified;
-        header->date = u->cache->ctx.date;
-        header->length = r->headers_out.content_length_n;
-        u->cache->ctx.length = r->headers_out.content_length_n;
+        } else {
+            u->splice_size += n;
 
-        header->key_len = u->cache->ctx.key0.len;
-        ngx_memcpy(&header->key, u->cache->ctx.key0.data, header->key_len);
-        header->key[header->key_len] = LF;
-    }
+            if (u->length != NGX_MAX_SIZE_T_VALUE) {
+                u->length -= n;
 
-#endif
+                if (u->length == 0) {
+                    u->keepalive = !u->headers_in.connection_close;
+                }
+            }
+        }
 
-    p = u->pipe;
+        progress = 1;
 
-    p->output_filter = (ngx_event_pipe_output_filter_pt) ngx_http_output_filter;
-    p->output_ctx = r;
-    p->tag = u->output.tag;
-    p->bufs = u->conf->bufs;
-    p->busy_size = u->conf->busy_buffers_size;
-    p->upstream = u->peer.connection;
-    p->downstream = c;
-    p->pool = r->pool;
-    p->log = c->log;
+    } while (progress);
 
-    p->cachable = u->cachable;
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
-    p->temp_file = ngx_pcalloc(r->pool, sizeof(ngx_temp_file_t));
-    if (p->temp_file == NULL) {
+    if (ngx_handle_write_event(downstream->write, clcf->send_lowat)
+        == NGX_ERROR)
+    {
         ngx_http_upstream_finalize_request(r, u, 0);
         return;
     }
 
-    p->temp_file->file.fd = NGX_INVALID_FILE;
-    p->temp_file->file.log = c->log;
-    p->temp_file->path = u->conf->temp_path;
-    p->temp_file->pool = r->pool;
+    if (downstream->write->active && !downstream->write->ready) {
+        ngx_add_timer(downstream->write, clcf->send_timeout);
 
-    if (u->cachable) {
-        p->temp_file->persistent = 1;
-    } else {
-        p->temp_file->log_level = NGX_LOG_WARN;
-        p->temp_file->warn = "an upstream response is buffered "
-                             "to a temporary file";
+    } else if (downstream->write->timer_set) {
+        ngx_del_timer(downstream->write);
     }
 
-    p->max_temp_file_size = u->conf->max_temp_file_size;
-    p->temp_file_write_size = u->conf->temp_file_write_size;
-
-    p->preread_bufs = ngx_alloc_chain_link(r->pool);
-    if (p->preread_bufs == NULL) {
+    if (ngx_handle_read_event(upstream->read, 0) == NGX_ERROR) {
         ngx_http_upstream_finalize_request(r, u, 0);
         return;
     }
-    p->preread_bufs->buf = &u->buffer;
-    p->preread_bufs->next = NULL;
-    u->buffer.recycled = 1;
 
-    p->preread_size = u->buffer.last - u->buffer.pos;
+    if (upstream->read->active && !upstream->read->ready) {
+        ngx_add_timer(upstream->read, u->conf->read_timeout);
 
-    if (u->cachable) {
-        p->buf_to_file = ngx_calloc_buf(r->pool);
-        if (p->buf_to_file == NULL) {
-            ngx_http_upstream_finalize_request(r, u, 0);
-            return;
-        }
-        p->buf_to_file->pos = u->buffer.start;
-        p->buf_to_file->last = u->buffer.pos;
-        p->buf_to_file->temporary = 1;
+    } else if (upstream->read->timer_set) {
+        ngx_del_timer(upstream->read);
     }
+}
 
-    if (ngx_event_flags & NGX_USE_AIO_EVENT) {
-        /* the posted aio operation may currupt a shadow buffer */
-        p->single_buf = 1;
-    }
 
-    /* TODO: p->free_bufs = 0 if use ngx_create_chain_of_bufs() */
-    p->free_bufs = 1;
+static ngx_int_t
+ngx_http_upstream_init_request_splice(ngx_http_request_t *r,
+    ngx_http_upstream_t *u)
+{
+    ngx_pool_cleanup_t  *cln;
 
-    /*
-     * event_pipe would do u->buffer.last += p->preread_size
-     * as though these bytes were read
-     */
-    u->buffer.last = u->buffer.pos;
+#if (NGX_HTTP_SSL)
 
-    if (u->conf->cyclic_temp_file) {
+    if (r->connection->ssl) {
+        return NGX_DECLINED;
+    }
 
-        /*
-         * we need to disable the use of sendfile() if we use cyclic temp file
-         * because the writing a new data may interfere with sendfile()
-         * that uses the same kernel file pages (at least on FreeBSD)
-         */
+#endif
 
-        p->cyclic_temp_file = 1;
-        c->sendfile = 0;
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
 
-    } else {
-        p->cyclic_temp_file = 0;
+    if (pipe(u->request_splice_pipe) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                      "pipe() failed");
+        return NGX_DECLINED;
     }
 
-    p->read_timeout = u->conf->read_timeout;
-    p->send_timeout = clcf->send_timeout;
-    p->send_lowat = clcf->send_lowat;
+    cln->handler = ngx_http_upstream_splice_cleanup;
+    cln->data = u->request_splice_pipe;
 
-    u->peer.connection->read->handler = ngx_http_upstream_process_body;
-    r->write_event_handler = ngx_http_upstream_process_downstream;
+    if (ngx_nonblocking(u->request_splice_pipe[0]) == -1
+        || ngx_nonblocking(u->request_splice_pipe[1]) == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_socket_errno,
+                      ngx_nonblocking_n " failed");
+        return NGX_DECLINED;
+    }
 
-    ngx_http_upstream_process_body(u->peer.connection->read);
-}
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream request splice pipe: %d:%d",
+                   u->request_splice_pipe[0], u->request_splice_pipe[1]);
 
+    u->request_splice = 1;
 
-static void
-ngx_http_upstream_process_non_buffered_downstream(ngx_http_request_t *r)
-{
-    ngx_http_upstream_process_non_buffered_body(r->connection->write);
+    return NGX_OK;
 }
 
 
-static void
-ngx_http_upstream_process_non_buffered_body(ngx_event_t *ev)
+/*
+ * the rest of the unbuffered client request body is passed to the upstream
+ * through the pipe, the client connection is read only after the pipe
+ * has been emptied to the upstream; it returns NGX_OK if the whole body
+ * has been sent, NGX_AGAIN if the upstream does not take the data,
+ * NGX_DONE if the client has no data, and NGX_DECLINED if the body
+ * should be copied
+ */
+
+static ngx_int_t
+ngx_http_upstream_splice_request_body(ngx_http_request_t *r,
+    ngx_http_upstream_t *u)
 {
     size_t                     size;
     ssize_t                    n;
-    ngx_buf_t                 *b;
-    ngx_int_t                  rc;
-    ngx_uint_t                 do_write;
-    ngx_connection_t          *c, *downstream, *upstream;
-    ngx_http_request_t        *r;
-    ngx_http_upstream_t       *u;
+    ngx_err_t                  err;
+    ngx_connection_t          *downstream, *upstream;
+    ngx_http_request_body_t   *rb;
     ngx_http_core_loc_conf_t  *clcf;
 
-    c = ev->data;
-    r = c->data;
-    u = r->upstream;
+    downstream = r->connection;
+    upstream = u->peer.connection;
+    rb = r->request_body;
 
-    if (ev->write) {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
-                       "http upstream process non buffered downstream");
-        c->log->action = "sending to client";
+#if (NGX_HTTP_SSL)
 
-    } else {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
-                       "http upstream process non buffered upstream");
-        c->log->action = "reading upstream";
+    if (upstream->ssl) {
+        u->request_splice = 0;
+        return NGX_DECLINED;
     }
 
-    if (ev->timedout) {
-        if (ev->write) {
-            c->timedout = 1;
-            ngx_connection_error(c, NGX_ETIMEDOUT, "client timed out");
-
-        } else {
-            ngx_connection_error(c, NGX_ETIMEDOUT, "upstream timed out");
-        }
+#endif
 
-        ngx_http_upstream_finalize_request(r, u, 0);
-        return;
+    if (downstream->read->timedout) {
+        downstream->timedout = 1;
+        return NGX_HTTP_REQUEST_TIME_OUT;
     }
 
-    downstream = r->connection;
-    upstream = u->peer.connection;
+    for ( ;; ) {
 
-    b = &u->buffer;
+        if (u->request_splice_size) {
 
-    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+            if (!upstream->write->ready) {
 
-    do_write = ev->write || u->length == 0;
+                /*
+                 * the client request body is not read until the upstream
+                 * gets the pipe data, so the client timeout is stopped
+                 */
 
-    for ( ;; ) {
+                if (downstream->read->timer_set) {
+                    ngx_del_timer(downstream->read);
+                }
 
-        if (do_write) {
+                return NGX_AGAIN;
+            }
 
-            if (u->out_bufs || u->busy_bufs) {
-                rc = ngx_http_output_filter(r, u->out_bufs);
+            n = splice(u->request_splice_pipe[0], NULL, upstream->fd, NULL,
+                       u->request_splice_size,
+                       SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
 
-                if (downstream->destroyed) {
-                    return;
-                }
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, downstream->log, 0,
+                           "splice to upstream: %z of %uz",
+                           n, u->request_splice_size);
 
-                if (rc == NGX_ERROR) {
-                    ngx_http_upstream_finalize_request(r, u, 0);
-                    return;
+            if (n == -1) {
+                err = ngx_errno;
+
+                if (err != NGX_EAGAIN) {
+                    ngx_connection_error(upstream, err,
+                                         "splice() to upstream failed");
+                    return NGX_ERROR;
                 }
 
-                ngx_chain_update_chains(&u->free_bufs, &u->busy_bufs,
-                                        &u->out_bufs, u->output.tag);
+                upstream->write->ready = 0;
+                continue;
             }
 
-            if (u->busy_bufs == NULL) {
+            u->request_splice_size -= n;
+            upstream->sent += n;
 
-                if (u->length == 0
-                    || upstream->read->eof
-                    || upstream->read->error)
-                {
-                    ngx_http_upstream_finalize_request(r, u, 0);
-                    return;
-                }
+            continue;
+        }
 
-                b->pos = b->start;
-                b->last = b->start;
+        if (rb->rest == 0) {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, downstream->log, 0,
+                           "http upstream request body spliced");
+            return NGX_OK;
+        }
+
+        if (!downstream->read->ready) {
+            clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+            ngx_add_timer(downstream->read, clcf->client_body_timeout);
+
+            if (ngx_handle_read_event(downstream->read, 0) == NGX_ERROR) {
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
             }
+
+            return NGX_DONE;
         }
 
-        size = b->end - b->last;
+        size = NGX_HTTP_UPSTREAM_SPLICE_SIZE;
 
-        if (size > u->length) {
-            size = u->length;
+        if ((off_t) size > rb->rest) {
+            size = (size_t) rb->rest;
         }
 
-        if (size && upstream->read->ready) {
+        n = splice(downstream->fd, NULL, u->request_splice_pipe[1], NULL, size,
+                   SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
 
-            n = upstream->recv(upstream, b->last, size);
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, downstream->log, 0,
+                       "splice from client: %z of %uz", n, size);
 
-            if (n == NGX_AGAIN) {
-                break;
+        if (n == -1) {
+            err = ngx_errno;
+
+            if (err == NGX_EAGAIN) {
+                downstream->read->ready = 0;
+                continue;
             }
 
-            if (n > 0) {
-                if (u->input_filter(u->input_filter_ctx, n) == NGX_ERROR) {
-                    ngx_http_upstream_finalize_request(r, u, 0);
-                    return;
-                }
+            /* the pipe is empty here, so the body may be copied further */
+
+            if (err == NGX_EINVAL || err == NGX_ENOSYS) {
+                ngx_log_error(NGX_LOG_INFO, downstream->log, err,
+                              "splice() from client failed, "
+                              "the request body is copied");
+
+                u->request_splice = 0;
+
+                return NGX_DECLINED;
             }
 
-            do_write = 1;
+            downstream->error = 1;
+            ngx_connection_error(downstream, err,
+                                 "splice() from client failed");
+            return NGX_HTTP_BAD_REQUEST;
+        }
 
-            continue;
+        if (n == 0) {
+            ngx_log_error(NGX_LOG_INFO, downstream->log, 0,
+                          "client closed prematurely connection");
+            downstream->error = 1;
+            return NGX_HTTP_BAD_REQUEST;
         }
 
-        break;
-    }
+        /* the pipe data are not kept, so the request can not be resent */
 
-    if (downstream->data == r) {
-        if (ngx_handle_write_event(downstream->write, clcf->send_lowat)
-            == NGX_ERROR)
-        {
-            ngx_http_upstream_finalize_request(r, u, 0);
-            return;
+        u->request_body_streamed = 1;
+
+        u->request_splice_size += n;
+        rb->rest -= n;
+        r->request_length += n;
+
+        if (downstream->read->timer_set) {
+            ngx_del_timer(downstream->read);
         }
     }
+}
 
-    if (downstream->write->active) {
-        ngx_add_timer(downstream->write, clcf->send_timeout);
 
-    } else if (downstream->write->timer_set) {
-        ngx_del_timer(downstream->write);
-    }
+static void
+ngx_http_upstream_splice_cleanup(void *data)
+{
+    ngx_fd_t  *fd = data;
 
-    if (ngx_handle_read_event(upstream->read, 0) == NGX_ERROR) {
-        ngx_http_upstream_finalize_request(r, u, 0);
-        return;
-    }
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http upstream splice pipe close: %d:%d", fd[0], fd[1]);
 
-    if (upstream->read->active) {
-        ngx_add_timer(upstream->read, u->conf->read_timeout);
+    if (close(fd[0]) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "close() pipe failed");
+    }
 
-    } else if (upstream->read->timer_set) {
-        ngx_del_timer(upstream->read);
+    if (close(fd[1]) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "close() pipe failed");
     }
 }
 
+#endif
+
 
 static ngx_int_t
 ngx_http_upstream_non_buffered_filter_init(void *data)
@@ -1867,24 +3101,12 @@ ngx_http_upstream_process_body(ngx_event_t *ev)
 
     if (u->peer.connection) {
 
-#if (NGX_HTTP_FILE_CACHE)
-
-        if (p->upstream_done && u->cachable) {
-            if (ngx_http_cache_update(r) == NGX_ERROR) {
-                ngx_http_busy_unlock(u->conf->busy_lock, &u->busy_lock);
-                ngx_http_upstream_finalize_request(r, u, 0);
-                return;
-            }
-
-        } else if (p->upstream_eof && u->cachable) {
-
-            /* TODO: check length & update cache */
+#if (NGX_HTTP_CACHE)
 
-            if (ngx_http_cache_update(r) == NGX_ERROR) {
-                ngx_http_busy_unlock(u->conf->busy_lock, &u->busy_lock);
-                ngx_http_upstream_finalize_request(r, u, 0);
-                return;
-            }
+        if (u->cachable
+            && (p->upstream_done || (p->upstream_eof && p->length == -1)))
+        {
+            ngx_http_upstream_cache_update(r, u);
         }
 
 #endif
@@ -1979,6 +3201,20 @@ ngx_http_upstream_next(ngx_http_request_t *r, ngx_http_upstream_t *u,
         return;
     }
 
+    if (u->request_body_streamed) {
+
+        /* the part of the body that has been sent is not kept anymore */
+
+        if (status == 0) {
+            status = NGX_HTTP_BAD_GATEWAY;
+        }
+
+        u->state->status = status;
+
+        ngx_http_upstream_finalize_request(r, u, status);
+        return;
+    }
+
     if (status) {
         u->state->status = status;
 
@@ -1986,9 +3222,7 @@ ngx_http_upstream_next(ngx_http_request_t *r, ngx_http_upstream_t *u,
 
 #if (NGX_HTTP_CACHE)
 
-            if (u->stale && (u->conf->use_stale & ft_type)) {
-                ngx_http_upstream_finalize_request(r, u,
-                                             ngx_http_send_cached_response(r));
+            if (ngx_http_upstream_cache_stale(r, u, ft_type) == NGX_OK) {
                 return;
             }
 
@@ -2090,6 +3324,15 @@ ngx_http_upstream_finalize_request(ngx_http_request_t *r,
 
     u->peer.connection = NULL;
 
+    if (r->request_body_no_buffering && r->request_body
+        && r->request_body->rest)
+    {
+        /* the rest of the client request body is not read */
+
+        r->read_event_handler = ngx_http_block_read;
+        r->keepalive = 0;
+    }
+
     if (u->header_sent && (rc == NGX_ERROR || rc >= NGX_HTTP_SPECIAL_RESPONSE))
     {
         rc = 0;
@@ -2101,12 +3344,16 @@ ngx_http_upstream_finalize_request(ngx_http_request_t *r,
                        u->pipe->temp_file->file.fd);
     }
 
-#if 0
-    if (u->cache) {
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "http upstream cache fd: %d",
-                       u->cache->ctx.file.fd);
+#if (NGX_HTTP_CACHE)
+
+    if (r->cache) {
+
+        /* the response has not been stored in the cache */
+
+        ngx_http_file_cache_free(r->cache,
+                                 u->cachable ? u->pipe->temp_file : NULL);
     }
+
 #endif
 
     if (rc == NGX_DECLINED) {
@@ -2174,6 +3421,55 @@ ngx_http_upstream_ignore_header_line(ngx_http_request_t *r, ngx_table_elt_t *h,
 }
 
 
+static ngx_int_t
+ngx_http_upstream_process_content_length(ngx_http_request_t *r,
+    ngx_table_elt_t *h, ngx_uint_t offset)
+{
+    ngx_http_upstream_t  *u;
+
+    u = r->upstream;
+
+    u->headers_in.content_length = h;
+    u->headers_in.content_length_n = ngx_atoof(h->value.data, h->value.len);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_process_connection(ngx_http_request_t *r, ngx_table_elt_t *h,
+    ngx_uint_t offset)
+{
+    r->upstream->headers_in.connection = h;
+
+    if (ngx_strcasecmp(h->value.data, "close") == 0) {
+        r->upstream->headers_in.connection_close = 1;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_process_transfer_encoding(ngx_http_request_t *r,
+    ngx_table_elt_t *h, ngx_uint_t offset)
+{
+    r->upstream->headers_in.transfer_encoding = h;
+
+    if (ngx_strcasecmp(h->value.data, "chunked") == 0) {
+        r->upstream->headers_in.chunked = 1;
+
+    } else {
+
+        /* the response length is known by the connection close only */
+
+        r->upstream->headers_in.connection_close = 1;
+    }
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_upstream_process_limit_rate(ngx_http_request_t *r, ngx_table_elt_t *h,
     ngx_uint_t offset)
@@ -2329,6 +3625,10 @@ ngx_http_upstream_copy_content_length(ngx_http_request_t *r, ngx_table_elt_t *h,
 {
     ngx_table_elt_t  *ho;
 
+    if (r->upstream->headers_in.chunked) {
+        return NGX_OK;
+    }
+
     ho = ngx_list_push(&r->headers_out.headers);
     if (ho == NULL) {
         return NGX_ERROR;
@@ -2531,6 +3831,7 @@ ngx_http_upstream_response_time_variable(ngx_http_request_t *r,
     u_char                     *p;
     size_t                      len;
     ngx_uint_t                  i;
+    ngx_msec_t                  ms;
     ngx_http_upstream_t        *u;
     ngx_http_upstream_state_t  *state;
 
@@ -2558,13 +3859,13 @@ ngx_http_upstream_response_time_variable(ngx_http_request_t *r,
     state = u->states.elts;
 
     for ( ;; ) {
-        if (state[i].status == 0) {
+        ms = *(ngx_msec_t *) ((char *) &state[i] + data);
+
+        if (state[i].status == 0 || ms == (ngx_msec_t) -1) {
             *p++ = '-';
 
         } else {
-            p = ngx_sprintf(p, "%d.%03d",
-                            state[i].response_time / 1000,
-                            state[i].response_time % 1000);
+            p = ngx_sprintf(p, "%d.%03d", ms / 1000, ms % 1000);
         }
 
         if (++i == u->states.nelts) {
@@ -2581,6 +3882,33 @@ ngx_http_upstream_response_time_variable(ngx_http_request_t *r,
 }
 
 
+#if (NGX_HTTP_CACHE)
+
+static ngx_int_t
+ngx_http_upstream_cache_status_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_uint_t  n;
+
+    if (r->upstream == NULL || r->upstream->cache_status == 0) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    n = r->upstream->cache_status - 1;
+
+    v->valid = 1;
+    v->no_cachable = 0;
+    v->not_found = 0;
+    v->len = ngx_http_cache_status[n].len;
+    v->data = ngx_http_cache_status[n].data;
+
+    return NGX_OK;
+}
+
+#endif
+
+
 static char *
 ngx_http_upstream(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy)
 {
@@ -24,6 +24,9 @@
 #define NGX_HTTP_UPSTREAM_FT_HTTP_404        0x00000040
 #define NGX_HTTP_UPSTREAM_FT_BUSY_LOCK       0x00000080
 #define NGX_HTTP_UPSTREAM_FT_MAX_WAITING     0x00000100
+#define NGX_HTTP_UPSTREAM_FT_HTTP_502        0x00000200
+#define NGX_HTTP_UPSTREAM_FT_HTTP_504        0x00000400
+#define NGX_HTTP_UPSTREAM_FT_UPDATING        0x00000800
 #define NGX_HTTP_UPSTREAM_FT_OFF             0x80000000
 
 
@@ -36,6 +39,8 @@ typedef struct {
 
     ngx_uint_t                      status;
     ngx_msec_t                      response_time;
+    ngx_msec_t                      connect_time;
+    ngx_msec_t                      header_time;
 
     ngx_str_t                      *peer;
 } ngx_http_upstream_state_t;
@@ -120,6 +125,8 @@ typedef struct {
     ngx_bufs_t                      bufs;
 
     ngx_flag_t                      buffering;
+    ngx_flag_t                      request_buffering;
+    ngx_flag_t                      splice;
     ngx_flag_t                      pass_request_headers;
     ngx_flag_t                      pass_request_body;
 
@@ -129,6 +136,15 @@ typedef struct {
 
     ngx_path_t                     *temp_path;
 
+#if (NGX_HTTP_CACHE)
+    ngx_shm_zone_t                 *cache;
+    ngx_uint_t                      cache_min_uses;
+    ngx_array_t                    *cache_valid;
+    ngx_flag_t                      cache_lock;
+    ngx_msec_t                      cache_lock_timeout;
+    ngx_uint_t                      cache_use_stale;
+#endif
+
     ngx_hash_t                      hide_headers_hash;
     ngx_array_t                    *hide_headers;
     ngx_array_t                    *pass_headers;
@@ -177,17 +193,24 @@ typedef struct {
 
     ngx_table_elt_t                *content_type;
     ngx_table_elt_t                *content_length;
+    ngx_table_elt_t                *transfer_encoding;
 
     ngx_table_elt_t                *last_modified;
     ngx_table_elt_t                *location;
     ngx_table_elt_t                *accept_ranges;
     ngx_table_elt_t                *www_authenticate;
+    ngx_table_elt_t                *set_cookie;
 
 #if (NGX_HTTP_GZIP)
     ngx_table_elt_t                *content_encoding;
 #endif
 
     ngx_array_t                     cache_control;
+
+    off_t                           content_length_n;
+
+    unsigned                        connection_close:1;
+    unsigned                        chunked:1;
 } ngx_http_upstream_headers_in_t;
 
 
@@ -212,10 +235,22 @@ struct ngx_http_upstream_s {
     ngx_chain_t                    *busy_bufs;
     ngx_chain_t                    *free_bufs;
 
+#if (NGX_HAVE_SPLICE)
+    ngx_fd_t                        splice_pipe[2];
+    size_t                          splice_size;
+
+    /* the pipe of the unbuffered client request body */
+    ngx_fd_t                        request_splice_pipe[2];
+    size_t                          request_splice_size;
+#endif
+
     ngx_int_t                     (*input_filter_init)(void *data);
     ngx_int_t                     (*input_filter)(void *data, ssize_t bytes);
     void                           *input_filter_ctx;
 
+#if (NGX_HTTP_CACHE)
+    ngx_int_t                     (*create_key)(ngx_http_request_t *r);
+#endif
     ngx_int_t                     (*create_request)(ngx_http_request_t *r);
     ngx_int_t                     (*reinit_request)(ngx_http_request_t *r);
     ngx_int_t                     (*process_header)(ngx_http_request_t *r);
@@ -236,12 +271,20 @@ struct ngx_http_upstream_s {
 
     ngx_http_cleanup_pt            *cleanup;
 
+#if (NGX_HTTP_CACHE)
+    ngx_uint_t                      cache_status;
+#endif
+
     unsigned                        cachable:1;
     unsigned                        accel:1;
+    unsigned                        keepalive:1;
 
     unsigned                        buffering:1;
+    unsigned                        splice:1;
+    unsigned                        request_splice:1;
 
     unsigned                        request_sent:1;
+    unsigned                        request_body_streamed:1;
     unsigned                        header_sent:1;
 };
 
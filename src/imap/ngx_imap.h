@@ -130,9 +130,25 @@ typedef enum {
 } ngx_po3_state_e;
 
 
+#if (NGX_HAVE_SPLICE)
+
+typedef struct {
+    ngx_fd_t                fd[2];
+    size_t                  size;        /* the data size in the pipe */
+    unsigned                splice:1;
+} ngx_imap_proxy_pipe_t;
+
+#endif
+
+
 typedef struct {
     ngx_peer_connection_t   upstream;
     ngx_buf_t              *buffer;
+
+#if (NGX_HAVE_SPLICE)
+    /* from upstream to client and from client to upstream */
+    ngx_imap_proxy_pipe_t   pipe[2];
+#endif
 } ngx_imap_proxy_ctx_t;
 
 
@@ -253,6 +269,12 @@ typedef struct {
 #define ngx_imap_conf_get_module_main_conf(cf, module)                       \
     ((ngx_imap_conf_ctx_t *) cf->ctx)->main_conf[module.ctx_index]
 
+#define ngx_imap_cycle_get_module_main_conf(cycle, module)                   \
+    (cycle->conf_ctx[ngx_imap_module.index] ?                                \
+        ((ngx_imap_conf_ctx_t *) cycle->conf_ctx[ngx_imap_module.index])     \
+            ->main_conf[module.ctx_index]                                    \
+        : NULL)
+
 
 void ngx_imap_init_connection(ngx_connection_t *c);
 void ngx_imap_send(ngx_event_t *wev);
@@ -272,6 +294,7 @@ void ngx_imap_auth_http_init(ngx_imap_session_t *s);
 
 
 extern ngx_uint_t    ngx_imap_max_module;
+extern ngx_module_t  ngx_imap_module;
 extern ngx_module_t  ngx_imap_core_module;
 
 
@@ -11,6 +11,64 @@
 #include <ngx_imap.h>
 
 
+#if (NGX_HAVE_OPENSSL_MD5_H)
+#include <openssl/md5.h>
+#else
+#include <md5.h>
+#endif
+
+#if (NGX_OPENSSL_MD5)
+#define  MD5Init    MD5_Init
+#define  MD5Update  MD5_Update
+#define  MD5Final   MD5_Final
+#endif
+
+
+#define NGX_IMAP_AUTH_HTTP_KEY_LEN  16
+
+
+typedef struct {
+    ngx_rbtree_t                    rbtree;
+    ngx_rbtree_node_t               sentinel;
+    ngx_queue_t                     queue;
+} ngx_imap_auth_http_cache_sh_t;
+
+
+typedef struct {
+    ngx_imap_auth_http_cache_sh_t  *sh;
+    ngx_slab_pool_t                *shpool;
+    ngx_shm_zone_t                 *shm_zone;
+} ngx_imap_auth_http_cache_t;
+
+
+/*
+ * the node data are the server address and port, the "Auth-User" and
+ * "Auth-Pass" header values, and the "Auth-Status" error message
+ */
+
+typedef struct {
+    ngx_rbtree_node_t               node;
+    ngx_queue_t                     queue;
+
+    u_char                          key[NGX_IMAP_AUTH_HTTP_KEY_LEN
+                                        - sizeof(ngx_rbtree_key_t)];
+
+    time_t                          expire;
+    time_t                          sleep;
+
+    u_short                         addr_len;
+    u_short                         port_len;
+    u_short                         login_len;
+    u_short                         passwd_len;
+    u_short                         errmsg_len;
+
+    unsigned                        login:1;
+    unsigned                        passwd:1;
+
+    u_char                          data[1];
+} ngx_imap_auth_http_cache_node_t;
+
+
 typedef struct {
     ngx_peer_addr_t                *peer;
 
@@ -21,9 +79,29 @@ typedef struct {
     ngx_str_t                       header;
 
     ngx_array_t                    *headers;
+
+    ngx_imap_auth_http_cache_t     *cache;
+    time_t                          cache_valid;
+    time_t                          cache_fail_valid;
+
+    ngx_uint_t                      keepalive;
+    ngx_msec_t                      keepalive_timeout;
+
+    ngx_queue_t                     keepalive_cache;
+    ngx_queue_t                     keepalive_free;
 } ngx_imap_auth_http_conf_t;
 
 
+typedef struct {
+    ngx_imap_auth_http_conf_t      *conf;
+
+    ngx_queue_t                     queue;
+    ngx_connection_t               *connection;
+
+    ngx_peer_addr_t                *peer;
+} ngx_imap_auth_http_keepalive_t;
+
+
 typedef struct ngx_imap_auth_http_ctx_s  ngx_imap_auth_http_ctx_t;
 
 typedef void (*ngx_imap_auth_http_handler_pt)(ngx_imap_session_t *s,
@@ -51,16 +129,35 @@ struct ngx_imap_auth_http_ctx_s {
 
     time_t                          sleep;
 
+    ngx_uint_t                      http_version;
+    ngx_int_t                       content_length;
+
+    u_char                          key[NGX_IMAP_AUTH_HTTP_KEY_LEN];
+
+    unsigned                        cacheable:1;
+    unsigned                        cached:1;
+    unsigned                        close:1;
+    unsigned                        login:1;
+    unsigned                        passwd:1;
+
     ngx_pool_t                     *pool;
 };
 
 
+static void ngx_imap_auth_http_connect(ngx_imap_session_t *s,
+    ngx_imap_auth_http_ctx_t *ctx);
+static void ngx_imap_auth_http_retry(ngx_imap_session_t *s,
+    ngx_imap_auth_http_ctx_t *ctx);
 static void ngx_imap_auth_http_write_handler(ngx_event_t *wev);
 static void ngx_imap_auth_http_read_handler(ngx_event_t *rev);
 static void ngx_imap_auth_http_ignore_status_line(ngx_imap_session_t *s,
     ngx_imap_auth_http_ctx_t *ctx);
 static void ngx_imap_auth_http_process_headers(ngx_imap_session_t *s,
     ngx_imap_auth_http_ctx_t *ctx);
+static ngx_int_t ngx_imap_auth_http_set_err(ngx_imap_session_t *s,
+    ngx_imap_auth_http_ctx_t *ctx);
+static void ngx_imap_auth_http_done(ngx_imap_session_t *s,
+    ngx_imap_auth_http_ctx_t *ctx);
 static void ngx_imap_auth_sleep_handler(ngx_event_t *rev);
 static ngx_int_t ngx_imap_auth_http_parse_header_line(ngx_imap_session_t *s,
     ngx_imap_auth_http_ctx_t *ctx);
@@ -71,12 +168,40 @@ static ngx_buf_t *ngx_imap_auth_http_create_request(ngx_imap_session_t *s,
 static ngx_int_t ngx_imap_auth_http_escape(ngx_pool_t *pool, ngx_str_t *text,
     ngx_str_t *escaped);
 
+static ngx_int_t ngx_imap_auth_http_get_keepalive(ngx_imap_session_t *s,
+    ngx_imap_auth_http_ctx_t *ctx, ngx_imap_auth_http_conf_t *ahcf);
+static void ngx_imap_auth_http_free_keepalive(ngx_imap_session_t *s,
+    ngx_imap_auth_http_ctx_t *ctx);
+static void ngx_imap_auth_http_keepalive_close_handler(ngx_event_t *ev);
+static void ngx_imap_auth_http_exit_process(ngx_cycle_t *cycle);
+
+static void ngx_imap_auth_http_cache_key(ngx_imap_session_t *s,
+    ngx_imap_auth_http_ctx_t *ctx, ngx_imap_auth_http_conf_t *ahcf);
+static ngx_int_t ngx_imap_auth_http_cache_lookup(ngx_imap_session_t *s,
+    ngx_imap_auth_http_ctx_t *ctx, ngx_imap_auth_http_cache_t *cache);
+static void ngx_imap_auth_http_cache_store(ngx_imap_session_t *s,
+    ngx_imap_auth_http_ctx_t *ctx, ngx_imap_auth_http_cache_t *cache,
+    time_t valid);
+static ngx_imap_auth_http_cache_node_t *ngx_imap_auth_http_cache_find(
+    ngx_imap_auth_http_cache_t *cache, u_char *key);
+static void ngx_imap_auth_http_cache_delete(ngx_imap_auth_http_cache_t *cache,
+    ngx_imap_auth_http_cache_node_t *cn);
+static void ngx_imap_auth_http_cache_rbtree_insert_value(
+    ngx_rbtree_node_t *temp, ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel);
+static ngx_int_t ngx_imap_auth_http_cache_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+
 static void *ngx_imap_auth_http_create_conf(ngx_conf_t *cf);
 static char *ngx_imap_auth_http_merge_conf(ngx_conf_t *cf, void *parent,
     void *child);
 static char *ngx_imap_auth_http(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_imap_auth_http_header(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_imap_auth_http_keepalive(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_imap_auth_http_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
 
 static ngx_command_t  ngx_imap_auth_http_commands[] = {
@@ -102,6 +227,34 @@ static ngx_command_t  ngx_imap_auth_http_commands[] = {
       0,
       NULL },
 
+    { ngx_string("auth_http_keepalive"),
+      NGX_IMAP_MAIN_CONF|NGX_IMAP_SRV_CONF|NGX_CONF_TAKE12,
+      ngx_imap_auth_http_keepalive,
+      NGX_IMAP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("auth_http_cache"),
+      NGX_IMAP_MAIN_CONF|NGX_IMAP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_imap_auth_http_cache,
+      NGX_IMAP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("auth_http_cache_valid"),
+      NGX_IMAP_MAIN_CONF|NGX_IMAP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_sec_slot,
+      NGX_IMAP_SRV_CONF_OFFSET,
+      offsetof(ngx_imap_auth_http_conf_t, cache_valid),
+      NULL },
+
+    { ngx_string("auth_http_cache_fail_valid"),
+      NGX_IMAP_MAIN_CONF|NGX_IMAP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_sec_slot,
+      NGX_IMAP_SRV_CONF_OFFSET,
+      offsetof(ngx_imap_auth_http_conf_t, cache_fail_valid),
+      NULL },
+
       ngx_null_command
 };
 
@@ -125,7 +278,7 @@ ngx_module_t  ngx_imap_auth_http_module = {
     NULL,                                  /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
-    NULL,                                  /* exit process */
+    ngx_imap_auth_http_exit_process,       /* exit process */
     NULL,                                  /* exit master */
     NGX_MODULE_V1_PADDING
 };
@@ -163,16 +316,10 @@ ngx_imap_auth_http_init(ngx_imap_session_t *s)
     }
 
     ctx->pool = pool;
+    ctx->content_length = -1;
 
     ahcf = ngx_imap_get_module_srv_conf(s, ngx_imap_auth_http_module);
 
-    ctx->request = ngx_imap_auth_http_create_request(s, pool, ahcf);
-    if (ctx->request == NULL) {
-        ngx_destroy_pool(ctx->pool);
-        ngx_imap_session_internal_server_error(s);
-        return;
-    }
-
     ngx_imap_set_ctx(s, ctx, ngx_imap_auth_http_module);
 
     ctx->peer.sockaddr = ahcf->peer->sockaddr;
@@ -182,18 +329,67 @@ ngx_imap_auth_http_init(ngx_imap_session_t *s)
     ctx->peer.log = s->connection->log;
     ctx->peer.log_error = NGX_ERROR_ERR;
 
-    rc = ngx_event_connect_peer(&ctx->peer);
+    /*
+     * the APOP and CRAM-MD5 digests depend on the salt of the connection,
+     * so only the plain text logins are cached
+     */
 
-    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
-        if (ctx->peer.connection) {
-            ngx_close_connection(ctx->peer.connection);
+    if (ahcf->cache && s->auth_method == NGX_IMAP_AUTH_PLAIN) {
+
+        ngx_imap_auth_http_cache_key(s, ctx, ahcf);
+
+        rc = ngx_imap_auth_http_cache_lookup(s, ctx, ahcf->cache);
+
+        if (rc == NGX_OK) {
+            ngx_imap_auth_http_done(s, ctx);
+            return;
+        }
+
+        if (rc == NGX_ERROR) {
+            ngx_destroy_pool(ctx->pool);
+            ngx_imap_session_internal_server_error(s);
+            return;
         }
 
+        ctx->cacheable = 1;
+    }
+
+    ctx->request = ngx_imap_auth_http_create_request(s, pool, ahcf);
+    if (ctx->request == NULL) {
         ngx_destroy_pool(ctx->pool);
         ngx_imap_session_internal_server_error(s);
         return;
     }
 
+    ngx_imap_auth_http_connect(s, ctx);
+}
+
+
+static void
+ngx_imap_auth_http_connect(ngx_imap_session_t *s,
+    ngx_imap_auth_http_ctx_t *ctx)
+{
+    ngx_int_t                   rc;
+    ngx_imap_auth_http_conf_t  *ahcf;
+
+    ahcf = ngx_imap_get_module_srv_conf(s, ngx_imap_auth_http_module);
+
+    rc = ngx_imap_auth_http_get_keepalive(s, ctx, ahcf);
+
+    if (rc == NGX_DECLINED) {
+        rc = ngx_event_connect_peer(&ctx->peer);
+
+        if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+            if (ctx->peer.connection) {
+                ngx_close_connection(ctx->peer.connection);
+            }
+
+            ngx_destroy_pool(ctx->pool);
+            ngx_imap_session_internal_server_error(s);
+            return;
+        }
+    }
+
     ctx->peer.connection->data = s;
     ctx->peer.connection->pool = s->connection->pool;
 
@@ -213,6 +409,27 @@ ngx_imap_auth_http_init(ngx_imap_session_t *s)
 }
 
 
+/*
+ * the keepalive connection may be closed by the auth http server
+ * before the request has been sent, so the request is sent again
+ * in a new connection
+ */
+
+static void
+ngx_imap_auth_http_retry(ngx_imap_session_t *s, ngx_imap_auth_http_ctx_t *ctx)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_IMAP, s->connection->log, 0,
+                   "imap auth http retry");
+
+    ngx_close_connection(ctx->peer.connection);
+    ctx->peer.connection = NULL;
+
+    ctx->request->pos = ctx->request->start;
+
+    ngx_imap_auth_http_connect(s, ctx);
+}
+
+
 static void
 ngx_imap_auth_http_write_handler(ngx_event_t *wev)
 {
@@ -244,6 +461,12 @@ ngx_imap_auth_http_write_handler(ngx_event_t *wev)
     n = ngx_send(c, ctx->request->pos, size);
 
     if (n == NGX_ERROR) {
+
+        if (ctx->peer.cached) {
+            ngx_imap_auth_http_retry(s, ctx);
+            return;
+        }
+
         ngx_close_connection(ctx->peer.connection);
         ngx_destroy_pool(ctx->pool);
         ngx_imap_session_internal_server_error(s);
@@ -327,6 +550,11 @@ ngx_imap_auth_http_read_handler(ngx_event_t *rev)
         return;
     }
 
+    if (ctx->peer.cached && ctx->response->last == ctx->response->start) {
+        ngx_imap_auth_http_retry(s, ctx);
+        return;
+    }
+
     ngx_close_connection(ctx->peer.connection);
     ngx_destroy_pool(ctx->pool);
     ngx_imap_session_internal_server_error(s);
@@ -344,6 +572,7 @@ ngx_imap_auth_http_ignore_status_line(ngx_imap_session_t *s,
         sw_HT,
         sw_HTT,
         sw_HTTP,
+        sw_version,
         sw_skip,
         sw_almost_done
     } state;
@@ -389,11 +618,31 @@ ngx_imap_auth_http_ignore_status_line(ngx_imap_session_t *s,
 
         case sw_HTTP:
             if (ch == '/') {
-                state = sw_skip;
+                state = sw_version;
                 break;
             }
             goto next;
 
+        /* "1.1" is stored as 11 */
+        case sw_version:
+            if (ch >= '0' && ch <= '9') {
+                ctx->http_version = ctx->http_version * 10 + ch - '0';
+                break;
+            }
+
+            switch (ch) {
+            case '.':
+                break;
+            case CR:
+                state = sw_almost_done;
+                break;
+            case LF:
+                goto done;
+            default:
+                state = sw_skip;
+            }
+            break;
+
         /* any text until end of line */
         case sw_skip:
             switch (ch) {
@@ -444,12 +693,8 @@ static void
 ngx_imap_auth_http_process_headers(ngx_imap_session_t *s,
     ngx_imap_auth_http_ctx_t *ctx)
 {
-    u_char              *p;
-    time_t               timer;
-    size_t               len, size;
-    ngx_int_t            rc, port, n;
-    ngx_peer_addr_t     *peer;
-    struct sockaddr_in  *sin;
+    size_t      len;
+    ngx_int_t   rc, n;
 
     ngx_log_debug0(NGX_LOG_DEBUG_IMAP, s->connection->log, 0,
                    "imap auth http process headers");
@@ -502,39 +747,13 @@ ngx_imap_auth_http_process_headers(ngx_imap_session_t *s,
                 ctx->errmsg.len = len;
                 ctx->errmsg.data = ctx->header_start;
 
-                if (s->protocol == NGX_IMAP_POP3_PROTOCOL) {
-                    size = sizeof("-ERR ") - 1 + len + sizeof(CRLF) - 1;
-
-                } else {
-                    size = s->tag.len + sizeof("NO ") - 1 + len
-                           + sizeof(CRLF) - 1;
-                }
-
-                p = ngx_pcalloc(s->connection->pool, size);
-                if (p == NULL) {
+                if (ngx_imap_auth_http_set_err(s, ctx) != NGX_OK) {
                     ngx_close_connection(ctx->peer.connection);
                     ngx_destroy_pool(ctx->pool);
                     ngx_imap_session_internal_server_error(s);
                     return;
                 }
 
-                ctx->err.data = p;
-
-                if (s->protocol == NGX_IMAP_POP3_PROTOCOL) {
-                    *p++ = '-'; *p++ = 'E'; *p++ = 'R'; *p++ = 'R';
-
-                } else {
-                    p = ngx_cpymem(p, s->tag.data, s->tag.len);
-                    *p++ = 'N'; *p++ = 'O';
-                }
-
-                *p++ = ' ';
-
-                p = ngx_cpymem(p, ctx->header_start, len);
-                *p++ = CR; *p++ = LF;
-
-                ctx->err.len = p - ctx->err.data;
-
                 continue;
             }
 
@@ -574,6 +793,8 @@ ngx_imap_auth_http_process_headers(ngx_imap_session_t *s,
 
                 ngx_memcpy(s->login.data, ctx->header_start, s->login.len);
 
+                ctx->login = 1;
+
                 continue;
             }
 
@@ -593,6 +814,8 @@ ngx_imap_auth_http_process_headers(ngx_imap_session_t *s,
 
                 ngx_memcpy(s->passwd.data, ctx->header_start, s->passwd.len);
 
+                ctx->passwd = 1;
+
                 continue;
             }
 
@@ -610,6 +833,29 @@ ngx_imap_auth_http_process_headers(ngx_imap_session_t *s,
                 continue;
             }
 
+            if (len == sizeof("Content-Length") - 1
+                && ngx_strncasecmp(ctx->header_name_start, "Content-Length",
+                                   sizeof("Content-Length") - 1) == 0)
+            {
+                ctx->content_length = ngx_atoi(ctx->header_start,
+                                          ctx->header_end - ctx->header_start);
+                continue;
+            }
+
+            if (len == sizeof("Connection") - 1
+                && ngx_strncasecmp(ctx->header_name_start, "Connection",
+                                   sizeof("Connection") - 1) == 0)
+            {
+                if (ctx->header_end - ctx->header_start == sizeof("close") - 1
+                    && ngx_strncasecmp(ctx->header_start, "close",
+                                       sizeof("close") - 1) == 0)
+                {
+                    ctx->close = 1;
+                }
+
+                continue;
+            }
+
             /* ignore other headers */
 
             continue;
@@ -619,150 +865,217 @@ ngx_imap_auth_http_process_headers(ngx_imap_session_t *s,
             ngx_log_debug0(NGX_LOG_DEBUG_IMAP, s->connection->log, 0,
                            "auth http header done");
 
-            ngx_close_connection(ctx->peer.connection);
+            ngx_imap_auth_http_free_keepalive(s, ctx);
+            ngx_imap_auth_http_done(s, ctx);
 
-            if (ctx->err.len) {
-                ngx_log_error(NGX_LOG_INFO, s->connection->log, 0,
-                              "client login failed: \"%V\"", &ctx->errmsg);
+            return;
+        }
 
-                s->out = ctx->err;
-                timer = ctx->sleep;
+        if (rc == NGX_AGAIN ) {
+            return;
+        }
 
-                ngx_destroy_pool(ctx->pool);
+        /* rc == NGX_ERROR */
 
-                if (timer == 0) {
-                    s->quit = 1;
-                    ngx_imap_send(s->connection->write);
-                    return;
-                }
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "auth http server %V sent invalid header in response",
+                      ctx->peer.name);
+        ngx_close_connection(ctx->peer.connection);
+        ngx_destroy_pool(ctx->pool);
+        ngx_imap_session_internal_server_error(s);
 
-                ngx_add_timer(s->connection->read, timer * 1000);
+        return;
+    }
+}
 
-                s->connection->read->handler = ngx_imap_auth_sleep_handler;
 
-                return;
-            }
+static ngx_int_t
+ngx_imap_auth_http_set_err(ngx_imap_session_t *s,
+    ngx_imap_auth_http_ctx_t *ctx)
+{
+    u_char  *p;
+    size_t   len, size;
 
-            if (s->auth_wait) {
-                timer = ctx->sleep;
+    len = ctx->errmsg.len;
 
-                ngx_destroy_pool(ctx->pool);
+    if (s->protocol == NGX_IMAP_POP3_PROTOCOL) {
+        size = sizeof("-ERR ") - 1 + len + sizeof(CRLF) - 1;
 
-                if (timer == 0) {
-                    ngx_imap_auth_http_init(s);
-                    return;
-                }
+    } else {
+        size = s->tag.len + sizeof("NO ") - 1 + len + sizeof(CRLF) - 1;
+    }
 
-                ngx_add_timer(s->connection->read, timer * 1000);
+    p = ngx_pcalloc(s->connection->pool, size);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
 
-                s->connection->read->handler = ngx_imap_auth_sleep_handler;
+    ctx->err.data = p;
 
-                return;
-            }
+    if (s->protocol == NGX_IMAP_POP3_PROTOCOL) {
+        *p++ = '-'; *p++ = 'E'; *p++ = 'R'; *p++ = 'R';
 
-            if (ctx->addr.len == 0 || ctx->port.len == 0) {
-                ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
-                              "auth http server %V did not send server or port",
-                              ctx->peer.name);
-                ngx_destroy_pool(ctx->pool);
-                ngx_imap_session_internal_server_error(s);
-                return;
-            }
+    } else {
+        p = ngx_cpymem(p, s->tag.data, s->tag.len);
+        *p++ = 'N'; *p++ = 'O';
+    }
 
-            if (s->passwd.data == NULL) {
-                ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
-                              "auth http server %V did not send password",
-                              ctx->peer.name);
-                ngx_destroy_pool(ctx->pool);
-                ngx_imap_session_internal_server_error(s);
-                return;
-            }
+    *p++ = ' ';
 
-            peer = ngx_pcalloc(s->connection->pool, sizeof(ngx_peer_addr_t));
-            if (peer == NULL) {
-                ngx_destroy_pool(ctx->pool);
-                ngx_imap_session_internal_server_error(s);
-                return;
-            }
+    p = ngx_cpymem(p, ctx->errmsg.data, len);
+    *p++ = CR; *p++ = LF;
 
-            sin = ngx_pcalloc(s->connection->pool, sizeof(struct sockaddr_in));
-            if (sin == NULL) {
-                ngx_destroy_pool(ctx->pool);
-                ngx_imap_session_internal_server_error(s);
-                return;
-            }
+    ctx->err.len = p - ctx->err.data;
 
-            sin->sin_family = AF_INET;
+    return NGX_OK;
+}
 
-            port = ngx_atoi(ctx->port.data, ctx->port.len);
-            if (port == NGX_ERROR || port < 1 || port > 65536) {
-                ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
-                              "auth http server %V sent invalid server "
-                              "port:\"%V\"",
-                              ctx->peer.name, &ctx->port);
-                ngx_destroy_pool(ctx->pool);
-                ngx_imap_session_internal_server_error(s);
-                return;
-            }
 
-            sin->sin_port = htons((in_port_t) port);
+static void
+ngx_imap_auth_http_done(ngx_imap_session_t *s, ngx_imap_auth_http_ctx_t *ctx)
+{
+    time_t                      timer;
+    size_t                      len;
+    ngx_int_t                   port;
+    ngx_peer_addr_t            *peer;
+    struct sockaddr_in         *sin;
+    ngx_imap_auth_http_conf_t  *ahcf;
 
-            ctx->addr.data[ctx->addr.len] = '\0';
-            sin->sin_addr.s_addr = inet_addr((char *) ctx->addr.data);
-            if (sin->sin_addr.s_addr == INADDR_NONE) {
-                ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
-                              "auth http server %V sent invalid server "
-                              "address:\"%V\"",
-                              ctx->peer.name, &ctx->addr);
-                ngx_destroy_pool(ctx->pool);
-                ngx_imap_session_internal_server_error(s);
-                return;
-            }
+    ahcf = ngx_imap_get_module_srv_conf(s, ngx_imap_auth_http_module);
+
+    if (ctx->err.len) {
+        ngx_log_error(NGX_LOG_INFO, s->connection->log, 0,
+                      "client login failed: \"%V\"", &ctx->errmsg);
 
-            peer->sockaddr = (struct sockaddr *) sin;
-            peer->socklen = sizeof(struct sockaddr_in);
+        if (ctx->cacheable && ahcf->cache_fail_valid) {
+            ngx_imap_auth_http_cache_store(s, ctx, ahcf->cache,
+                                           ahcf->cache_fail_valid);
+        }
 
-            len = ctx->addr.len + 1 + ctx->port.len;
+        s->out = ctx->err;
+        timer = ctx->sleep;
 
-            peer->name.len = len;
+        ngx_destroy_pool(ctx->pool);
 
-            peer->name.data = ngx_palloc(s->connection->pool, len);
-            if (peer->name.data == NULL) {
-                ngx_destroy_pool(ctx->pool);
-                ngx_imap_session_internal_server_error(s);
-                return;
-            }
+        if (timer == 0) {
+            s->quit = 1;
+            ngx_imap_send(s->connection->write);
+            return;
+        }
 
-            len = ctx->addr.len;
+        ngx_add_timer(s->connection->read, timer * 1000);
 
-            ngx_memcpy(peer->name.data, ctx->addr.data, len);
+        s->connection->read->handler = ngx_imap_auth_sleep_handler;
 
-            peer->name.data[len++] = ':';
+        return;
+    }
 
-            ngx_memcpy(peer->name.data + len, ctx->port.data, ctx->port.len);
+    if (s->auth_wait) {
+        timer = ctx->sleep;
 
-            ngx_destroy_pool(ctx->pool);
-            ngx_imap_proxy_init(s, peer);
+        ngx_destroy_pool(ctx->pool);
 
+        if (timer == 0) {
+            ngx_imap_auth_http_init(s);
             return;
         }
 
-        if (rc == NGX_AGAIN ) {
-            return;
-        }
+        ngx_add_timer(s->connection->read, timer * 1000);
 
-        /* rc == NGX_ERROR */
+        s->connection->read->handler = ngx_imap_auth_sleep_handler;
 
+        return;
+    }
+
+    if (ctx->addr.len == 0 || ctx->port.len == 0) {
         ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
-                      "auth http server %V sent invalid header in response",
+                      "auth http server %V did not send server or port",
                       ctx->peer.name);
-        ngx_close_connection(ctx->peer.connection);
         ngx_destroy_pool(ctx->pool);
         ngx_imap_session_internal_server_error(s);
+        return;
+    }
 
+    if (s->passwd.data == NULL) {
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "auth http server %V did not send password",
+                      ctx->peer.name);
+        ngx_destroy_pool(ctx->pool);
+        ngx_imap_session_internal_server_error(s);
         return;
     }
-}
+
+    peer = ngx_pcalloc(s->connection->pool, sizeof(ngx_peer_addr_t));
+    if (peer == NULL) {
+        ngx_destroy_pool(ctx->pool);
+        ngx_imap_session_internal_server_error(s);
+        return;
+    }
+
+    sin = ngx_pcalloc(s->connection->pool, sizeof(struct sockaddr_in));
+    if (sin == NULL) {
+        ngx_destroy_pool(ctx->pool);
+        ngx_imap_session_internal_server_error(s);
+        return;
+    }
+
+    sin->sin_family = AF_INET;
+
+    port = ngx_atoi(ctx->port.data, ctx->port.len);
+    if (port == NGX_ERROR || port < 1 || port > 65536) {
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "auth http server %V sent invalid server "
+                      "port:\"%V\"",
+                      ctx->peer.name, &ctx->port);
+        ngx_destroy_pool(ctx->pool);
+        ngx_imap_session_internal_server_error(s);
+        return;
+    }
+
+    sin->sin_port = htons((in_port_t) port);
+
+    ctx->addr.data[ctx->addr.len] = '\0';
+    sin->sin_addr.s_addr = inet_addr((char *) ctx->addr.data);
+    if (sin->sin_addr.s_addr == INADDR_NONE) {
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "auth http server %V sent invalid server "
+                      "address:\"%V\"",
+                      ctx->peer.name, &ctx->addr);
+        ngx_destroy_pool(ctx->pool);
+        ngx_imap_session_internal_server_error(s);
+        return;
+    }
+
+    peer->sockaddr = (struct sockaddr *) sin;
+    peer->socklen = sizeof(struct sockaddr_in);
+
+    len = ctx->addr.len + 1 + ctx->port.len;
+
+    peer->name.len = len;
+
+    peer->name.data = ngx_palloc(s->connection->pool, len);
+    if (peer->name.data == NULL) {
+        ngx_destroy_pool(ctx->pool);
+        ngx_imap_session_internal_server_error(s);
+        return;
+    }
+
+    len = ctx->addr.len;
+
+    ngx_memcpy(peer->name.data, ctx->addr.data, len);
+
+    peer->name.data[len++] = ':';
+
+    ngx_memcpy(peer->name.data + len, ctx->port.data, ctx->port.len);
+
+    if (ctx->cacheable && ahcf->cache_valid) {
+        ngx_imap_auth_http_cache_store(s, ctx, ahcf->cache,
+                                       ahcf->cache_valid);
+    }
+
+    ngx_destroy_pool(ctx->pool);
+    ngx_imap_proxy_init(s, peer);
+}
 
 
 static void
@@ -1091,8 +1404,15 @@ ngx_imap_auth_http_create_request(ngx_imap_session_t *s, ngx_pool_t *pool,
 
     b->last = ngx_cpymem(b->last, "GET ", sizeof("GET ") - 1);
     b->last = ngx_copy(b->last, ahcf->uri.data, ahcf->uri.len);
-    b->last = ngx_cpymem(b->last, " HTTP/1.0" CRLF,
-                         sizeof(" HTTP/1.0" CRLF) - 1);
+
+    if (ahcf->keepalive) {
+        b->last = ngx_cpymem(b->last, " HTTP/1.1" CRLF,
+                             sizeof(" HTTP/1.1" CRLF) - 1);
+
+    } else {
+        b->last = ngx_cpymem(b->last, " HTTP/1.0" CRLF,
+                             sizeof(" HTTP/1.0" CRLF) - 1);
+    }
 
     b->last = ngx_cpymem(b->last, "Host: ", sizeof("Host: ") - 1);
     b->last = ngx_copy(b->last, ahcf->host_header.data,
@@ -1211,6 +1531,599 @@ ngx_imap_auth_http_escape(ngx_pool_t *pool, ngx_str_t *text, ngx_str_t *escaped)
 }
 
 
+static ngx_int_t
+ngx_imap_auth_http_get_keepalive(ngx_imap_session_t *s,
+    ngx_imap_auth_http_ctx_t *ctx, ngx_imap_auth_http_conf_t *ahcf)
+{
+    ngx_queue_t                     *q, *cache;
+    ngx_connection_t                *c;
+    ngx_imap_auth_http_keepalive_t  *item;
+
+    ctx->peer.cached = 0;
+
+    if (ahcf->keepalive == 0) {
+        return NGX_DECLINED;
+    }
+
+    cache = &ahcf->keepalive_cache;
+
+    for (q = ngx_queue_head(cache);
+         q != ngx_queue_sentinel(cache);
+         q = ngx_queue_next(q))
+    {
+        item = ngx_queue_data(q, ngx_imap_auth_http_keepalive_t, queue);
+
+        if (item->peer != ahcf->peer) {
+            continue;
+        }
+
+        c = item->connection;
+
+        ngx_queue_remove(q);
+        ngx_queue_insert_head(&ahcf->keepalive_free, q);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_IMAP, s->connection->log, 0,
+                       "imap auth http keepalive connection %p", c);
+
+        if (c->read->timer_set) {
+            ngx_del_timer(c->read);
+        }
+
+        c->read->cancelable = 0;
+
+        c->log = s->connection->log;
+        c->read->log = s->connection->log;
+        c->write->log = s->connection->log;
+
+        ctx->peer.connection = c;
+        ctx->peer.cached = 1;
+
+        return NGX_OK;
+    }
+
+    return NGX_DECLINED;
+}
+
+
+static void
+ngx_imap_auth_http_free_keepalive(ngx_imap_session_t *s,
+    ngx_imap_auth_http_ctx_t *ctx)
+{
+    ngx_queue_t                     *q;
+    ngx_connection_t                *c;
+    ngx_imap_auth_http_conf_t       *ahcf;
+    ngx_imap_auth_http_keepalive_t  *item;
+
+    ahcf = ngx_imap_get_module_srv_conf(s, ngx_imap_auth_http_module);
+
+    c = ctx->peer.connection;
+    ctx->peer.connection = NULL;
+
+    /*
+     * the connection is kept only after an HTTP/1.1 response
+     * whose whole body has been already read
+     */
+
+    if (ahcf->keepalive == 0
+        || ngx_exiting
+        || ctx->http_version < 11
+        || ctx->close
+        || ctx->content_length != ctx->response->last - ctx->response->pos
+        || c->read->eof
+        || c->read->error
+        || c->write->error)
+    {
+        ngx_close_connection(c);
+        return;
+    }
+
+    if (ngx_handle_read_event(c->read, 0) == NGX_ERROR) {
+        ngx_close_connection(c);
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_IMAP, s->connection->log, 0,
+                   "imap auth http save keepalive connection %p", c);
+
+    if (ngx_queue_empty(&ahcf->keepalive_free)) {
+
+        /* close the least recently used connection */
+
+        q = ngx_queue_last(&ahcf->keepalive_cache);
+        ngx_queue_remove(q);
+
+        item = ngx_queue_data(q, ngx_imap_auth_http_keepalive_t, queue);
+
+        ngx_close_connection(item->connection);
+
+    } else {
+        q = ngx_queue_head(&ahcf->keepalive_free);
+        ngx_queue_remove(q);
+
+        item = ngx_queue_data(q, ngx_imap_auth_http_keepalive_t, queue);
+    }
+
+    ngx_queue_insert_head(&ahcf->keepalive_cache, q);
+
+    item->connection = c;
+    item->peer = ahcf->peer;
+
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    c->write->handler = ngx_imap_auth_http_dummy_handler;
+    c->read->handler = ngx_imap_auth_http_keepalive_close_handler;
+
+    c->data = item;
+    c->pool = NULL;
+    c->log = ngx_cycle->log;
+    c->read->log = ngx_cycle->log;
+    c->write->log = ngx_cycle->log;
+
+    /* the idle connection does not delay the exit of the worker process */
+
+    c->read->cancelable = 1;
+
+    ngx_add_timer(c->read, ahcf->keepalive_timeout);
+
+    if (c->read->ready) {
+        ngx_imap_auth_http_keepalive_close_handler(c->read);
+    }
+}
+
+
+static void
+ngx_imap_auth_http_keepalive_close_handler(ngx_event_t *ev)
+{
+    int                              n;
+    char                             buf[1];
+    ngx_err_t                        err;
+    ngx_connection_t                *c;
+    ngx_imap_auth_http_conf_t       *ahcf;
+    ngx_imap_auth_http_keepalive_t  *item;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_IMAP, ev->log, 0,
+                   "imap auth http keepalive close handler");
+
+    c = ev->data;
+
+    if (!ev->timedout) {
+
+        n = recv(c->fd, buf, 1, MSG_PEEK);
+
+        err = ngx_socket_errno;
+
+        if (n == -1 && err == NGX_EAGAIN) {
+            ev->ready = 0;
+
+            if (ngx_handle_read_event(c->read, 0) == NGX_ERROR) {
+                goto close;
+            }
+
+            return;
+        }
+
+        /*
+         * the auth http server has closed the connection or
+         * has sent an unexpected data, in both cases
+         * the connection can not be reused
+         */
+    }
+
+close:
+
+    item = c->data;
+    ahcf = item->conf;
+
+    ngx_close_connection(c);
+
+    ngx_queue_remove(&item->queue);
+    ngx_queue_insert_head(&ahcf->keepalive_free, &item->queue);
+}
+
+
+static void
+ngx_imap_auth_http_exit_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                       i;
+    ngx_queue_t                     *q;
+    ngx_imap_auth_http_conf_t       *ahcf;
+    ngx_imap_core_srv_conf_t       **cscfp;
+    ngx_imap_core_main_conf_t       *cmcf;
+    ngx_imap_auth_http_keepalive_t  *item;
+
+    cmcf = ngx_imap_cycle_get_module_main_conf(cycle, ngx_imap_core_module);
+
+    if (cmcf == NULL) {
+        return;
+    }
+
+    cscfp = cmcf->servers.elts;
+
+    for (i = 0; i < cmcf->servers.nelts; i++) {
+
+        ahcf = cscfp[i]->ctx->srv_conf[ngx_imap_auth_http_module.ctx_index];
+
+        if (ahcf->keepalive == 0) {
+            continue;
+        }
+
+        while (!ngx_queue_empty(&ahcf->keepalive_cache)) {
+            q = ngx_queue_head(&ahcf->keepalive_cache);
+            ngx_queue_remove(q);
+
+            item = ngx_queue_data(q, ngx_imap_auth_http_keepalive_t, queue);
+
+            ngx_close_connection(item->connection);
+
+            ngx_queue_insert_head(&ahcf->keepalive_free, q);
+        }
+    }
+}
+
+
+/*
+ * the cache key is MD5 hash of the auth http server, protocol, login,
+ * and password, so the passwords are not stored in the shared memory
+ */
+
+static void
+ngx_imap_auth_http_cache_key(ngx_imap_session_t *s,
+    ngx_imap_auth_http_ctx_t *ctx, ngx_imap_auth_http_conf_t *ahcf)
+{
+    MD5_CTX  md5;
+
+    MD5Init(&md5);
+
+    MD5Update(&md5, ahcf->peer->name.data, ahcf->peer->name.len);
+    MD5Update(&md5, ahcf->uri.data, ahcf->uri.len);
+    MD5Update(&md5, (u_char *) "", 1);
+    MD5Update(&md5, ngx_imap_auth_http_protocol[s->protocol],
+              sizeof("imap"));
+    MD5Update(&md5, s->login.data, s->login.len);
+    MD5Update(&md5, (u_char *) "", 1);
+    MD5Update(&md5, s->passwd.data, s->passwd.len);
+
+    MD5Final(ctx->key, &md5);
+}
+
+
+static ngx_int_t
+ngx_imap_auth_http_cache_lookup(ngx_imap_session_t *s,
+    ngx_imap_auth_http_ctx_t *ctx, ngx_imap_auth_http_cache_t *cache)
+{
+    u_char                           *p, *data;
+    ngx_imap_auth_http_cache_node_t  *cn;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    cn = ngx_imap_auth_http_cache_find(cache, ctx->key);
+
+    if (cn == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    if (cn->expire < ngx_time()) {
+        ngx_imap_auth_http_cache_delete(cache, cn);
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_IMAP, s->connection->log, 0,
+                   "imap auth http cache hit");
+
+    /* the address is null-terminated by ngx_imap_auth_http_done() */
+
+    p = ngx_palloc(ctx->pool,
+                   cn->addr_len + 1 + cn->port_len + cn->errmsg_len);
+    if (p == NULL) {
+        goto failed;
+    }
+
+    data = cn->data;
+
+    ctx->addr.len = cn->addr_len;
+    ctx->addr.data = p;
+    p = ngx_cpymem(p, data, cn->addr_len) + 1;
+    data += cn->addr_len;
+
+    ctx->port.len = cn->port_len;
+    ctx->port.data = p;
+    p = ngx_cpymem(p, data, cn->port_len);
+    data += cn->port_len;
+
+    if (cn->login) {
+        s->login.len = cn->login_len;
+        s->login.data = ngx_palloc(s->connection->pool, cn->login_len);
+        if (s->login.data == NULL) {
+            goto failed;
+        }
+
+        ngx_memcpy(s->login.data, data, cn->login_len);
+    }
+
+    data += cn->login_len;
+
+    if (cn->passwd) {
+        s->passwd.len = cn->passwd_len;
+        s->passwd.data = ngx_palloc(s->connection->pool, cn->passwd_len);
+        if (s->passwd.data == NULL) {
+            goto failed;
+        }
+
+        ngx_memcpy(s->passwd.data, data, cn->passwd_len);
+    }
+
+    data += cn->passwd_len;
+
+    ctx->errmsg.len = cn->errmsg_len;
+    ctx->errmsg.data = p;
+    ngx_memcpy(p, data, cn->errmsg_len);
+
+    ctx->sleep = cn->sleep;
+
+    ngx_queue_remove(&cn->queue);
+    ngx_queue_insert_head(&cache->sh->queue, &cn->queue);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ctx->cached = 1;
+
+    if (ctx->errmsg.len) {
+        return ngx_imap_auth_http_set_err(s, ctx);
+    }
+
+    return NGX_OK;
+
+failed:
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_imap_auth_http_cache_store(ngx_imap_session_t *s,
+    ngx_imap_auth_http_ctx_t *ctx, ngx_imap_auth_http_cache_t *cache,
+    time_t valid)
+{
+    u_char                           *p;
+    size_t                            size, login_len, passwd_len;
+    ngx_uint_t                        n;
+    ngx_queue_t                      *q;
+    ngx_imap_auth_http_cache_node_t  *cn;
+
+    login_len = ctx->login ? s->login.len : 0;
+    passwd_len = ctx->passwd ? s->passwd.len : 0;
+
+    if (ctx->addr.len > 0xffff
+        || ctx->port.len > 0xffff
+        || login_len > 0xffff
+        || passwd_len > 0xffff
+        || ctx->errmsg.len > 0xffff)
+    {
+        return;
+    }
+
+    size = offsetof(ngx_imap_auth_http_cache_node_t, data)
+           + ctx->addr.len + ctx->port.len + login_len + passwd_len
+           + ctx->errmsg.len;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    cn = ngx_imap_auth_http_cache_find(cache, ctx->key);
+
+    if (cn) {
+        ngx_imap_auth_http_cache_delete(cache, cn);
+    }
+
+    /* free up to two expired nodes */
+
+    for (n = 0; n < 2; n++) {
+        if (ngx_queue_empty(&cache->sh->queue)) {
+            break;
+        }
+
+        q = ngx_queue_last(&cache->sh->queue);
+        cn = ngx_queue_data(q, ngx_imap_auth_http_cache_node_t, queue);
+
+        if (cn->expire >= ngx_time()) {
+            break;
+        }
+
+        ngx_imap_auth_http_cache_delete(cache, cn);
+    }
+
+    for ( ;; ) {
+        cn = ngx_slab_alloc_locked(cache->shpool, size);
+
+        if (cn) {
+            break;
+        }
+
+        if (ngx_queue_empty(&cache->sh->queue)) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+
+            ngx_log_error(NGX_LOG_ALERT, s->connection->log, 0,
+                          "could not allocate node in auth_http_cache "
+                          "zone \"%V\"", &cache->shm_zone->name);
+            return;
+        }
+
+        /* free the least recently used node */
+
+        q = ngx_queue_last(&cache->sh->queue);
+
+        ngx_imap_auth_http_cache_delete(cache,
+                 ngx_queue_data(q, ngx_imap_auth_http_cache_node_t, queue));
+    }
+
+    ngx_memcpy((u_char *) &cn->node.key, ctx->key, sizeof(ngx_rbtree_key_t));
+    ngx_memcpy(cn->key, &ctx->key[sizeof(ngx_rbtree_key_t)],
+               NGX_IMAP_AUTH_HTTP_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+    cn->expire = ngx_time() + valid;
+    cn->sleep = ctx->sleep;
+
+    cn->addr_len = (u_short) ctx->addr.len;
+    cn->port_len = (u_short) ctx->port.len;
+    cn->login_len = (u_short) login_len;
+    cn->passwd_len = (u_short) passwd_len;
+    cn->errmsg_len = (u_short) ctx->errmsg.len;
+    cn->login = ctx->login;
+    cn->passwd = ctx->passwd;
+
+    p = ngx_cpymem(cn->data, ctx->addr.data, ctx->addr.len);
+    p = ngx_cpymem(p, ctx->port.data, ctx->port.len);
+    p = ngx_cpymem(p, s->login.data, login_len);
+    p = ngx_cpymem(p, s->passwd.data, passwd_len);
+    ngx_memcpy(p, ctx->errmsg.data, ctx->errmsg.len);
+
+    ngx_rbtree_insert(&cache->sh->rbtree, &cn->node);
+    ngx_queue_insert_head(&cache->sh->queue, &cn->queue);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+}
+
+
+static ngx_imap_auth_http_cache_node_t *
+ngx_imap_auth_http_cache_find(ngx_imap_auth_http_cache_t *cache, u_char *key)
+{
+    ngx_int_t                         rc;
+    ngx_rbtree_key_t                  node_key;
+    ngx_rbtree_node_t                *node, *sentinel;
+    ngx_imap_auth_http_cache_node_t  *cn;
+
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (node_key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (node_key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* node_key == node->key */
+
+        cn = (ngx_imap_auth_http_cache_node_t *) node;
+
+        rc = ngx_memcmp(&key[sizeof(ngx_rbtree_key_t)], cn->key,
+                        NGX_IMAP_AUTH_HTTP_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        if (rc == 0) {
+            return cn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_imap_auth_http_cache_delete(ngx_imap_auth_http_cache_t *cache,
+    ngx_imap_auth_http_cache_node_t *cn)
+{
+    ngx_queue_remove(&cn->queue);
+    ngx_rbtree_delete(&cache->sh->rbtree, &cn->node);
+    ngx_slab_free_locked(cache->shpool, cn);
+}
+
+
+static void
+ngx_imap_auth_http_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t                **p;
+    ngx_imap_auth_http_cache_node_t   *cn, *cnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            cn = (ngx_imap_auth_http_cache_node_t *) node;
+            cnt = (ngx_imap_auth_http_cache_node_t *) temp;
+
+            p = (ngx_memcmp(cn->key, cnt->key,
+                            NGX_IMAP_AUTH_HTTP_KEY_LEN
+                            - sizeof(ngx_rbtree_key_t))
+                 < 0)
+                    ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static ngx_int_t
+ngx_imap_auth_http_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_imap_auth_http_cache_t  *ocache = data;
+
+    ngx_imap_auth_http_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        cache->sh = ocache->sh;
+        cache->shpool = ocache->shpool;
+
+        return NGX_OK;
+    }
+
+    cache->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    cache->sh = ngx_slab_alloc(cache->shpool,
+                               sizeof(ngx_imap_auth_http_cache_sh_t));
+    if (cache->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_rbt_black(&cache->sh->sentinel);
+
+    cache->sh->rbtree.root = &cache->sh->sentinel;
+    cache->sh->rbtree.sentinel = &cache->sh->sentinel;
+    cache->sh->rbtree.insert = ngx_imap_auth_http_cache_rbtree_insert_value;
+
+    ngx_queue_init(&cache->sh->queue);
+
+    return NGX_OK;
+}
+
+
 static void *
 ngx_imap_auth_http_create_conf(ngx_conf_t *cf)
 {
@@ -1223,6 +2136,13 @@ ngx_imap_auth_http_create_conf(ngx_conf_t *cf)
 
     ahcf->timeout = NGX_CONF_UNSET_MSEC;
 
+    ahcf->cache = NGX_CONF_UNSET_PTR;
+    ahcf->cache_valid = NGX_CONF_UNSET;
+    ahcf->cache_fail_valid = NGX_CONF_UNSET;
+
+    ahcf->keepalive = NGX_CONF_UNSET_UINT;
+    ahcf->keepalive_timeout = NGX_CONF_UNSET_MSEC;
+
     return ahcf;
 }
 
@@ -1233,10 +2153,11 @@ ngx_imap_auth_http_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_imap_auth_http_conf_t *prev = parent;
     ngx_imap_auth_http_conf_t *conf = child;
 
-    u_char           *p;
-    size_t            len;
-    ngx_uint_t        i;
-    ngx_table_elt_t  *header;
+    u_char                          *p;
+    size_t                           len;
+    ngx_uint_t                       i;
+    ngx_table_elt_t                 *header;
+    ngx_imap_auth_http_keepalive_t  *item;
 
     if (conf->peer == NULL) {
         conf->peer = prev->peer;
@@ -1246,6 +2167,36 @@ ngx_imap_auth_http_merge_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_msec_value(conf->timeout, prev->timeout, 60000);
 
+    if (conf->cache == NGX_CONF_UNSET_PTR) {
+        conf->cache = (prev->cache == NGX_CONF_UNSET_PTR) ? NULL : prev->cache;
+    }
+
+    ngx_conf_merge_sec_value(conf->cache_valid, prev->cache_valid, 60);
+    ngx_conf_merge_sec_value(conf->cache_fail_valid, prev->cache_fail_valid, 0);
+
+    ngx_conf_merge_uint_value(conf->keepalive, prev->keepalive, 0);
+    ngx_conf_merge_msec_value(conf->keepalive_timeout,
+                              prev->keepalive_timeout, 60000);
+
+    if (conf->keepalive) {
+
+        /* the keepalive connections are cached per server */
+
+        item = ngx_pcalloc(cf->pool, sizeof(ngx_imap_auth_http_keepalive_t)
+                                     * conf->keepalive);
+        if (item == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_queue_init(&conf->keepalive_cache);
+        ngx_queue_init(&conf->keepalive_free);
+
+        for (i = 0; i < conf->keepalive; i++) {
+            ngx_queue_insert_head(&conf->keepalive_free, &item[i].queue);
+            item[i].conf = conf;
+        }
+    }
+
     if (conf->headers == NULL) {
         conf->headers = prev->headers;
         conf->header = prev->header;
@@ -1343,3 +2294,131 @@ ngx_imap_auth_http_header(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     return NGX_CONF_OK;
 }
+
+
+static char *
+ngx_imap_auth_http_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_imap_auth_http_conf_t *ahcf = conf;
+
+    ngx_int_t   n;
+    ngx_str_t  *value, s;
+
+    if (ahcf->keepalive != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    n = ngx_atoi(value[1].data, value[1].len);
+
+    if (n == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\" in \"%V\" directive",
+                           &value[1], &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    ahcf->keepalive = n;
+
+    if (cf->args->nelts == 3) {
+
+        if (ngx_strncmp(value[2].data, "timeout=", 8) != 0) {
+            goto invalid;
+        }
+
+        s.len = value[2].len - 8;
+        s.data = &value[2].data[8];
+
+        n = ngx_parse_time(&s, 0);
+
+        if (n == NGX_ERROR) {
+            goto invalid;
+        }
+
+        ahcf->keepalive_timeout = (ngx_msec_t) n;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[2]);
+
+    return NGX_CONF_ERROR;
+}
+
+
+static char *
+ngx_imap_auth_http_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_imap_auth_http_conf_t *ahcf = conf;
+
+    u_char          *p;
+    size_t           size;
+    ngx_str_t       *value, name, s;
+    ngx_shm_zone_t  *shm_zone;
+
+    if (ahcf->cache != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        ahcf->cache = NULL;
+        return NGX_CONF_OK;
+    }
+
+    /* the zone size may be omitted if it is set in another server */
+
+    size = 0;
+    name = value[1];
+
+    p = (u_char *) ngx_strchr(value[1].data, ':');
+
+    if (p) {
+        name.len = p - name.data;
+
+        s.data = p + 1;
+        s.len = value[1].data + value[1].len - s.data;
+
+        size = ngx_parse_size(&s);
+
+        if (size == (size_t) NGX_ERROR) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid zone size \"%V\"", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+
+        if (size < 8 * ngx_pagesize) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "zone \"%V\" is too small", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_imap_auth_http_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (shm_zone->data) {
+        ahcf->cache = shm_zone->data;
+        return NGX_CONF_OK;
+    }
+
+    ahcf->cache = ngx_pcalloc(cf->pool, sizeof(ngx_imap_auth_http_cache_t));
+    if (ahcf->cache == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ahcf->cache->shm_zone = shm_zone;
+
+    shm_zone->init = ngx_imap_auth_http_cache_init_zone;
+    shm_zone->data = ahcf->cache;
+
+    return NGX_CONF_OK;
+}
@@ -11,9 +11,15 @@
 #include <ngx_imap.h>
 
 
+#if (NGX_HAVE_SPLICE)
+#define NGX_IMAP_PROXY_SPLICE_SIZE  65536
+#endif
+
+
 typedef struct {
     ngx_flag_t  enable;
     ngx_flag_t  pass_error_message;
+    ngx_flag_t  splice;
     size_t      buffer_size;
     ngx_msec_t  timeout;
 } ngx_imap_proxy_conf_t;
@@ -26,6 +32,12 @@ static void ngx_imap_proxy_dummy_handler(ngx_event_t *ev);
 static ngx_int_t ngx_imap_proxy_read_response(ngx_imap_session_t *s,
     ngx_uint_t state);
 static void ngx_imap_proxy_handler(ngx_event_t *ev);
+#if (NGX_HAVE_SPLICE)
+static void ngx_imap_proxy_init_splice(ngx_imap_session_t *s);
+static ngx_int_t ngx_imap_proxy_splice(ngx_imap_session_t *s,
+    ngx_connection_t *src, ngx_connection_t *dst, ngx_imap_proxy_pipe_t *pp);
+static void ngx_imap_proxy_splice_cleanup(void *data);
+#endif
 static void ngx_imap_proxy_upstream_error(ngx_imap_session_t *s);
 static void ngx_imap_proxy_internal_server_error(ngx_imap_session_t *s);
 static void ngx_imap_proxy_close_session(ngx_imap_session_t *s);
@@ -64,6 +76,13 @@ static ngx_command_t  ngx_imap_proxy_commands[] = {
       offsetof(ngx_imap_proxy_conf_t, pass_error_message),
       NULL },
 
+    { ngx_string("proxy_splice"),
+      NGX_IMAP_MAIN_CONF|NGX_IMAP_SRV_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_IMAP_SRV_CONF_OFFSET,
+      offsetof(ngx_imap_proxy_conf_t, splice),
+      NULL },
+
       ngx_null_command
 };
 
@@ -294,6 +313,14 @@ ngx_imap_proxy_imap_handler(ngx_event_t *rev)
         c->log->action = NULL;
         ngx_log_error(NGX_LOG_INFO, c->log, 0, "client logged in");
 
+#if (NGX_HAVE_SPLICE)
+
+        if (pcf->splice) {
+            ngx_imap_proxy_init_splice(s);
+        }
+
+#endif
+
         ngx_imap_proxy_handler(s->connection->write);
 
         return;
@@ -418,6 +445,14 @@ ngx_imap_proxy_pop3_handler(ngx_event_t *rev)
         c->log->action = NULL;
         ngx_log_error(NGX_LOG_INFO, c->log, 0, "client logged in");
 
+#if (NGX_HAVE_SPLICE)
+
+        if (pcf->splice) {
+            ngx_imap_proxy_init_splice(s);
+        }
+
+#endif
+
         ngx_imap_proxy_handler(s->connection->write);
 
         return;
@@ -569,6 +604,10 @@ ngx_imap_proxy_handler(ngx_event_t *ev)
     ngx_connection_t       *c, *src, *dst;
     ngx_imap_session_t     *s;
     ngx_imap_proxy_conf_t  *pcf;
+#if (NGX_HAVE_SPLICE)
+    ngx_int_t               rc;
+    ngx_imap_proxy_pipe_t  *pp;
+#endif
 
     c = ev->data;
     s = c->data;
@@ -629,6 +668,38 @@ ngx_imap_proxy_handler(ngx_event_t *ev)
                    "imap proxy handler: %d, #%d > #%d",
                    do_write, src->fd, dst->fd);
 
+#if (NGX_HAVE_SPLICE)
+
+    /*
+     * the data read before the splicing has been started
+     * or before the fallback are sent from the buffer first;
+     * each direction falls back to copying on its own, so the data
+     * left in the pipe of the other direction are still spliced
+     */
+
+    pp = &s->proxy->pipe[(b == s->proxy->buffer) ? 0 : 1];
+
+    if (pp->splice && b->pos == b->last) {
+        c->log->action = (b == s->buffer) ? recv_action : send_action;
+
+        rc = ngx_imap_proxy_splice(s, src, dst, pp);
+
+        if (rc == NGX_ERROR) {
+            ngx_imap_proxy_close_session(s);
+            return;
+        }
+
+        if (rc == NGX_OK) {
+            goto done;
+        }
+
+        /* rc == NGX_DECLINED: the pipe of this direction is empty */
+
+        pp->splice = 0;
+    }
+
+#endif
+
     for ( ;; ) {
 
         if (do_write) {
@@ -682,11 +753,20 @@ ngx_imap_proxy_handler(ngx_event_t *ev)
         break;
     }
 
+#if (NGX_HAVE_SPLICE)
+done:
+#endif
+
     c->log->action = "proxying";
 
     if ((s->connection->read->eof || s->proxy->upstream.connection->read->eof)
         && s->buffer->pos == s->buffer->last
-        && s->proxy->buffer->pos == s->proxy->buffer->last)
+        && s->proxy->buffer->pos == s->proxy->buffer->last
+#if (NGX_HAVE_SPLICE)
+        && s->proxy->pipe[0].size == 0
+        && s->proxy->pipe[1].size == 0
+#endif
+        )
     {
         action = c->log->action;
         c->log->action = NULL;
@@ -724,6 +804,177 @@ ngx_imap_proxy_handler(ngx_event_t *ev)
 }
 
 
+#if (NGX_HAVE_SPLICE)
+
+static void
+ngx_imap_proxy_init_splice(ngx_imap_session_t *s)
+{
+    ngx_uint_t           i;
+    ngx_pool_cleanup_t  *cln;
+
+#if (NGX_IMAP_SSL)
+
+    if (s->connection->ssl) {
+        return;
+    }
+
+#endif
+
+    cln = ngx_pool_cleanup_add(s->connection->pool, 0);
+    if (cln == NULL) {
+        return;
+    }
+
+    for (i = 0; i < 2; i++) {
+        s->proxy->pipe[i].fd[0] = -1;
+        s->proxy->pipe[i].fd[1] = -1;
+    }
+
+    cln->handler = ngx_imap_proxy_splice_cleanup;
+    cln->data = s->proxy;
+
+    for (i = 0; i < 2; i++) {
+
+        if (pipe(s->proxy->pipe[i].fd) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, s->connection->log, ngx_errno,
+                          "pipe() failed");
+            return;
+        }
+
+        if (ngx_nonblocking(s->proxy->pipe[i].fd[0]) == -1
+            || ngx_nonblocking(s->proxy->pipe[i].fd[1]) == -1)
+        {
+            ngx_log_error(NGX_LOG_ALERT, s->connection->log, ngx_socket_errno,
+                          ngx_nonblocking_n " failed");
+            return;
+        }
+    }
+
+    ngx_log_debug4(NGX_LOG_DEBUG_IMAP, s->connection->log, 0,
+                   "imap proxy splice pipes: %d:%d %d:%d",
+                   s->proxy->pipe[0].fd[0], s->proxy->pipe[0].fd[1],
+                   s->proxy->pipe[1].fd[0], s->proxy->pipe[1].fd[1]);
+
+    s->proxy->pipe[0].splice = 1;
+    s->proxy->pipe[1].splice = 1;
+}
+
+
+static ngx_int_t
+ngx_imap_proxy_splice(ngx_imap_session_t *s, ngx_connection_t *src,
+    ngx_connection_t *dst, ngx_imap_proxy_pipe_t *pp)
+{
+    size_t      size;
+    ssize_t     n;
+    ngx_err_t   err;
+    ngx_uint_t  progress;
+
+    do {
+        progress = 0;
+
+        if (pp->size && dst->write->ready) {
+
+            n = splice(pp->fd[0], NULL, dst->fd, NULL, pp->size,
+                       SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+            ngx_log_debug3(NGX_LOG_DEBUG_IMAP, s->connection->log, 0,
+                           "imap proxy splice to #%d: %z of %uz",
+                           dst->fd, n, pp->size);
+
+            if (n == -1) {
+                err = ngx_errno;
+
+                if (err != NGX_EAGAIN) {
+                    ngx_connection_error(dst, err, "splice() failed");
+                    return NGX_ERROR;
+                }
+
+                dst->write->ready = 0;
+
+            } else {
+                pp->size -= n;
+                dst->sent += n;
+                progress = 1;
+            }
+        }
+
+        size = NGX_IMAP_PROXY_SPLICE_SIZE - pp->size;
+
+        if (size == 0 || !src->read->ready || src->read->eof) {
+            continue;
+        }
+
+        n = splice(src->fd, NULL, pp->fd[1], NULL, size,
+                   SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+        ngx_log_debug3(NGX_LOG_DEBUG_IMAP, s->connection->log, 0,
+                       "imap proxy splice from #%d: %z of %uz",
+                       src->fd, n, size);
+
+        if (n == -1) {
+            err = ngx_errno;
+
+            if (err == NGX_EAGAIN) {
+
+                /* the pipe is not full, so the socket has no data */
+
+                if (pp->size == 0) {
+                    src->read->ready = 0;
+                }
+
+                continue;
+            }
+
+            if (pp->size == 0 && (err == NGX_EINVAL || err == NGX_ENOSYS)) {
+                ngx_log_error(NGX_LOG_INFO, s->connection->log, err,
+                              "splice() failed, the session is copied");
+                return NGX_DECLINED;
+            }
+
+            ngx_connection_error(src, err, "splice() failed");
+
+            src->read->eof = 1;
+
+        } else if (n == 0) {
+            src->read->eof = 1;
+
+        } else {
+            pp->size += n;
+        }
+
+        progress = 1;
+
+    } while (progress);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_imap_proxy_splice_cleanup(void *data)
+{
+    ngx_imap_proxy_ctx_t  *p = data;
+
+    ngx_uint_t  i, j;
+
+    for (i = 0; i < 2; i++) {
+        for (j = 0; j < 2; j++) {
+
+            if (p->pipe[i].fd[j] == -1) {
+                continue;
+            }
+
+            if (close(p->pipe[i].fd[j]) == -1) {
+                ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                              "close() pipe failed");
+            }
+        }
+    }
+}
+
+#endif
+
+
 static void
 ngx_imap_proxy_upstream_error(ngx_imap_session_t *s)
 {
@@ -787,6 +1038,7 @@ ngx_imap_proxy_create_conf(ngx_conf_t *cf)
 
     pcf->enable = NGX_CONF_UNSET;
     pcf->pass_error_message = NGX_CONF_UNSET;
+    pcf->splice = NGX_CONF_UNSET;
     pcf->buffer_size = NGX_CONF_UNSET_SIZE;
     pcf->timeout = NGX_CONF_UNSET_MSEC;
 
@@ -802,6 +1054,7 @@ ngx_imap_proxy_merge_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_value(conf->enable, prev->enable, 0);
     ngx_conf_merge_value(conf->pass_error_message, prev->pass_error_message, 0);
+    ngx_conf_merge_value(conf->splice, prev->splice, 0);
     ngx_conf_merge_size_value(conf->buffer_size, prev->buffer_size,
                               (size_t) ngx_pagesize);
     ngx_conf_merge_msec_value(conf->timeout, prev->timeout, 24 * 60 * 60000);
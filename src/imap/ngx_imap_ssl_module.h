@@ -28,6 +28,8 @@ typedef struct {
 
     ngx_uint_t      protocols;
 
+    ngx_int_t       builtin_session_cache;
+
     time_t          session_timeout;
 
     ngx_str_t       certificate;
@@ -35,6 +37,7 @@ typedef struct {
 
     ngx_str_t       ciphers;
 
+    ngx_shm_zone_t *shm_zone;
 } ngx_imap_ssl_conf_t;
 
 
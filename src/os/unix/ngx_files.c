@@ -7,6 +7,28 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 
+#if (NGX_THREAD_POOL)
+#include <ngx_thread_pool.h>
+#endif
+
+
+#if (NGX_THREAD_POOL)
+
+typedef struct {
+    ngx_fd_t     fd;
+    u_char      *buf;
+    size_t       size;
+    size_t       len;
+    off_t        offset;
+    ssize_t      nread;
+    ngx_err_t    err;
+} ngx_thread_read_ctx_t;
+
+
+static void ngx_thread_read_handler(void *data, ngx_log_t *log);
+
+#endif
+
 
 ssize_t
 ngx_read_file(ngx_file_t *file, u_char *buf, size_t size, off_t offset)
@@ -54,6 +76,113 @@ ngx_read_file(ngx_file_t *file, u_char *buf, size_t size, off_t offset)
 }
 
 
+#if (NGX_THREAD_POOL)
+
+/*
+ * the file is read by a thread into the memory of the task and is copied
+ * into the buffer when the read is complete, so the request pool may be
+ * freed while the read is in progress; the caller should repeat the call
+ * with the same arguments after the task event was posted
+ */
+
+ssize_t
+ngx_thread_read(ngx_file_t *file, u_char *buf, size_t size, off_t offset)
+{
+    ngx_thread_task_t      *task;
+    ngx_thread_read_ctx_t  *ctx;
+
+    ngx_log_debug4(NGX_LOG_DEBUG_CORE, file->log, 0,
+                   "thread read: %d, %p, %uz, %O", file->fd, buf, size, offset);
+
+    task = file->thread_task;
+
+    if (task) {
+
+        if (task->event.active) {
+            return NGX_AGAIN;
+        }
+
+        ctx = task->ctx;
+
+        if (task->event.complete) {
+            task->event.complete = 0;
+
+            if (ctx->fd == file->fd
+                && ctx->offset == offset
+                && ctx->len == size)
+            {
+                if (ctx->err) {
+                    ngx_log_error(NGX_LOG_CRIT, file->log, ctx->err,
+                                  "pread() failed, file \"%s\"",
+                                  file->name.data);
+                    return NGX_ERROR;
+                }
+
+                ngx_memcpy(buf, ctx->buf, ctx->nread);
+
+                file->offset += ctx->nread;
+
+                return ctx->nread;
+            }
+        }
+
+        if (ctx->size < size) {
+            ngx_thread_task_free(task);
+            file->thread_task = NULL;
+            task = NULL;
+        }
+    }
+
+    if (task == NULL) {
+        task = ngx_thread_task_alloc(sizeof(ngx_thread_read_ctx_t) + size,
+                                     file->log);
+        if (task == NULL) {
+            return NGX_ERROR;
+        }
+
+        ctx = task->ctx;
+
+        ctx->buf = (u_char *) (ctx + 1);
+        ctx->size = size;
+
+        file->thread_task = task;
+    }
+
+    ctx->fd = file->fd;
+    ctx->len = size;
+    ctx->offset = offset;
+
+    task->handler = ngx_thread_read_handler;
+
+    if (file->thread_handler(task, file) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return NGX_AGAIN;
+}
+
+
+static void
+ngx_thread_read_handler(void *data, ngx_log_t *log)
+{
+    ngx_thread_read_ctx_t *ctx = data;
+
+    ssize_t  n;
+
+    n = pread(ctx->fd, ctx->buf, ctx->len, ctx->offset);
+
+    if (n == -1) {
+        ctx->err = ngx_errno;
+
+    } else {
+        ctx->nread = n;
+        ctx->err = 0;
+    }
+}
+
+#endif
+
+
 ssize_t
 ngx_write_file(ngx_file_t *file, u_char *buf, size_t size, off_t offset)
 {
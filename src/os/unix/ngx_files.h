@@ -43,6 +43,10 @@ ngx_fd_t ngx_open_tempfile(u_char *name, ngx_uint_t persistent,
 
 
 ssize_t ngx_read_file(ngx_file_t *file, u_char *buf, size_t size, off_t offset);
+#if (NGX_THREAD_POOL)
+ssize_t ngx_thread_read(ngx_file_t *file, u_char *buf, size_t size,
+    off_t offset);
+#endif
 #define ngx_read_file_n          "read()"
 
 ssize_t ngx_write_file(ngx_file_t *file, u_char *buf, size_t size,
@@ -53,6 +57,7 @@ ssize_t ngx_write_chain_to_file(ngx_file_t *file, ngx_chain_t *ce,
 
 
 #define ngx_write_fd             write
+#define ngx_writev_fd            writev
 #define ngx_linefeed(p)          *p++ = LF;
 #define NGX_LINEFEED_SIZE        1
 
@@ -80,6 +85,9 @@ ngx_int_t ngx_set_file_time(u_char *name, ngx_fd_t fd, time_t s);
 #define ngx_is_link(sb)          (S_ISLNK((sb)->st_mode))
 #define ngx_is_exec(sb)          ((sb)->st_mode & S_IXUSR)
 #define ngx_file_size(sb)        (sb)->st_size
+#define ngx_file_fs_size(sb)                                                 \
+    (((sb)->st_blocks * 512 > (sb)->st_size) ? (sb)->st_blocks * 512         \
+                                              : (sb)->st_size)
 #define ngx_file_mtime(sb)       (sb)->st_mtime
 #define ngx_file_uniq(sb)        (sb)->st_ino
 
@@ -127,6 +135,7 @@ ngx_int_t ngx_open_dir(ngx_str_t *name, ngx_dir_t *dir);
 #define ngx_de_is_file(dir)      (S_ISREG((dir)->info.st_mode))
 #define ngx_de_is_link(dir)      (S_ISLNK((dir)->info.st_mode))
 #define ngx_de_size(dir)         (dir)->info.st_size
+#define ngx_de_fs_size(dir)      ngx_file_fs_size(&(dir)->info)
 #define ngx_de_mtime(dir)        (dir)->info.st_mtime
 
 
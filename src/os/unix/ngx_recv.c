@@ -147,8 +147,15 @@ ssize_t ngx_unix_recv(ngx_connection_t *c, u_char *buf, size_t size)
 
         } else if (n > 0) {
 
+            /*
+             * epoll with EPOLLRDHUP does not set NGX_USE_GREEDY_EVENT:
+             * the short read means that the socket is drained unless
+             * the peer has closed the connection, then read the eof
+             */
+
             if ((size_t) n < size
-                && !(ngx_event_flags & NGX_USE_GREEDY_EVENT))
+                && !(ngx_event_flags & NGX_USE_GREEDY_EVENT)
+                && !rev->pending_eof)
             {
                 rev->ready = 0;
             }